@@ -1,4 +1,5 @@
 #include <Guid/FileInfo.h>
+#include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/PrintLib.h>
@@ -11,8 +12,10 @@
 #include <Protocol/SimpleFileSystem.h>
 #include <Uefi.h>
 
+#include "boot_trace.hpp"
 #include "elf.hpp"
 #include "frame_buffer.hpp"
+#include "memory_layout.hpp"
 
 /// Thin wrapper struct for UEFI memory map.
 struct MemoryMap {
@@ -29,6 +32,17 @@ void Halt(void) {
   while (1) __asm__("hlt");
 }
 
+/// Record the TSC at the end of the boot phase.
+/// Phases that exceed the capacity are ignored.
+void BootTraceMark(struct BootTrace *trace, const CHAR8 *name) {
+  if (trace->count >= kBootTraceMaxEntries) return;
+
+  struct BootTraceEntry *entry = &trace->entries[trace->count];
+  entry->tsc = AsmReadTsc();
+  AsciiStrnCpyS(entry->name, sizeof(entry->name), name, sizeof(entry->name) - 1);
+  trace->count++;
+}
+
 /// Get UEFI memory map.
 EFI_STATUS GetMemoryMap(struct MemoryMap *map) {
   if (map->buffer == NULL) {
@@ -167,27 +181,90 @@ void CalcLoadAddressRange(Elf64_Ehdr *ehdr, UINT64 *first, UINT64 *last) {
   *last = 0;
   for (Elf64_Half i = 0; i < ehdr->e_phnum; ++i) {
     if (phdr[i].p_type != PT_LOAD) continue;
-    *first = MIN(*first, phdr[i].p_vaddr);
-    *last = MAX(*last, phdr[i].p_vaddr + phdr[i].p_memsz);
+    *first = MIN(*first, phdr[i].p_vaddr - kKernelVirtualBase);
+    *last = MAX(*last, phdr[i].p_vaddr - kKernelVirtualBase + phdr[i].p_memsz);
   }
 }
 
 /// Copy the loadable segments from the ELF file to the memory.
+/// Segments are linked in the higher half and loaded at `p_vaddr - kKernelVirtualBase`.
 void CopyLoadSegments(Elf64_Ehdr *ehdr) {
   Elf64_Phdr *phdr = (Elf64_Phdr *)((UINT64)ehdr + ehdr->e_phoff);
   for (Elf64_Half i = 0; i < ehdr->e_phnum; ++i) {
     if (phdr[i].p_type != PT_LOAD) continue;
 
     UINT64 segm_in_file = (UINT64)ehdr + phdr[i].p_offset;
-    CopyMem((VOID *)phdr[i].p_vaddr, (VOID *)segm_in_file, phdr[i].p_filesz);
+    UINT64 segm_phys = phdr[i].p_vaddr - kKernelVirtualBase;
+    CopyMem((VOID *)segm_phys, (VOID *)segm_in_file, phdr[i].p_filesz);
 
     UINTN remain_bytes = phdr[i].p_memsz - phdr[i].p_filesz;
-    SetMem((VOID *)(phdr[i].p_vaddr + phdr[i].p_filesz), remain_bytes, 0);
+    SetMem((VOID *)(segm_phys + phdr[i].p_filesz), remain_bytes, 0);
   }
 }
 
+/// Get the end of the physical address space described by the memory map.
+UINT64 GetPhysicalEnd(struct MemoryMap *map) {
+  UINT64 end = 0;
+  EFI_PHYSICAL_ADDRESS iter;
+  for (iter = (EFI_PHYSICAL_ADDRESS)map->buffer;
+       iter < (EFI_PHYSICAL_ADDRESS)map->buffer + map->map_size;
+       iter += map->descriptor_size) {
+    EFI_MEMORY_DESCRIPTOR *desc = (EFI_MEMORY_DESCRIPTOR *)iter;
+    end = MAX(end, desc->PhysicalStart + EFI_PAGES_TO_SIZE(desc->NumberOfPages));
+  }
+  return end;
+}
+
+#define PAGE_PRESENT_WRITE 0x3ULL
+#define PAGE_SIZE_BIT 0x80ULL
+#define PAGE_SIZE_1GB 0x40000000ULL
+#define PAGE_SIZE_2MB 0x200000ULL
+
+/// Construct the temporary page table that the kernel is entered with.
+/// The physical memory up to `phys_end` (at least 4GiB, at most 512GiB) is mapped by 2MiB pages
+/// at both the identity map and the direct map, and the low 1GiB is also mapped at kKernelVirtualBase.
+/// The identity map keeps the loader and the arguments of the kernel accessible.
+/// The kernel replaces this page table with its own during initialization.
+/// The tables are allocated as EfiLoaderData so that the kernel does not reuse them until then.
+EFI_STATUS SetupPageTables(UINT64 phys_end, UINT64 *pml4_addr) {
+  UINTN num_pds = (MAX(phys_end, 4 * PAGE_SIZE_1GB) + PAGE_SIZE_1GB - 1) / PAGE_SIZE_1GB;
+  num_pds = MIN(num_pds, 512);
+
+  // PML4, PDPT shared by the identity map and the direct map, PDPT of the kernel image, and PDs.
+  EFI_PHYSICAL_ADDRESS tables;
+  EFI_STATUS status = gBS->AllocatePages(AllocateAnyPages, EfiLoaderData, 3 + num_pds, &tables);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  SetMem((VOID *)tables, EFI_PAGES_TO_SIZE(3 + num_pds), 0);
+
+  UINT64 *pml4 = (UINT64 *)tables;
+  UINT64 *pdpt = (UINT64 *)(tables + EFI_PAGE_SIZE);
+  UINT64 *kernel_pdpt = (UINT64 *)(tables + 2 * EFI_PAGE_SIZE);
+  UINT64 *pds = (UINT64 *)(tables + 3 * EFI_PAGE_SIZE);
+
+  for (UINTN i = 0; i < num_pds; ++i) {
+    UINT64 *pd = pds + 512 * i;
+    for (UINTN j = 0; j < 512; ++j) {
+      pd[j] = (i * PAGE_SIZE_1GB + j * PAGE_SIZE_2MB) | PAGE_SIZE_BIT | PAGE_PRESENT_WRITE;
+    }
+    pdpt[i] = (UINT64)pd | PAGE_PRESENT_WRITE;
+  }
+  kernel_pdpt[(kKernelVirtualBase >> 30) & 0x1FF] = (UINT64)pds | PAGE_PRESENT_WRITE;
+
+  pml4[0] = (UINT64)pdpt | PAGE_PRESENT_WRITE;
+  pml4[(kDirectMapBase >> 39) & 0x1FF] = (UINT64)pdpt | PAGE_PRESENT_WRITE;
+  pml4[(kKernelVirtualBase >> 39) & 0x1FF] = (UINT64)kernel_pdpt | PAGE_PRESENT_WRITE;
+
+  *pml4_addr = tables;
+  return EFI_SUCCESS;
+}
+
 EFI_STATUS EFIAPI UefiMain(EFI_HANDLE image_handle,
                            EFI_SYSTEM_TABLE *system_table) {
+  struct BootTrace boot_trace = {0};
+  BootTraceMark(&boot_trace, "loader-start");
+
   Print(L"Hello, world...!\n");
 
   // Save memory map
@@ -214,6 +291,7 @@ EFI_STATUS EFIAPI UefiMain(EFI_HANDLE image_handle,
   memmap_file->Close(memmap_file);
 
   Print(L"Saved a memory map to \\memmap.\n");
+  BootTraceMark(&boot_trace, "loader-memmap");
 
   // Open GOP
   EFI_GRAPHICS_OUTPUT_PROTOCOL *gop;
@@ -227,6 +305,7 @@ EFI_STATUS EFIAPI UefiMain(EFI_HANDLE image_handle,
         gop->Mode->FrameBufferBase,
         gop->Mode->FrameBufferBase + gop->Mode->FrameBufferSize,
         gop->Mode->FrameBufferSize);
+  BootTraceMark(&boot_trace, "loader-gop");
 
   // Get kernel ELF file info
   EFI_FILE_PROTOCOL *kernel_file;
@@ -261,6 +340,7 @@ EFI_STATUS EFIAPI UefiMain(EFI_HANDLE image_handle,
     Print(L"error: %r", kern_setup_status);
     Halt();
   }
+  BootTraceMark(&boot_trace, "loader-read-kernel");
 
   // Allocate pages for kernel loadable segments
   Elf64_Ehdr *kernel_ehdr = (Elf64_Ehdr *)kernel_buffer;
@@ -278,6 +358,7 @@ EFI_STATUS EFIAPI UefiMain(EFI_HANDLE image_handle,
   // Load kernel
   CopyLoadSegments(kernel_ehdr);
   Print(L"Kernel: 0x%0lx - 0x%0lx\n", kernel_first_addr, kernel_last_addr);
+  BootTraceMark(&boot_trace, "loader-copy-kernel");
 
   kern_setup_status = gBS->FreePool(kernel_buffer);
   if (EFI_ERROR(kern_setup_status)) {
@@ -285,6 +366,14 @@ EFI_STATUS EFIAPI UefiMain(EFI_HANDLE image_handle,
     Halt();
   }
 
+  // Construct the page table to enter the kernel in the higher half.
+  UINT64 pml4_addr;
+  kern_setup_status = SetupPageTables(GetPhysicalEnd(&memmap), &pml4_addr);
+  if (EFI_ERROR(kern_setup_status)) {
+    Print(L"failed to set up page tables: %r\n", kern_setup_status);
+    Halt();
+  }
+
   EFI_STATUS status;
   status = gBS->ExitBootServices(image_handle, memmap.map_key);
   if (EFI_ERROR(status)) {
@@ -301,6 +390,7 @@ EFI_STATUS EFIAPI UefiMain(EFI_HANDLE image_handle,
       Halt();
     }
   }
+  BootTraceMark(&boot_trace, "loader-exit-bs");
 
   // prepare framebuffer config for argument of kernel entry point
   struct FrameBufferConfig config = {(UINT8 *)gop->Mode->FrameBufferBase,
@@ -330,9 +420,12 @@ EFI_STATUS EFIAPI UefiMain(EFI_HANDLE image_handle,
 
 #define ELF_OFFSET_TO_ENTRYPOINT 24
   typedef void EntryPointType(const struct FrameBufferConfig *,
-                              const struct MemoryMap *, const VOID *);
+                              const struct MemoryMap *, const VOID *,
+                              const struct BootTrace *);
   UINT64 entry_addr = *(UINT64 *)(kernel_first_addr + ELF_OFFSET_TO_ENTRYPOINT);
-  ((EntryPointType *)entry_addr)(&config, &memmap, acpi_table);
+  BootTraceMark(&boot_trace, "loader-end");
+  AsmWriteCr3(pml4_addr);
+  ((EntryPointType *)entry_addr)(&config, &memmap, acpi_table, &boot_trace);
 
   // unreachable
 
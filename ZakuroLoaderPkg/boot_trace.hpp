@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+/// Maximum number of phases the loader can record.
+#define kBootTraceMaxEntries 16
+/// Maximum length of a phase name including the null terminator.
+#define kBootTraceNameLength 24
+
+/// TSC timestamp taken at the end of a boot phase.
+struct BootTraceEntry {
+  char name[kBootTraceNameLength];
+  uint64_t tsc;
+};
+
+/// Boot phases recorded by the loader and passed to the kernel.
+struct BootTrace {
+  uint32_t count;
+  uint32_t reserved;
+  struct BootTraceEntry entries[kBootTraceMaxEntries];
+};
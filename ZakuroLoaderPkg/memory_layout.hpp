@@ -0,0 +1,10 @@
+#pragma once
+
+/// Base virtual address of the kernel image.
+/// Physical address `p` of the kernel image is mapped to `kKernelVirtualBase + p`.
+/// MUST be the same as `kernel_base` of the kernel.
+#define kKernelVirtualBase 0xFFFFFFFF80000000ULL
+/// Base virtual address of the direct map.
+/// Physical address `p` is mapped to `kDirectMapBase + p`.
+/// MUST be the same as `direct_map_base` of the kernel.
+#define kDirectMapBase 0xFFFF800000000000ULL
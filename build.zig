@@ -58,6 +58,42 @@ pub fn build(b: *std.Build) void {
         makefont_outfile = b.addInstallFileWithDir(makefont_output, .prefix, "font.o");
     }
 
+    // A tool to generate a symbol table of the kernel.
+    var symtab: *std.Build.Step.Compile = undefined;
+    {
+        const dwarf = b.createModule(.{
+            .root_source_file = b.path("kernel/dwarf/dwarf.zig"),
+        });
+        symtab = b.addExecutable(.{
+            .name = "symtab",
+            .root_source_file = b.path("tools/symtab.zig"),
+            .target = target,
+            .optimize = optimize,
+        });
+        symtab.root_module.addImport("clap", clap.module("clap"));
+        symtab.root_module.addImport("plog", plog);
+        symtab.root_module.addImport("dwarf", dwarf);
+    }
+
+    // A tool to benchmark memory routines of the kernel on the host.
+    {
+        const mem = b.createModule(.{
+            .root_source_file = b.path("kernel/arch/x86/mem.zig"),
+        });
+        const membench = b.addExecutable(.{
+            .name = "membench",
+            .root_source_file = b.path("tools/membench.zig"),
+            .target = target,
+            .optimize = optimize,
+        });
+        membench.root_module.addImport("plog", plog);
+        membench.root_module.addImport("mem", mem);
+
+        const membench_artifact = b.addRunArtifact(membench);
+        const run_membench_step = b.step("membench", "Benchmark memory routines of the kernel on the host");
+        run_membench_step.dependOn(&membench_artifact.step);
+    }
+
     // A tool to build EFI using EDK2.
     {
         const build_efi = b.addExecutable(.{
@@ -86,7 +122,7 @@ pub fn build(b: *std.Build) void {
     }
 
     // Options
-    var options: *std.Build.Step.Options = undefined;
+    var kernel_options: KernelOptions = undefined;
     {
         const prettylog = b.option(
             bool,
@@ -109,44 +145,62 @@ pub fn build(b: *std.Build) void {
         else
             @panic("Invalid log level");
 
-        options = b.addOptions();
-        options.addOption(bool, "prettylog", prettylog);
-        options.addOption(std.log.Level, "log_level", log_level);
-    }
+        const profile_interval = b.option(
+            u64,
+            "profile",
+            "Enable the sampling profiler with the given interval in timer ticks",
+        ) orelse 0;
 
-    // Zakuro module
-    const zakuro = b.createModule(.{
-        .root_source_file = b.path("kernel/zakuro.zig"),
-    });
-    zakuro.addImport("zakuro", zakuro);
-    zakuro.addImport("chameleon", chameleon.module("chameleon"));
-    zakuro.addOptions("option", options);
+        const bench = b.option(
+            bool,
+            "bench",
+            "Boot into the benchmark runner instead of the desktop",
+        ) orelse false;
 
-    // Main binary
-    var kernel: *std.Build.Step.Compile = undefined;
-    {
-        kernel = b.addExecutable(.{
-            .name = "kernel.elf",
-            .root_source_file = b.path("kernel/main.zig"),
-            .target = b.resolveTargetQuery(.{
-                .cpu_arch = .x86_64,
-                .os_tag = .freestanding,
-                .ofmt = .elf,
-            }),
-            .optimize = .Debug,
-            .linkage = .static,
-        });
-        kernel.root_module.red_zone = false;
-        kernel.image_base = 0x10_0000;
-        kernel.link_z_relro = false;
-        kernel.entry = .{ .symbol_name = "kernel_entry" };
-        kernel.addObjectFile(makefont_output);
+        const lock_stats = b.option(
+            bool,
+            "lock_stats",
+            "Collect contention statistics and hold-time histograms of locks",
+        ) orelse false;
 
-        kernel.root_module.addImport("zakuro", zakuro);
+        kernel_options = .{
+            .prettylog = prettylog,
+            .log_level = log_level,
+            .profile_interval = profile_interval,
+            .bench = bench,
+            .lock_stats = lock_stats,
+        };
+    }
+
+    // Kernel code generation
+    var kernel_build: KernelBuild = undefined;
+    {
+        const hot_optimize = b.option(
+            std.builtin.OptimizeMode,
+            "hot_optimize",
+            "Optimize mode of hot modules (gfx, mm, usb). Defaults to -Doptimize",
+        );
+        const kernel_cpu = b.option(
+            KernelCpu,
+            "kernel_cpu",
+            "CPU model the kernel is compiled for",
+        ) orelse .baseline;
 
-        b.installArtifact(kernel);
+        kernel_build = .{
+            .optimize = optimize,
+            .hot_optimize = hot_optimize,
+            .cpu = kernel_cpu,
+        };
     }
 
+    // Zakuro module
+    const zakuro = addZakuro(b, chameleon, addKernelOptions(b, kernel_options), kernel_build.hot_optimize, null);
+
+    // Main binary
+    const kernel = addSymbolizedKernel(b, zakuro, kernel_build, makefont_output, symtab, "kernel");
+    b.installArtifact(kernel.kernel);
+    b.getInstallStep().dependOn(kernel.check);
+
     // Declare a run step to run QEMU.
     {
         const run_qemu_cmd = b.addSystemCommand(&.{
@@ -156,17 +210,42 @@ pub fn build(b: *std.Build) void {
             std.fs.path.join(b.allocator, &.{
                 b.install_path,
                 "bin",
-                kernel.out_filename,
+                kernel.kernel.out_filename,
             }) catch {
                 @panic("Failed to join path of 'run_qemu_cmd()'");
             },
         });
+        run_qemu_cmd.setEnvironmentVariable("QEMU_CPU", kernel_build.cpu.qemuCpu());
         run_qemu_cmd.step.dependOn(b.getInstallStep());
 
         const run_step = b.step("run", "Run the kernel on QEMU");
         run_step.dependOn(&run_qemu_cmd.step);
     }
 
+    // Declare a step to run benchmarks on QEMU.
+    // The benchmark kernel is built regardless of `-Dbench`.
+    {
+        var bench_options = kernel_options;
+        bench_options.bench = true;
+        const bench_zakuro = addZakuro(b, chameleon, addKernelOptions(b, bench_options), kernel_build.hot_optimize, null);
+        const bench_kernel = addSymbolizedKernel(b, bench_zakuro, kernel_build, makefont_output, symtab, "kernel-bench");
+
+        const run_bench_cmd = b.addSystemCommand(&.{
+            "tools/run_bench",
+            "bench.img",
+            "Loader.efi",
+        });
+        run_bench_cmd.addFileArg(bench_kernel.kernel.getEmittedBin());
+        run_bench_cmd.addArg(b.pathJoin(&.{ b.install_path, "bench.json" }));
+        run_bench_cmd.setEnvironmentVariable("QEMU_CPU", kernel_build.cpu.qemuCpu());
+        run_bench_cmd.has_side_effects = true;
+        run_bench_cmd.step.dependOn(b.getInstallStep());
+        run_bench_cmd.step.dependOn(bench_kernel.check);
+
+        const bench_step = b.step("bench", "Run kernel benchmarks on headless QEMU");
+        bench_step.dependOn(&run_bench_cmd.step);
+    }
+
     // Build test asset
     var dwarf_example_out: []const u8 = undefined;
     var dwarf_exe: *std.Build.Step.Compile = undefined;
@@ -190,27 +269,235 @@ pub fn build(b: *std.Build) void {
     }
 
     // Declare a test step.
+    // Tests are run for each of the zakuro module and hot modules,
+    // since only tests in the root module of a test binary are run.
     {
-        const zakuro_unit_tests = b.addTest(.{
-            .root_source_file = b.path("kernel/zakuro.zig"),
-            .target = target,
-            .optimize = optimize,
-            .link_libc = true,
-        });
-        zakuro_unit_tests.root_module.addImport("zakuro", &zakuro_unit_tests.root_module);
-        zakuro_unit_tests.addObjectFile(makefont_output);
-
-        const run_zakuro_unit_tests = b.addRunArtifact(zakuro_unit_tests);
         const test_step = b.step("test", "Run unit tests");
-        test_step.dependOn(&run_zakuro_unit_tests.step);
+        const test_roots = [_]KernelModule{
+            .{ .name = "zakuro", .path = "kernel/zakuro.zig" },
+        } ++ hot_modules;
 
-        // Add a embed files
-        {
-            zakuro_unit_tests.root_module.addAnonymousImport("dwarf-elf", .{
-                .root_source_file = b.path(dwarf_example_out),
+        for (test_roots) |test_root| {
+            const unit_tests = b.addTest(.{
+                .name = b.fmt("{s}-test", .{test_root.name}),
+                .root_source_file = b.path(test_root.path),
+                .target = target,
+                .optimize = optimize,
+                .link_libc = true,
             });
-            zakuro_unit_tests.step.dependOn(&dwarf_install.step);
-            zakuro_unit_tests.step.dependOn(&dwarf_exe.step);
+            const test_zakuro = addZakuro(b, chameleon, null, null, .{
+                .name = test_root.name,
+                .module = &unit_tests.root_module,
+            });
+            unit_tests.addObjectFile(makefont_output);
+
+            const run_unit_tests = b.addRunArtifact(unit_tests);
+            test_step.dependOn(&run_unit_tests.step);
+
+            // Add a embed files
+            {
+                test_zakuro.addAnonymousImport("dwarf-elf", .{
+                    .root_source_file = b.path(dwarf_example_out),
+                });
+                unit_tests.step.dependOn(&dwarf_install.step);
+                unit_tests.step.dependOn(&dwarf_exe.step);
+            }
         }
     }
 }
+
+/// Build options passed to the kernel as the "option" module.
+const KernelOptions = struct {
+    /// Enable pretty log output.
+    prettylog: bool,
+    /// Log level.
+    log_level: std.log.Level,
+    /// Interval of the sampling profiler in timer ticks. 0 to disable.
+    profile_interval: u64,
+    /// Run benchmarks instead of the desktop.
+    bench: bool,
+    /// Collect statistics of locks.
+    lock_stats: bool,
+};
+
+/// Add an options step that exposes each field of `KernelOptions`.
+fn addKernelOptions(b: *std.Build, kernel_options: KernelOptions) *std.Build.Step.Options {
+    const options = b.addOptions();
+    inline for (@typeInfo(KernelOptions).Struct.fields) |field| {
+        options.addOption(field.type, field.name, @field(kernel_options, field.name));
+    }
+    return options;
+}
+
+/// CPU model the kernel is compiled for.
+const KernelCpu = enum {
+    /// x86-64 baseline. Only SSE2 is available as vector extensions.
+    baseline,
+    /// x86-64-v3. AVX2, BMI2, and FMA are available.
+    x86_64_v3,
+
+    fn model(self: KernelCpu) *const std.Target.Cpu.Model {
+        return switch (self) {
+            .baseline => &std.Target.x86.cpu.x86_64,
+            .x86_64_v3 => &std.Target.x86.cpu.x86_64_v3,
+        };
+    }
+
+    /// CPU model of QEMU that can run the kernel.
+    fn qemuCpu(self: KernelCpu) []const u8 {
+        return switch (self) {
+            .baseline => "qemu64",
+            .x86_64_v3 => "max",
+        };
+    }
+};
+
+/// Code generation options of the kernel.
+const KernelBuild = struct {
+    /// Optimize mode of the kernel.
+    optimize: std.builtin.OptimizeMode,
+    /// Optimize mode of hot modules. Same as `optimize` if null.
+    hot_optimize: ?std.builtin.OptimizeMode,
+    /// CPU model.
+    cpu: KernelCpu,
+};
+
+/// Source of a module of the kernel.
+const KernelModule = struct {
+    /// Name to import the module.
+    name: []const u8,
+    /// Path to the root source file.
+    path: []const u8,
+};
+
+/// Modules of the kernel whose optimize mode can be overridden by `-Dhot_optimize`.
+/// Each of them is a separate module imported by the zakuro module.
+const hot_modules = [_]KernelModule{
+    .{ .name = "gfx", .path = "kernel/gfx.zig" },
+    .{ .name = "mm", .path = "kernel/mm.zig" },
+    .{ .name = "usb", .path = "kernel/drivers/usb/usb.zig" },
+};
+
+/// Module that is already created for one of the kernel modules, such as the root module of a test.
+const ExistingModule = struct {
+    /// Name of the kernel module.
+    name: []const u8,
+    /// Module to use.
+    module: *std.Build.Module,
+};
+
+/// Add the zakuro module and hot modules it imports.
+/// Hot modules are compiled with `hot_optimize` if given, otherwise they inherit the mode of the root module.
+/// If `existing` is given, it is used as the module of the same name instead of creating a new one.
+fn addZakuro(
+    b: *std.Build,
+    chameleon: *std.Build.Dependency,
+    options: ?*std.Build.Step.Options,
+    hot_optimize: ?std.builtin.OptimizeMode,
+    existing: ?ExistingModule,
+) *std.Build.Module {
+    const zakuro = findExisting(existing, "zakuro") orelse b.createModule(.{
+        .root_source_file = b.path("kernel/zakuro.zig"),
+    });
+    zakuro.addImport("zakuro", zakuro);
+    zakuro.addImport("chameleon", chameleon.module("chameleon"));
+    if (options) |o| zakuro.addOptions("option", o);
+
+    for (hot_modules) |hot| {
+        const module = findExisting(existing, hot.name) orelse b.createModule(.{
+            .root_source_file = b.path(hot.path),
+            .optimize = hot_optimize,
+        });
+        module.addImport("zakuro", zakuro);
+        zakuro.addImport(hot.name, module);
+    }
+
+    return zakuro;
+}
+
+fn findExisting(existing: ?ExistingModule, name: []const u8) ?*std.Build.Module {
+    const e = existing orelse return null;
+    return if (std.mem.eql(u8, e.name, name)) e.module else null;
+}
+
+/// Kernel executable with its symbol table embedded.
+const SymbolizedKernel = struct {
+    /// Final kernel executable.
+    kernel: *std.Build.Step.Compile,
+    /// Step to verify the embedded symbol table is up-to-date.
+    check: *std.Build.Step,
+};
+
+/// Add the kernel executable named `<name>.elf` with a symbol table generated from its own DWARF.
+/// The kernel is linked twice: the first link embeds an empty table. Since the table is placed
+/// after the code, functions do not move in the second link, which is verified by regenerating the table.
+fn addSymbolizedKernel(
+    b: *std.Build,
+    zakuro: *std.Build.Module,
+    kernel_build: KernelBuild,
+    font: std.Build.LazyPath,
+    symtab: *std.Build.Step.Compile,
+    name: []const u8,
+) SymbolizedKernel {
+    const symtab_empty = b.addRunArtifact(symtab);
+    symtab_empty.addArg("--empty");
+    symtab_empty.addArg("--output");
+    const symtab_empty_output = symtab_empty.addOutputFileArg("symtab-empty.bin");
+    const kernel_nosym = addKernel(b, zakuro, kernel_build, font, symtab_empty_output, b.fmt("{s}-nosym.elf", .{name}));
+
+    const symtab_gen = b.addRunArtifact(symtab);
+    symtab_gen.addArg("--input");
+    symtab_gen.addFileArg(kernel_nosym.getEmittedBin());
+    symtab_gen.addArg("--output");
+    const symtab_output = symtab_gen.addOutputFileArg("symtab.bin");
+    const kernel = addKernel(b, zakuro, kernel_build, font, symtab_output, b.fmt("{s}.elf", .{name}));
+
+    const symtab_check = b.addRunArtifact(symtab);
+    symtab_check.addArg("--input");
+    symtab_check.addFileArg(kernel.getEmittedBin());
+    symtab_check.addArg("--check");
+    symtab_check.addFileArg(symtab_output);
+
+    return .{ .kernel = kernel, .check = &symtab_check.step };
+}
+
+/// Add the kernel executable that embeds the given symbol table.
+fn addKernel(
+    b: *std.Build,
+    zakuro: *std.Build.Module,
+    kernel_build: KernelBuild,
+    font: std.Build.LazyPath,
+    symtab: std.Build.LazyPath,
+    name: []const u8,
+) *std.Build.Step.Compile {
+    const kernel = b.addExecutable(.{
+        .name = name,
+        .root_source_file = b.path("kernel/main.zig"),
+        .target = b.resolveTargetQuery(.{
+            .cpu_arch = .x86_64,
+            .cpu_model = .{ .explicit = kernel_build.cpu.model() },
+            .os_tag = .freestanding,
+            .ofmt = .elf,
+        }),
+        .optimize = kernel_build.optimize,
+        .linkage = .static,
+    });
+    kernel.root_module.red_zone = false;
+    // Frame pointers and debug info are required to symbolize and unwind stacks in any mode.
+    kernel.root_module.omit_frame_pointer = false;
+    kernel.root_module.strip = false;
+    // The kernel is linked in the higher half: the top 2GiB of the address space.
+    // MUST be the same as `kKernelVirtualBase + 0x10_0000` of the bootloader.
+    kernel.root_module.code_model = .kernel;
+    kernel.image_base = 0xFFFF_FFFF_8010_0000;
+    kernel.link_z_relro = false;
+    kernel.entry = .{ .symbol_name = "kernel_entry" };
+    kernel.addObjectFile(font);
+
+    kernel.root_module.addImport("zakuro", zakuro);
+    kernel.root_module.addAnonymousImport("symtab", .{
+        .root_source_file = symtab,
+    });
+
+    return kernel;
+}
@@ -1,10 +1,14 @@
 //! ACPI (Advanced Configuration and Power Interface) support.
-//! This file is expected to be used for ACPI PM timer.
+//! All tables listed in XSDT (or RSDT) are validated once at initialization
+//! and registered to the table index, so that consumers can look them up by signature.
+//! Tables are accessed via the direct map since they refer to each other by physical addresses.
 
 const std = @import("std");
+const log = std.log.scoped(.acpi);
 
 const zakuro = @import("zakuro");
 const arch = zakuro.arch;
+const page = @import("page.zig");
 
 const AcpiError = error{
     InvalidSignature,
@@ -20,7 +24,11 @@ const pm_timer_freq: u64 = 3_579_545; // 3.579545 MHz
 /// You MUST call `init()` before using this pointer.
 var fadt: ?*Fadt = null;
 
+/// Index of the validated ACPI tables.
+var tables: TableIndex = .{};
+
 /// Initialize ACPI.
+/// XSDT is used for ACPI 2.0+ and RSDT is used for ACPI 1.0.
 pub fn init(rsdp: *Rsdp) void {
     rsdp.valid() catch |e| switch (e) {
         AcpiError.InvalidSignature => @panic("Invalid RSDP signature."),
@@ -29,23 +37,124 @@ pub fn init(rsdp: *Rsdp) void {
         AcpiError.InvalidExtendedChecksum => @panic("Invalid RSDP extended checksum."),
     };
 
-    const xsdt: *Xsdt = @ptrFromInt(rsdp.xsdt_address);
-    xsdt.header.valid("XSDT") catch |e| switch (e) {
-        AcpiError.InvalidSignature => @panic("Invalid XSDT signature."),
-        AcpiError.InvalidChecksum => @panic("Invalid XSDT checksum."),
-        else => unreachable,
+    tables.clear();
+    if (rsdp.revision >= 2 and rsdp.xsdt_address != 0) {
+        const xsdt: *Xsdt = @ptrFromInt(page.phys2virt(rsdp.xsdt_address));
+        xsdt.header.valid("XSDT") catch |e| switch (e) {
+            AcpiError.InvalidSignature => @panic("Invalid XSDT signature."),
+            AcpiError.InvalidChecksum => @panic("Invalid XSDT checksum."),
+            else => unreachable,
+        };
+        for (0..xsdt.size()) |ix| {
+            registerTable(xsdt.get(ix));
+        }
+    } else {
+        const rsdt: *Rsdt = @ptrFromInt(page.phys2virt(rsdp.rsdt_address));
+        rsdt.header.valid("RSDT") catch |e| switch (e) {
+            AcpiError.InvalidSignature => @panic("Invalid RSDT signature."),
+            AcpiError.InvalidChecksum => @panic("Invalid RSDT checksum."),
+            else => unreachable,
+        };
+        for (0..rsdt.size()) |ix| {
+            registerTable(rsdt.get(ix));
+        }
+    }
+
+    // The signature of FADT is "FACP".
+    fadt = getTable(Fadt, "FACP") orelse @panic("FADT not found.");
+}
+
+/// Validate the table and register it to the table index.
+/// Tables with an invalid checksum are ignored.
+fn registerTable(table: *DescriptorHeader) void {
+    table.validChecksum() catch {
+        log.warn("Ignoring ACPI table {s} with invalid checksum.", .{table.signature});
+        return;
     };
+    if (!tables.insert(table)) {
+        log.warn("Ignoring ACPI table {s}: the index is full.", .{table.signature});
+        return;
+    }
+    log.debug("Found ACPI table: {s} @ 0x{X:0>16}", .{ table.signature, @intFromPtr(table) });
+}
 
-    var ix: usize = 0;
-    fadt = while (ix < xsdt.size()) : (ix += 1) {
-        const ent = xsdt.get(ix);
-        if (ent.valid("FACP")) |_| {
-            // The signature of FADT is "FACP".
-            break @as(*Fadt, @ptrCast(ent));
-        } else |_| {}
-    } else @panic("FADT not found.");
+/// Find the ACPI table with the given signature.
+/// Returns null if ACPI is not initialized or the table is not found.
+/// If there are multiple tables with the same signature, the first one is returned.
+pub fn findTable(signature: *const [4]u8) ?*DescriptorHeader {
+    return tables.lookup(signature.*, 0);
 }
 
+/// Find the `n`-th ACPI table with the given signature in the order listed in XSDT (or RSDT).
+/// Some tables such as SSDT can appear multiple times.
+/// Returns null if there are not more than `n` such tables.
+pub fn findNthTable(signature: *const [4]u8, n: usize) ?*DescriptorHeader {
+    return tables.lookup(signature.*, n);
+}
+
+/// Find the ACPI table with the given signature and cast it to the table type.
+pub fn getTable(comptime T: type, signature: *const [4]u8) ?*T {
+    const table = findTable(signature) orelse return null;
+    return @alignCast(@ptrCast(table));
+}
+
+/// Get MCFG table.
+/// Returns null if ACPI is not initialized or the firmware does not provide MCFG.
+pub fn getMcfg() ?*Mcfg {
+    return getTable(Mcfg, "MCFG");
+}
+
+/// Hash table that maps a signature to the ACPI tables.
+/// It uses open addressing with linear probing.
+/// Tables with the same signature are kept in the order of insertion along the probe sequence,
+/// since entries are never removed individually.
+const TableIndex = struct {
+    /// Number of slots.
+    /// This is the maximum number of tables that can be registered.
+    const num_slots: usize = 64;
+
+    slots: [num_slots]?*DescriptorHeader = [_]?*DescriptorHeader{null} ** num_slots,
+
+    /// Remove all entries.
+    fn clear(self: *TableIndex) void {
+        self.* = .{};
+    }
+
+    /// Register the table.
+    /// Returns false if the index is full.
+    fn insert(self: *TableIndex, table: *DescriptorHeader) bool {
+        var pos = hash(table.signature);
+        for (0..num_slots) |_| {
+            if (self.slots[pos] == null) {
+                self.slots[pos] = table;
+                return true;
+            }
+            pos = (pos + 1) % num_slots;
+        }
+        return false;
+    }
+
+    /// Find the `n`-th table with the signature.
+    fn lookup(self: *const TableIndex, signature: [4]u8, n: usize) ?*DescriptorHeader {
+        var pos = hash(signature);
+        var seen: usize = 0;
+        for (0..num_slots) |_| {
+            const slot = self.slots[pos] orelse return null;
+            if (std.mem.eql(u8, &slot.signature, &signature)) {
+                if (seen == n) return slot;
+                seen += 1;
+            }
+            pos = (pos + 1) % num_slots;
+        }
+        return null;
+    }
+
+    fn hash(signature: [4]u8) usize {
+        const key = std.mem.readInt(u32, &signature, .little);
+        return (key *% 0x9E37_79B9) >> @intCast(32 - std.math.log2_int(usize, num_slots));
+    }
+};
+
 /// Wait for the specified milliseconds using ACPI PM timer.
 /// This function is busy-waiting.
 pub fn waitMilliSeconds(msec: u64) void {
@@ -96,6 +205,80 @@ const Fadt = extern struct {
     }
 };
 
+/// MCFG (PCI Express memory mapped configuration space base address description table).
+/// MCFG starts with a header and 8 reserved bytes,
+/// followed by a list of configuration space base address allocation structures.
+pub const Mcfg = extern struct {
+    header: DescriptorHeader,
+    _reserved: [8]u8,
+    _entries: void,
+
+    /// Get the allocation structure at the specified index.
+    pub fn get(self: *Mcfg, index: usize) McfgEntry {
+        // NOTE: Entries start at offset 44, so they are only 4 bytes aligned.
+        const ents_start = @intFromPtr(&self._entries);
+        const ent: *align(1) const McfgEntry = @ptrFromInt(ents_start + index * @sizeOf(McfgEntry));
+        return ent.*;
+    }
+
+    /// Number of allocation structures.
+    pub fn size(self: *Mcfg) usize {
+        return (self.header.length - @sizeOf(Mcfg)) / @sizeOf(McfgEntry);
+    }
+
+    comptime {
+        if (@sizeOf(Mcfg) != 44) {
+            @compileError("Invalid size of MCFG.");
+        }
+    }
+};
+
+/// Configuration space base address allocation structure in MCFG.
+/// Each entry describes an ECAM region for a range of buses in a PCI segment group.
+pub const McfgEntry = extern struct {
+    /// Physical base address of the ECAM region.
+    base_address: u64,
+    /// PCI segment group number.
+    segment: u16,
+    /// Start PCI bus number decoded by this host bridge.
+    start_bus: u8,
+    /// End PCI bus number decoded by this host bridge.
+    end_bus: u8,
+    /// Reserved.
+    _reserved: u32,
+
+    comptime {
+        if (@sizeOf(McfgEntry) != 16) {
+            @compileError("Invalid size of MCFG entry.");
+        }
+    }
+};
+
+/// RSDT (Root System Descriptor Table) structure of ACPI v1.0.
+/// RSDT starts with a header and followed by a list of 32-bit pointers to other tables.
+const Rsdt = extern struct {
+    header: DescriptorHeader,
+    _pointer_entries: void,
+
+    /// Get the table entry at the specified index.
+    pub fn get(self: *Rsdt, index: usize) *DescriptorHeader {
+        const ents_start = @intFromPtr(&self._pointer_entries);
+        const ent: *u32 = @ptrFromInt(ents_start + index * @sizeOf(u32));
+        return @ptrFromInt(page.phys2virt(ent.*));
+    }
+
+    /// Number of table entries.
+    pub fn size(self: *Rsdt) usize {
+        return (self.header.length - @sizeOf(DescriptorHeader)) / @sizeOf(u32);
+    }
+
+    comptime {
+        if (@sizeOf(Rsdt) != 36) {
+            @compileError("Invalid size of RSDT.");
+        }
+    }
+};
+
 /// XSDT (Extended System Descriptor Table) structure of ACPI v2.0+..
 /// XSDT starts with a header and followed by a list of 64-bit pointers to other tables.
 const Xsdt = extern struct {
@@ -111,7 +294,7 @@ const Xsdt = extern struct {
         const ents_start = @intFromPtr(&self._pointer_entries);
         const first: *u32 = @ptrFromInt(ents_start + index * @sizeOf(u64));
         const second: *u32 = @ptrFromInt(ents_start + index * @sizeOf(u64) + @sizeOf(u32));
-        return @ptrFromInt((@as(u64, second.*) << 32) + first.*);
+        return @ptrFromInt(page.phys2virt((@as(u64, second.*) << 32) + first.*));
     }
 
     /// Number of table entries.
@@ -127,7 +310,7 @@ const Xsdt = extern struct {
 };
 
 /// Descriptor header of ACPI structures.
-const DescriptorHeader = extern struct {
+pub const DescriptorHeader = extern struct {
     signature: [4]u8,
     length: u32,
     revision: u8,
@@ -144,6 +327,11 @@ const DescriptorHeader = extern struct {
         if (!std.mem.eql(u8, signature, &self.signature)) {
             return AcpiError.InvalidSignature;
         }
+        try self.validChecksum();
+    }
+
+    /// Check if the sum of all bytes of the table is 0.
+    pub fn validChecksum(self: *DescriptorHeader) AcpiError!void {
         const ents: [*]u8 = @ptrCast(self);
         if (checksum(ents[0..self.length]) != 0) {
             return AcpiError.InvalidChecksum;
@@ -176,6 +364,8 @@ pub const Rsdp = extern struct {
     /// RSDT physical address.
     rsdt_address: u32,
 
+    // Following fields are valid only for ACPI 2.0+.
+
     /// Total length of RSDP.
     length: u32,
     /// XSDT (Extended System Descriptor Table) physical address.
@@ -197,13 +387,14 @@ pub const Rsdp = extern struct {
         if (!std.mem.eql(u8, &self.signature, "RSD PTR ")) {
             return AcpiError.InvalidSignature;
         }
-        if (self.revision != 2) {
+        if (self.revision != 0 and self.revision < 2) {
             return AcpiError.InvalidRevision;
         }
         if (checksum(std.mem.asBytes(self)[0..size_first_byte]) != 0) {
             return AcpiError.InvalidChecksum;
         }
-        if (checksum(std.mem.asBytes(self)[0..size_extended_byte]) != 0) {
+        // ACPI 1.0 RSDP does not have the extended fields.
+        if (self.revision >= 2 and checksum(std.mem.asBytes(self)[0..size_extended_byte]) != 0) {
             return AcpiError.InvalidExtendedChecksum;
         }
     }
@@ -213,5 +404,50 @@ test "Size of structures" {
     std.testing.refAllDecls(@This());
     try std.testing.expectEqual(36, @sizeOf(DescriptorHeader));
     try std.testing.expectEqual(36, @sizeOf(Xsdt));
+    try std.testing.expectEqual(36, @sizeOf(Rsdt));
     try std.testing.expectEqual(276, @sizeOf(Fadt));
+    try std.testing.expectEqual(44, @sizeOf(Mcfg));
+    try std.testing.expectEqual(16, @sizeOf(McfgEntry));
+}
+
+test "TableIndex" {
+    const signatures = [_]*const [4]u8{ "FACP", "APIC", "HPET", "MCFG", "WAET", "BGRT" };
+    var headers: [signatures.len]DescriptorHeader = undefined;
+    for (&headers, signatures) |*h, sig| {
+        h.signature = sig.*;
+    }
+
+    var index = TableIndex{};
+    for (&headers) |*h| {
+        try std.testing.expect(index.insert(h));
+    }
+    for (&headers) |*h| {
+        try std.testing.expectEqual(h, index.lookup(h.signature, 0));
+        try std.testing.expectEqual(null, index.lookup(h.signature, 1));
+    }
+    try std.testing.expectEqual(null, index.lookup("SSDT".*, 0));
+
+    // All tables with the same signature are kept in the order of insertion.
+    var ssdts: [3]DescriptorHeader = undefined;
+    for (&ssdts) |*h| {
+        h.signature = "SSDT".*;
+        try std.testing.expect(index.insert(h));
+    }
+    for (&ssdts, 0..) |*h, i| {
+        try std.testing.expectEqual(h, index.lookup("SSDT".*, i));
+    }
+    try std.testing.expectEqual(null, index.lookup("SSDT".*, ssdts.len));
+    try std.testing.expectEqual(&headers[2], index.lookup("HPET".*, 0));
+
+    // Insertion fails only when the index is full.
+    var fill: [TableIndex.num_slots]DescriptorHeader = undefined;
+    var inserted: usize = signatures.len + ssdts.len;
+    for (&fill) |*h| {
+        h.signature = "FILL".*;
+        if (index.insert(h)) inserted += 1;
+    }
+    try std.testing.expectEqual(TableIndex.num_slots, inserted);
+
+    index.clear();
+    try std.testing.expectEqual(null, index.lookup("FACP".*, 0));
 }
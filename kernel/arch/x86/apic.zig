@@ -1,4 +1,7 @@
 //! This file provides x64 Local APIC register definitions.
+//! The addresses are physical, and the registers are accessed via the direct map by `register()`.
+
+const page = @import("page.zig");
 
 /// Local APIC ID registers
 pub const lapic_id_register: u64 = 0xFEE0_0020;
@@ -21,12 +24,17 @@ pub const current_count_register: u64 = 0xFEE0_0390;
 /// Divide Configuration Register for Timer
 pub const divide_config_register: u64 = 0xFEE0_03E0;
 
+/// Get the pointer to the Local APIC register at the physical address.
+pub inline fn register(phys: u64) *volatile u32 {
+    return @ptrFromInt(page.phys2virt(phys));
+}
+
 /// Get a Local APIC ID of the current core.
 pub fn getLapicId() u8 {
-    return @truncate(@as(*u32, @ptrFromInt(lapic_id_register)).* >> 24);
+    return @truncate(register(lapic_id_register).* >> 24);
 }
 
 /// Notify the LAPIC that the interrupt has been handled.
 pub fn notifyEoi() void {
-    @as(*volatile u32, @ptrFromInt(eoi)).* = 0;
+    register(eoi).* = 0;
 }
@@ -6,7 +6,15 @@ pub const intr = @import("interrupt.zig");
 pub const msi = @import("msi.zig");
 pub const gdt = @import("gdt.zig");
 pub const page = @import("page.zig");
+pub const pcid = @import("pcid.zig");
+pub const percpu = @import("percpu.zig");
 pub const timer = @import("timer.zig");
+pub const hpet = @import("hpet.zig");
+pub const pmu = @import("pmu.zig");
+pub const mem = @import("mem.zig");
+pub const fpu = @import("fpu.zig");
+pub const context = @import("context.zig");
+pub const idle = @import("idle.zig");
 
 const am = @import("asm.zig");
 const apic = @import("apic.zig");
@@ -40,6 +48,22 @@ pub inline fn enableIntr() void {
     am.sti();
 }
 
+/// Disable interrupts and return whether they were enabled.
+/// Pass the returned value to `restoreIntr()` to restore the state.
+pub inline fn saveAndDisableIntr() bool {
+    const enabled = am.readRflags() & rflags_if != 0;
+    am.cli();
+    return enabled;
+}
+
+/// Enable interrupts if `enabled` is true, which is returned by `saveAndDisableIntr()`.
+pub inline fn restoreIntr(enabled: bool) void {
+    if (enabled) am.sti();
+}
+
+/// RFLAGS.IF: Interrupt enable flag.
+const rflags_if: u64 = 1 << 9;
+
 /// Halt the current CPU.
 pub inline fn halt() void {
     am.hlt();
@@ -55,6 +79,26 @@ pub inline fn in(T: type, port: u16) T {
     };
 }
 
+/// Read the time-stamp counter.
+/// The frequency is available by `timer.tscFrequency()`.
+pub inline fn readTsc() u64 {
+    return am.rdtsc();
+}
+
+/// I/O port of QEMU's isa-debug-exit device.
+const qemu_debug_exit_port: u16 = 0xF4;
+
+/// Exit QEMU with the status `(code << 1) | 1`.
+/// This requires QEMU to be started with `-device isa-debug-exit,iobase=0xf4,iosize=0x04`.
+/// If the device is not present, this function halts the CPU forever.
+pub fn exitQemu(code: u8) noreturn {
+    am.outl(code, qemu_debug_exit_port);
+    while (true) {
+        am.cli();
+        am.hlt();
+    }
+}
+
 test {
     @import("std").testing.refAllDeclsRecursive(@This());
 }
@@ -67,6 +67,14 @@ pub inline fn lgdt(gdtr: u64) void {
     );
 }
 
+pub inline fn ltr(selector: u16) void {
+    asm volatile (
+        \\ltr %[selector]
+        :
+        : [selector] "r" (selector),
+    );
+}
+
 pub inline fn cli() void {
     asm volatile ("cli");
 }
@@ -79,6 +87,50 @@ pub inline fn hlt() void {
     asm volatile ("hlt");
 }
 
+pub inline fn monitor(addr: u64, extensions: u32, hints: u32) void {
+    asm volatile (
+        \\monitor
+        :
+        : [addr] "{rax}" (addr),
+          [extensions] "{ecx}" (extensions),
+          [hints] "{edx}" (hints),
+    );
+}
+
+pub inline fn mwait(hints: u32, extensions: u32) void {
+    asm volatile (
+        \\mwait
+        :
+        : [hints] "{eax}" (hints),
+          [extensions] "{ecx}" (extensions),
+    );
+}
+
+pub inline fn readRflags() u64 {
+    return asm volatile (
+        \\pushfq
+        \\popq %[rflags]
+        : [rflags] "=r" (-> u64),
+    );
+}
+
+pub inline fn loadCr0(cr0: u64) void {
+    asm volatile (
+        \\mov %[cr0], %%cr0
+        :
+        : [cr0] "r" (cr0),
+    );
+}
+
+pub inline fn readCr0() u64 {
+    var cr0: u64 = undefined;
+    asm volatile (
+        \\mov %%cr0, %[cr0]
+        : [cr0] "=r" (cr0),
+    );
+    return cr0;
+}
+
 pub inline fn readCr2() u64 {
     var cr2: u64 = undefined;
     asm volatile (
@@ -96,6 +148,12 @@ pub inline fn loadCr3(cr3: u64) void {
     );
 }
 
+/// Load CR3 without invalidating TLB entries of the PCID being loaded.
+/// Valid only when CR4.PCIDE is set.
+pub inline fn loadCr3NoFlush(cr3: u64) void {
+    loadCr3(cr3 | (1 << 63));
+}
+
 pub inline fn readCr3() u64 {
     var cr3: u64 = undefined;
     asm volatile (
@@ -105,6 +163,160 @@ pub inline fn readCr3() u64 {
     return cr3;
 }
 
+pub inline fn loadCr4(cr4: u64) void {
+    asm volatile (
+        \\mov %[cr4], %%cr4
+        :
+        : [cr4] "r" (cr4),
+    );
+}
+
+pub inline fn readCr4() u64 {
+    var cr4: u64 = undefined;
+    asm volatile (
+        \\mov %%cr4, %[cr4]
+        : [cr4] "=r" (cr4),
+    );
+    return cr4;
+}
+
+pub inline fn invlpg(addr: u64) void {
+    asm volatile (
+        \\invlpg (%[addr])
+        :
+        : [addr] "r" (addr),
+        : "memory"
+    );
+}
+
+/// Write back and invalidate the cache line containing the address from all levels of the cache hierarchy.
+pub inline fn clflush(addr: u64) void {
+    asm volatile (
+        \\clflush (%[addr])
+        :
+        : [addr] "r" (addr),
+        : "memory"
+    );
+}
+
+pub inline fn mfence() void {
+    asm volatile ("mfence" ::: "memory");
+}
+
+/// Write back and invalidate all caches.
+pub inline fn wbinvd() void {
+    asm volatile ("wbinvd" ::: "memory");
+}
+
+/// Invalidate TLB entries and paging-structure caches based on PCID.
+/// `typ` is the INVPCID type: 0 for an address, 1 for a PCID, 2 for all contexts including globals,
+/// and 3 for all contexts except globals.
+pub inline fn invpcid(typ: u64, pcid: u64, addr: u64) void {
+    const desc = [2]u64{ pcid, addr };
+    asm volatile (
+        \\invpcid (%[desc]), %[typ]
+        :
+        : [desc] "r" (&desc),
+          [typ] "r" (typ),
+        : "memory"
+    );
+}
+
+pub inline fn readMsr(msr: u32) u64 {
+    var eax: u32 = undefined;
+    var edx: u32 = undefined;
+    asm volatile (
+        \\rdmsr
+        : [eax] "={eax}" (eax),
+          [edx] "={edx}" (edx),
+        : [msr] "{ecx}" (msr),
+    );
+    return (@as(u64, edx) << 32) | eax;
+}
+
+pub inline fn writeMsr(msr: u32, value: u64) void {
+    asm volatile (
+        \\wrmsr
+        :
+        : [msr] "{ecx}" (msr),
+          [eax] "{eax}" (@as(u32, @truncate(value))),
+          [edx] "{edx}" (@as(u32, @truncate(value >> 32))),
+    );
+}
+
+pub inline fn xgetbv(xcr: u32) u64 {
+    var eax: u32 = undefined;
+    var edx: u32 = undefined;
+    asm volatile (
+        \\xgetbv
+        : [eax] "={eax}" (eax),
+          [edx] "={edx}" (edx),
+        : [xcr] "{ecx}" (xcr),
+    );
+    return (@as(u64, edx) << 32) | eax;
+}
+
+pub inline fn xsetbv(xcr: u32, value: u64) void {
+    asm volatile (
+        \\xsetbv
+        :
+        : [xcr] "{ecx}" (xcr),
+          [eax] "{eax}" (@as(u32, @truncate(value))),
+          [edx] "{edx}" (@as(u32, @truncate(value >> 32))),
+    );
+}
+
+pub inline fn rdpmc(counter: u32) u64 {
+    var eax: u32 = undefined;
+    var edx: u32 = undefined;
+    asm volatile (
+        \\rdpmc
+        : [eax] "={eax}" (eax),
+          [edx] "={edx}" (edx),
+        : [counter] "{ecx}" (counter),
+    );
+    return (@as(u64, edx) << 32) | eax;
+}
+
+/// Read the time-stamp counter.
+/// LFENCE makes the read wait for all preceding instructions to complete.
+pub inline fn rdtsc() u64 {
+    var eax: u32 = undefined;
+    var edx: u32 = undefined;
+    asm volatile (
+        \\lfence
+        \\rdtsc
+        : [eax] "={eax}" (eax),
+          [edx] "={edx}" (edx),
+    );
+    return (@as(u64, edx) << 32) | eax;
+}
+
+/// Registers returned by CPUID instruction.
+pub const CpuidRegisters = struct {
+    eax: u32,
+    ebx: u32,
+    ecx: u32,
+    edx: u32,
+};
+
+pub inline fn cpuid(leaf: u32, subleaf: u32) CpuidRegisters {
+    var eax: u32 = undefined;
+    var ebx: u32 = undefined;
+    var ecx: u32 = undefined;
+    var edx: u32 = undefined;
+    asm volatile (
+        \\cpuid
+        : [eax] "={eax}" (eax),
+          [ebx] "={ebx}" (ebx),
+          [ecx] "={ecx}" (ecx),
+          [edx] "={edx}" (edx),
+        : [leaf] "{eax}" (leaf),
+          [subleaf] "{ecx}" (subleaf),
+    );
+    return .{ .eax = eax, .ebx = ebx, .ecx = ecx, .edx = edx };
+}
+
 /// Pause the CPU for a short period of time.
 pub fn relax() void {
     asm volatile ("rep; nop");
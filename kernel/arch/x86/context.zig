@@ -0,0 +1,99 @@
+//! Switching between stacks of cooperative tasks.
+//!
+//! Only callee-saved registers of the System V ABI are saved on the stack being switched from,
+//! since switches always happen at a function call.
+//! The frame of a suspended stack looks like below, from the saved stack pointer upwards:
+//!
+//!   r15, r14, r13, r12, rbx, rbp, return address
+
+const std = @import("std");
+
+/// Entry point of a new stack.
+/// It is called with the argument given to `initStack()` and MUST NOT return.
+pub const Entry = *const fn (arg: *anyopaque) callconv(.C) noreturn;
+
+/// Number of registers saved in the frame.
+const num_saved_regs = 6;
+
+comptime {
+    // The return address of a new stack points to `contextEntry`,
+    // which calls the entry point in R13 with the argument in R12.
+    asm (
+        \\.global contextSwitch
+        \\.type contextSwitch, @function
+        \\contextSwitch:
+        \\  pushq %rbp
+        \\  pushq %rbx
+        \\  pushq %r12
+        \\  pushq %r13
+        \\  pushq %r14
+        \\  pushq %r15
+        \\  movq %rsp, (%rdi)
+        \\  movq %rsi, %rsp
+        \\  popq %r15
+        \\  popq %r14
+        \\  popq %r13
+        \\  popq %r12
+        \\  popq %rbx
+        \\  popq %rbp
+        \\  retq
+        \\
+        \\.global contextEntry
+        \\.type contextEntry, @function
+        \\contextEntry:
+        \\  movq %r12, %rdi
+        \\  callq *%r13
+        \\  ud2
+    );
+}
+
+extern fn contextSwitch(save: *u64, to: u64) callconv(.C) void;
+extern fn contextEntry() callconv(.C) void;
+
+/// Prepare a new stack whose highest address is `top`, so that switching to it calls `entry(arg)`.
+/// Returns the stack pointer to pass to `switchStack()`.
+pub fn initStack(top: u64, entry: Entry, arg: *anyopaque) u64 {
+    // RSP is aligned to 16 bytes when `contextEntry` calls the entry point.
+    const base = std.mem.alignBackward(u64, top, 16);
+    const frame: [*]u64 = @ptrFromInt(base - (num_saved_regs + 1) * @sizeOf(u64));
+    frame[0] = 0; // r15
+    frame[1] = 0; // r14
+    frame[2] = @intFromPtr(entry); // r13
+    frame[3] = @intFromPtr(arg); // r12
+    frame[4] = 0; // rbx
+    frame[5] = 0; // rbp: terminates frame-pointer unwinding.
+    frame[6] = @intFromPtr(&contextEntry);
+    return @intFromPtr(frame);
+}
+
+/// Save the current context, storing its stack pointer to `save`, and resume the stack at `to`.
+/// Returns when another context switches back to `save`.
+pub fn switchStack(save: *u64, to: u64) void {
+    contextSwitch(save, to);
+}
+
+test "Switch to a new stack and back" {
+    const Ctx = struct {
+        main_rsp: u64 = 0,
+        task_rsp: u64 = 0,
+        count: usize = 0,
+
+        fn entry(arg: *anyopaque) callconv(.C) noreturn {
+            const self: *@This() = @alignCast(@ptrCast(arg));
+            while (true) {
+                self.count += 1;
+                switchStack(&self.task_rsp, self.main_rsp);
+            }
+        }
+    };
+
+    const stack = try std.testing.allocator.alignedAlloc(u8, 16, 4096);
+    defer std.testing.allocator.free(stack);
+
+    var ctx = Ctx{};
+    ctx.task_rsp = initStack(@intFromPtr(stack.ptr) + stack.len, Ctx.entry, &ctx);
+    switchStack(&ctx.main_rsp, ctx.task_rsp);
+    try std.testing.expectEqual(1, ctx.count);
+    switchStack(&ctx.main_rsp, ctx.task_rsp);
+    try std.testing.expectEqual(2, ctx.count);
+}
@@ -0,0 +1,109 @@
+//! x87 FPU, SSE, and AVX state management.
+//!
+//! The compiler can use vector registers anywhere in the kernel, including interrupt handlers
+//! (e.g. to copy structs or in `memcpy`). Therefore, the extended state of the interrupted context
+//! is saved by the common ISR stub on the stack before any Zig code runs, and restored before IRETQ.
+//! The state is saved by XSAVE if available, or FXSAVE otherwise.
+//!
+//! Only x87, SSE, and AVX components are enabled in XCR0,
+//! so that the save area always fits in `max_state_size` bytes.
+
+const std = @import("std");
+const log = std.log.scoped(.fpu);
+
+const am = @import("asm.zig");
+
+/// Maximum size in bytes of the save area reserved by the ISR stub.
+/// Legacy region (512) + XSAVE header (64) + AVX (256) fits in it.
+pub const max_state_size = 1024;
+/// Required alignment of the save area.
+pub const state_align = 64;
+
+/// Instruction to save the extended state.
+pub const SaveMode = enum(u8) {
+    /// The state is not saved. Used until `init()` is called.
+    None = 0,
+    /// FXSAVE / FXRSTOR.
+    Fxsave = 1,
+    /// XSAVE / XRSTOR.
+    Xsave = 2,
+};
+
+/// Instruction used by the ISR stub to save the state.
+/// This is referred by the ISR stub by its name.
+export var fpu_save_mode: SaveMode = .None;
+/// Size in bytes of the state saved.
+var state_size: usize = 0;
+
+/// XCR0 state components.
+const Xcr0 = packed struct(u64) {
+    x87: bool = true,
+    sse: bool = true,
+    avx: bool = false,
+    _reserved: u61 = 0,
+};
+
+/// Enable the FPU, SSE, and AVX if available, and start saving the state across interrupts.
+pub fn init() SaveMode {
+    // Let the FPU raise exceptions natively and not trap on its instructions.
+    var cr0 = am.readCr0();
+    cr0 |= cr0_mp | cr0_ne;
+    cr0 &= ~(cr0_em | cr0_ts);
+    am.loadCr0(cr0);
+
+    // Enable SSE and its exceptions.
+    var cr4 = am.readCr4() | cr4_osfxsr | cr4_osxmmexcpt;
+
+    const features = am.cpuid(1, 0).ecx;
+    if (features & cpuid_xsave == 0) {
+        am.loadCr4(cr4);
+        state_size = 512;
+        fpu_save_mode = .Fxsave;
+        log.info("FPU state is saved by FXSAVE: {d} bytes", .{state_size});
+        return fpu_save_mode;
+    }
+
+    cr4 |= cr4_osxsave;
+    am.loadCr4(cr4);
+    const xcr0 = Xcr0{ .avx = features & cpuid_avx != 0 };
+    am.xsetbv(0, @bitCast(xcr0));
+
+    // EBX reports the size required by components enabled in XCR0.
+    state_size = am.cpuid(0xD, 0).ebx;
+    if (state_size > max_state_size) {
+        @panic("XSAVE area is larger than the reserved area.");
+    }
+    fpu_save_mode = .Xsave;
+    log.info("FPU state is saved by XSAVE: AVX={} {d} bytes", .{ xcr0.avx, state_size });
+
+    return fpu_save_mode;
+}
+
+/// Size in bytes of the state saved on interrupts.
+pub fn stateSize() usize {
+    return state_size;
+}
+
+/// CR0.MP: Monitor Coprocessor.
+const cr0_mp: u64 = 1 << 1;
+/// CR0.EM: Emulation.
+const cr0_em: u64 = 1 << 2;
+/// CR0.TS: Task Switched.
+const cr0_ts: u64 = 1 << 3;
+/// CR0.NE: Numeric Error.
+const cr0_ne: u64 = 1 << 5;
+/// CR4.OSFXSR: OS support for FXSAVE and FXRSTOR.
+const cr4_osfxsr: u64 = 1 << 9;
+/// CR4.OSXMMEXCPT: OS support for unmasked SIMD floating-point exceptions.
+const cr4_osxmmexcpt: u64 = 1 << 10;
+/// CR4.OSXSAVE: XSAVE and processor extended states enable.
+const cr4_osxsave: u64 = 1 << 18;
+/// CPUID.01H:ECX.XSAVE.
+const cpuid_xsave: u32 = 1 << 26;
+/// CPUID.01H:ECX.AVX.
+const cpuid_avx: u32 = 1 << 28;
+
+test "XCR0 encoding" {
+    try std.testing.expectEqual(0b011, @as(u64, @bitCast(Xcr0{})));
+    try std.testing.expectEqual(0b111, @as(u64, @bitCast(Xcr0{ .avx = true })));
+}
@@ -1,4 +1,7 @@
+const std = @import("std");
+
 const am = @import("asm.zig");
+const page = @import("page.zig");
 
 /// Maximum number of GDT entries.
 const max_num_gdt = 0x10;
@@ -19,6 +22,21 @@ var gdtr = GdtRegister{
 const null_desc_index: u16 = 0x00;
 pub const kernel_ds_index: u16 = 0x01;
 pub const kernel_cs_index: u16 = 0x02;
+/// TSS descriptor occupies two entries.
+const tss_index: u16 = 0x03;
+
+/// IST index of the stack used to handle double faults.
+pub const double_fault_ist: u3 = 1;
+/// Size in bytes of the double fault stack.
+const double_fault_stack_size = 4 * page.page_size_4k;
+/// Stack used to handle double faults.
+/// A double fault is raised when the kernel stack overflows into its guard page,
+/// so it cannot be handled on the kernel stack.
+pub var double_fault_stack: page.GuardedStack(double_fault_stack_size) = std.mem.zeroes(page.GuardedStack(double_fault_stack_size));
+
+/// Task State Segment.
+/// Only used to provide IST stacks.
+var tss: Tss = std.mem.zeroes(Tss);
 
 /// Initialize the GDT.
 pub fn init() void {
@@ -40,6 +58,13 @@ pub fn init() void {
         .KByte,
     );
 
+    double_fault_stack.guard();
+    tss.ist[double_fault_ist - 1] = double_fault_stack.top();
+    tss.iomap_base = @sizeOf(Tss);
+    const tss_desc = TssDescriptor.new(@intFromPtr(&tss), @sizeOf(Tss) - 1);
+    gdt[tss_index] = @bitCast(@as(u64, @truncate(@as(u128, @bitCast(tss_desc)))));
+    gdt[tss_index + 1] = @bitCast(@as(u64, @truncate(@as(u128, @bitCast(tss_desc)) >> 64)));
+
     am.lgdt(@intFromPtr(&gdtr));
 
     // Changing the entries in the GDT, or setting GDTR
@@ -47,6 +72,7 @@ pub fn init() void {
     // To flush the changes, we need to set segment registers.
     loadKernelDs();
     loadKernelCs();
+    am.ltr(tss_index << 3);
 }
 
 /// Load the kernel data segment selector.
@@ -187,3 +213,61 @@ const GdtRegister = packed struct {
     limit: u16,
     base: *[max_num_gdt]SegmentDescriptor,
 };
+
+/// 64-bit Task State Segment.
+/// SDM Vol.3A 8.7
+const Tss = extern struct {
+    _reserved1: u32 align(1),
+    /// Stack pointers loaded on privilege level changes to ring 0-2.
+    rsp: [3]u64 align(1),
+    _reserved2: u64 align(1),
+    /// Interrupt Stack Table.
+    /// IST1 to IST7 are stored in `ist[0]` to `ist[6]`.
+    ist: [7]u64 align(1),
+    _reserved3: u64 align(1),
+    _reserved4: u16 align(1),
+    /// Offset of the I/O permission bit map from the base of the TSS.
+    /// Setting this to the size of the TSS disables the map.
+    iomap_base: u16 align(1),
+
+    comptime {
+        if (@sizeOf(Tss) != 104) {
+            @compileError("Invalid size of TSS.");
+        }
+    }
+};
+
+/// TSS Descriptor in 64-bit mode, which occupies two GDT entries.
+/// SDM Vol.3A 8.2.3
+const TssDescriptor = packed struct(u128) {
+    limit_low: u16,
+    base_low: u24,
+    /// 0b1001: 64-bit TSS (Available).
+    segment_type: u4 = 0b1001,
+    /// Must be System.
+    desc_type: DescriptorType = .System,
+    dpl: u2 = 0,
+    present: bool = true,
+    limit_high: u4,
+    avl: u1 = 0,
+    _reserved1: u2 = 0,
+    granularity: Granularity = .Byte,
+    base_high: u40,
+    _reserved2: u32 = 0,
+
+    fn new(base: u64, limit: u20) TssDescriptor {
+        return TssDescriptor{
+            .limit_low = @truncate(limit),
+            .base_low = @truncate(base),
+            .limit_high = @truncate(limit >> 16),
+            .base_high = @truncate(base >> 24),
+        };
+    }
+};
+
+test "TSS descriptor encoding" {
+    const desc = TssDescriptor.new(0xFFFF_FFFF_8012_3456, 103);
+    const raw: u128 = @bitCast(desc);
+    try std.testing.expectEqual(0x8000_8912_3456_0067, @as(u64, @truncate(raw)));
+    try std.testing.expectEqual(0xFFFF_FFFF, @as(u64, @truncate(raw >> 64)));
+}
@@ -0,0 +1,290 @@
+//! HPET (High Precision Event Timer) driver.
+//! HPET has a memory-mapped main counter that runs at a constant frequency (typically 10MHz+),
+//! and a set of comparators that can generate interrupts.
+//! It is used as a reference to calibrate other timers, as a clocksource,
+//! and as a one-shot event timer delivering interrupts via FSB (MSI).
+
+const std = @import("std");
+const log = std.log.scoped(.hpet);
+
+const acpi = @import("acpi.zig");
+const msi = @import("msi.zig");
+const page = @import("page.zig");
+
+pub const HpetError = error{
+    /// HPET is not available or not initialized.
+    NotAvailable,
+    /// The timer does not exist.
+    InvalidTimer,
+    /// The timer does not support FSB interrupt delivery.
+    FsbUnsupported,
+};
+
+/// Femtoseconds per millisecond.
+const fs_per_msec: u64 = 1_000_000_000_000;
+/// Femtoseconds per nanosecond.
+const fs_per_nsec: u64 = 1_000_000;
+/// Maximum period of the main counter defined by the spec (100ns).
+const max_period_fs: u64 = 100 * fs_per_nsec;
+
+/// Offsets of HPET registers.
+const RegisterOffsets = struct {
+    /// General Capabilities and ID Register.
+    const capabilities = 0x000;
+    /// General Configuration Register.
+    const configuration = 0x010;
+    /// General Interrupt Status Register.
+    const interrupt_status = 0x020;
+    /// Main Counter Value Register.
+    const main_counter = 0x0F0;
+    /// Timer N Configuration and Capability Register.
+    fn timerConfig(n: usize) u64 {
+        return 0x100 + 0x20 * n;
+    }
+    /// Timer N Comparator Value Register.
+    fn timerComparator(n: usize) u64 {
+        return 0x108 + 0x20 * n;
+    }
+    /// Timer N FSB Interrupt Route Register.
+    fn timerFsbRoute(n: usize) u64 {
+        return 0x110 + 0x20 * n;
+    }
+};
+
+/// Virtual address of HPET registers.
+/// null if HPET is not available.
+var base: ?u64 = null;
+/// Period of the main counter in femtoseconds.
+var period_fs: u64 = 0;
+/// Mask of valid bits of the main counter.
+var counter_mask: u64 = 0;
+/// Number of comparators.
+var num_timers: usize = 0;
+
+/// Initialize HPET and start the main counter.
+/// ACPI MUST be initialized before calling this function.
+/// Returns false if HPET is not available.
+pub fn init() bool {
+    const table = acpi.getTable(Hpet, "HPET") orelse {
+        log.info("HPET not found.", .{});
+        return false;
+    };
+    if (table.address_space_id != 0) {
+        log.warn("HPET is not in memory space.", .{});
+        return false;
+    }
+
+    const phys = (@as(u64, table.address_high) << 32) | table.address_low;
+    base = page.ioremap(phys, 0x400, .Uncacheable) catch {
+        log.err("Failed to map HPET registers.", .{});
+        return false;
+    };
+
+    const caps = register(GeneralCapabilities, RegisterOffsets.capabilities).*;
+    if (caps.period_fs == 0 or caps.period_fs > max_period_fs) {
+        log.warn("HPET reports invalid period: {d} fs", .{caps.period_fs});
+        base = null;
+        return false;
+    }
+    period_fs = caps.period_fs;
+    counter_mask = if (caps.counter_64bit) 0xFFFF_FFFF_FFFF_FFFF else 0xFFFF_FFFF;
+    num_timers = @as(usize, caps.num_timers) + 1;
+
+    // Disable legacy replacement route and all comparator interrupts, then start the counter.
+    const config = register(GeneralConfiguration, RegisterOffsets.configuration);
+    config.* = .{ .enable = false, .legacy_route = false };
+    for (0..num_timers) |n| {
+        const tconfig = register(TimerConfiguration, RegisterOffsets.timerConfig(n));
+        var tc = tconfig.*;
+        tc.int_enable = false;
+        tconfig.* = tc;
+    }
+    config.* = .{ .enable = true, .legacy_route = false };
+
+    log.info("HPET initialized: base=0x{X} freq={d} Hz timers={d} {d}-bit", .{
+        phys,
+        frequency(),
+        num_timers,
+        @as(u8, if (caps.counter_64bit) 64 else 32),
+    });
+    return true;
+}
+
+/// Check if HPET is initialized and available.
+pub fn available() bool {
+    return base != null;
+}
+
+/// Frequency of the main counter in Hz.
+pub fn frequency() u64 {
+    return if (period_fs == 0) 0 else 1_000_000_000_000_000 / period_fs;
+}
+
+/// Read the main counter.
+pub fn readCounter() u64 {
+    return register(u64, RegisterOffsets.main_counter).* & counter_mask;
+}
+
+/// Convert counter ticks to nanoseconds.
+pub fn ticksToNanoSeconds(ticks: u64) u64 {
+    return @truncate(@as(u128, ticks) * period_fs / fs_per_nsec);
+}
+
+/// Wait for the specified milliseconds using HPET main counter.
+/// This function is busy-waiting.
+pub fn waitMilliSeconds(msec: u64) void {
+    if (!available()) @panic("HPET is not initialized.");
+
+    const ticks: u64 = @truncate(@as(u128, msec) * fs_per_msec / period_fs);
+    const start = readCounter();
+    // Wrapping subtraction and masking handle the overflow of 32-bit counters.
+    while ((readCounter() -% start) & counter_mask < ticks) {
+        std.atomic.spinLoopHint();
+    }
+}
+
+/// Arm the comparator to generate an interrupt once after `ticks` counter ticks.
+/// The interrupt is delivered via FSB with the given MSI address and data.
+pub fn armOneShot(
+    n: usize,
+    ticks: u64,
+    addr: msi.MessageAddress,
+    data: msi.MessageData,
+) HpetError!void {
+    if (!available()) return HpetError.NotAvailable;
+    if (n >= num_timers) return HpetError.InvalidTimer;
+
+    const tconfig = register(TimerConfiguration, RegisterOffsets.timerConfig(n));
+    var tc = tconfig.*;
+    if (!tc.fsb_capable) return HpetError.FsbUnsupported;
+
+    // Disable the timer while reprogramming it.
+    tc.int_enable = false;
+    tconfig.* = tc;
+
+    register(u64, RegisterOffsets.timerFsbRoute(n)).* =
+        (@as(u64, @as(u32, @bitCast(addr))) << 32) | @as(u32, @bitCast(data));
+    const comparator = (readCounter() +% ticks) & (if (tc.size_64bit) counter_mask else 0xFFFF_FFFF);
+    register(u64, RegisterOffsets.timerComparator(n)).* = comparator;
+
+    tc.level_triggered = false;
+    tc.periodic = false;
+    tc.force_32bit = false;
+    tc.fsb_enable = true;
+    tc.int_enable = true;
+    tconfig.* = tc;
+}
+
+/// Disarm the comparator.
+pub fn disarm(n: usize) HpetError!void {
+    if (!available()) return HpetError.NotAvailable;
+    if (n >= num_timers) return HpetError.InvalidTimer;
+
+    const tconfig = register(TimerConfiguration, RegisterOffsets.timerConfig(n));
+    var tc = tconfig.*;
+    tc.int_enable = false;
+    tconfig.* = tc;
+}
+
+/// Get the pointer to the register at the given offset.
+fn register(comptime T: type, offset: u64) *volatile T {
+    return @ptrFromInt(base.? + offset);
+}
+
+/// HPET Description Table.
+const Hpet = extern struct {
+    header: acpi.DescriptorHeader,
+    /// Hardware ID of Event Timer Block.
+    event_timer_block_id: u32,
+    /// Address space of the base address.
+    /// 0 for memory space, 1 for I/O space.
+    address_space_id: u8,
+    /// Register bit width.
+    register_bit_width: u8,
+    /// Register bit offset.
+    register_bit_offset: u8,
+    /// Reserved.
+    _reserved: u8,
+    /// Lower 32 bits of the base address.
+    /// NOTE: The 64-bit address is only 4 bytes aligned.
+    address_low: u32,
+    /// Upper 32 bits of the base address.
+    address_high: u32,
+    /// HPET sequence number.
+    hpet_number: u8,
+    /// Minimum clock ticks in periodic mode without lost interrupts.
+    minimum_tick: u16 align(1),
+    /// Page protection and OEM attribute.
+    page_protection: u8,
+
+    comptime {
+        if (@sizeOf(Hpet) != 56) {
+            @compileError("Invalid size of HPET.");
+        }
+    }
+};
+
+/// General Capabilities and ID Register.
+const GeneralCapabilities = packed struct(u64) {
+    /// Revision ID.
+    revision: u8,
+    /// Index of the last timer.
+    num_timers: u5,
+    /// The main counter is 64-bit.
+    counter_64bit: bool,
+    /// Reserved.
+    _reserved: u1,
+    /// Legacy replacement route capable.
+    legacy_route_capable: bool,
+    /// Vendor ID.
+    vendor_id: u16,
+    /// Period of the main counter in femtoseconds.
+    period_fs: u32,
+};
+
+/// General Configuration Register.
+const GeneralConfiguration = packed struct(u64) {
+    /// Enable the main counter and timer interrupts.
+    enable: bool,
+    /// Enable legacy replacement route.
+    legacy_route: bool,
+    /// Reserved.
+    _reserved: u62 = 0,
+};
+
+/// Timer N Configuration and Capability Register.
+const TimerConfiguration = packed struct(u64) {
+    /// Reserved.
+    _reserved1: u1,
+    /// Interrupt is level-triggered.
+    level_triggered: bool,
+    /// Enable interrupts.
+    int_enable: bool,
+    /// Periodic mode.
+    periodic: bool,
+    /// Periodic mode capable.
+    periodic_capable: bool,
+    /// 64-bit comparator.
+    size_64bit: bool,
+    /// Allow software to set the accumulator in periodic mode.
+    value_set: bool,
+    /// Reserved.
+    _reserved2: u1,
+    /// Force 32-bit mode.
+    force_32bit: bool,
+    /// I/O APIC interrupt route.
+    int_route: u5,
+    /// Enable FSB interrupt delivery.
+    fsb_enable: bool,
+    /// FSB interrupt delivery capable.
+    fsb_capable: bool,
+    /// Reserved.
+    _reserved3: u16,
+    /// Bitmap of I/O APIC inputs that the timer can be routed to.
+    int_route_capable: u32,
+};
+
+test "Size of structures" {
+    std.testing.refAllDecls(@This());
+    try std.testing.expectEqual(56, @sizeOf(Hpet));
+}
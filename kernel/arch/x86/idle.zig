@@ -0,0 +1,56 @@
+//! Idling the CPU until the next interrupt.
+//!
+//! The caller checks that there is no work with interrupts disabled, and then calls `wait()`.
+//! Interrupts stay masked until the CPU starts waiting, so an interrupt that arrives after the check
+//! still wakes the CPU instead of being handled before it sleeps.
+//!
+//! MWAIT is used if the CPU can treat masked interrupts as break events.
+//! Otherwise, `sti; hlt` is used, which relies on the interrupt shadow of STI.
+
+const std = @import("std");
+const log = std.log.scoped(.idle);
+
+const am = @import("asm.zig");
+
+/// Whether MWAIT is used to wait.
+var use_mwait = false;
+
+/// Cache line armed by MONITOR.
+/// Nothing writes to it, so MWAIT returns only on interrupts.
+var monitor_line: [64]u8 align(64) = [_]u8{0} ** 64;
+
+/// Select the instruction to wait for interrupts.
+/// Returns true if MWAIT is used.
+pub fn init() bool {
+    use_mwait = am.cpuid(1, 0).ecx & cpuid_monitor != 0 and
+        am.cpuid(0, 0).eax >= 5 and
+        am.cpuid(5, 0).ecx & (cpuid_emx | cpuid_ibe) == (cpuid_emx | cpuid_ibe);
+    log.info("Idle with {s}.", .{if (use_mwait) "MWAIT" else "HLT"});
+
+    return use_mwait;
+}
+
+/// Wait for an interrupt and enable interrupts.
+/// Interrupts MUST be disabled when this function is called.
+pub fn wait() void {
+    if (use_mwait) {
+        am.monitor(@intFromPtr(&monitor_line), 0, 0);
+        // Hint 0 requests C1. Interrupts break MWAIT even though they are masked.
+        am.mwait(0, mwait_ibe);
+        am.sti();
+    } else {
+        asm volatile (
+            \\sti
+            \\hlt
+        );
+    }
+}
+
+/// CPUID.01H:ECX.MONITOR.
+const cpuid_monitor: u32 = 1 << 3;
+/// CPUID.05H:ECX[0]: MWAIT extensions are enumerated.
+const cpuid_emx: u32 = 1 << 0;
+/// CPUID.05H:ECX[1]: Interrupts are break events for MWAIT even when masked.
+const cpuid_ibe: u32 = 1 << 1;
+/// MWAIT extension ECX[0]: Treat masked interrupts as break events.
+const mwait_ibe: u32 = 1 << 0;
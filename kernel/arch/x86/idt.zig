@@ -79,13 +79,20 @@ pub fn setGate(
     };
 }
 
+/// Let the gate switch to the stack in the given IST entry of the TSS.
+/// 0 means the stack is not switched.
+pub fn setIst(index: usize, ist: u3) void {
+    idt[index].ist = ist;
+}
+
 /// Entry in the Interrupt Descriptor Table.
 pub const GateDesriptor = packed struct(u128) {
     /// Lower 16 bits of the offset to the ISR.
     offset_low: u16,
     /// Segment Selector that must point to a valid code segment in the GDT.
     seg_selector: u16,
-    /// Interrupt Stack Table. Not used.
+    /// Index of the Interrupt Stack Table entry to switch to.
+    /// 0 means the stack is not switched.
     ist: u3 = 0,
     /// Reserved.
     _reserved1: u5 = 0,
@@ -63,6 +63,10 @@ pub fn init() void {
     }
 
     registerHandler(pageFault, unhandledFaultHandler);
+    registerHandler(doubleFault, doubleFaultHandler);
+    // Stack overflow leads to a double fault since the CPU cannot push the context of #PF.
+    // Handle it on a separate stack.
+    idt.setIst(doubleFault, gdt.double_fault_ist);
 
     idt.init();
 
@@ -132,6 +136,20 @@ fn unhandledFaultHandler(context: *Context) void {
     unhandledHandler(context);
 }
 
+fn doubleFaultHandler(context: *Context) void {
+    log.err("============ Double Fault ===================", .{});
+
+    const cr2 = am.readCr2();
+    if (page.isGuardPage(cr2)) {
+        log.err("Kernel stack overflow: 0x{X:0>16}", .{cr2});
+    } else {
+        log.err("Fault Address: 0x{X:0>16}", .{cr2});
+    }
+    log.err("", .{});
+
+    unhandledHandler(context);
+}
+
 // Exception vectors.
 const divideByZero = 0;
 const debug = 1;
@@ -40,6 +40,12 @@ const log = std.log.scoped(.isr);
 
 const intr = @import("interrupt.zig");
 const idt = @import("idt.zig");
+const fpu = @import("fpu.zig");
+
+comptime {
+    // `fpu_save_mode` is referred only by its name from the ISR stub.
+    _ = &fpu.fpu_save_mode;
+}
 
 // Execution Context
 pub const Context = packed struct {
@@ -117,7 +123,10 @@ pub fn generateIsr(comptime vector: usize) idt.Isr {
 /// This function assumes that `Context` is saved at the top of the stack except for general-purpose registers.
 export fn isrCommon() callconv(.Naked) void {
     // Save the general-purpose registers.
+    // DF can be set by the interrupted code (e.g. `mem.move()` copying backward),
+    // while the ABI requires it to be clear on function entry. IRETQ restores it from the saved RFLAGS.
     asm volatile (
+        \\cld
         \\pushq %%rax
         \\pushq %%rcx
         \\pushq %%rdx
@@ -136,18 +145,58 @@ export fn isrCommon() callconv(.Naked) void {
         \\pushq %%r8
     );
 
-    // Push the context and call the handler.
-    // NOTE: I'm not sure but we have to put contex address both to RDI and stack.
+    // Save the extended state on the stack aligned for XSAVE.
+    // RBX keeps the address of the context and R12 keeps the save mode,
+    // both of which are callee-saved and restored from the context later.
+    // The mode is kept since `fpu_save_mode` can change while the handler runs.
     asm volatile (
-        \\pushq %%rsp
-        \\popq %%rdi
-        \\pushq %%rdi
+        \\movq %%rsp, %%rbx
+        \\subq %[size], %%rsp
+        \\andq %[mask], %%rsp
+        \\movzbl fpu_save_mode(%%rip), %%r12d
+        \\cmpl $1, %%r12d
+        \\jb 2f
+        \\je 1f
+        \\xorl %%eax, %%eax
+        \\movq %%rax, 512(%%rsp)
+        \\movq %%rax, 520(%%rsp)
+        \\movq %%rax, 528(%%rsp)
+        \\movq %%rax, 536(%%rsp)
+        \\movq %%rax, 544(%%rsp)
+        \\movq %%rax, 552(%%rsp)
+        \\movq %%rax, 560(%%rsp)
+        \\movq %%rax, 568(%%rsp)
+        \\movl $0xFFFFFFFF, %%eax
+        \\movl $0xFFFFFFFF, %%edx
+        \\xsave (%%rsp)
+        \\jmp 2f
+        \\1:
+        \\fxsave (%%rsp)
+        \\2:
+        :
+        : [size] "n" (fpu.max_state_size),
+          [mask] "n" (-fpu.state_align),
+    );
+
+    // Call the handler with the context.
+    asm volatile (
+        \\movq %%rbx, %%rdi
         \\call  intrZigEntry
     );
 
-    // Handler function must return the saved stack pointer, so restore it.
+    // Restore the extended state and the stack pointer.
     asm volatile (
-        \\add  $0x8, %%rsp
+        \\cmpl $1, %%r12d
+        \\jb 4f
+        \\je 3f
+        \\movl $0xFFFFFFFF, %%eax
+        \\movl $0xFFFFFFFF, %%edx
+        \\xrstor (%%rsp)
+        \\jmp 4f
+        \\3:
+        \\fxrstor (%%rsp)
+        \\4:
+        \\movq %%rbx, %%rsp
     );
 
     // Remove general-purpose registers, error code, and vector from the stack.
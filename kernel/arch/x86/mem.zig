@@ -0,0 +1,373 @@
+//! Memory copy and fill routines optimized for x86_64.
+//!
+//! The kernel exports them as `memcpy`, `memmove`, and `memset`,
+//! which override the generic implementation of compiler-rt.
+//! The strategy is chosen by the size of the operation and CPU features detected by `init()`:
+//!
+//!   - Large operations that exceed `nt_threshold` use non-temporal stores to bypass the cache,
+//!     since the destination is unlikely to be read soon (e.g. framebuffers) and would evict everything else.
+//!   - With FSRM, or ERMS for non-small operations, `rep movsb` / `rep stosb` is the fastest.
+//!   - If the kernel is compiled with AVX2 (`-Dkernel_cpu=x86_64_v3`), 32-byte vector loops are used otherwise.
+//!   - Otherwise, `rep movsq` / `rep stosq` followed by byte operations for the remainder.
+//!
+//! Every loop is written in inline assembly.
+//! Loops written in Zig could be recognized as a copy idiom and compiled into a call to `memcpy` itself.
+//! Before `init()` is called, only the last strategy is used, which works on any x86_64 CPU.
+
+const std = @import("std");
+const builtin = @import("builtin");
+
+const am = @import("asm.zig");
+
+/// Size in bytes above which non-temporal stores are used.
+pub const nt_threshold = 1024 * 1024;
+/// Size in bytes below which ERMS `rep movsb` is not used unless FSRM is available,
+/// since its startup cost dominates.
+const erms_threshold = 128;
+
+/// Whether the kernel is compiled with AVX2.
+const has_avx2 = std.Target.x86.featureSetHas(builtin.cpu.features, .avx2);
+
+/// CPU features that affect the strategy.
+pub const Features = struct {
+    /// Enhanced REP MOVSB/STOSB.
+    erms: bool = false,
+    /// Fast Short REP MOV.
+    fsrm: bool = false,
+    /// AVX2 is supported by the CPU and the kernel is compiled with it.
+    avx2: bool = false,
+};
+
+/// Detected CPU features.
+var features = Features{};
+
+/// Detect CPU features to choose the strategy.
+pub fn init() Features {
+    if (am.cpuid(0, 0).eax < 7) return features;
+
+    const leaf7 = am.cpuid(7, 0);
+    features = .{
+        .erms = (leaf7.ebx >> 9) & 1 != 0,
+        .fsrm = (leaf7.edx >> 4) & 1 != 0,
+        .avx2 = has_avx2 and (leaf7.ebx >> 5) & 1 != 0,
+    };
+    return features;
+}
+
+/// Use the strategies allowed by `f` regardless of the CPU.
+/// This is intended to compare strategies in benchmarks.
+pub fn force(f: Features) void {
+    features = f;
+}
+
+/// Copy `len` bytes from `src` to `dest`. The regions MUST NOT overlap.
+pub fn copy(dest: [*]u8, src: [*]const u8, len: usize) void {
+    if (len >= nt_threshold) {
+        copyNonTemporal(dest, src, len);
+    } else if (features.fsrm or (features.erms and len >= erms_threshold)) {
+        movsb(dest, src, len);
+    } else if (has_avx2 and features.avx2 and len >= 32) {
+        copyAvx2(dest, src, len);
+    } else {
+        copyQwords(dest, src, len);
+    }
+}
+
+/// Copy `len` bytes from `src` to `dest`. The regions can overlap.
+pub fn move(dest: [*]u8, src: [*]const u8, len: usize) void {
+    const d = @intFromPtr(dest);
+    const s = @intFromPtr(src);
+    if (d <= s or d >= s + len) {
+        // Copying forward does not overwrite the source before it is read.
+        copy(dest, src, len);
+    } else {
+        movsbBackward(dest, src, len);
+    }
+}
+
+/// Fill `len` bytes of `dest` with `value`.
+pub fn set(dest: [*]u8, value: u8, len: usize) void {
+    if (len >= nt_threshold) {
+        setNonTemporal(dest, value, len);
+    } else if (features.fsrm or (features.erms and len >= erms_threshold)) {
+        stosb(dest, value, len);
+    } else if (has_avx2 and features.avx2 and len >= 32) {
+        setAvx2(dest, value, len);
+    } else {
+        setQwords(dest, value, len);
+    }
+}
+
+// Registers consumed by string instructions are declared as outputs,
+// so that the compiler does not assume they hold the inputs after the instructions.
+
+inline fn movsb(dest: [*]u8, src: [*]const u8, len: usize) void {
+    var rdi: usize = undefined;
+    var rsi: usize = undefined;
+    var rcx: usize = undefined;
+    asm volatile (
+        \\rep movsb
+        : [rdi] "={rdi}" (rdi),
+          [rsi] "={rsi}" (rsi),
+          [rcx] "={rcx}" (rcx),
+        : [dest] "{rdi}" (dest),
+          [src] "{rsi}" (src),
+          [len] "{rcx}" (len),
+        : "memory"
+    );
+}
+
+inline fn stosb(dest: [*]u8, value: u8, len: usize) void {
+    var rdi: usize = undefined;
+    var rcx: usize = undefined;
+    asm volatile (
+        \\rep stosb
+        : [rdi] "={rdi}" (rdi),
+          [rcx] "={rcx}" (rcx),
+        : [dest] "{rdi}" (dest),
+          [value] "{al}" (value),
+          [len] "{rcx}" (len),
+        : "memory"
+    );
+}
+
+/// Copy bytes backward from the end, so that overlapping regions where `dest > src` are copied correctly.
+/// DF is set during the copy. Interrupt handlers clear it on entry (see `isrCommon`).
+fn movsbBackward(dest: [*]u8, src: [*]const u8, len: usize) void {
+    if (len == 0) return;
+
+    var rdi: usize = undefined;
+    var rsi: usize = undefined;
+    var rcx: usize = undefined;
+    asm volatile (
+        \\std
+        \\rep movsb
+        \\cld
+        : [rdi] "={rdi}" (rdi),
+          [rsi] "={rsi}" (rsi),
+          [rcx] "={rcx}" (rcx),
+        : [dest] "{rdi}" (dest + len - 1),
+          [src] "{rsi}" (src + len - 1),
+          [len] "{rcx}" (len),
+        : "memory"
+    );
+}
+
+fn copyQwords(dest: [*]u8, src: [*]const u8, len: usize) void {
+    var rdi: usize = undefined;
+    var rsi: usize = undefined;
+    var rcx: usize = undefined;
+    asm volatile (
+        \\rep movsq
+        \\movq %%rdx, %%rcx
+        \\rep movsb
+        : [rdi] "={rdi}" (rdi),
+          [rsi] "={rsi}" (rsi),
+          [rcx] "={rcx}" (rcx),
+        : [dest] "{rdi}" (dest),
+          [src] "{rsi}" (src),
+          [qwords] "{rcx}" (len / 8),
+          [rem] "{rdx}" (len % 8),
+        : "memory"
+    );
+}
+
+fn setQwords(dest: [*]u8, value: u8, len: usize) void {
+    var rdi: usize = undefined;
+    var rcx: usize = undefined;
+    asm volatile (
+        \\rep stosq
+        \\movq %%rdx, %%rcx
+        \\rep stosb
+        : [rdi] "={rdi}" (rdi),
+          [rcx] "={rcx}" (rcx),
+        : [dest] "{rdi}" (dest),
+          [value] "{rax}" (@as(u64, value) * 0x0101_0101_0101_0101),
+          [qwords] "{rcx}" (len / 8),
+          [rem] "{rdx}" (len % 8),
+        : "memory"
+    );
+}
+
+// Loops below keep their inputs intact and advance clobbered scratch registers instead.
+
+/// Copy with 32-byte AVX2 loads and stores. `len` MUST be at least 32.
+/// The last 32 bytes are copied by an overlapping store instead of a byte loop.
+/// They are loaded before the loop, since `move()` copies overlapping regions forward
+/// and the loop can overwrite them when `dest` is less than 32 bytes before `src`.
+fn copyAvx2(dest: [*]u8, src: [*]const u8, len: usize) void {
+    asm volatile (
+        \\vmovdqu (%[src], %[last]), %%ymm1
+        \\xorl %%eax, %%eax
+        \\1:
+        \\vmovdqu (%[src], %%rax), %%ymm0
+        \\vmovdqu %%ymm0, (%[dest], %%rax)
+        \\addq $32, %%rax
+        \\cmpq %[last], %%rax
+        \\jb 1b
+        \\vmovdqu %%ymm1, (%[dest], %[last])
+        \\vzeroupper
+        :
+        : [dest] "r" (dest),
+          [src] "r" (src),
+          [last] "r" (len - 32),
+        : "rax", "ymm0", "ymm1", "memory", "cc"
+    );
+}
+
+/// Fill with 32-byte AVX2 stores. `len` MUST be at least 32.
+fn setAvx2(dest: [*]u8, value: u8, len: usize) void {
+    asm volatile (
+        \\vmovd %[value], %%xmm0
+        \\vpbroadcastb %%xmm0, %%ymm0
+        \\xorl %%eax, %%eax
+        \\1:
+        \\vmovdqu %%ymm0, (%[dest], %%rax)
+        \\addq $32, %%rax
+        \\cmpq %[last], %%rax
+        \\jb 1b
+        \\vmovdqu %%ymm0, (%[dest], %[last])
+        \\vzeroupper
+        :
+        : [dest] "r" (dest),
+          [value] "r" (@as(u32, value)),
+          [last] "r" (len - 32),
+        : "rax", "ymm0", "memory", "cc"
+    );
+}
+
+/// Copy with non-temporal stores.
+/// The head is copied by `rep movsb` until the destination is aligned to a cache line,
+/// and the tail that does not fill a cache line is copied by `rep movsb` too.
+fn copyNonTemporal(dest: [*]u8, src: [*]const u8, len: usize) void {
+    const head = std.mem.alignForward(usize, @intFromPtr(dest), 64) - @intFromPtr(dest);
+    movsb(dest, src, head);
+
+    const body = (len - head) & ~@as(usize, 63);
+    asm volatile (
+        \\movq %[src], %%rsi
+        \\movq %[dest], %%rdi
+        \\movq %[body], %%rcx
+        \\1:
+        \\movdqu (%%rsi), %%xmm0
+        \\movdqu 16(%%rsi), %%xmm1
+        \\movdqu 32(%%rsi), %%xmm2
+        \\movdqu 48(%%rsi), %%xmm3
+        \\movntdq %%xmm0, (%%rdi)
+        \\movntdq %%xmm1, 16(%%rdi)
+        \\movntdq %%xmm2, 32(%%rdi)
+        \\movntdq %%xmm3, 48(%%rdi)
+        \\addq $64, %%rsi
+        \\addq $64, %%rdi
+        \\subq $64, %%rcx
+        \\jnz 1b
+        \\sfence
+        :
+        : [dest] "r" (dest + head),
+          [src] "r" (src + head),
+          [body] "r" (body),
+        : "rsi", "rdi", "rcx", "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc"
+    );
+
+    movsb(dest + head + body, src + head + body, len - head - body);
+}
+
+/// Fill with non-temporal stores.
+fn setNonTemporal(dest: [*]u8, value: u8, len: usize) void {
+    const head = std.mem.alignForward(usize, @intFromPtr(dest), 64) - @intFromPtr(dest);
+    stosb(dest, value, head);
+
+    const body = (len - head) & ~@as(usize, 63);
+    asm volatile (
+        \\movq %[pattern], %%xmm0
+        \\punpcklqdq %%xmm0, %%xmm0
+        \\movq %[dest], %%rdi
+        \\movq %[body], %%rcx
+        \\1:
+        \\movntdq %%xmm0, (%%rdi)
+        \\movntdq %%xmm0, 16(%%rdi)
+        \\movntdq %%xmm0, 32(%%rdi)
+        \\movntdq %%xmm0, 48(%%rdi)
+        \\addq $64, %%rdi
+        \\subq $64, %%rcx
+        \\jnz 1b
+        \\sfence
+        :
+        : [dest] "r" (dest + head),
+          [body] "r" (body),
+          [pattern] "r" (@as(u64, value) * 0x0101_0101_0101_0101),
+        : "rdi", "rcx", "xmm0", "memory", "cc"
+    );
+
+    stosb(dest + head + body, value, len - head - body);
+}
+
+const testing = std.testing;
+
+/// Sizes that cover every strategy and remainder.
+const test_sizes = [_]usize{ 0, 1, 7, 8, 31, 32, 33, 127, 128, 129, 4096 + 13, nt_threshold + 77 };
+
+test "Copy, move, and fill with each strategy" {
+    const saved = features;
+    defer features = saved;
+
+    const src = try testing.allocator.alloc(u8, nt_threshold + 256);
+    defer testing.allocator.free(src);
+    const dest = try testing.allocator.alloc(u8, nt_threshold + 256);
+    defer testing.allocator.free(dest);
+    for (src, 0..) |*b, i| b.* = @truncate(i *% 31 +% 7);
+
+    const strategies = [_]Features{
+        .{},
+        .{ .erms = true },
+        .{ .erms = true, .fsrm = true },
+        .{ .avx2 = has_avx2 },
+    };
+    for (strategies) |strategy| {
+        features = strategy;
+        for (test_sizes) |size| {
+            for ([_]usize{ 0, 3 }) |misalign| {
+                @memset(dest, 0xAA);
+                copy(dest.ptr + misalign, src.ptr + 1, size);
+                try testing.expectEqualSlices(u8, src[1 .. 1 + size], dest[misalign .. misalign + size]);
+                try testing.expectEqual(0xAA, dest[misalign + size]);
+
+                set(dest.ptr + misalign, 0x5C, size);
+                for (dest[misalign .. misalign + size]) |b| try testing.expectEqual(0x5C, b);
+                try testing.expectEqual(0xAA, dest[misalign + size]);
+            }
+        }
+    }
+}
+
+test "Move overlapping regions" {
+    const saved = features;
+    defer features = saved;
+
+    const strategies = [_]Features{
+        .{},
+        .{ .erms = true },
+        .{ .erms = true, .fsrm = true },
+        .{ .avx2 = has_avx2 },
+    };
+    var buf: [256]u8 = undefined;
+    var expected: [256]u8 = undefined;
+    for (strategies) |strategy| {
+        features = strategy;
+        for ([_]usize{ 1, 31, 32, 33, 45, 100, 127, 200 }) |len| {
+            for ([_]usize{ 1, 5, 8, 31, 40 }) |distance| {
+                // Destination after the source.
+                for (&buf, 0..) |*b, i| b.* = @intCast(i);
+                move(buf[distance..].ptr, buf[0..].ptr, len);
+                for (0..len) |i| try testing.expectEqual(@as(u8, @intCast(i)), buf[distance + i]);
+
+                // Destination before the source.
+                for (&buf, 0..) |*b, i| b.* = @intCast(i);
+                @memcpy(&expected, &buf);
+                for (0..len) |i| expected[i] = @intCast(i + distance);
+                move(buf[0..].ptr, buf[distance..].ptr, len);
+                try testing.expectEqualSlices(u8, &expected, &buf);
+            }
+        }
+    }
+}
@@ -1,116 +1,763 @@
+//! x86-64 4-level paging.
+//!
+//! The kernel uses the following layout of the virtual address space:
+//!
+//!   0x0000_0000_0000_0000 - 0x0000_7FFF_FFFF_FFFF : not mapped (reserved for future address spaces)
+//!   0xFFFF_8000_0000_0000 - ...                   : direct map of the physical address space
+//!   0xFFFF_C000_0000_0000 - 0xFFFF_C00F_FFFF_FFFF : vmalloc area
+//!   0xFFFF_FFFF_8000_0000 - ...                   : kernel image
+//!
+//! The bootloader enters the kernel with a temporary page table that also identity maps the physical memory,
+//! so that the kernel can read the arguments placed in the low memory.
+//! `init()` replaces it with the kernel page table, which does not have the identity map.
+//! The direct map uses 1GiB pages if supported, or 2MiB pages otherwise.
+//! The kernel image is mapped by 4KiB pages so that guard pages of stacks can be left unmapped.
+//!
+//! `map()`, `unmap()`, and `protect()` manage arbitrary kernel mappings in 4KiB granularity.
+//! Page-table pages are taken from a pool that keeps freed tables for reuse,
+//! and TLB entries are invalidated in a batch after the page tables are updated.
+//!
+//! Translations of the kernel half are global, since every address space shares them.
+//! INVLPG invalidates a global translation in all PCIDs, so changes of kernel mappings are seen by all address spaces.
+
 const std = @import("std");
 const log = std.log.scoped(.archp);
 const Allocator = std.mem.Allocator;
 
 const arch = @import("arch.zig");
 const am = @import("asm.zig");
+const pcid = @import("pcid.zig");
 
-const page_size_4k: usize = arch.page_size;
+pub const page_size_4k: usize = arch.page_size;
 const page_size_2mb: usize = page_size_4k << 9;
 const page_size_1gb: usize = page_size_2mb << 9;
 const page_shift = arch.page_shift;
 const num_table_entries: usize = 512;
 
+/// Base virtual address of the direct map.
+/// Physical address `p` is mapped to `direct_map_base + p`.
+/// MUST be the same as `kDirectMapBase` of the bootloader.
+pub const direct_map_base: u64 = 0xFFFF_8000_0000_0000;
+/// Base virtual address of the kernel image.
+/// Physical address `p` of the kernel image is mapped to `kernel_base + p`.
+/// MUST be the same as `kKernelVirtualBase` of the bootloader.
+pub const kernel_base: u64 = 0xFFFF_FFFF_8000_0000;
+/// Base virtual address of the vmalloc area.
+/// The area is used to map physically non-contiguous pages to contiguous virtual addresses.
+pub const vmalloc_base: u64 = 0xFFFF_C000_0000_0000;
+/// Size in bytes of the vmalloc area.
+pub const vmalloc_size: u64 = 64 * page_size_1gb;
+/// Minimum size of the physical address space covered by the direct map.
+/// The low 4GiB is always covered since it contains MMIO regions such as LAPIC and PCI ECAM.
+const min_direct_map_size: u64 = 4 * page_size_1gb;
+
+/// End of the kernel image provided by the linker.
+const kernel_end = @extern(*const u8, .{ .name = "_end" });
+
+/// Maximum number of guard pages.
+const max_guard_pages = 8;
+/// Virtual addresses of registered guard pages.
+var guard_pages: [max_guard_pages]u64 = undefined;
+/// Number of registered guard pages.
+var num_guard_pages: usize = 0;
+/// Whether the kernel page table is in use.
+var initialized = false;
+/// End of the physical address space covered by the direct map.
+var direct_map_end: u64 = 0;
+/// Whether 1GiB pages are used.
+var use_1gb_pages = false;
+/// Page allocator used to allocate page-table pages for `map()` and `protect()`.
+var page_allocator: Allocator = undefined;
+/// Pool of free page-table pages.
+var table_pool = TablePool{};
+
 pub const PageError = error{
     /// Failed to allocate memory.
     NoMemory,
+    /// The region is mapped in a way that is not supported.
+    InvalidMapping,
+    /// The address or the size is not aligned to the page size.
+    InvalidArgument,
+    /// The region is already mapped.
+    AlreadyMapped,
+    /// The region is not mapped.
+    NotMapped,
+};
+
+/// Attributes of a mapping.
+pub const MapFlags = struct {
+    /// Whether the region is writable.
+    writable: bool = true,
+    /// Memory type of the region.
+    mtype: MemoryType = .WriteBack,
+};
+
+/// Memory type of a mapping.
+/// The memory type is selected from PAT entries by PWT and PCD bits of the page table entry.
+pub const MemoryType = enum {
+    /// Write-back. Used for normal memory.
+    WriteBack,
+    /// Write-combining. Used for framebuffers and prefetchable MMIO.
+    WriteCombining,
+    /// Uncacheable. Used for MMIO registers.
+    Uncacheable,
 };
 
-/// Construct the identity mapping and switch to it.
-/// This function uses 2MiB pages to reduce the number of page table entries.
-/// Only the first entry of the PML4 table is used.
-/// TODO: This is a temporary implementation. Replace it.
-pub fn initIdentityMapping(allocator: Allocator) PageError!void {
-    // Allocate and init tables.
-    const pml4_table = allocator.alloc(Pml4Entry, num_table_entries) catch {
-        return PageError.NoMemory;
+/// IA32_PAT MSR.
+const ia32_pat: u32 = 0x277;
+/// Value of IA32_PAT.
+/// PA0=WB, PA1=WC, PA2=UC-, PA3=UC, PA4=WB, PA5=WT, PA6=UC-, PA7=UC.
+/// This is the power-on default except that PA1 is changed from WT to WC.
+const pat_value: u64 = 0x00_07_04_06_00_07_01_06;
+
+/// Convert the physical address to the virtual address in the direct map.
+pub inline fn phys2virt(phys: u64) u64 {
+    return phys + direct_map_base;
+}
+
+/// Convert the virtual address in the direct map or the kernel image to the physical address.
+pub inline fn virt2phys(virt: u64) u64 {
+    return if (virt >= kernel_base) virt - kernel_base else virt - direct_map_base;
+}
+
+/// Construct the kernel page table and switch to it.
+/// The direct map covers the physical address space up to `phys_end`, and at least the low 4GiB.
+/// After this call, the identity map provided by the bootloader is no longer available.
+pub fn init(phys_end: u64, allocator: Allocator) PageError!void {
+    page_allocator = allocator;
+    const pml4 = try allocTable(Pml4Entry, allocator);
+
+    // Construct the direct map.
+    const use_1gb = has1gbPages();
+    use_1gb_pages = use_1gb;
+    const end = std.mem.alignForward(u64, @max(phys_end, min_direct_map_size), page_size_1gb);
+    direct_map_end = end;
+    var phys: u64 = 0;
+    while (phys < end) : (phys += page_size_1gb) {
+        const vaddr = phys2virt(phys);
+        const pdpt = try getOrCreatePdpt(pml4, vaddr, allocator);
+        if (use_1gb) {
+            var ent = PdptEntry.new_1gb(phys);
+            ent.global = true;
+            pdpt[pdptIndex(vaddr)] = ent;
+        } else {
+            const pdt = try allocTable(PdtEntry, allocator);
+            for (pdt, 0..) |*ent, i| {
+                ent.* = PdtEntry.new_4mb(phys + i * page_size_2mb);
+                ent.global = true;
+            }
+            pdpt[pdptIndex(vaddr)] = PdptEntry.new(virt2phys(@intFromPtr(pdt)));
+        }
+    }
+
+    // Map the kernel image by 4KiB pages except for guard pages.
+    const image_end = std.mem.alignForward(u64, @intFromPtr(kernel_end), page_size_4k);
+    var vaddr = kernel_base;
+    while (vaddr < image_end) : (vaddr += page_size_4k) {
+        const pt = try getOrCreatePt(pml4, vaddr, allocator);
+        if (isGuardPage(vaddr)) {
+            pt[ptIndex(vaddr)] = PtEntry.new_nopresent();
+        } else {
+            var ent = PtEntry.new(virt2phys(vaddr));
+            ent.global = true;
+            pt[ptIndex(vaddr)] = ent;
+        }
+    }
+
+    // Set up PAT so that WC can be selected by page table entries.
+    // No existing mapping uses PWT=1, so changing PA1 does not affect them.
+    am.writeMsr(ia32_pat, pat_value);
+
+    // Load CR3 register, and then enable global pages.
+    // Global translations of the bootloader page table are flushed when CR4.PGE changes.
+    am.loadCr3(virt2phys(@intFromPtr(pml4)));
+    am.loadCr4(am.readCr4() | cr4_pge);
+    initialized = true;
+
+    log.info("Direct map: 0x{X:0>16} - 0x{X:0>16} ({s} pages)", .{
+        direct_map_base,
+        phys2virt(end),
+        if (use_1gb) "1GiB" else "2MiB",
+    });
+    log.info("Kernel image: 0x{X:0>16} - 0x{X:0>16}", .{ kernel_base, image_end });
+}
+
+/// Register the page in the kernel image as a guard page, which is never mapped.
+/// If the kernel page table is already in use, the page is unmapped immediately.
+pub fn addGuardPage(vaddr: u64) void {
+    if (num_guard_pages >= max_guard_pages) {
+        @panic("Too many guard pages.");
+    }
+    guard_pages[num_guard_pages] = vaddr;
+    num_guard_pages += 1;
+
+    if (initialized) {
+        const pt = getPt(getCurrentPml4(), vaddr) orelse @panic("Guard page is not in the kernel image.");
+        pt[ptIndex(vaddr)] = PtEntry.new_nopresent();
+        am.invlpg(vaddr);
+    }
+}
+
+/// Check if the address is in one of the guard pages.
+pub fn isGuardPage(addr: u64) bool {
+    const page = std.mem.alignBackward(u64, addr, page_size_4k);
+    for (guard_pages[0..num_guard_pages]) |guard| {
+        if (guard == page) return true;
+    }
+    return false;
+}
+
+/// Stack in the kernel image with a guard page below it.
+/// Once `guard()` is called, overflowing the stack faults on the guard page
+/// instead of silently corrupting the memory below the stack.
+pub fn GuardedStack(comptime size: usize) type {
+    if (size % page_size_4k != 0) {
+        @compileError("Size of the stack must be a multiple of the page size.");
+    }
+
+    return extern struct {
+        const Self = @This();
+
+        /// Guard page, which is never mapped.
+        guard_page: [page_size_4k]u8 align(page_size_4k),
+        /// Usable region of the stack.
+        stack: [size]u8 align(page_size_4k),
+
+        /// Register the guard page of the stack.
+        pub fn guard(self: *Self) void {
+            addGuardPage(@intFromPtr(&self.guard_page));
+        }
+
+        /// Lowest address of the usable region.
+        pub fn base(self: *const Self) u64 {
+            return @intFromPtr(&self.stack);
+        }
+
+        /// Initial stack pointer.
+        pub fn top(self: *const Self) u64 {
+            return self.base() + size;
+        }
     };
-    errdefer allocator.free(pml4_table);
-    for (0..num_table_entries) |i| {
-        pml4_table[i] = Pml4Entry.new_nopresent();
+}
+
+/// Map the MMIO region in the direct map with the given memory type.
+/// Only the 4KiB pages covering the region get the memory type.
+/// Large pages of the direct map partially covered by the region are split, so that the neighbors keep their type.
+/// Pages beyond the end of the direct map are mapped newly.
+/// Returns the virtual address corresponding to `phys`.
+pub fn ioremap(phys: u64, size: usize, mtype: MemoryType) PageError!u64 {
+    const start = std.mem.alignBackward(u64, phys, page_size_4k);
+    const end = std.mem.alignForward(u64, phys + size, page_size_4k);
+    const split = std.math.clamp(direct_map_end, start, end);
+    const flags = MapFlags{ .mtype = mtype };
+
+    if (start < split) {
+        try protect(phys2virt(start), split - start, flags);
+        // Lines cached while the region was mapped as WB are not covered by the new type.
+        if (mtype != .WriteBack) flushCache(phys2virt(start), split - start);
+    }
+    if (split < end) {
+        map(phys2virt(split), split, end - split, flags) catch |err| switch (err) {
+            // The region has been mapped by a previous call.
+            PageError.AlreadyMapped => try protect(phys2virt(split), end - split, flags),
+            else => return err,
+        };
+    }
+
+    return phys2virt(phys);
+}
+
+/// Size in bytes above which `flushCache()` writes back the whole cache instead of each line.
+const wbinvd_threshold = 4 * 1024 * 1024;
+/// Size in bytes of a cache line.
+const cache_line_size = 64;
+
+/// Write back and invalidate the cache lines of the virtual region.
+fn flushCache(vaddr: u64, size: usize) void {
+    if (size >= wbinvd_threshold) {
+        am.wbinvd();
+        return;
+    }
+
+    var addr = std.mem.alignBackward(u64, vaddr, cache_line_size);
+    while (addr < vaddr + size) : (addr += cache_line_size) {
+        am.clflush(addr);
+    }
+    am.mfence();
+}
+
+/// Map the physical region to the virtual region with the given attributes.
+/// The largest page size that fits the alignment of the addresses and the remaining size is used for each page.
+/// Fails if any part of the virtual region is already mapped, in which case nothing is mapped.
+pub fn map(vaddr: u64, paddr: u64, size: usize, flags: MapFlags) PageError!void {
+    if (!isPageAligned(vaddr) or !isPageAligned(paddr) or !isPageAligned(size)) {
+        return PageError.InvalidArgument;
+    }
+
+    var offset: u64 = 0;
+    errdefer unmap(vaddr, offset) catch {};
+    while (offset < size) {
+        const va = vaddr + offset;
+        const pa = paddr + offset;
+        if (translate(va) != null) return PageError.AlreadyMapped;
+
+        const pml4 = getCurrentPml4();
+        const psize = largestPageSize(va, pa, size - offset, use_1gb_pages);
+        switch (psize) {
+            page_size_1gb => {
+                const pdpt = try getOrCreatePdpt(pml4, va, page_allocator);
+                const ent = &pdpt[pdptIndex(va)];
+                if (ent.present) return PageError.AlreadyMapped;
+                var new = PdptEntry.new_1gb(pa);
+                applyFlags(&new, va, flags);
+                ent.* = new;
+            },
+            page_size_2mb => {
+                const pdt = try getOrCreatePdt(pml4, va, page_allocator);
+                const ent = &pdt[pdtIndex(va)];
+                if (ent.present) return PageError.AlreadyMapped;
+                var new = PdtEntry.new_4mb(pa);
+                applyFlags(&new, va, flags);
+                ent.* = new;
+            },
+            else => {
+                const pt = try getOrCreatePt(pml4, va, page_allocator);
+                var new = PtEntry.new(pa);
+                applyFlags(&new, va, flags);
+                pt[ptIndex(va)] = new;
+            },
+        }
+        // Not-present entries are never cached in the TLB, so no invalidation is needed.
+        offset += psize;
+    }
+}
+
+/// Unmap the virtual region.
+/// Large pages partially covered by the region are split.
+/// Pages in the region that are not mapped are ignored.
+/// Page tables that become empty are returned to the pool.
+pub fn unmap(vaddr: u64, size: usize) PageError!void {
+    if (!isPageAligned(vaddr) or !isPageAligned(size)) {
+        return PageError.InvalidArgument;
+    }
+
+    var batch = TlbBatch{};
+    defer batch.flush();
+
+    const pml4 = getCurrentPml4();
+    const end = vaddr + size;
+    var va = vaddr;
+    while (va < end) {
+        const pml4_ent = pml4[pml4Index(va)];
+        if (!pml4_ent.present) {
+            va = nextBoundary(va, page_size_1gb << 9, end);
+            continue;
+        }
+
+        const pdpt = getTable(PdptEntry, pml4_ent.phys_pdpt << page_shift);
+        const pdpt_ent = &pdpt[pdptIndex(va)];
+        if (!pdpt_ent.present) {
+            va = nextBoundary(va, page_size_1gb, end);
+            continue;
+        }
+        if (pdpt_ent.ps and std.mem.isAligned(va, page_size_1gb) and end - va >= page_size_1gb) {
+            pdpt_ent.* = PdptEntry.new_nopresent();
+            batch.add(va);
+            va += page_size_1gb;
+            continue;
+        }
+
+        const pdt = try getOrCreatePdt(pml4, va, page_allocator);
+        const pdt_ent = &pdt[pdtIndex(va)];
+        if (!pdt_ent.present) {
+            va = nextBoundary(va, page_size_2mb, end);
+            continue;
+        }
+        if (pdt_ent.ps and std.mem.isAligned(va, page_size_2mb) and end - va >= page_size_2mb) {
+            pdt_ent.* = PdtEntry.new_nopresent();
+            batch.add(va);
+            va += page_size_2mb;
+            continue;
+        }
+
+        const pt = try getOrCreatePt(pml4, va, page_allocator);
+        const pt_end = nextBoundary(va, page_size_2mb, end);
+        while (va < pt_end) : (va += page_size_4k) {
+            const ent = &pt[ptIndex(va)];
+            if (!ent.present) continue;
+            ent.* = PtEntry.new_nopresent();
+            batch.add(va);
+        }
+
+        // Release the page table if no page is mapped by it.
+        if (isEmptyTable(pt)) {
+            pdt_ent.* = PdtEntry.new_nopresent();
+            batch.release(@intFromPtr(pt));
+        }
+    }
+}
+
+/// Change the attributes of the mapped virtual region.
+/// Large pages partially covered by the region are split.
+/// Fails if any part of the region is not mapped.
+pub fn protect(vaddr: u64, size: usize, flags: MapFlags) PageError!void {
+    if (!isPageAligned(vaddr) or !isPageAligned(size)) {
+        return PageError.InvalidArgument;
+    }
+
+    var batch = TlbBatch{};
+    defer batch.flush();
+
+    const pml4 = getCurrentPml4();
+    const end = vaddr + size;
+    var va = vaddr;
+    while (va < end) {
+        const psize = mappedPageSize(va) orelse return PageError.NotMapped;
+        const covered = std.mem.isAligned(va, psize) and end - va >= psize;
+        switch (psize) {
+            page_size_1gb => if (covered) {
+                const pdpt = getTable(PdptEntry, pml4[pml4Index(va)].phys_pdpt << page_shift);
+                applyFlags(&pdpt[pdptIndex(va)], va, flags);
+                batch.add(va);
+                va += psize;
+                continue;
+            },
+            page_size_2mb => if (covered) {
+                const pdt = try getOrCreatePdt(pml4, va, page_allocator);
+                applyFlags(&pdt[pdtIndex(va)], va, flags);
+                batch.add(va);
+                va += psize;
+                continue;
+            },
+            else => {},
+        }
+
+        // The page is mapped by a 4KiB page, or the large page is split into them.
+        const pt = try getOrCreatePt(pml4, va, page_allocator);
+        applyFlags(&pt[ptIndex(va)], va, flags);
+        batch.add(va);
+        va += page_size_4k;
+    }
+}
+
+/// Translate the virtual address to the physical address.
+/// Returns null if the address is not mapped.
+pub fn translate(vaddr: u64) ?u64 {
+    const pml4_ent = getCurrentPml4()[pml4Index(vaddr)];
+    if (!pml4_ent.present) return null;
+
+    const pdpt_ent = getTable(PdptEntry, pml4_ent.phys_pdpt << page_shift)[pdptIndex(vaddr)];
+    if (!pdpt_ent.present) return null;
+    if (pdpt_ent.ps) return (pdpt_ent.phys_pdt << page_shift) + (vaddr & (page_size_1gb - 1));
+
+    const pdt_ent = getTable(PdtEntry, pdpt_ent.phys_pdt << page_shift)[pdtIndex(vaddr)];
+    if (!pdt_ent.present) return null;
+    if (pdt_ent.ps) return (pdt_ent.phys_pt << page_shift) + (vaddr & (page_size_2mb - 1));
+
+    const pt_ent = getTable(PtEntry, pdt_ent.phys_pt << page_shift)[ptIndex(vaddr)];
+    if (!pt_ent.present) return null;
+    return (pt_ent.phys << page_shift) + (vaddr & (page_size_4k - 1));
+}
+
+/// Get the size of the page that maps the virtual address.
+/// Returns null if the address is not mapped.
+fn mappedPageSize(vaddr: u64) ?u64 {
+    const pml4_ent = getCurrentPml4()[pml4Index(vaddr)];
+    if (!pml4_ent.present) return null;
+
+    const pdpt_ent = getTable(PdptEntry, pml4_ent.phys_pdpt << page_shift)[pdptIndex(vaddr)];
+    if (!pdpt_ent.present) return null;
+    if (pdpt_ent.ps) return page_size_1gb;
+
+    const pdt_ent = getTable(PdtEntry, pdpt_ent.phys_pdt << page_shift)[pdtIndex(vaddr)];
+    if (!pdt_ent.present) return null;
+    if (pdt_ent.ps) return page_size_2mb;
+
+    const pt_ent = getTable(PtEntry, pdt_ent.phys_pt << page_shift)[ptIndex(vaddr)];
+    return if (pt_ent.present) page_size_4k else null;
+}
+
+/// Select the largest page size that can map `size` bytes from `vaddr` to `paddr`.
+fn largestPageSize(vaddr: u64, paddr: u64, size: u64, allow_1gb: bool) u64 {
+    const sizes = [_]u64{ page_size_1gb, page_size_2mb };
+    for (sizes) |psize| {
+        if (psize == page_size_1gb and !allow_1gb) continue;
+        if (std.mem.isAligned(vaddr, psize) and std.mem.isAligned(paddr, psize) and size >= psize) {
+            return psize;
+        }
+    }
+    return page_size_4k;
+}
+
+/// Get the next `align`-aligned address after `addr`, limited to `end`.
+fn nextBoundary(addr: u64, alignment: u64, end: u64) u64 {
+    return @min(std.mem.alignForward(u64, addr + 1, alignment), end);
+}
+
+inline fn isPageAligned(value: u64) bool {
+    return std.mem.isAligned(value, page_size_4k);
+}
+
+/// Set the access permission and the memory type of the entry mapping the page at `vaddr`.
+/// Pages in the kernel half are also made global.
+fn applyFlags(ent: anytype, vaddr: u64, flags: MapFlags) void {
+    const bits = cacheBits(flags.mtype);
+    ent.rw = flags.writable;
+    ent.pwt = bits.pwt;
+    ent.pcd = bits.pcd;
+    ent.global = isKernelHalf(vaddr);
+}
+
+/// Check if the address is in the kernel half, which is shared by all address spaces.
+inline fn isKernelHalf(vaddr: u64) bool {
+    return vaddr >= direct_map_base;
+}
+
+/// Check if all entries of the page table are not present.
+fn isEmptyTable(pt: [*]const PtEntry) bool {
+    for (pt[0..num_table_entries]) |ent| {
+        if (ent.present) return false;
     }
+    return true;
+}
 
-    const pdp_table = allocator.alloc(PdptEntry, num_table_entries) catch {
-        return PageError.NoMemory;
+/// Pool of free page-table pages.
+/// Page tables are allocated and released frequently as regions are mapped and unmapped.
+/// Released tables are kept in the pool and reused instead of going back to the page allocator.
+/// The pool never returns pages to the allocator, since the allocator that provided each page is not tracked.
+const TablePool = struct {
+    /// Number of pages taken from the page allocator when the pool is empty.
+    const refill_count = 8;
+
+    /// Free table, which is linked by its first entry.
+    const Node = struct {
+        next: ?*Node,
     };
-    errdefer allocator.free(pdp_table);
-    for (0..num_table_entries) |i| {
-        pdp_table[i] = PdptEntry.new_nopresent();
+
+    /// Head of the free list.
+    head: ?*Node = null,
+    /// Number of free tables in the pool.
+    count: usize = 0,
+
+    /// Get a free table.
+    /// Returns the virtual address of the table.
+    fn get(self: *TablePool, allocator: Allocator) PageError!u64 {
+        if (self.head == null) {
+            for (0..refill_count) |_| {
+                const table = allocator.alignedAlloc(u8, page_size_4k, page_size_4k) catch break;
+                self.put(@intFromPtr(table.ptr));
+            }
+        }
+
+        const node = self.head orelse return PageError.NoMemory;
+        self.head = node.next;
+        self.count -= 1;
+        return @intFromPtr(node);
+    }
+
+    /// Put the table back to the pool.
+    /// The caller MUST ensure that the table is no longer referenced by the TLB.
+    fn put(self: *TablePool, table: u64) void {
+        const node: *Node = @ptrFromInt(table);
+        node.next = self.head;
+        self.head = node;
+        self.count += 1;
     }
+};
 
-    // Construct PML4 table.
-    pml4_table[0] = Pml4Entry.new(&pdp_table[0]);
+/// Batch of TLB invalidations.
+/// Invalidations are deferred until `flush()` so that page tables can be updated at once.
+/// If too many pages are invalidated, the TLB of all PCIDs is flushed instead,
+/// which is cheaper than executing INVLPG for each page.
+/// INVLPG removes global translations from all PCIDs, but paging-structure caches only from the current PCID.
+/// So released page tables also require the flush of all PCIDs before they are reused.
+const TlbBatch = struct {
+    /// Maximum number of pages invalidated one by one.
+    const max_pages = 32;
 
-    // Construct PDPT table and 2MiB PDT entries.
-    for (0..num_table_entries) |pdp_i| {
-        const page_directory = allocator.alloc(PdtEntry, num_table_entries) catch {
-            return PageError.NoMemory;
-        };
-        errdefer allocator.free(page_directory);
+    /// Pages to invalidate.
+    pages: [max_pages]u64 = undefined,
+    /// Number of pages in `pages`.
+    num_pages: usize = 0,
+    /// Whether the whole TLB needs to be flushed.
+    flush_all: bool = false,
+    /// Page tables released while the batch is pending.
+    /// They can still be referenced by the paging-structure caches until the flush.
+    released: ?*TablePool.Node = null,
+
+    /// Record the page to invalidate.
+    fn add(self: *TlbBatch, vaddr: u64) void {
+        if (self.flush_all) return;
+        if (self.num_pages >= max_pages) {
+            self.flush_all = true;
+            return;
+        }
+        self.pages[self.num_pages] = vaddr;
+        self.num_pages += 1;
+    }
+
+    /// Record the released page table, which is put back to the pool after the flush.
+    fn release(self: *TlbBatch, table: u64) void {
+        const node: *TablePool.Node = @ptrFromInt(table);
+        node.next = self.released;
+        self.released = node;
+    }
 
-        pdp_table[pdp_i] = PdptEntry.new(@intFromPtr(page_directory.ptr));
+    /// Invalidate the recorded pages and put the released tables back to the pool.
+    fn flush(self: *TlbBatch) void {
+        if (self.flush_all or self.released != null) {
+            pcid.flushAll();
+        } else {
+            for (self.pages[0..self.num_pages]) |vaddr| {
+                am.invlpg(vaddr);
+            }
+        }
 
-        for (0..num_table_entries) |pdt_i| {
-            page_directory[pdt_i] = PdtEntry.new_4mb(
-                pdp_i * page_size_1gb + pdt_i * page_size_2mb,
-            );
+        while (self.released) |node| {
+            self.released = node.next;
+            table_pool.put(@intFromPtr(node));
         }
+        self.num_pages = 0;
+        self.flush_all = false;
     }
+};
+
+/// Get PWT and PCD bits that select the memory type from PAT.
+fn cacheBits(mtype: MemoryType) struct { pwt: bool, pcd: bool } {
+    return switch (mtype) {
+        .WriteBack => .{ .pwt = false, .pcd = false }, // PA0
+        .WriteCombining => .{ .pwt = true, .pcd = false }, // PA1
+        .Uncacheable => .{ .pwt = true, .pcd = true }, // PA3
+    };
+}
+
+/// CR4.PGE: Page Global Enable.
+const cr4_pge: u64 = 1 << 7;
+
+/// Check if the CPU supports 1GiB pages.
+fn has1gbPages() bool {
+    if (am.cpuid(0x8000_0000, 0).eax < 0x8000_0001) return false;
+    // CPUID.80000001H:EDX.Page1GB[bit 26]
+    return am.cpuid(0x8000_0001, 0).edx & (1 << 26) != 0;
+}
+
+inline fn pml4Index(vaddr: u64) usize {
+    return @truncate((vaddr >> 39) & 0x1FF);
+}
+
+inline fn pdptIndex(vaddr: u64) usize {
+    return @truncate((vaddr >> 30) & 0x1FF);
+}
+
+inline fn pdtIndex(vaddr: u64) usize {
+    return @truncate((vaddr >> 21) & 0x1FF);
+}
 
-    // Load CR3 register.
-    am.loadCr3(@intFromPtr(&pml4_table[0]));
+inline fn ptIndex(vaddr: u64) usize {
+    return @truncate((vaddr >> 12) & 0x1FF);
 }
 
-/// Maps the given virtual address to the physical address identity for 2MiB page.
-/// TODO: this is a temporary implementation to workaround the problem
-/// that xHC MMIO address exceeds 16GiB.
-pub fn mapIdentity(vaddr: u64, allocator: Allocator) !void {
-    // TODO: remove magic numbers.
-    const pml4_index = (vaddr >> 39) & 0x1FF;
-    const pdp_index = (vaddr >> 30) & 0x1FF;
-    const pdt_index = (vaddr >> 21) & 0x1FF;
+/// Allocate a page table whose entries are all not present.
+/// The table is taken from the pool, which is refilled by `allocator` if empty.
+fn allocTable(comptime T: type, allocator: Allocator) PageError![*]T {
+    const table: [*]T = @ptrFromInt(try table_pool.get(allocator));
+    for (table[0..num_table_entries]) |*ent| {
+        ent.* = T.new_nopresent();
+    }
+    return table;
+}
 
-    const pml4_table = getCurrentPml4();
+/// Get the page table at the physical address via the direct map.
+fn getTable(comptime T: type, phys: u64) [*]T {
+    return @ptrFromInt(phys2virt(phys));
+}
 
-    const pml4_ent = &pml4_table[pml4_index];
+/// Get the PDP table for the given virtual address.
+/// The table is allocated if it does not exist.
+fn getOrCreatePdpt(pml4: [*]Pml4Entry, vaddr: u64, allocator: Allocator) PageError![*]PdptEntry {
+    const pml4_ent = &pml4[pml4Index(vaddr)];
     if (!pml4_ent.present) {
-        const pdpt = try allocator.alloc(PdptEntry, num_table_entries);
-        pml4_ent.* = Pml4Entry.new(&pdpt[0]);
+        const pdpt = try allocTable(PdptEntry, allocator);
+        pml4_ent.* = Pml4Entry.new(virt2phys(@intFromPtr(pdpt)));
     }
+    return getTable(PdptEntry, pml4_ent.phys_pdpt << page_shift);
+}
 
-    const pdp: [*]PdptEntry = @ptrFromInt(pml4_ent.phys_pdpt << page_shift);
-    const pdp_ent = &pdp[pdp_index];
-    if (!pdp_ent.present) {
-        const pdt = try allocator.alloc(PdtEntry, num_table_entries);
-        pdp_ent.* = PdptEntry.new(@intFromPtr(pdt.ptr));
+/// Get the page directory for the given virtual address.
+/// The tables are allocated if they do not exist.
+/// If the address is mapped by a 1GiB page, the page is split into 2MiB pages with the same attributes.
+fn getOrCreatePdt(pml4: [*]Pml4Entry, vaddr: u64, allocator: Allocator) PageError![*]PdtEntry {
+    const pdpt = try getOrCreatePdpt(pml4, vaddr, allocator);
+    const pdpt_ent = &pdpt[pdptIndex(vaddr)];
+    if (!pdpt_ent.present) {
+        const pdt = try allocTable(PdtEntry, allocator);
+        pdpt_ent.* = PdptEntry.new(virt2phys(@intFromPtr(pdt)));
+    } else if (pdpt_ent.ps) {
+        const pdt = try allocTable(PdtEntry, allocator);
+        const base = pdpt_ent.phys_pdt << page_shift;
+        for (0..num_table_entries) |i| {
+            var ent = PdtEntry.new_4mb(base + i * page_size_2mb);
+            ent.rw = pdpt_ent.rw;
+            ent.pwt = pdpt_ent.pwt;
+            ent.pcd = pdpt_ent.pcd;
+            ent.global = pdpt_ent.global;
+            pdt[i] = ent;
+        }
+        pdpt_ent.* = PdptEntry.new(virt2phys(@intFromPtr(pdt)));
     }
+    return getTable(PdtEntry, pdpt_ent.phys_pdt << page_shift);
+}
 
-    const pdt: [*]PdtEntry = @ptrFromInt(pdp_ent.phys_pdt << page_shift);
-    const pdt_ent = &pdt[pdt_index];
+/// Get the page table for the given virtual address.
+/// The tables are allocated if they do not exist.
+/// If the address is mapped by a 2MiB page, the page is split into 4KiB pages with the same attributes.
+fn getOrCreatePt(pml4: [*]Pml4Entry, vaddr: u64, allocator: Allocator) PageError![*]PtEntry {
+    const pdt = try getOrCreatePdt(pml4, vaddr, allocator);
+    const pdt_ent = &pdt[pdtIndex(vaddr)];
     if (!pdt_ent.present) {
-        pdt_ent.* = PdtEntry.new_4mb(
-            pml4_index * 512 * page_size_1gb + pdp_index * page_size_1gb + pdt_index * page_size_2mb,
-        );
-    } else {
-        // TODO
-        @panic("The page is already mapped.");
+        const pt = try allocTable(PtEntry, allocator);
+        pdt_ent.* = PdtEntry.new(virt2phys(@intFromPtr(pt)));
+    } else if (pdt_ent.ps) {
+        const pt = try allocTable(PtEntry, allocator);
+        const base = pdt_ent.phys_pt << page_shift;
+        for (0..num_table_entries) |i| {
+            var ent = PtEntry.new(base + i * page_size_4k);
+            ent.rw = pdt_ent.rw;
+            ent.pwt = pdt_ent.pwt;
+            ent.pcd = pdt_ent.pcd;
+            ent.global = pdt_ent.global;
+            pt[i] = ent;
+        }
+        pdt_ent.* = PdtEntry.new(virt2phys(@intFromPtr(pt)));
     }
+    return getTable(PtEntry, pdt_ent.phys_pt << page_shift);
+}
+
+/// Get the existing page table for the given virtual address.
+/// Returns null if the address is not mapped by 4KiB pages.
+fn getPt(pml4: [*]Pml4Entry, vaddr: u64) ?[*]PtEntry {
+    const pml4_ent = pml4[pml4Index(vaddr)];
+    if (!pml4_ent.present) return null;
+    const pdpt_ent = getTable(PdptEntry, pml4_ent.phys_pdpt << page_shift)[pdptIndex(vaddr)];
+    if (!pdpt_ent.present or pdpt_ent.ps) return null;
+    const pdt_ent = getTable(PdtEntry, pdpt_ent.phys_pdt << page_shift)[pdtIndex(vaddr)];
+    if (!pdt_ent.present or pdt_ent.ps) return null;
+    return getTable(PtEntry, pdt_ent.phys_pt << page_shift);
 }
 
 /// Get the pointer to the PML4 table of the current CPU.
 fn getCurrentPml4() [*]Pml4Entry {
     const cr3 = am.readCr3();
-    return @ptrFromInt(cr3 & ~@as(u64, 0xFFF));
+    return getTable(Pml4Entry, cr3 & ~@as(u64, 0xFFF));
 }
 
 /// Show the process of the address translation for the given linear address.
 /// TODO: do not use logger of this scope.
 pub fn showPageTable(lin_addr: u64) void {
-    // TODO: remove magic numbers.
-    const pml4_index = (lin_addr >> 39) & 0x1FF;
-    const pdp_index = (lin_addr >> 30) & 0x1FF;
-    const pdt_index = (lin_addr >> 21) & 0x1FF;
-    const pt_index = (lin_addr >> 12) & 0x1FF;
+    const pml4_index = pml4Index(lin_addr);
+    const pdp_index = pdptIndex(lin_addr);
+    const pdt_index = pdtIndex(lin_addr);
+    const pt_index = ptIndex(lin_addr);
     log.err("Linear Address: 0x{X:0>16} (0x{X}, 0x{X}, 0x{X}, 0x{X})", .{
         lin_addr,
         pml4_index,
@@ -118,20 +765,32 @@ pub fn showPageTable(lin_addr: u64) void {
         pdt_index,
         pt_index,
     });
+    if (isGuardPage(lin_addr)) {
+        log.err("The address is in a guard page of a stack.", .{});
+    }
 
-    const cr3 = am.readCr3();
-    const pml4: [*]Pml4Entry = @ptrFromInt(cr3);
+    const pml4 = getCurrentPml4();
     log.debug("PML4: 0x{X:0>16}", .{@intFromPtr(pml4)});
     const pml4_entry = pml4[pml4_index];
-    log.debug("\tPML4[{d}]: 0x{X:0>16}", .{ pml4_index, std.mem.bytesAsValue(u64, &pml4_entry).* });
-    const pdp: [*]PdptEntry = @ptrFromInt(pml4_entry.phys_pdpt << page_shift);
+    log.debug("\tPML4[{d}]: 0x{X:0>16}", .{ pml4_index, @as(u64, @bitCast(pml4_entry)) });
+    if (!pml4_entry.present) return;
+
+    const pdp = getTable(PdptEntry, pml4_entry.phys_pdpt << page_shift);
     log.debug("PDPT: 0x{X:0>16}", .{@intFromPtr(pdp)});
     const pdp_entry = pdp[pdp_index];
-    log.debug("\tPDPT[{d}]: 0x{X:0>16}", .{ pdp_index, std.mem.bytesAsValue(u64, &pdp_entry).* });
-    const pdt: [*]PdtEntry = @ptrFromInt(pdp_entry.phys_pdt << page_shift);
+    log.debug("\tPDPT[{d}]: 0x{X:0>16}", .{ pdp_index, @as(u64, @bitCast(pdp_entry)) });
+    if (!pdp_entry.present or pdp_entry.ps) return;
+
+    const pdt = getTable(PdtEntry, pdp_entry.phys_pdt << page_shift);
     log.debug("PDT: 0x{X:0>16}", .{@intFromPtr(pdt)});
     const pdt_entry = pdt[pdt_index];
-    log.debug("\tPDT[{d}]: 0x{X:0>16}", .{ pdt_index, std.mem.bytesAsValue(u64, &pdt_entry).* });
+    log.debug("\tPDT[{d}]: 0x{X:0>16}", .{ pdt_index, @as(u64, @bitCast(pdt_entry)) });
+    if (!pdt_entry.present or pdt_entry.ps) return;
+
+    const pt = getTable(PtEntry, pdt_entry.phys_pt << page_shift);
+    log.debug("PT: 0x{X:0>16}", .{@intFromPtr(pt)});
+    const pt_entry = pt[pt_index];
+    log.debug("\tPT[{d}]: 0x{X:0>16}", .{ pt_index, @as(u64, @bitCast(pt_entry)) });
 }
 
 /// PML4E
@@ -175,12 +834,12 @@ const Pml4Entry = packed struct(u64) {
     }
 
     /// Get a new PML4E entry.
-    pub fn new(phys_pdpt: *PdptEntry) Pml4Entry {
+    pub fn new(phys_pdpt: u64) Pml4Entry {
         return Pml4Entry{
             .present = true,
             .rw = true,
             .us = false,
-            .phys_pdpt = @truncate(@as(u64, @intFromPtr(phys_pdpt)) >> page_shift),
+            .phys_pdpt = @truncate(phys_pdpt >> page_shift),
         };
     }
 };
@@ -210,8 +869,12 @@ const PdptEntry = packed struct(u64) {
     /// If set to true, the entry maps a 1GiB page.
     /// If set to false, the entry references a PD Table.
     ps: bool,
+    /// Global.
+    /// Ignored when CR4.PGE != 1.
+    /// Ignored when this entry references a PD Table.
+    global: bool = false,
     /// Ignored
-    _ignored2: u3 = 0,
+    _ignored2: u2 = 0,
     /// Ignored except for HLAT paging.
     restart: bool = false,
     /// 4KB aligned address of the PD Table.
@@ -238,6 +901,17 @@ const PdptEntry = packed struct(u64) {
             .phys_pdt = @truncate(phys_pdt >> page_shift),
         };
     }
+
+    /// Get a new PDPT entry that maps a 1GiB page.
+    pub fn new_1gb(phys: u64) PdptEntry {
+        return PdptEntry{
+            .present = true,
+            .rw = true,
+            .us = false,
+            .ps = true,
+            .phys_pdt = @truncate(phys >> page_shift),
+        };
+    }
 };
 
 /// PDT Entry
@@ -289,6 +963,17 @@ const PdtEntry = packed struct(u64) {
         };
     }
 
+    /// Get a new PDT entry that references a Page Table.
+    pub fn new(phys_pt: u64) PdtEntry {
+        return PdtEntry{
+            .present = true,
+            .rw = true,
+            .us = false,
+            .ps = false,
+            .phys_pt = @truncate(phys_pt >> page_shift),
+        };
+    }
+
     /// Get a new PDT entry that maps a 2MiB page.
     pub fn new_4mb(phys: u64) PdtEntry {
         return PdtEntry{
@@ -300,3 +985,114 @@ const PdtEntry = packed struct(u64) {
         };
     }
 };
+
+/// PT Entry
+const PtEntry = packed struct(u64) {
+    /// Present.
+    present: bool = true,
+    /// Read/Write.
+    /// If set to false, wirte access is not allowed to the 4KiB page.
+    rw: bool,
+    /// User/Supervisor.
+    /// If set to false, user-mode access is not allowed to the 4KiB page.
+    us: bool,
+    /// Page-level writh-through.
+    /// Indirectly determines the memory type used to access the 4KiB page.
+    pwt: bool = false,
+    /// Page-level cache disable.
+    /// Indirectly determines the memory type used to access the 4KiB page.
+    pcd: bool = false,
+    /// Accessed.
+    /// Indicates wheter this entry has been used for translation.
+    accessed: bool = false,
+    /// Dirty bit.
+    /// Indicates wheter software has written to the 4KiB page.
+    dirty: bool = false,
+    /// PAT.
+    /// Indirectly determines the memory type used to access the 4KiB page.
+    pat: bool = false,
+    /// Ignored when CR4.PGE != 1.
+    global: bool = false,
+    /// Ignored
+    _ignored2: u2 = 0,
+    /// Ignored except for HLAT paging.
+    restart: bool = false,
+    /// Physical address of the 4KiB page.
+    phys: u52,
+
+    /// Get a new PT entry with the present bit set to false.
+    pub fn new_nopresent() PtEntry {
+        return PtEntry{
+            .present = false,
+            .rw = false,
+            .us = false,
+            .phys = 0,
+        };
+    }
+
+    /// Get a new PT entry that maps a 4KiB page.
+    pub fn new(phys: u64) PtEntry {
+        return PtEntry{
+            .present = true,
+            .rw = true,
+            .us = false,
+            .phys = @truncate(phys >> page_shift),
+        };
+    }
+};
+
+test "Direct map address conversion" {
+    try std.testing.expectEqual(direct_map_base + 0x1000, phys2virt(0x1000));
+    try std.testing.expectEqual(0x1000, virt2phys(phys2virt(0x1000)));
+    try std.testing.expectEqual(0x10_0000, virt2phys(kernel_base + 0x10_0000));
+}
+
+test "Page table indices" {
+    const vaddr: u64 = kernel_base + 0x12_3456;
+    try std.testing.expectEqual(511, pml4Index(vaddr));
+    try std.testing.expectEqual(510, pdptIndex(vaddr));
+    try std.testing.expectEqual(0, pdtIndex(vaddr));
+    try std.testing.expectEqual(0x123, ptIndex(vaddr));
+    try std.testing.expectEqual(256, pml4Index(direct_map_base));
+}
+
+test "Largest page size" {
+    const mb2 = page_size_2mb;
+    const gb1 = page_size_1gb;
+    try std.testing.expectEqual(gb1, largestPageSize(vmalloc_base, gb1, gb1, true));
+    try std.testing.expectEqual(mb2, largestPageSize(vmalloc_base, gb1, gb1, false));
+    try std.testing.expectEqual(mb2, largestPageSize(vmalloc_base, mb2, gb1, true));
+    try std.testing.expectEqual(mb2, largestPageSize(vmalloc_base + mb2, gb1, gb1 - mb2, true));
+    try std.testing.expectEqual(page_size_4k, largestPageSize(vmalloc_base, mb2, mb2 - page_size_4k, true));
+    try std.testing.expectEqual(page_size_4k, largestPageSize(vmalloc_base + page_size_4k, mb2, mb2, true));
+}
+
+test "Next boundary" {
+    try std.testing.expectEqual(page_size_2mb, nextBoundary(0, page_size_2mb, page_size_1gb));
+    try std.testing.expectEqual(page_size_2mb, nextBoundary(page_size_4k, page_size_2mb, page_size_1gb));
+    try std.testing.expectEqual(page_size_4k * 3, nextBoundary(page_size_4k, page_size_2mb, page_size_4k * 3));
+}
+
+test "TLB batch falls back to a full flush" {
+    var batch = TlbBatch{};
+    for (0..TlbBatch.max_pages) |i| {
+        batch.add(i * page_size_4k);
+    }
+    try std.testing.expectEqual(false, batch.flush_all);
+    try std.testing.expectEqual(TlbBatch.max_pages, batch.num_pages);
+    batch.add(0);
+    try std.testing.expectEqual(true, batch.flush_all);
+}
+
+test "Table pool reuses released tables" {
+    var pool = TablePool{};
+    const tables = try std.testing.allocator.alignedAlloc(u8, page_size_4k, 2 * page_size_4k);
+    defer std.testing.allocator.free(tables);
+
+    pool.put(@intFromPtr(tables.ptr));
+    pool.put(@intFromPtr(tables.ptr) + page_size_4k);
+    try std.testing.expectEqual(2, pool.count);
+    try std.testing.expectEqual(@intFromPtr(tables.ptr) + page_size_4k, try pool.get(std.testing.failing_allocator));
+    try std.testing.expectEqual(@intFromPtr(tables.ptr), try pool.get(std.testing.failing_allocator));
+    try std.testing.expectError(PageError.NoMemory, pool.get(std.testing.failing_allocator));
+}
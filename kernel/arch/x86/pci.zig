@@ -1,10 +1,132 @@
 //! This module provides a x64 impl for PCI access.
+//! The configuration space is accessed via PCI Express ECAM (Enhanced Configuration Access Mechanism)
+//! if the firmware provides MCFG table, otherwise via legacy CF8/CFC I/O ports.
+
+const std = @import("std");
+const log = std.log.scoped(.x64pci);
 
 const zakuro = @import("zakuro");
 const pci = zakuro.pci;
 const am = @import("asm.zig");
+const acpi = @import("acpi.zig");
+const page = @import("page.zig");
 const ConfigAddress = pci.ConfigAddress;
 
+/// Size in bytes of the configuration space accessible via legacy I/O ports.
+const legacy_config_size: usize = 0x100;
+
+/// ECAM region for PCI segment group 0.
+const Ecam = struct {
+    /// Physical base address of the ECAM region.
+    /// This address corresponds to bus 0 even if `start_bus` is not 0.
+    base: u64,
+    /// Start bus number decoded by the ECAM region.
+    start_bus: u8,
+    /// End bus number decoded by the ECAM region.
+    end_bus: u8,
+};
+
+/// ECAM region in use.
+/// If null, the configuration space is accessed via legacy I/O ports.
+var ecam: ?Ecam = null;
+
+/// Initialize the configuration space access method.
+/// If MCFG is available, ECAM is used for the buses it covers.
+/// ACPI MUST be initialized before calling this function to use ECAM.
+/// Note that the ECAM region is assumed to be identity mapped.
+pub fn init() void {
+    ecam = null;
+    const mcfg = acpi.getMcfg() orelse {
+        log.info("MCFG not found. Using legacy I/O for PCI configuration.", .{});
+        return;
+    };
+
+    for (0..mcfg.size()) |i| {
+        const ent = mcfg.get(i);
+        if (ent.segment != 0) continue;
+
+        ecam = .{
+            .base = ent.base_address,
+            .start_bus = ent.start_bus,
+            .end_bus = ent.end_bus,
+        };
+        log.info("PCI ECAM: base=0x{X} bus={X:0>2}-{X:0>2}", .{
+            ent.base_address,
+            ent.start_bus,
+            ent.end_bus,
+        });
+        return;
+    }
+
+    log.info("No ECAM region for segment 0. Using legacy I/O for PCI configuration.", .{});
+}
+
+/// Read 32-bit data from the configuration space.
+/// `offset` is rounded down to 4-byte boundary.
+/// If the offset is not reachable with the current access method, all-ones is returned.
+pub fn readConfig(bus: u8, device: u5, function: u3, offset: u12) u32 {
+    if (ecamAddress(bus, device, function, offset)) |addr| {
+        return @as(*const volatile u32, @ptrFromInt(addr)).*;
+    }
+    if (offset >= legacy_config_size) {
+        return 0xFFFF_FFFF;
+    }
+
+    setConfigAddress(.{
+        .offset = @truncate(offset),
+        .function = function,
+        .device = device,
+        .bus = bus,
+    });
+    return getConfigData();
+}
+
+/// Write 32-bit data to the configuration space.
+/// `offset` is rounded down to 4-byte boundary.
+/// If the offset is not reachable with the current access method, the write is ignored.
+pub fn writeConfig(bus: u8, device: u5, function: u3, offset: u12, data: u32) void {
+    if (ecamAddress(bus, device, function, offset)) |addr| {
+        @as(*volatile u32, @ptrFromInt(addr)).* = data;
+        return;
+    }
+    if (offset >= legacy_config_size) {
+        return;
+    }
+
+    setConfigAddress(.{
+        .offset = @truncate(offset),
+        .function = function,
+        .device = device,
+        .bus = bus,
+    });
+    setConfigData(data);
+}
+
+/// Check if the extended configuration space (offset 0x100 and above) is accessible for the bus.
+pub fn hasExtendedConfig(bus: u8) bool {
+    const e = ecam orelse return false;
+    return e.start_bus <= bus and bus <= e.end_bus;
+}
+
+/// Get the virtual address of the configuration register in the ECAM region.
+/// The region is accessed via the direct map.
+/// Returns null if ECAM is not available for the bus.
+fn ecamAddress(bus: u8, device: u5, function: u3, offset: u12) ?u64 {
+    const e = ecam orelse return null;
+    if (bus < e.start_bus or e.end_bus < bus) {
+        return null;
+    }
+    return page.phys2virt(e.base + ecamOffset(bus, device, function, offset));
+}
+
+/// Get the offset of the configuration register from the base of the ECAM region.
+fn ecamOffset(bus: u8, device: u5, function: u3, offset: u12) u64 {
+    return (@as(u64, bus) << 20) |
+        (@as(u64, device) << 15) |
+        (@as(u64, function) << 12) |
+        (@as(u64, offset) & ~@as(u64, 0b11));
+}
+
 /// Set PCI configuration address.
 pub fn setConfigAddress(addr: ConfigAddress) void {
     am.outl(
@@ -22,3 +144,12 @@ pub fn getConfigData() u32 {
 pub fn setConfigData(data: u32) void {
     return am.outl(data, pci.addr_configuration_data);
 }
+
+test "ECAM offset" {
+    try std.testing.expectEqual(0, ecamOffset(0, 0, 0, 0));
+    try std.testing.expectEqual(0x0010_0000, ecamOffset(1, 0, 0, 0));
+    try std.testing.expectEqual(0x0000_8000, ecamOffset(0, 1, 0, 0));
+    try std.testing.expectEqual(0x0000_1000, ecamOffset(0, 0, 1, 0));
+    try std.testing.expectEqual(0x0FFF_FFFC, ecamOffset(0xFF, 0x1F, 0b111, 0xFFF));
+    try std.testing.expectEqual(0x0002_D104, ecamOffset(0, 5, 5, 0x106));
+}
@@ -0,0 +1,210 @@
+//! Process-Context Identifiers (PCID).
+//!
+//! When PCID is enabled, TLB entries are tagged with the PCID in CR3[11:0],
+//! so switching address spaces does not have to flush the whole TLB.
+//! PCID 0 is reserved for the kernel address space. Other address spaces get a PCID lazily when switched to.
+//! When all PCIDs are used up, a new generation starts: the TLB of all PCIDs is flushed once,
+//! and address spaces of older generations get new PCIDs on their next switch.
+//!
+//! Invalidations of an address space that is not current use INVPCID if available.
+//! Otherwise, the TLB entries of the PCID are flushed on the next switch to the address space.
+//! Kernel-half translations are global and shared by all PCIDs. `page.zig` invalidates them.
+
+const std = @import("std");
+const log = std.log.scoped(.pcid);
+
+const am = @import("asm.zig");
+
+/// Number of PCIDs.
+const num_pcids = 4096;
+/// PCID of the kernel address space.
+const kernel_pcid: u12 = 0;
+
+/// INVPCID type: individual-address invalidation.
+const invpcid_address: u64 = 0;
+/// INVPCID type: single-context invalidation.
+const invpcid_single: u64 = 1;
+/// INVPCID type: all-context invalidation, including global translations.
+const invpcid_all: u64 = 2;
+
+/// Address space identified by its PML4 table.
+pub const AddressSpace = struct {
+    /// Physical address of the PML4 table.
+    root: u64,
+    /// PCID assigned to this address space.
+    /// Valid only if `generation` is the current generation.
+    pcid: u12 = kernel_pcid,
+    /// Generation in which `pcid` is assigned.
+    /// 0 means that no PCID is assigned.
+    generation: u64 = 0,
+    /// Whether TLB entries of the PCID must be flushed on the next switch.
+    stale: bool = false,
+};
+
+/// Allocator of PCIDs with generation-based recycling.
+const PcidAllocator = struct {
+    /// Current generation. Starts from 1 since 0 means unassigned.
+    generation: u64 = 1,
+    /// Next PCID to assign in the current generation.
+    next: u13 = kernel_pcid + 1,
+
+    /// Assign a PCID of the current generation to the address space if it does not have one.
+    /// Returns true if a new generation is started,
+    /// in which case the caller MUST flush TLB entries of all PCIDs.
+    fn assign(self: *PcidAllocator, space: *AddressSpace) bool {
+        if (space.generation == self.generation) return false;
+
+        var rollover = false;
+        if (self.next == num_pcids) {
+            self.generation += 1;
+            self.next = kernel_pcid + 1;
+            rollover = true;
+        }
+        space.pcid = @intCast(self.next);
+        space.generation = self.generation;
+        space.stale = false;
+        self.next += 1;
+        return rollover;
+    }
+};
+
+/// Whether PCID is enabled.
+var enabled = false;
+/// Whether INVPCID is supported.
+var has_invpcid = false;
+/// PCID allocator.
+var pcids = PcidAllocator{};
+/// Kernel address space.
+var kernel_space = AddressSpace{ .root = 0 };
+/// Address space currently loaded in CR3.
+var current_space: *AddressSpace = &kernel_space;
+
+/// Enable PCID if supported.
+/// This function MUST be called while CR3 holds the kernel page table with PCID 0.
+/// Returns true if PCID is enabled.
+pub fn init() bool {
+    const cr3 = am.readCr3();
+    kernel_space.root = cr3 & ~@as(u64, 0xFFF);
+
+    if (am.cpuid(1, 0).ecx & cpuid_pcid == 0) {
+        log.info("PCID is not supported.", .{});
+        return false;
+    }
+    has_invpcid = am.cpuid(0, 0).eax >= 7 and am.cpuid(7, 0).ebx & cpuid_invpcid != 0;
+
+    // CR4.PCIDE can be set only when CR3[11:0] is 0.
+    if (cr3 & 0xFFF != 0) {
+        am.loadCr3(kernel_space.root);
+    }
+    am.loadCr4(am.readCr4() | cr4_pcide);
+    enabled = true;
+    log.info("PCID enabled: INVPCID={}", .{has_invpcid});
+
+    return true;
+}
+
+/// Get the kernel address space.
+pub fn kernelSpace() *AddressSpace {
+    return &kernel_space;
+}
+
+/// Switch to the address space.
+/// If PCID is enabled, TLB entries of the address space cached before are kept.
+pub fn switchTo(space: *AddressSpace) void {
+    current_space = space;
+    if (!enabled) {
+        am.loadCr3(space.root);
+        return;
+    }
+
+    const rollover = space != &kernel_space and pcids.assign(space);
+    if (space.stale) {
+        space.stale = false;
+        am.loadCr3(space.root | space.pcid);
+    } else {
+        am.loadCr3NoFlush(space.root | space.pcid);
+    }
+    // Flush after the switch, since the CPU can cache translations of the previous PCID until CR3 is loaded,
+    // and that PCID can be reassigned in the new generation.
+    if (rollover) {
+        flushAll();
+    }
+}
+
+/// Invalidate the TLB entry of the page in the address space.
+pub fn invalidatePage(space: *AddressSpace, vaddr: u64) void {
+    if (space == current_space) {
+        am.invlpg(vaddr);
+    } else if (hasPcid(space)) {
+        if (has_invpcid) {
+            am.invpcid(invpcid_address, space.pcid, vaddr);
+        } else {
+            space.stale = true;
+        }
+    }
+    // Otherwise, the TLB has no entries of the address space.
+}
+
+/// Invalidate all TLB entries of the address space.
+pub fn invalidateSpace(space: *AddressSpace) void {
+    if (space == current_space) {
+        am.loadCr3(am.readCr3());
+    } else if (hasPcid(space)) {
+        if (has_invpcid) {
+            am.invpcid(invpcid_single, space.pcid, 0);
+        } else {
+            space.stale = true;
+        }
+    }
+}
+
+/// Check if the address space has a PCID of the current generation,
+/// which means that the TLB can have entries of the address space.
+fn hasPcid(space: *const AddressSpace) bool {
+    if (!enabled) return false;
+    return space == &kernel_space or space.generation == pcids.generation;
+}
+
+/// Flush TLB entries and paging-structure caches of all PCIDs including global ones.
+/// This works even if PCID is not enabled.
+pub fn flushAll() void {
+    if (has_invpcid) {
+        am.invpcid(invpcid_all, 0, 0);
+    } else {
+        // Toggling CR4.PGE invalidates all TLB entries of all PCIDs.
+        const cr4 = am.readCr4();
+        am.loadCr4(cr4 ^ cr4_pge);
+        am.loadCr4(cr4);
+    }
+}
+
+/// CR4.PGE: Page Global Enable.
+const cr4_pge: u64 = 1 << 7;
+/// CR4.PCIDE: PCID Enable.
+const cr4_pcide: u64 = 1 << 17;
+/// CPUID.01H:ECX.PCID.
+const cpuid_pcid: u32 = 1 << 17;
+/// CPUID.(EAX=07H,ECX=0):EBX.INVPCID.
+const cpuid_invpcid: u32 = 1 << 10;
+
+test "PCIDs are recycled by generation" {
+    var allocator = PcidAllocator{};
+    var first = AddressSpace{ .root = 0x1000 };
+    var second = AddressSpace{ .root = 0x2000 };
+
+    try std.testing.expectEqual(false, allocator.assign(&first));
+    try std.testing.expectEqual(1, first.pcid);
+    // Already assigned in this generation.
+    try std.testing.expectEqual(false, allocator.assign(&first));
+    try std.testing.expectEqual(1, first.pcid);
+
+    // Use up all PCIDs.
+    allocator.next = num_pcids;
+    try std.testing.expectEqual(true, allocator.assign(&second));
+    try std.testing.expectEqual(1, second.pcid);
+    try std.testing.expectEqual(2, second.generation);
+
+    // The first address space belongs to the old generation and gets a new PCID.
+    try std.testing.expectEqual(false, allocator.assign(&first));
+    try std.testing.expectEqual(2, first.pcid);
+}
@@ -0,0 +1,163 @@
+//! Per-CPU data areas.
+//!
+//! Each CPU has its own area, whose address is held in IA32_GS_BASE.
+//! The area starts with `Header`, followed by a copy of the `zakuro_percpu` section:
+//!
+//!   GS base -> +------------------------+
+//!              | Header                 |
+//!              +------------------------+ <- data_offset
+//!              | copy of zakuro_percpu  |
+//!              +------------------------+
+//!
+//! Per-CPU variables are declared in the section with `PerCpu(T)`, like the current task in `task.zig`:
+//!
+//!   var current: PerCpu(?*Task) linksection(percpu.section) = PerCpu(?*Task).init(null);
+//!
+//! and `counter.ptr()` returns the pointer to the copy of the current CPU.
+//! The variable in the section itself is only a template of the initial value.
+//! The ID of the current CPU is read by a single GS-relative load without accessing the local APIC.
+//!
+//! GS base is reset when GS is loaded with a selector, so areas MUST be installed after the GDT is initialized.
+//! IA32_KERNEL_GS_BASE is cleared and reserved for SWAPGS on user-mode entries.
+
+const std = @import("std");
+const log = std.log.scoped(.percpu);
+const Allocator = std.mem.Allocator;
+const is_test = @import("builtin").is_test;
+
+const am = @import("asm.zig");
+
+/// Name of the section that per-CPU variables MUST be placed in.
+pub const section = "zakuro_percpu";
+
+/// IA32_GS_BASE MSR.
+const ia32_gs_base: u32 = 0xC000_0101;
+/// IA32_KERNEL_GS_BASE MSR.
+const ia32_kernel_gs_base: u32 = 0xC000_0102;
+
+/// Start of the template section.
+const percpu_start = @extern(?[*]align(8) const u8, .{
+    .name = "__start_zakuro_percpu",
+    .linkage = .weak,
+});
+/// End of the template section.
+const percpu_stop = @extern(?[*]const u8, .{
+    .name = "__stop_zakuro_percpu",
+    .linkage = .weak,
+});
+
+/// Fixed part at the start of each per-CPU area.
+pub const Header = extern struct {
+    /// Pointer to this header.
+    /// Reading GS:0 yields the address of the area.
+    self: *Header,
+    /// Sequential ID of the CPU.
+    cpu_id: u32,
+    /// Local APIC ID of the CPU.
+    lapic_id: u32,
+};
+
+/// Offset of the copy of the template section from the start of the area.
+const data_offset = std.mem.alignForward(usize, @sizeOf(Header), 64);
+
+/// Per-CPU variable of type `T`.
+/// Variables of this type MUST be placed in `section`.
+pub fn PerCpu(comptime T: type) type {
+    return struct {
+        const Self = @This();
+
+        /// Initial value of the variable copied to each CPU.
+        template: T,
+
+        /// Create a template with the initial value.
+        pub fn init(value: T) Self {
+            return .{ .template = value };
+        }
+
+        /// Get the pointer to the variable of the current CPU.
+        /// In tests, the template itself is returned.
+        pub fn ptr(self: *Self) *T {
+            if (is_test) return &self.template;
+            const start = percpu_start orelse unreachable;
+            return @ptrFromInt(areaBase() + data_offset + (@intFromPtr(&self.template) - @intFromPtr(start)));
+        }
+
+        /// Get the value of the current CPU.
+        pub fn get(self: *Self) T {
+            return self.ptr().*;
+        }
+
+        /// Set the value of the current CPU.
+        pub fn set(self: *Self, value: T) void {
+            self.ptr().* = value;
+        }
+    };
+}
+
+/// Allocate and install the per-CPU area of the current CPU.
+/// The area is initialized with the template section.
+pub fn init(cpu_id: u32, lapic_id: u32, allocator: Allocator) Allocator.Error!void {
+    const size = templateSize();
+    const area = try allocator.alignedAlloc(u8, 64, data_offset + size);
+    if (size != 0) {
+        @memcpy(area[data_offset..], percpu_start.?[0..size]);
+    }
+
+    const header: *Header = @ptrCast(area.ptr);
+    header.* = .{
+        .self = header,
+        .cpu_id = cpu_id,
+        .lapic_id = lapic_id,
+    };
+    am.writeMsr(ia32_gs_base, @intFromPtr(header));
+    am.writeMsr(ia32_kernel_gs_base, 0);
+
+    log.info("Per-CPU area of CPU#{d}: 0x{X:0>16} ({d} bytes)", .{ cpu_id, @intFromPtr(header), area.len });
+}
+
+/// Sequential ID of the current CPU.
+pub inline fn cpuId() u32 {
+    return asm volatile (
+        \\movl %%gs:%c[offset], %[ret]
+        : [ret] "=r" (-> u32),
+        : [offset] "i" (@offsetOf(Header, "cpu_id")),
+    );
+}
+
+/// Local APIC ID of the current CPU.
+pub inline fn lapicId() u32 {
+    return asm volatile (
+        \\movl %%gs:%c[offset], %[ret]
+        : [ret] "=r" (-> u32),
+        : [offset] "i" (@offsetOf(Header, "lapic_id")),
+    );
+}
+
+/// Address of the per-CPU area of the current CPU.
+inline fn areaBase() u64 {
+    return asm volatile (
+        \\movq %%gs:%c[offset], %[ret]
+        : [ret] "=r" (-> u64),
+        : [offset] "i" (@offsetOf(Header, "self")),
+    );
+}
+
+/// Size in bytes of the template section.
+fn templateSize() usize {
+    const start = percpu_start orelse return 0;
+    const stop = percpu_stop orelse return 0;
+    return @intFromPtr(stop) - @intFromPtr(start);
+}
+
+test "Header layout" {
+    try std.testing.expectEqual(0, @offsetOf(Header, "self"));
+    try std.testing.expectEqual(8, @offsetOf(Header, "cpu_id"));
+    try std.testing.expectEqual(12, @offsetOf(Header, "lapic_id"));
+    try std.testing.expect(data_offset >= @sizeOf(Header));
+}
+
+test "Per-CPU variable in tests" {
+    var counter = PerCpu(u64).init(3);
+    counter.set(counter.get() + 1);
+    try std.testing.expectEqual(4, counter.template);
+}
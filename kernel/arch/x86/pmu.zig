@@ -0,0 +1,239 @@
+//! Intel architectural performance monitoring unit (PMU).
+//!
+//! The PMU version, the number of general-purpose counters and their width are detected by CPUID leaf 0xA.
+//! One general-purpose counter is programmed for each `Event` that the CPU supports.
+//! Counters count in both user and kernel mode and are read by RDPMC.
+//!
+//! `measure()` takes a snapshot of all counters, and `Scope.end()` accumulates the deltas
+//! into the statistics of the region, which can be printed by `printStats()`.
+//!
+//!   const scope = pmu.measure("flush_layer");
+//!   defer scope.end();
+
+const std = @import("std");
+const log = std.log.scoped(.pmu);
+
+const am = @import("asm.zig");
+
+/// IA32_PERFEVTSEL0. IA32_PERFEVTSELx is at `ia32_perfevtsel0 + x`.
+const ia32_perfevtsel0 = 0x186;
+/// IA32_PMC0. IA32_PMCx is at `ia32_pmc0 + x`.
+const ia32_pmc0 = 0xC1;
+/// IA32_PERF_GLOBAL_CTRL. Available since version 2.
+const ia32_perf_global_ctrl = 0x38F;
+
+/// Maximum number of regions whose statistics are kept.
+const max_regions = 32;
+
+/// Events that can be measured.
+pub const Event = enum(u8) {
+    /// UnHalted Core Cycles.
+    Cycles,
+    /// Instructions Retired.
+    Instructions,
+    /// LLC Misses.
+    LlcMisses,
+    /// Branch Misses Retired.
+    BranchMisses,
+};
+const num_events = @typeInfo(Event).Enum.fields.len;
+
+/// Architectural event encodings.
+const EventEncoding = struct {
+    /// Event select.
+    event: u8,
+    /// Unit mask.
+    umask: u8,
+    /// Bit in CPUID.0AH:EBX that indicates the event is NOT available.
+    unavailable_bit: u5,
+};
+const encodings = [num_events]EventEncoding{
+    .{ .event = 0x3C, .umask = 0x00, .unavailable_bit = 0 },
+    .{ .event = 0xC0, .umask = 0x00, .unavailable_bit = 1 },
+    .{ .event = 0x2E, .umask = 0x41, .unavailable_bit = 4 },
+    .{ .event = 0xC5, .umask = 0x00, .unavailable_bit = 6 },
+};
+
+/// Architectural PMU version. 0 if not supported.
+var version: u8 = 0;
+/// Mask of valid bits of general-purpose counters.
+var counter_mask: u64 = 0;
+/// Index of the general-purpose counter programmed for each event.
+var counters: [num_events]?u8 = [_]?u8{null} ** num_events;
+
+/// Statistics of regions registered by `measure()`.
+var regions: [max_regions]*Stats = undefined;
+/// Number of registered regions.
+var num_regions: usize = 0;
+
+/// Detect the PMU and start counting the events.
+/// Returns false if the architectural PMU is not available.
+pub fn init() bool {
+    if (am.cpuid(0, 0).eax < 0xA) {
+        log.info("CPUID leaf 0xA is not supported.", .{});
+        return false;
+    }
+
+    const leaf = am.cpuid(0xA, 0);
+    const eax: CpuidEax = @bitCast(leaf.eax);
+    if (eax.version == 0 or eax.num_counters == 0) {
+        log.info("Architectural PMU is not available.", .{});
+        return false;
+    }
+    version = eax.version;
+    counter_mask = if (eax.counter_width >= 64) 0xFFFF_FFFF_FFFF_FFFF else (@as(u64, 1) << @intCast(eax.counter_width)) - 1;
+
+    // Assign a counter to each available event.
+    var next: u8 = 0;
+    var enabled: u64 = 0;
+    for (encodings, 0..) |enc, i| {
+        counters[i] = null;
+        const unavailable = enc.unavailable_bit < eax.ebx_length and (leaf.ebx >> enc.unavailable_bit) & 1 != 0;
+        if (unavailable or next >= eax.num_counters) continue;
+
+        const sel = EventSelect{ .event = enc.event, .umask = enc.umask };
+        am.writeMsr(ia32_perfevtsel0 + @as(u32, next), 0);
+        am.writeMsr(ia32_pmc0 + @as(u32, next), 0);
+        am.writeMsr(ia32_perfevtsel0 + @as(u32, next), @as(u32, @bitCast(sel)));
+        counters[i] = next;
+        enabled |= @as(u64, 1) << @intCast(next);
+        next += 1;
+    }
+    if (version >= 2) {
+        // Fixed counters are not used.
+        am.writeMsr(ia32_perf_global_ctrl, enabled);
+    }
+
+    log.info("PMU v{d}: {d} counters, {d}-bit", .{ version, eax.num_counters, eax.counter_width });
+    return true;
+}
+
+/// Check if the PMU is initialized.
+pub fn available() bool {
+    return version != 0;
+}
+
+/// Read the counter of the event.
+/// Returns 0 if the event is not counted.
+pub fn read(event: Event) u64 {
+    const counter = counters[@intFromEnum(event)] orelse return 0;
+    return am.rdpmc(counter);
+}
+
+/// Values of all counters.
+pub const Snapshot = struct {
+    values: [num_events]u64,
+
+    /// Read all counters.
+    pub fn take() Snapshot {
+        var s: Snapshot = undefined;
+        for (0..num_events) |i| {
+            s.values[i] = read(@enumFromInt(i));
+        }
+        return s;
+    }
+};
+
+/// Accumulated statistics of a region.
+pub const Stats = struct {
+    /// Name of the region.
+    name: []const u8,
+    /// Number of measurements.
+    calls: u64 = 0,
+    /// Sum of deltas of each event.
+    totals: [num_events]u64 = [_]u64{0} ** num_events,
+    /// Registered in the region table.
+    registered: bool = false,
+};
+
+/// Measurement of a region in progress.
+pub const Scope = struct {
+    stats: *Stats,
+    start: Snapshot,
+
+    /// End the measurement and accumulate the deltas into the statistics.
+    pub fn end(self: Scope) void {
+        const now = Snapshot.take();
+        for (0..num_events) |i| {
+            self.stats.totals[i] +%= (now.values[i] -% self.start.values[i]) & counter_mask;
+        }
+        self.stats.calls += 1;
+
+        if (!self.stats.registered and num_regions < max_regions) {
+            regions[num_regions] = self.stats;
+            num_regions += 1;
+            self.stats.registered = true;
+        }
+    }
+};
+
+/// Start measuring the region.
+/// Each distinct `name` has its own statistics.
+pub fn measure(comptime name: []const u8) Scope {
+    const Region = struct {
+        var stats = Stats{ .name = name };
+    };
+    return .{ .stats = &Region.stats, .start = Snapshot.take() };
+}
+
+/// Print the statistics of all measured regions.
+pub fn printStats() void {
+    for (regions[0..num_regions]) |stats| {
+        const calls = @max(stats.calls, 1);
+        const cycles = stats.totals[@intFromEnum(Event.Cycles)];
+        const insts = stats.totals[@intFromEnum(Event.Instructions)];
+        log.info("{s}: calls={d} cycles/call={d} insts/call={d} IPC={d}.{d:0>2} LLC-miss/call={d} br-miss/call={d}", .{
+            stats.name,
+            stats.calls,
+            cycles / calls,
+            insts / calls,
+            if (cycles == 0) 0 else insts / cycles,
+            if (cycles == 0) 0 else insts * 100 / cycles % 100,
+            stats.totals[@intFromEnum(Event.LlcMisses)] / calls,
+            stats.totals[@intFromEnum(Event.BranchMisses)] / calls,
+        });
+    }
+}
+
+/// EAX of CPUID leaf 0xA.
+const CpuidEax = packed struct(u32) {
+    /// Version ID of architectural performance monitoring.
+    version: u8,
+    /// Number of general-purpose performance counters per logical processor.
+    num_counters: u8,
+    /// Bit width of general-purpose performance counters.
+    counter_width: u8,
+    /// Length of EBX bit vector to enumerate architectural events.
+    ebx_length: u8,
+};
+
+/// IA32_PERFEVTSELx.
+const EventSelect = packed struct(u32) {
+    /// Event select.
+    event: u8,
+    /// Unit mask.
+    umask: u8,
+    /// Count in user mode.
+    usr: bool = true,
+    /// Count in kernel mode.
+    os: bool = true,
+    /// Edge detect.
+    edge: bool = false,
+    /// Pin control.
+    pc: bool = false,
+    /// Interrupt on overflow.
+    int: bool = false,
+    /// Count on any thread.
+    any: bool = false,
+    /// Enable the counter.
+    enable: bool = true,
+    /// Invert counter mask.
+    inv: bool = false,
+    /// Counter mask.
+    cmask: u8 = 0,
+};
+
+test "Event select encoding" {
+    const sel = EventSelect{ .event = 0x2E, .umask = 0x41 };
+    try std.testing.expectEqual(0x0043_412E, @as(u32, @bitCast(sel)));
+}
@@ -6,11 +6,15 @@ const log = std.log.scoped(.x64timer);
 const apic = @import("apic.zig");
 const acpi = @import("acpi.zig");
 const arch = @import("arch.zig");
+const hpet = @import("hpet.zig");
+const am = @import("asm.zig");
 
 /// Initial value of the APIC timer counter.
 var initial_value: u32 = undefined;
 /// Frequency of the Local APIC timer.
 var lapic_timer_freq: u32 = undefined;
+/// Frequency of the TSC. 0 if not calibrated yet.
+var tsc_freq: u64 = 0;
 
 /// Timer tick frequency.
 const timer_tick_freq: u32 = 100; // 100 Hz
@@ -21,48 +25,69 @@ const timer_tick_freq: u32 = 100; // 100 Hz
 pub fn init(vector: u8, rsdp: *acpi.Rsdp) void {
     // Init ACPI PM timer.
     acpi.init(rsdp);
+    // Init HPET, which is preferred over ACPI PM timer if available.
+    _ = hpet.init();
 
-    // Measure the frequency of the APIC timer using ACPI PM timer.
-    @as(*volatile u32, @ptrFromInt(apic.divide_config_register)).* = @intFromEnum(DivideValue.By1);
+    // Measure the frequency of the APIC timer using HPET or ACPI PM timer.
+    apic.register(apic.divide_config_register).* = @intFromEnum(DivideValue.By1);
     const lvt = Lvt{
         .vector = vector,
         .mode = .OneShot,
     };
-    @as(*volatile u32, @ptrFromInt(apic.lvt_timer_register)).* = @bitCast(lvt);
+    apic.register(apic.lvt_timer_register).* = @bitCast(lvt);
     initial_value = 0xFFFF_FFFF;
 
     arch.disableIntr();
     {
+        const tsc_start = am.rdtsc();
         start();
-        acpi.waitMilliSeconds(100);
+        waitMilliSeconds(100);
         const elapsed_time = elapsed();
         stop();
+        tsc_freq = (am.rdtsc() - tsc_start) * 10;
         lapic_timer_freq = elapsed_time * 10;
         log.info("Local APIC timer initialized with frequency: {} Hz", .{lapic_timer_freq});
+        log.info("TSC frequency: {} Hz", .{tsc_freq});
     }
     arch.enableIntr();
 
     // Configure the timer.
-    @as(*volatile u32, @ptrFromInt(apic.divide_config_register)).* = @intFromEnum(DivideValue.By1);
+    apic.register(apic.divide_config_register).* = @intFromEnum(DivideValue.By1);
     const lvt_periodic = Lvt{
         .vector = vector,
         .mode = .Periodic,
     };
-    @as(*volatile u32, @ptrFromInt(apic.lvt_timer_register)).* = @bitCast(lvt_periodic);
+    apic.register(apic.lvt_timer_register).* = @bitCast(lvt_periodic);
     initial_value = lapic_timer_freq / timer_tick_freq;
-    @as(*volatile u32, @ptrFromInt(apic.initial_count_register)).* = initial_value;
+    apic.register(apic.initial_count_register).* = initial_value;
+}
+
+/// Wait for the specified milliseconds using the most precise reference timer.
+/// This function is busy-waiting.
+pub fn waitMilliSeconds(msec: u64) void {
+    if (hpet.available()) {
+        hpet.waitMilliSeconds(msec);
+    } else {
+        acpi.waitMilliSeconds(msec);
+    }
+}
+
+/// Get the frequency of the TSC measured in `init()`.
+/// Returns 0 if the timer is not initialized yet.
+pub fn tscFrequency() u64 {
+    return tsc_freq;
 }
 
 inline fn start() void {
-    @as(*volatile u32, @ptrFromInt(apic.initial_count_register)).* = initial_value;
+    apic.register(apic.initial_count_register).* = initial_value;
 }
 
 inline fn stop() void {
-    @as(*volatile u32, @ptrFromInt(apic.initial_count_register)).* = 0;
+    apic.register(apic.initial_count_register).* = 0;
 }
 
 inline fn elapsed() u32 {
-    return initial_value - @as(*volatile u32, @ptrFromInt(apic.current_count_register)).*;
+    return initial_value - apic.register(apic.current_count_register).*;
 }
 
 /// The APIC timer frequency is the processor's bus clock or crystal clock freq
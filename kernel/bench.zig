@@ -0,0 +1,296 @@
+//! This module provides an in-kernel microbenchmark harness.
+//!
+//! When the kernel is built with `-Dbench`, it runs `runAll()` after initialization
+//! instead of entering the main loop. Each benchmark is run `warmup` times without measurement
+//! and then `iterations` times, each of which is timed by the TSC.
+//! Interrupts are disabled while benchmarks run so that handlers do not disturb the timing.
+//!
+//! Results are emitted to the serial console as one JSON object per line:
+//!
+//!   @bench {"name":"slub_alloc_free_64","warmup":16,"iterations":1024,...}
+//!   @bench-done
+//!
+//! and QEMU exits via isa-debug-exit when all benchmarks finish.
+//! `zig build bench` runs the benchmark kernel under headless QEMU and collects the results.
+
+const std = @import("std");
+const log = std.log.scoped(.bench);
+const option = @import("option");
+const Allocator = std.mem.Allocator;
+
+const zakuro = @import("zakuro");
+const arch = zakuro.arch;
+const ser = zakuro.serial;
+const gfx = zakuro.gfx;
+const color = zakuro.color;
+const event = zakuro.event;
+const BitmapPageAllocator = zakuro.mm.BitmapPageAllocator;
+const Window = gfx.window.Window;
+const Controller = zakuro.drivers.usb.xhc.Controller;
+
+/// Whether the kernel runs benchmarks instead of the desktop.
+pub const enabled = option.bench;
+
+/// Iteration control of a benchmark.
+pub const Options = struct {
+    /// Number of unmeasured iterations run before measurement.
+    warmup: usize = 16,
+    /// Number of measured iterations.
+    iterations: usize = 1024,
+};
+
+/// Result of a benchmark.
+pub const Result = struct {
+    /// Name of the benchmark.
+    name: []const u8,
+    /// Options the benchmark ran with.
+    options: Options,
+    /// Number of iterations measured.
+    /// Less than `options.iterations` if the benchmark failed.
+    measured: usize = 0,
+    /// Minimum TSC cycles of an iteration.
+    min: u64 = std.math.maxInt(u64),
+    /// Maximum TSC cycles of an iteration.
+    max: u64 = 0,
+    /// Sum of TSC cycles of all measured iterations.
+    total: u64 = 0,
+    /// Error returned by the benchmark if any.
+    err: ?anyerror = null,
+
+    /// Mean TSC cycles of an iteration.
+    pub fn mean(self: Result) u64 {
+        return self.total / @max(self.measured, 1);
+    }
+
+    /// Write the result as a JSON object.
+    pub fn writeJson(self: Result, tsc_hz: u64, writer: anytype) !void {
+        try writer.writeAll("{\"name\":");
+        try std.json.encodeJsonString(self.name, .{}, writer);
+        try writer.print(",\"warmup\":{d},\"iterations\":{d},\"tsc_hz\":{d}", .{
+            self.options.warmup,
+            self.measured,
+            tsc_hz,
+        });
+        if (self.measured != 0) {
+            try writer.print(",\"min_cycles\":{d},\"mean_cycles\":{d},\"max_cycles\":{d}", .{
+                self.min,
+                self.mean(),
+                self.max,
+            });
+            try writer.print(",\"min_ns\":{d},\"mean_ns\":{d},\"max_ns\":{d}", .{
+                toNanoseconds(self.min, tsc_hz),
+                toNanoseconds(self.mean(), tsc_hz),
+                toNanoseconds(self.max, tsc_hz),
+            });
+        }
+        if (self.err) |err| {
+            try writer.writeAll(",\"error\":");
+            try std.json.encodeJsonString(@errorName(err), .{}, writer);
+        }
+        try writer.writeAll("}");
+    }
+};
+
+/// Convert TSC cycles to nanoseconds.
+/// Returns 0 if the TSC frequency is unknown.
+fn toNanoseconds(cycles: u64, tsc_hz: u64) u64 {
+    if (tsc_hz == 0) return 0;
+    return @intCast(@as(u128, cycles) * std.time.ns_per_s / tsc_hz);
+}
+
+/// Run `func` with `context` and measure each iteration.
+/// The benchmark stops at the first error, which is recorded in the result.
+pub fn run(
+    name: []const u8,
+    options: Options,
+    context: anytype,
+    comptime func: fn (@TypeOf(context)) anyerror!void,
+) Result {
+    var result = Result{ .name = name, .options = options };
+
+    for (0..options.warmup) |_| {
+        func(context) catch |err| {
+            result.err = err;
+            return result;
+        };
+    }
+
+    for (0..options.iterations) |_| {
+        const start = arch.readTsc();
+        func(context) catch |err| {
+            result.err = err;
+            return result;
+        };
+        const cycles = arch.readTsc() -% start;
+
+        result.min = @min(result.min, cycles);
+        result.max = @max(result.max, cycles);
+        result.total +%= cycles;
+        result.measured += 1;
+    }
+
+    return result;
+}
+
+/// Kernel objects that benchmarks operate on.
+pub const Environment = struct {
+    /// General purpose allocator.
+    gpa: Allocator,
+    /// Page allocator.
+    bpa: *BitmapPageAllocator,
+    /// Window to draw on.
+    window: *Window,
+    /// Running xHC controller.
+    xhc: *Controller,
+};
+
+/// Run all benchmarks, emit the results, and exit QEMU.
+/// QEMU exits with status 1 if all benchmarks succeed, or 3 otherwise.
+pub fn runAll(env: Environment) noreturn {
+    const writer = ser.get().writer();
+    const tsc_hz = arch.timer.tscFrequency();
+    log.info("Running benchmarks: TSC={d} Hz", .{tsc_hz});
+
+    // Allocate buffers for memory benchmarks.
+    const mem_pages = mem_buffer_size / arch.page_size;
+    const src_pfn = env.bpa.getAdjacentPages(mem_pages) orelse @panic("Failed to allocate a benchmark buffer.");
+    const dest_pfn = env.bpa.getAdjacentPages(mem_pages) orelse @panic("Failed to allocate a benchmark buffer.");
+    mem_src = @ptrFromInt(zakuro.mm.page.pfn2virt(src_pfn));
+    mem_dest = @ptrFromInt(zakuro.mm.page.pfn2virt(dest_pfn));
+
+    // Discard events queued during initialization so that the queue has room.
+    arch.disableIntr();
+    while (event.pop()) |_| {}
+
+    var failed: usize = 0;
+    inline for (benchmarks) |bench| {
+        const result = run(bench.name, bench.options, &env, bench.func);
+        if (result.err != null) failed += 1;
+
+        writer.writeAll("@bench ") catch {};
+        result.writeJson(tsc_hz, writer) catch {};
+        writer.writeAll("\n") catch {};
+    }
+    arch.enableIntr();
+
+    // Report the regions measured by the PMU while the benchmarks ran.
+    arch.pmu.printStats();
+    // Report the lock statistics if the kernel is built with `-Dlock_stats`.
+    zakuro.timer.dumpLockStats();
+    zakuro.task.dumpLockStats();
+
+    writer.writeAll("@bench-done\n") catch {};
+    log.info("Finished {d} benchmarks: {d} failed", .{ benchmarks.len, failed });
+    arch.exitQemu(if (failed == 0) 0 else 1);
+}
+
+/// Registered benchmark.
+const Benchmark = struct {
+    name: []const u8,
+    options: Options = .{},
+    func: fn (*const Environment) anyerror!void,
+};
+
+/// Benchmarks run by `runAll()` in order.
+const benchmarks = [_]Benchmark{
+    .{ .name = "slub_alloc_free_64", .func = slubAllocFree64 },
+    .{ .name = "slub_alloc_free_1024", .func = slubAllocFree1024 },
+    .{ .name = "bitmap_alloc_free_1", .func = bitmapAllocFree1 },
+    .{ .name = "bitmap_alloc_free_16", .func = bitmapAllocFree16 },
+    .{ .name = "glyph_render", .func = glyphRender },
+    .{ .name = "screen_flush", .options = .{ .warmup = 2, .iterations = 32 }, .func = screenFlush },
+    .{ .name = "event_push_pop", .func = eventPushPop },
+    .{ .name = "xhc_event_drain", .func = xhcEventDrain },
+} ++ memBenchmarks();
+
+/// Sizes of memory benchmarks.
+const mem_sizes = [_]usize{ 16, 256, 4096, 64 * 1024, 1024 * 1024, 8 * 1024 * 1024 };
+/// Size of each buffer for memory benchmarks.
+const mem_buffer_size = mem_sizes[mem_sizes.len - 1];
+/// Source buffer for memory benchmarks.
+var mem_src: [*]u8 = undefined;
+/// Destination buffer for memory benchmarks.
+var mem_dest: [*]u8 = undefined;
+
+/// Generate `memcpy_<size>` and `memset_<size>` benchmarks for each size.
+fn memBenchmarks() [2 * mem_sizes.len]Benchmark {
+    var ret: [2 * mem_sizes.len]Benchmark = undefined;
+    inline for (mem_sizes, 0..) |size, i| {
+        const options: Options = if (size >= arch.mem.nt_threshold)
+            .{ .warmup = 2, .iterations = 16 }
+        else
+            .{};
+        const Funcs = struct {
+            fn copy(_: *const Environment) anyerror!void {
+                arch.mem.copy(mem_dest, mem_src, size);
+            }
+            fn set(_: *const Environment) anyerror!void {
+                arch.mem.set(mem_dest, 0xA5, size);
+            }
+        };
+        ret[2 * i] = .{ .name = std.fmt.comptimePrint("memcpy_{d}", .{size}), .options = options, .func = Funcs.copy };
+        ret[2 * i + 1] = .{ .name = std.fmt.comptimePrint("memset_{d}", .{size}), .options = options, .func = Funcs.set };
+    }
+    return ret;
+}
+
+fn slubAllocFree64(env: *const Environment) anyerror!void {
+    const p = try env.gpa.alloc(u8, 64);
+    env.gpa.free(p);
+}
+
+fn slubAllocFree1024(env: *const Environment) anyerror!void {
+    const p = try env.gpa.alloc(u8, 1024);
+    env.gpa.free(p);
+}
+
+fn bitmapAllocFree1(env: *const Environment) anyerror!void {
+    const pfn = env.bpa.getAdjacentPages(1) orelse return error.OutOfMemory;
+    env.bpa.returnAdjacentPages(pfn, 1);
+}
+
+fn bitmapAllocFree16(env: *const Environment) anyerror!void {
+    const pfn = env.bpa.getAdjacentPages(16) orelse return error.OutOfMemory;
+    env.bpa.returnAdjacentPages(pfn, 16);
+}
+
+fn glyphRender(env: *const Environment) anyerror!void {
+    env.window.writeAscii(0, 0, 'Z', color.GBFg, color.GBBg);
+}
+
+fn screenFlush(_: *const Environment) anyerror!void {
+    gfx.layer.getLayers().flush();
+}
+
+fn eventPushPop(_: *const Environment) anyerror!void {
+    try event.push(.{ .timer = zakuro.timer.Timer.new(0, 0) });
+    _ = event.pop() orelse return error.EventLost;
+}
+
+fn xhcEventDrain(env: *const Environment) anyerror!void {
+    while (env.xhc.hasEvent()) {
+        try env.xhc.processEvent();
+    }
+}
+
+test "Measure iterations" {
+    const Counter = struct {
+        calls: usize = 0,
+
+        fn call(self: *@This()) anyerror!void {
+            self.calls += 1;
+            if (self.calls > 10) return error.Stop;
+        }
+    };
+
+    var counter = Counter{};
+    const ok = run("ok", .{ .warmup = 2, .iterations = 5 }, &counter, Counter.call);
+    try std.testing.expectEqual(7, counter.calls);
+    try std.testing.expectEqual(5, ok.measured);
+    try std.testing.expectEqual(null, ok.err);
+    try std.testing.expect(ok.min <= ok.mean() and ok.mean() <= ok.max);
+
+    const failed = run("failed", .{ .warmup = 0, .iterations = 8 }, &counter, Counter.call);
+    try std.testing.expectEqual(3, failed.measured);
+    try std.testing.expectEqual(error.Stop, failed.err.?);
+}
@@ -0,0 +1,127 @@
+//! This module records TSC timestamps at the end of each boot phase.
+//!
+//! The bootloader records its own phases and passes them to the kernel entry point.
+//! The kernel appends its phases by `mark()`, and `print()` shows how long each phase took:
+//!
+//!   phase                         cycles         ms
+//!   loader-read-kernel          12345678     10.123
+//!
+//! The duration of a phase is the difference from the previous timestamp.
+//! Cycles are converted to milliseconds after the TSC frequency is calibrated by the timer.
+
+const std = @import("std");
+const log = std.log.scoped(.boot);
+
+const zakuro = @import("zakuro");
+const arch = zakuro.arch;
+
+/// Maximum number of phases recorded by the bootloader.
+/// MUST be the same as `kBootTraceMaxEntries` of the bootloader.
+const max_loader_entries = 16;
+/// Maximum length of a phase name recorded by the bootloader including the null terminator.
+/// MUST be the same as `kBootTraceNameLength` of the bootloader.
+const loader_name_length = 24;
+/// Maximum number of phases recorded in total.
+const max_entries = 48;
+
+/// Phase recorded by the bootloader.
+pub const LoaderEntry = extern struct {
+    /// Null-terminated name of the phase.
+    name: [loader_name_length]u8,
+    /// TSC at the end of the phase.
+    tsc: u64,
+};
+
+/// Phases recorded by the bootloader.
+/// This struct corresponds to `struct BootTrace` of the bootloader.
+pub const LoaderTrace = extern struct {
+    /// Number of valid entries.
+    count: u32,
+    /// Reserved.
+    _reserved: u32,
+    /// Recorded phases.
+    entries: [max_loader_entries]LoaderEntry,
+};
+
+/// Recorded phase.
+const Entry = struct {
+    /// Name of the phase.
+    name: []const u8,
+    /// TSC at the end of the phase.
+    tsc: u64,
+};
+
+/// Recorded phases in order.
+var entries: [max_entries]Entry = undefined;
+/// Number of recorded phases.
+var num_entries: usize = 0;
+/// Names of the phases copied from the bootloader.
+var loader_names: [max_loader_entries][loader_name_length]u8 = undefined;
+
+/// Start the trace with the phases recorded by the bootloader.
+/// The trace is copied, so the bootloader's memory can be reused after this call.
+pub fn init(loader: *const LoaderTrace) void {
+    num_entries = 0;
+    for (loader.entries[0..@min(loader.count, max_loader_entries)], 0..) |ent, i| {
+        loader_names[i] = ent.name;
+        loader_names[i][loader_name_length - 1] = 0;
+        append(std.mem.sliceTo(&loader_names[i], 0), ent.tsc);
+    }
+}
+
+/// Record the end of the boot phase.
+/// Phases that exceed the capacity are ignored.
+pub fn mark(comptime name: []const u8) void {
+    append(name, arch.readTsc());
+}
+
+fn append(name: []const u8, tsc: u64) void {
+    if (num_entries >= max_entries) return;
+    entries[num_entries] = .{ .name = name, .tsc = tsc };
+    num_entries += 1;
+}
+
+/// Print the duration of each recorded phase.
+pub fn print() void {
+    if (num_entries == 0) return;
+    const tsc_hz = arch.timer.tscFrequency();
+
+    log.info("=== Boot Trace ===", .{});
+    log.info("{s: <24} {s: >14} {s: >10}", .{ "phase", "cycles", "ms" });
+    var prev = entries[0].tsc;
+    for (entries[0..num_entries]) |ent| {
+        const cycles = ent.tsc -% prev;
+        const us = toMicroseconds(cycles, tsc_hz);
+        log.info("{s: <24} {d: >14} {d: >6}.{d:0>3}", .{ ent.name, cycles, us / 1000, us % 1000 });
+        prev = ent.tsc;
+    }
+
+    const total_cycles = entries[num_entries - 1].tsc -% entries[0].tsc;
+    const total_us = toMicroseconds(total_cycles, tsc_hz);
+    log.info("{s: <24} {d: >14} {d: >6}.{d:0>3}", .{ "total", total_cycles, total_us / 1000, total_us % 1000 });
+}
+
+/// Convert TSC cycles to microseconds.
+/// Returns 0 if the TSC frequency is unknown.
+fn toMicroseconds(cycles: u64, tsc_hz: u64) u64 {
+    if (tsc_hz == 0) return 0;
+    return @intCast(@as(u128, cycles) * std.time.us_per_s / tsc_hz);
+}
+
+test "Copy loader phases" {
+    var loader = std.mem.zeroes(LoaderTrace);
+    loader.count = 2;
+    @memcpy(loader.entries[0].name[0..5], "start");
+    loader.entries[0].tsc = 100;
+    @memset(&loader.entries[1].name, 'a'); // not null-terminated
+    loader.entries[1].tsc = 200;
+
+    init(&loader);
+    // The bootloader's memory is no longer referred.
+    loader = std.mem.zeroes(LoaderTrace);
+
+    try std.testing.expectEqual(2, num_entries);
+    try std.testing.expectEqualStrings("start", entries[0].name);
+    try std.testing.expectEqual(loader_name_length - 1, entries[1].name.len);
+    try std.testing.expectEqual(200, entries[1].tsc);
+}
@@ -1,6 +1,6 @@
 //! This module defines a set of colors.
 
-const Color = @import("gfx.zig").PixelColor;
+const Color = @import("zakuro").gfx.PixelColor;
 
 fn c(red: u8, green: u8, blue: u8) Color {
     return .{ .r = red, .g = green, .b = blue };
@@ -1,4 +1,4 @@
-pub const usb = @import("drivers/usb/usb.zig");
+pub const usb = @import("usb");
 
 test {
     @import("std").testing.refAllDecls(@This());
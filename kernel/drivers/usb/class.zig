@@ -13,7 +13,6 @@ pub const keyboard = @import("class/keyboard.zig");
 pub const ClassError = error{
     UnsupportedClass,
     AllocationFailed,
-    InvalidPhase,
     Unknown,
 };
 
@@ -45,7 +44,6 @@ pub fn newClassDriver(
 fn parseError(err: anytype) ClassError {
     return switch (err) {
         DriverError.AllocationFailed => ClassError.AllocationFailed,
-        DriverError.InvalidPhase => ClassError.InvalidPhase,
         else => ClassError.Unknown,
     };
 }
@@ -13,8 +13,6 @@ const SetupData = zakuro.drivers.usb.setupdata.SetupData;
 pub const ClassDriverError = error{
     /// Failed to allocater memory.
     AllocationFailed,
-    /// Invalid phase
-    InvalidPhase,
     /// The feature is not supported.
     Unimplemented,
 };
@@ -36,8 +34,6 @@ ep_intr_out: EndpoinInfo = undefined,
 /// TODO: doc
 in_packed_size: u32,
 
-/// Initialization phase
-phase: Phase = .NotInitialized,
 /// General purpose buffer for this driver.
 /// Any alignment is allowed.
 buffer: [buffer_size]u8 = [_]u8{0} ** buffer_size,
@@ -57,8 +53,9 @@ pub fn setEndpoint(self: *Self, ep_config: EndpoinInfo) void {
     }
 }
 
-/// Enable boot protocol.
-pub fn onEndpointConfigured(self: *Self) !void {
+/// Enable boot protocol and start polling the interrupt IN endpoint.
+/// This function MUST be called in a task since it waits for the control transfer.
+pub fn start(self: *Self) !void {
     const sud = SetupData{
         .bm_request_type = .{
             .dtd = .Out,
@@ -71,17 +68,7 @@ pub fn onEndpointConfigured(self: *Self) !void {
         .w_length = 0,
     };
 
-    self.phase = .Phase1;
-    try self.device.controlOut(default_control_pipe_id, sud, null, self);
-}
-
-/// TODO: doc
-pub fn onControlComplete(self: *Self) !void {
-    if (self.phase != .Phase1) {
-        return ClassDriverError.InvalidPhase;
-    }
-
-    self.phase = .Phase2;
+    try self.device.controlOut(default_control_pipe_id, sud, null);
     try self.device.interruptIn(self.ep_intr_in.ep_id, self.buffer[0..self.in_packed_size]);
 }
 
@@ -94,10 +81,3 @@ pub fn onInterruptComplete(self: *Self, ep_id: EndpointId, buf: []u8) !void {
 
     try self.device.interruptIn(ep_id, buf[0..self.in_packed_size]);
 }
-
-const Phase = enum {
-    NotInitialized,
-    Phase1,
-    Phase2,
-    Phase3,
-};
@@ -8,6 +8,7 @@ const Ring = @import("xhci/ring.zig").Ring;
 const regs = @import("xhci/register.zig");
 const zakuro = @import("zakuro");
 const UsbDevice = zakuro.drivers.usb.device.UsbDevice;
+const Host = zakuro.drivers.usb.device.Host;
 const Register = zakuro.mmio.Register;
 
 pub const ControllerError = error{
@@ -26,7 +27,8 @@ pub const Controller = struct {
     /// Pointers to the registered devices.
     devices: []?*UsbDevice,
     /// DCBAA: Device Context Base Address Array.
-    dcbaa: []?*DeviceContext,
+    /// Each entry is the physical address of the device context, or 0 if the slot is not used.
+    dcbaa: []u64,
 
     /// Memory allocator used by this controller internally.
     allocator: Allocator,
@@ -37,9 +39,9 @@ pub const Controller = struct {
         max_slot: usize,
         allocator: Allocator,
     ) ControllerError!Self {
-        const dcbaa = allocator.alignedAlloc(?*DeviceContext, 64, max_slot + 1) catch return ControllerError.AllocationFailed;
+        const dcbaa = allocator.alignedAlloc(u64, 64, max_slot + 1) catch return ControllerError.AllocationFailed;
         const devices = allocator.alloc(?*UsbDevice, max_slot + 1) catch return ControllerError.AllocationFailed;
-        @memset(dcbaa[0..dcbaa.len], null);
+        @memset(dcbaa[0..dcbaa.len], 0);
         @memset(devices[0..devices.len], null);
 
         return Self{
@@ -55,6 +57,7 @@ pub const Controller = struct {
         self: *Self,
         slot_id: usize,
         db: *volatile Register(regs.DoorbellRegister, .DWORD),
+        host: Host,
         allocator: std.mem.Allocator,
     ) !void {
         if (self.max_slot < slot_id) {
@@ -66,7 +69,7 @@ pub const Controller = struct {
 
         const device = self.allocator.create(UsbDevice) catch return ControllerError.AllocationFailed;
         const tr = self.allocator.alloc(?*Ring, 31) catch return ControllerError.AllocationFailed;
-        device.initialize(tr, slot_id, db, allocator);
+        device.initialize(tr, slot_id, db, host, allocator);
         self.devices[slot_id] = device;
     }
 };
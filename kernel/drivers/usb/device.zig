@@ -1,5 +1,9 @@
 //! This file provides a USB specicifi device.
 //! Note that this device is more abstract than xHCI device.
+//!
+//! Each device is enumerated in its own task (see `zakuro.task`).
+//! Control transfers suspend the task until the xHC reports their completion by a Transfer Event,
+//! so enumeration is written as a sequence of requests, and devices are enumerated concurrently.
 
 const std = @import("std");
 const endpoint = @import("endpoint.zig");
@@ -14,6 +18,8 @@ const regs = @import("xhci/register.zig");
 const ring = @import("xhci/ring.zig");
 const zakuro = @import("zakuro");
 const Register = zakuro.mmio.Register;
+const page = zakuro.mm.page;
+const task = zakuro.task;
 const log = std.log.scoped(.usbdev);
 
 pub const UsbDeviceError = error{
@@ -23,14 +29,48 @@ pub const UsbDeviceError = error{
     TransferRingUnavailable,
     /// Memory allocation failed.
     AllocationFailed,
-    /// No corresponding SetupStageTrb in the record.
-    NoCorrespondingSetupTrb,
+    /// No pending transfer corresponds to the Transfer Event.
+    NoCorrespondingTransfer,
     /// Descriptor returned by the divice is invalid.
     InvalidDescriptor,
-    /// Invalid initialization phase.
-    InvalidPhase,
     /// No event waiter
     NoWaiter,
+    /// The device failed to complete the transfer.
+    TransferFailed,
+};
+
+/// Completion Code: Success.
+const completion_success = 1;
+/// Completion Code: Short Packet.
+const completion_short_packet = 13;
+
+/// Result of a control transfer.
+const TransferResult = struct {
+    /// Completion Code of the Transfer Event.
+    code: u8,
+    /// Length in bytes of the transferred data.
+    length: usize,
+};
+
+/// Control transfer waiting for its completion.
+const Transfer = task.Future(TransferResult);
+
+/// Host controller that the device is connected to.
+pub const Host = struct {
+    /// Instance of the host controller.
+    ptr: *anyopaque,
+    /// vtable for the host controller.
+    vtable: *const VTable,
+
+    pub const VTable = struct {
+        /// Configure the endpoints in `endpoint_configs` of the device.
+        /// This function is called in the enumeration task and can wait for the completion.
+        configureEndpoints: *const fn (ctx: *anyopaque, dev: *UsbDevice) anyerror!void,
+    };
+
+    pub fn configureEndpoints(self: Host, dev: *UsbDevice) !void {
+        try self.vtable.configureEndpoints(self.ptr, dev);
+    }
 };
 
 /// USB device.
@@ -38,33 +78,35 @@ pub const UsbDevice = struct {
     pub const max_num_eps = 16;
 
     /// General purpose buffer for this device.
-    /// Any alignment is allowed.
-    buffer: [256]u8 = [_]u8{0} ** 256,
+    /// Aligned so that descriptors can be read in place.
+    buffer: [256]u8 align(8) = [_]u8{0} ** 256,
     /// xHCI Device
     dev: XhciDevice,
     /// Doorbell Register.
     db: *volatile Register(regs.DoorbellRegister, .DWORD),
-    /// Phase of the initialization.
-    phase: InitializationPhase = .NotAddressed,
+    /// Host controller.
+    host: Host,
     /// Index of the configuration descriptor currently being processed.
     config_index: u8,
     /// Number of configuration descriptors this device has.
     num_config: u8,
+    /// Number of valid entries in `endpoint_configs`.
+    num_endpoints: u8 = 0,
     /// Class drivers for each endpoints.
     class_drivers: [max_num_eps]?ClassDriver = [_]?ClassDriver{null} ** max_num_eps,
     /// Information of each endpoints.
     endpoint_configs: [max_num_eps]?endpoint.EndpointInfo = [_]?endpoint.EndpointInfo{null} ** max_num_eps,
 
-    /// Map that associate SetupStageTrb with DataStageTrb.
-    setup_trb_map: SetupTrbMap,
-    /// TODO: doc
-    event_waiters: EventWaiterMap,
+    /// Map that associates the TRB raising the Transfer Event with the pending control transfer.
+    transfers: TransferMap,
+    /// Completion Code of the command issued for this device.
+    /// The host controller completes it on the Command Completion Event.
+    command: task.Future(u8) = .{},
     /// Allocator used by this device internally to manage TRBs.
     allocator: std.mem.Allocator,
 
     pub const Self = @This();
-    const SetupTrbMap = std.hash_map.AutoHashMap(*trbs.Trb, *trbs.Trb);
-    const EventWaiterMap = std.hash_map.AutoHashMap(setupdata.SetupData, *ClassDriver);
+    const TransferMap = std.hash_map.AutoHashMap(*trbs.Trb, *Transfer);
     const RegDoorbell = Register(regs.DoorbellRegister, .DWORD);
 
     /// Initialize the device structure.
@@ -73,6 +115,7 @@ pub const UsbDevice = struct {
         tr: []?*ring.Ring,
         slot_id: usize,
         db: *volatile RegDoorbell,
+        host: Host,
         allocator: std.mem.Allocator,
     ) void {
         self.* = .{
@@ -83,8 +126,8 @@ pub const UsbDevice = struct {
                 .device_context = undefined,
             },
             .db = db,
-            .setup_trb_map = SetupTrbMap.init(allocator),
-            .event_waiters = EventWaiterMap.init(allocator),
+            .host = host,
+            .transfers = TransferMap.init(allocator),
             .allocator = allocator,
             .config_index = 0,
             .num_config = 0,
@@ -92,13 +135,14 @@ pub const UsbDevice = struct {
     }
 
     /// Get the specified type of descriptor.
+    /// Returns the length of the descriptor read into `buf`.
     fn getDescriptor(
         self: *Self,
         ep_id: endpoint.EndpointId,
         desc_type: descs.DescriptorType,
         desc_index: u8,
         buf: []u8,
-    ) !void {
+    ) !usize {
         const sud = setupdata.SetupData{
             .bm_request_type = .{
                 .dtd = .In,
@@ -111,7 +155,7 @@ pub const UsbDevice = struct {
             .w_length = @intCast(buf.len),
         };
 
-        try self.controlIn(ep_id, sud, buf);
+        return try self.controlIn(ep_id, sud, buf);
     }
 
     /// Issue Configure Endpoint Command and enable the endpoint.
@@ -132,7 +176,7 @@ pub const UsbDevice = struct {
             .w_value = @intCast(config_value),
         };
 
-        try self.controlOut(ep_id, sud, null, null);
+        try self.controlOut(ep_id, sud, null);
     }
 
     /// TODO: doc
@@ -145,7 +189,7 @@ pub const UsbDevice = struct {
         const tr = self.dev.transfer_rings[ep_dci - 1] orelse return UsbDeviceError.TransferRingUnavailable;
 
         var normal_trb = trbs.NormalTrb{
-            .data_buf_ptr = @intFromPtr(buf.ptr),
+            .data_buf_ptr = page.virt2phys(@intFromPtr(buf.ptr)),
             .trb_transfer_length = @truncate(buf.len),
             .ioc = true,
             .isp = true,
@@ -159,54 +203,66 @@ pub const UsbDevice = struct {
         });
     }
 
-    /// Start the initialization of the USB device.
-    pub fn start_device_init(self: *Self) !void {
-        if (self.phase != .NotAddressed) {
-            return UsbDeviceError.InvalidPhase;
-        }
-        self.phase = .Phase1;
+    /// Start enumerating the device in a new task.
+    /// The task runs until the first control transfer is issued.
+    pub fn startEnumeration(self: *Self) !void {
+        try task.spawn(enumerateTask, self);
+    }
 
-        try self.getDescriptor(
-            endpoint.default_control_pipe_id,
-            .Device,
-            0,
-            &self.buffer,
-        );
+    fn enumerateTask(ctx: *anyopaque) void {
+        const self: *Self = @alignCast(@ptrCast(ctx));
+        self.enumerate() catch |err| {
+            log.err("Slot {d:0>2}: Failed to enumerate the device: {?}", .{ self.dev.slot_id, err });
+        };
     }
 
-    /// Get the configuration descriptor and associated interface descriptors.
-    fn init_one(self: *Self, device_desc: *align(8) descs.DeviceDescriptor) !void {
-        if (self.phase != .Phase1) {
-            return UsbDeviceError.InvalidPhase;
-        }
+    /// Read the descriptors, select the configuration, and start class drivers.
+    /// This function MUST be called in a task.
+    fn enumerate(self: *Self) !void {
+        const dcp = endpoint.default_control_pipe_id;
 
-        self.phase = .Phase2;
+        const dev_len = try self.getDescriptor(dcp, .Device, 0, &self.buffer);
+        const device_desc: *align(8) descs.DeviceDescriptor = @ptrCast(&self.buffer);
+        if (dev_len < @divExact(@bitSizeOf(descs.DeviceDescriptor), 8) or device_desc.descriptor_type != .Device) {
+            return UsbDeviceError.InvalidDescriptor;
+        }
         self.num_config = device_desc.num_configurations;
         self.config_index = 0;
 
-        try self.getDescriptor(
-            endpoint.default_control_pipe_id,
-            .Configuration,
-            self.config_index,
-            &self.buffer,
-        );
+        const config_len = try self.getDescriptor(dcp, .Configuration, self.config_index, &self.buffer);
+        const config_value = try self.findClassDrivers(self.buffer[0..config_len]) orelse {
+            log.info("Slot {d:0>2}: No supported interface found.", .{self.dev.slot_id});
+            return;
+        };
+
+        log.debug("Requesting to set the configuration.", .{});
+        try self.setConfiguration(dcp, config_value);
+        for (self.endpoint_configs[0..self.num_endpoints]) |ep_info| {
+            const driver = &self.class_drivers[ep_info.?.ep_id.addr()].?;
+            driver.setEndpoint(ep_info.?);
+        }
+        log.info("Slot {d:0>2}: Device initialization completed.", .{self.dev.slot_id});
+
+        try self.host.configureEndpoints(self);
+
+        for (&self.class_drivers) |*d| {
+            if (d.*) |*driver| try driver.start();
+        }
     }
 
-    /// TODO: doc
-    fn init_second(self: *Self, buf: []u8) !void {
+    /// Instantiate class drivers for the interface found in the configuration descriptor,
+    /// and record the endpoints associated with it.
+    /// Returns the configuration value to select, or null if no supported interface is found.
+    fn findClassDrivers(self: *Self, buf: []u8) !?u8 {
         const config_desc: *align(8) descs.ConfigurationDescriptor = @alignCast(@ptrCast(buf.ptr));
-        if (config_desc.descriptor_type != .Configuration) {
+        if (buf.len < @divExact(@bitSizeOf(descs.ConfigurationDescriptor), 8) or config_desc.descriptor_type != .Configuration) {
             return UsbDeviceError.InvalidDescriptor;
         }
-        if (self.phase != .Phase2) {
-            return UsbDeviceError.InvalidPhase;
-        }
 
         // Read the interface descriptors and endpoint descriptors
         // to find devices of supported classes.
         var reader = DescReader.new(buf);
         var p: ?[*]u8 = buf.ptr;
-        var if_found = false;
 
         while (p != null) : (p = reader.next()) {
             const if_desc: *align(1) descs.InterfaceDescriptor = @alignCast(@ptrCast(p));
@@ -221,12 +277,10 @@ pub const UsbDevice = struct {
                 self.allocator,
             ) catch |err| switch (err) {
                 error.AllocationFailed => @panic("Memory allocation for class driver failed."),
-                error.InvalidPhase => @panic("Invalid phase for class driver instantiation."),
                 else => return err,
             };
 
-            var num_found_eps: usize = 0;
-            if_found = true;
+            var num_found_eps: u8 = 0;
             log.debug("Slot {d:0>2}: Class driver instantiated.", .{self.dev.slot_id});
 
             // Find all endpoints associated with the interface.
@@ -238,48 +292,13 @@ pub const UsbDevice = struct {
                 self.class_drivers[ep_info.ep_id.addr()] = class_driver;
                 num_found_eps += 1;
             }
+            self.num_endpoints = num_found_eps;
 
             // We suppose that there is only one interface for each device.
-            break;
+            return config_desc.configuration_value;
         }
 
-        if (!if_found) return;
-
-        self.phase = .Phase3;
-        log.debug("Requesting to set the configuration.", .{});
-
-        try self.setConfiguration(
-            endpoint.default_control_pipe_id,
-            config_desc.configuration_value,
-        );
-    }
-
-    /// Configure all endpoints included in the configuration.
-    fn init_third(self: *Self, sud: setupdata.SetupData) !void {
-        if (sud.b_request != .SetConfiguration) {
-            return UsbDeviceError.InvalidDescriptor;
-        }
-        if (self.phase != .Phase3) {
-            return UsbDeviceError.InvalidPhase;
-        }
-
-        for (0..self.num_config) |i| {
-            const ep_info = self.endpoint_configs[i].?;
-            const driver = &self.class_drivers[ep_info.ep_id.addr()].?;
-            driver.setEndpoint(ep_info);
-        }
-
-        self.phase = .Complete;
-    }
-
-    /// TODO: doc
-    pub fn onEndpointConfigured(self: *Self) !void {
-        for (0..self.class_drivers.len) |i| {
-            if (self.class_drivers[i] != null) {
-                const d = &self.class_drivers[i].?;
-                try d.onEndpointConfigured();
-            }
-        }
+        return null;
     }
 
     /// TODO: doc
@@ -296,12 +315,16 @@ pub const UsbDevice = struct {
         self: *Self,
         trb: *volatile trbs.TransferEventTrb,
     ) !void {
-        const issuer_trb: *trbs.Trb = @ptrFromInt(trb.trb_pointer);
+        const issuer_trb: *trbs.Trb = @ptrFromInt(page.phys2virt(trb.trb_pointer));
 
         if (issuer_trb.trb_type == .Normal) {
+            switch (trb.completion_code) {
+                completion_success, completion_short_packet => {},
+                else => return UsbDeviceError.TransferFailed,
+            }
             const normal_trb: *trbs.NormalTrb = @ptrCast(issuer_trb);
             const transfer_length = normal_trb.trb_transfer_length - trb.trb_transfer_length;
-            const buf: [*]u8 = @ptrFromInt(normal_trb.data_buf_ptr);
+            const buf: [*]u8 = @ptrFromInt(page.phys2virt(normal_trb.data_buf_ptr));
             return try self.onInterruptComplete(
                 endpoint.EndpointId.from(trb.eid),
                 buf[0..transfer_length],
@@ -309,22 +332,10 @@ pub const UsbDevice = struct {
         }
 
         log.debug(
-            "Slot {d:0>2}: Transfer Event recieved: {s}, phase={s}",
-            .{ self.dev.slot_id, @tagName(issuer_trb.trb_type), @tagName(self.phase) },
+            "Slot {d:0>2}: Transfer Event recieved: {s}",
+            .{ self.dev.slot_id, @tagName(issuer_trb.trb_type) },
         );
 
-        // Fulfill the SetupData with the SetupStageTRB.
-        const setup_trb = try self.popCorrespondingSetupTrb(issuer_trb);
-        const sud = setupdata.SetupData{
-            .b_request = @enumFromInt(setup_trb.b_request),
-            .bm_request_type = @bitCast(setup_trb.bm_request_type),
-            .w_value = setup_trb.w_value,
-            .w_index = setup_trb.w_index,
-            .w_length = setup_trb.w_length,
-        };
-
-        // Get the data buffer and its length.
-        var data_stage_buf: ?[*]u8 = null;
         // Transfer Event TRB's transfer_length field is the total length of the data buffer
         // minus the length of the data transferred by the TRB.
         // The residual length is the length of the data transferred by the issuer TRB.
@@ -332,7 +343,6 @@ pub const UsbDevice = struct {
         switch (issuer_trb.trb_type) {
             .DataStage => {
                 const data_trb: *trbs.DataStageTrb = @ptrCast(issuer_trb);
-                data_stage_buf = @ptrFromInt(data_trb.trb_buffer_pointer);
                 transfer_length = data_trb.trb_transfer_length - trb.trb_transfer_length;
             },
             .StatusStage => {},
@@ -342,90 +352,40 @@ pub const UsbDevice = struct {
             },
         }
 
-        const ep_id = endpoint.EndpointId.from(trb.eid);
-        const buf: ?[]u8 = if (data_stage_buf) |b| b[0..transfer_length] else null;
-
-        try self.onControlComplete(ep_id, sud, buf);
+        // Wake the task waiting for the transfer.
+        const transfer = self.transfers.fetchRemove(issuer_trb) orelse return UsbDeviceError.NoCorrespondingTransfer;
+        transfer.value.complete(.{ .code = trb.completion_code, .length = transfer_length });
     }
 
-    /// Handle the control transfer completion.
-    fn onControlComplete(
-        self: *Self,
-        ep_id: endpoint.EndpointId,
-        sud: setupdata.SetupData,
-        buf: ?[]u8,
-    ) !void {
-        if (self.phase == .Complete) {
-            const waiter = self.popCorrespondingWaiter(sud) catch return UsbDeviceError.NoWaiter;
-            return try waiter.onControlComplete();
-        }
+    /// Wait for the control transfer whose completion is reported on `ioc_trb`.
+    /// Returns the length of the transferred data.
+    fn waitTransfer(self: *Self, ioc_trb: *trbs.Trb, dci: usize) !usize {
+        var transfer = Transfer{};
+        try self.transfers.put(ioc_trb, &transfer);
 
-        switch (self.phase) {
-            .NotAddressed => @panic("onControlComplete is called while the initialization has not started."),
-            .Phase1 => {
-                if (buf) |b| {
-                    const desc: *align(8) descs.DeviceDescriptor = @alignCast(@ptrCast(b.ptr));
-                    if (desc.descriptor_type != .Device) return UsbDeviceError.InvalidDescriptor;
-                    try self.init_one(desc);
-                } else {
-                    return UsbDeviceError.InvalidPhase;
-                }
-            },
-            .Phase2 => {
-                if (buf) |b| {
-                    try self.init_second(b);
-                } else {
-                    return UsbDeviceError.InvalidPhase;
-                }
-            },
-            .Phase3 => {
-                try self.init_third(sud);
-                log.info(
-                    "Slot {d:0>2}: Device initialization completed: EPID={d}.",
-                    .{ self.dev.slot_id, ep_id.addr() },
-                );
-            },
-            else => @panic("Unimplemented: onControlComplete"),
-        }
-    }
-
-    /// Get the SetupStageTrb corresponding to the issuer TRB,
-    /// then remove the pair from the map.
-    pub fn popCorrespondingSetupTrb(
-        self: *Self,
-        issuer_trb: *trbs.Trb,
-    ) UsbDeviceError!*trbs.SetupStageTrb {
-        const trb = self.setup_trb_map.get(issuer_trb) orelse return UsbDeviceError.NoCorrespondingSetupTrb;
-        _ = self.setup_trb_map.remove(issuer_trb);
-        return @ptrCast(trb);
-    }
-
-    fn popCorrespondingWaiter(
-        self: *Self,
-        sud: setupdata.SetupData,
-    ) !*ClassDriver {
-        const waiter = self.event_waiters.get(sud) orelse return UsbDeviceError.NoCorrespondingSetupTrb;
-        _ = self.event_waiters.remove(sud);
-        return waiter;
-    }
+        self.db.write(.{
+            .db_stream_id = 0,
+            .db_target = @intCast(dci),
+        });
 
-    /// Delete the TRB pair from the map.
-    pub fn deleteFromMap(self: *Self, issuer_trb: *trbs.Trb) void {
-        _ = self.setup_trb_map.remove(issuer_trb);
+        const result = transfer.wait();
+        return switch (result.code) {
+            completion_success, completion_short_packet => result.length,
+            else => {
+                log.err("Slot {d:0>2}: Control transfer failed: code={d}", .{ self.dev.slot_id, result.code });
+                return UsbDeviceError.TransferFailed;
+            },
+        };
     }
 
-    /// TODO: doc
+    /// Issue a control transfer of the OUT direction and wait for its completion.
+    /// This function MUST be called in a task.
     pub fn controlOut(
         self: *Self,
         ep_id: endpoint.EndpointId,
         sud: setupdata.SetupData,
         buf: ?[]u8,
-        issuer: ?*ClassDriver,
     ) !void {
-        if (issuer) |drv| {
-            try self.event_waiters.put(sud, drv);
-        }
-
         if (15 < ep_id.number) {
             return UsbDeviceError.InvalidEndpointId;
         }
@@ -437,6 +397,7 @@ pub const UsbDevice = struct {
             .ioc = false,
             .dir = .Out,
         };
+        var ioc_trb: *trbs.Trb = undefined;
         if (buf) |b| {
             var setup_trb = trbs.SetupStageTrb{
                 .bm_request_type = @bitCast(sud.bm_request_type),
@@ -448,7 +409,7 @@ pub const UsbDevice = struct {
                 .interrupter_target = 0, // TODO
             };
             var data_trb = trbs.DataStageTrb{
-                .trb_buffer_pointer = @intFromPtr(b.ptr),
+                .trb_buffer_pointer = page.virt2phys(@intFromPtr(b.ptr)),
                 .trb_transfer_length = @truncate(b.len),
                 .td_size = 0,
                 .dir = .Out,
@@ -456,11 +417,9 @@ pub const UsbDevice = struct {
                 .interrupter_target = 0, // TODO
             };
 
-            const ptr_setup_trb = tr.push(@ptrCast(&setup_trb));
-            const ptr_data_trb = tr.push(@ptrCast(&data_trb));
+            _ = tr.push(@ptrCast(&setup_trb));
+            ioc_trb = @ptrCast(tr.push(@ptrCast(&data_trb)));
             _ = tr.push(@ptrCast(&status_trb));
-
-            try self.setup_trb_map.put(@ptrCast(ptr_data_trb), @ptrCast(ptr_setup_trb));
         } else {
             var setup_trb = trbs.SetupStageTrb{
                 .bm_request_type = @bitCast(sud.bm_request_type),
@@ -473,30 +432,26 @@ pub const UsbDevice = struct {
             };
             status_trb.ioc = true;
 
-            const ptr_setup_trb = tr.push(@ptrCast(&setup_trb));
-            const ptr_status_trb = tr.push(@ptrCast(&status_trb));
-
-            try self.setup_trb_map.put(@ptrCast(ptr_status_trb), @ptrCast(ptr_setup_trb));
+            _ = tr.push(@ptrCast(&setup_trb));
+            ioc_trb = @ptrCast(tr.push(@ptrCast(&status_trb)));
         }
 
-        self.db.write(.{
-            .db_stream_id = 0,
-            .db_target = @intCast(dci),
-        });
-
         log.debug(
             "Slot {d:0>2}: Issued a control out transfer: EPID={d}",
             .{ self.dev.slot_id, ep_id.addr() },
         );
+        _ = try self.waitTransfer(ioc_trb, dci);
     }
 
-    /// TODO: doc
+    /// Issue a control transfer of the IN direction and wait for its completion.
+    /// Returns the length of the data read into `buf`.
+    /// This function MUST be called in a task.
     pub fn controlIn(
         self: *Self,
         ep_id: endpoint.EndpointId,
         sud: setupdata.SetupData,
         buf: []u8,
-    ) !void {
+    ) !usize {
         if (15 < ep_id.number) {
             return UsbDeviceError.InvalidEndpointId;
         }
@@ -513,9 +468,9 @@ pub const UsbDevice = struct {
             .trt = .InDataStage,
             .interrupter_target = 0, // TODO
         };
-        const ptr_setup_trb = tr.push(@ptrCast(&setup_trb));
+        _ = tr.push(@ptrCast(&setup_trb));
         var data_trb = trbs.DataStageTrb{
-            .trb_buffer_pointer = @intFromPtr(buf.ptr),
+            .trb_buffer_pointer = page.virt2phys(@intFromPtr(buf.ptr)),
             .trb_transfer_length = @truncate(buf.len),
             .td_size = 0,
             .dir = .In,
@@ -529,23 +484,10 @@ pub const UsbDevice = struct {
         };
         _ = tr.push(@ptrCast(&status_trb));
 
-        self.db.write(.{
-            .db_stream_id = 0,
-            .db_target = @intCast(dci),
-        });
-
-        try self.setup_trb_map.put(@ptrCast(ptr_data_trb), @ptrCast(ptr_setup_trb));
+        return try self.waitTransfer(@ptrCast(ptr_data_trb), dci);
     }
 };
 
-const InitializationPhase = enum(u8) {
-    NotAddressed,
-    Phase1,
-    Phase2,
-    Phase3,
-    Complete,
-};
-
 /// Reader for USB interface descriptors and endpoint descriptors.
 const DescReader = struct {
     buf: []u8,
@@ -5,6 +5,7 @@ const LinkTrb = @import("trb.zig").LinkTrb;
 const regs = @import("register.zig");
 const std = @import("std");
 const log = std.log.scoped(.ring);
+const page = @import("zakuro").mm.page;
 
 /// Ring that can be used both for Command Ring and Transfer Ring.
 /// Command Ring is used by software to pass device and HC related command the xHC.
@@ -50,7 +51,7 @@ pub const Ring = struct {
         self.index += 1;
         if (self.index == self.trbs.len - 1) {
             var link = LinkTrb{
-                .ring_segment_pointer = @truncate(@as(u64, @intFromPtr(self.trbs.ptr)) >> 4),
+                .ring_segment_pointer = @truncate(page.virt2phys(@intFromPtr(self.trbs.ptr)) >> 4),
                 .tc = true,
             };
             self.copyToTail(@ptrCast(&link));
@@ -82,22 +83,23 @@ pub const EventRing = struct {
 
     /// Get the TRB pointed to by the Interrupter's dequeue pointer.
     pub fn front(self: *Self) *volatile Trb {
-        return @ptrFromInt(self.interrupter.erdp & ~@as(u64, 0b1111));
+        return @ptrFromInt(page.phys2virt(self.interrupter.erdp & ~@as(u64, 0b1111)));
     }
 
     /// Pop the front TRB.
     pub fn pop(self: *Self) void {
-        // Intcement ERDP
-        var p: *volatile Trb = @ptrFromInt((self.interrupter.erdp & ~@as(u64, 0b1111)) + @sizeOf(Trb));
-        const begin: *volatile Trb = @ptrFromInt(self.erst[0].ring_segment_base_addr);
-        const end: *volatile Trb = @ptrFromInt(self.erst[0].ring_segment_base_addr + self.erst[0].size * @sizeOf(Trb));
+        // Intcement ERDP.
+        // ERDP and ERST hold physical addresses.
+        var p = (self.interrupter.erdp & ~@as(u64, 0b1111)) + @sizeOf(Trb);
+        const begin = self.erst[0].ring_segment_base_addr;
+        const end = self.erst[0].ring_segment_base_addr + self.erst[0].size * @sizeOf(Trb);
         if (p == end) {
             p = begin;
             self.pcs +%= 1;
         }
 
         // Set ERDP
-        self.interrupter.erdp = (@intFromPtr(p) & ~@as(u64, 0b1111)) | (self.interrupter.erdp & @as(u64, 0b1111));
+        self.interrupter.erdp = (p & ~@as(u64, 0b1111)) | (self.interrupter.erdp & @as(u64, 0b1111));
     }
 };
 
@@ -6,6 +6,8 @@ const log = std.log.scoped(.xhci);
 
 const zakuro = @import("zakuro");
 const arch = zakuro.arch;
+const pci = zakuro.pci;
+const page = zakuro.mm.page;
 const context = @import("context.zig");
 const ring = @import("ring.zig");
 const port = @import("port.zig");
@@ -30,6 +32,28 @@ pub const XhcError = error{
     TransferFailed,
     /// xHC has invalid configuration.
     InvalidConfiguration,
+    /// xHC failed to process the Command.
+    CommandFailed,
+};
+
+/// Completion Code: Success.
+const completion_success = 1;
+
+/// PCI devices handled by this driver.
+/// We assume that Intel's xHC controller is the main one.
+pub const pci_driver = pci.Driver{
+    .name = "xhci",
+    .matches = &.{
+        .{ .class = xhc_class, .vendor_id = @intFromEnum(pci.KnownVendors.Intel) },
+        .{ .class = xhc_class },
+    },
+};
+
+/// Class triple of xHCI controllers.
+const xhc_class = pci.ClassTriple{
+    .base_class = @intFromEnum(pci.ClassCodes.SerialBusController),
+    .subclass = 0x03,
+    .prog_if = 0x30,
 };
 
 /// Maximum number of device slots supported by this driver.
@@ -142,7 +166,7 @@ pub const Controller = struct {
         log.debug("Set the num of device contexts to {d} (max: {d})", .{ num_device_slots, max_slots });
 
         // Set DCBAAP
-        self.operational_regs.dcbaap = @intFromPtr(self.dev_controller.dcbaa.ptr) & ~@as(u64, 0b111111);
+        self.operational_regs.dcbaap = page.virt2phys(@intFromPtr(self.dev_controller.dcbaa.ptr)) & ~@as(u64, 0b111111);
         log.debug("DCBAAP Set to: {X:0>16}", .{self.operational_regs.dcbaap});
 
         const num_trbs = 32;
@@ -154,7 +178,7 @@ pub const Controller = struct {
         };
         log.debug("Command Ring TRBs @ {X:0>16}", .{@intFromPtr(self.cmd_ring.trbs.ptr)});
         @memset(@as([*]u8, @ptrCast(self.cmd_ring.trbs.ptr))[0 .. num_trbs * @sizeOf(Trb)], 0);
-        self.operational_regs.crcr = @intFromPtr(self.cmd_ring.trbs.ptr) | @as(u64, @intCast(self.cmd_ring.pcs));
+        self.operational_regs.crcr = page.virt2phys(@intFromPtr(self.cmd_ring.trbs.ptr)) | @as(u64, @intCast(self.cmd_ring.pcs));
 
         // Create TRB and ERST for Event Ring and set the ring to primary interrupter.
         // We prepare only the primary interrupter.
@@ -172,13 +196,13 @@ pub const Controller = struct {
         });
         log.debug("Event Ring ERST @ {X:0>16}", .{@intFromPtr(self.event_ring.erst.ptr)});
         @memset(@as([*]u8, @ptrCast(self.event_ring.erst.ptr))[0 .. 1 * @sizeOf(ring.EventRingSegmentTableEntry)], 0);
-        self.event_ring.erst[0].ring_segment_base_addr = @intFromPtr(self.event_ring.trbs.ptr);
+        self.event_ring.erst[0].ring_segment_base_addr = page.virt2phys(@intFromPtr(self.event_ring.trbs.ptr));
         self.event_ring.erst[0].size = num_trbs;
 
         const primary_interrupter: *volatile Regs.InterrupterRegisterSet = self.getPrimaryInterrupter();
         primary_interrupter.erstsz = 1;
-        primary_interrupter.erdp = (@intFromPtr(self.event_ring.trbs.ptr) & ~@as(u64, 0b1111)) | (primary_interrupter.erdp & 0b1111);
-        primary_interrupter.erstba = @intFromPtr(self.event_ring.erst.ptr);
+        primary_interrupter.erdp = (page.virt2phys(@intFromPtr(self.event_ring.trbs.ptr)) & ~@as(u64, 0b1111)) | (primary_interrupter.erdp & 0b1111);
+        primary_interrupter.erstba = page.virt2phys(@intFromPtr(self.event_ring.erst.ptr));
         self.event_ring.interrupter = primary_interrupter;
 
         // Enable interrupts
@@ -283,6 +307,7 @@ pub const Controller = struct {
         self.dev_controller.allocateDevice(
             slot_id,
             &self.doorbell_regs[slot_id],
+            self.host(),
             self.allocator,
         ) catch |err| {
             log.err("Failed to allocate a device in the slot: {?}", .{err});
@@ -326,17 +351,17 @@ pub const Controller = struct {
         epctx.mult = 0;
         epctx.cerr = 3; // TODO: docs
         epctx.dcs = 1; // TODO: docs
-        epctx.tr_dequeue_pointer = @truncate(@intFromPtr(transfer_ring.trbs.ptr) >> 4);
+        epctx.tr_dequeue_pointer = @truncate(page.virt2phys(@intFromPtr(transfer_ring.trbs.ptr)) >> 4);
 
         // Record the device context.
-        self.dev_controller.dcbaa[slot_id] = &device.device_context;
+        self.dev_controller.dcbaa[slot_id] = page.virt2phys(@intFromPtr(&device.device_context));
 
         self.port_states[port_id] = .Addressing;
 
         // Notify the xHC to address the device.
         var adc_trb = trbs.AddressDeviceCommandTrb{
             .slot_id = @truncate(slot_id),
-            .input_context_pointer = @intFromPtr(&device.input_context),
+            .input_context_pointer = page.virt2phys(@intFromPtr(&device.input_context)),
         };
         _ = self.cmd_ring.push(@ptrCast(&adc_trb));
         self.notify_doorbell(0);
@@ -348,13 +373,38 @@ pub const Controller = struct {
             return XhcError.InvalidSlot;
         };
         self.port_states[port_id] = .InitializingDevice;
-        try device.start_device_init();
+        try device.startEnumeration();
+    }
+
+    /// Get the interface that USB devices use to request the controller.
+    fn host(self: *Self) usb.device.Host {
+        return .{
+            .ptr = self,
+            .vtable = &.{
+                .configureEndpoints = configureEndpoints,
+            },
+        };
+    }
+
+    /// Configure the endpoints of the device and wait for the completion of the Configure Endpoint Command.
+    /// This function is called in the enumeration task of the device.
+    fn configureEndpoints(ctx: *anyopaque, udev: *usb.device.UsbDevice) anyerror!void {
+        const self: *Self = @alignCast(@ptrCast(ctx));
+        try self.configureEndpoint(udev);
+
+        const code = udev.command.wait();
+        if (code != completion_success) {
+            log.err("Slot {d:0>2}: Configure Endpoint Command failed: code={d}", .{ udev.dev.slot_id, code });
+            return XhcError.CommandFailed;
+        }
+        const port_id = udev.dev.device_context.slot_context.root_hub_port_num;
+        self.port_states[port_id] = .Complete;
     }
 
-    /// TODO: doc
+    /// Issue the Configure Endpoint Command for the endpoints of the device.
     fn configureEndpoint(self: *Self, udev: *usb.device.UsbDevice) !void {
         const configs = udev.endpoint_configs;
-        const num_configs = udev.num_config;
+        const num_configs = udev.num_endpoints;
         const port_id = udev.dev.device_context.slot_context.root_hub_port_num;
         const port_speed = self.getPortAt(port_id).prs.portsc.read().speed;
 
@@ -388,7 +438,7 @@ pub const Controller = struct {
             ep_ctx.average_trb_length = 1;
 
             const tr = udev.dev.allocTransferRing(ep_dci, 32, self.allocator);
-            ep_ctx.tr_dequeue_pointer = @truncate(@intFromPtr(tr.trbs.ptr) >> 4);
+            ep_ctx.tr_dequeue_pointer = @truncate(page.virt2phys(@intFromPtr(tr.trbs.ptr)) >> 4);
 
             ep_ctx.dcs = 1;
             ep_ctx.max_pstreams = 0;
@@ -397,10 +447,11 @@ pub const Controller = struct {
         }
 
         self.port_states[port_id] = .ConfiguringEndpoint;
+        udev.command = .{};
 
         var cec_trb = trbs.ConfigureEndpointCommandTrb{
             .slot_id = @truncate(udev.dev.slot_id),
-            .input_context_pointer = @intFromPtr(&udev.dev.input_context),
+            .input_context_pointer = page.virt2phys(@intFromPtr(&udev.dev.input_context)),
         };
         _ = self.cmd_ring.push(@ptrCast(&cec_trb));
         self.notify_doorbell(0);
@@ -408,16 +459,6 @@ pub const Controller = struct {
         log.debug("Port {d:0>2}: Requested to configure the endpoint.", .{port_id});
     }
 
-    /// Complete the configuration of endpoints.
-    fn completeConfiguration(
-        self: *Self,
-        udev: *usb.device.UsbDevice,
-        port_id: u8,
-    ) !void {
-        try udev.onEndpointConfigured();
-        self.port_states[port_id] = .Complete;
-    }
-
     /// Handle an Transfer Event.
     fn onTransfer(
         self: *Self,
@@ -426,20 +467,9 @@ pub const Controller = struct {
         const slot_id = trb.slot_id;
         const udev = self.dev_controller.devices[slot_id] orelse return XhcError.InvalidSlot;
 
-        // Check if the completion code is valid.
-        switch (trb.completion_code) {
-            1, 13 => {},
-            else => return XhcError.TransferFailed,
-        }
-
         // Handle the Transfer Event.
+        // Failed control transfers are reported to the task waiting for them.
         try udev.onTransferEventReceived(trb);
-
-        // If the device is initialized, configure the endpoint.
-        const port_id = udev.dev.device_context.slot_context.root_hub_port_num;
-        if (udev.phase == .Complete and self.port_states[port_id] == .InitializingDevice) {
-            try self.configureEndpoint(udev);
-        }
     }
 
     /// Handle an Command Completion Event.
@@ -447,7 +477,7 @@ pub const Controller = struct {
         self: *Self,
         trb: *volatile trbs.CommandCompletionEventTrb,
     ) !void {
-        const cmd_trb: *Trb = @ptrFromInt(trb.command_trb_pointer);
+        const cmd_trb: *Trb = @ptrFromInt(page.phys2virt(trb.command_trb_pointer));
         const issuer_type = cmd_trb.trb_type;
         const slot_id = trb.slot_id;
         log.debug("Slot {d:0>2}: Command Completion Event: issuer={s}", .{ slot_id, @tagName(issuer_type) });
@@ -489,7 +519,8 @@ pub const Controller = struct {
                     return XhcError.InvalidState;
                 }
 
-                try self.completeConfiguration(device, port_id);
+                // Wake the enumeration task of the device.
+                device.command.complete(trb.completion_code);
             },
             else => {
                 log.err("Unsupported TRB command is completed: {?}", .{issuer_type});
@@ -115,6 +115,11 @@ pub fn parse(elf: Elf, allocator: Allocator) ![]Self {
 
 /// Find an abbreviation decl specified by the code.
 pub fn findDecl(self: *const Self, code: u64) ?Declaration {
+    // Codes are usually assigned sequentially from 1.
+    if (code >= 1 and code <= self.decls.len and self.decls[code - 1].code == code) {
+        return self.decls[code - 1];
+    }
+
     for (self.decls) |decl| {
         if (decl.code == code) return decl;
     }
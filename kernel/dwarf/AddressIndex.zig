@@ -0,0 +1,226 @@
+//! This file defines an index to find the function containing a given address.
+//!
+//! The index is built from DW_TAG_subprogram DIEs that have DW_AT_low_pc and DW_AT_high_pc,
+//! or DW_AT_ranges pointing to .debug_ranges section.
+//! It is a flat array of address ranges sorted by the start address,
+//! so a lookup is a single binary search without any allocation.
+//! Function names are slices of .debug_str or .debug_info section and are not copied.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const ArrayList = std.ArrayList;
+
+const Elf = @import("elf.zig").Elf;
+const AbbrevTable = @import("AbbreviationTable.zig");
+const CompilationUnit = @import("CompilationUnit.zig");
+const DieIndex = CompilationUnit.DieIndex;
+const AttributeValue = CompilationUnit.AttributeValue;
+const ParseError = CompilationUnit.ParseError;
+
+const Self = @This();
+const AddressIndex = Self;
+
+/// Address ranges of functions sorted by `low_pc`.
+entries: []Entry,
+/// Memory allocator.
+allocator: Allocator,
+
+/// Maximum number of DW_AT_abstract_origin / DW_AT_specification references followed to find a name.
+const max_ref_depth = 4;
+
+/// Address range of a function.
+pub const Entry = struct {
+    /// Start address of the range.
+    low_pc: u64,
+    /// End address of the range (exclusive).
+    high_pc: u64,
+    /// Name of the function.
+    /// The linkage name is preferred if available.
+    name: []const u8,
+};
+
+/// Build the index from all compilation units.
+/// The compilation units MUST outlive the index since names refer to their ELF sections.
+pub fn build(cus: []const CompilationUnit, allocator: Allocator) !Self {
+    var entries = ArrayList(Entry).init(allocator);
+    errdefer entries.deinit();
+
+    for (cus) |*cu| {
+        if (cu.dies.items.len == 0) continue;
+
+        // Base address of range lists is the low_pc of the compile unit.
+        const base = if (try cu.attribute(0, .LowPc)) |v| v.asUnsigned() orelse 0 else 0;
+        for (0..cu.dies.items.len) |i| {
+            const die: DieIndex = @intCast(i);
+            if (try cu.tag(die) != .Subprogram) continue;
+            try addSubprogram(&entries, cu, die, base);
+        }
+    }
+
+    std.sort.pdq(Entry, entries.items, {}, lessThan);
+
+    return .{
+        .entries = try entries.toOwnedSlice(),
+        .allocator = allocator,
+    };
+}
+
+/// Free the index.
+pub fn deinit(self: Self) void {
+    self.allocator.free(self.entries);
+}
+
+/// Find the function containing the address.
+/// Returns null if no function contains it.
+pub fn lookup(self: Self, addr: u64) ?Entry {
+    // Find the first entry whose `low_pc` is greater than the address.
+    var left: usize = 0;
+    var right: usize = self.entries.len;
+    while (left < right) {
+        const mid = left + (right - left) / 2;
+        if (self.entries[mid].low_pc <= addr) {
+            left = mid + 1;
+        } else {
+            right = mid;
+        }
+    }
+
+    // The candidate is the entry right before it.
+    if (left == 0) return null;
+    const ent = self.entries[left - 1];
+    return if (addr < ent.high_pc) ent else null;
+}
+
+/// Add the address ranges of the subprogram DIE.
+/// Subprograms without code (declarations, functions removed by the linker) are ignored.
+fn addSubprogram(entries: *ArrayList(Entry), cu: *const CompilationUnit, die: DieIndex, base: u64) !void {
+    var low_pc: ?u64 = null;
+    var high_pc: ?AttributeValue = null;
+    var ranges: ?u64 = null;
+
+    var it = try cu.attributes(die);
+    while (it.index < it.attrs.len) {
+        switch (it.attrs[it.index].name) {
+            .LowPc => low_pc = (try it.next()).?.value.asUnsigned(),
+            .HighPc => high_pc = (try it.next()).?.value,
+            .Ranges => ranges = (try it.next()).?.value.asUnsigned(),
+            else => try it.skip(),
+        }
+    }
+
+    if (low_pc == null and ranges == null) return;
+    const name = try functionName(cu, die) orelse "";
+
+    if (low_pc) |low| {
+        if (low == 0) return;
+        const hv = high_pc orelse return;
+        // DW_AT_high_pc is an address if its form is address, otherwise an offset from low_pc.
+        const high = switch (hv) {
+            .addr => |v| v,
+            else => low + (hv.asUnsigned() orelse return),
+        };
+        if (high <= low) return;
+
+        try entries.append(.{ .low_pc = low, .high_pc = high, .name = name });
+    } else if (ranges) |offset| {
+        try addRanges(entries, cu.elf, offset, base, name);
+    }
+}
+
+/// Add all ranges of the range list at the offset of .debug_ranges section.
+fn addRanges(entries: *ArrayList(Entry), elf: Elf, offset: u64, base: u64, name: []const u8) !void {
+    if (offset >= elf.debug_ranges.len) return ParseError.EndOfStream;
+
+    var stream = std.io.fixedBufferStream(elf.debug_ranges);
+    stream.pos = @intCast(offset);
+    const rdr = stream.reader();
+
+    var current_base = base;
+    while (true) {
+        const begin = try rdr.readInt(u64, .little);
+        const end = try rdr.readInt(u64, .little);
+
+        if (begin == 0 and end == 0) {
+            // End of list entry.
+            break;
+        } else if (begin == std.math.maxInt(u64)) {
+            // Base address selection entry.
+            current_base = end;
+        } else if (begin < end) {
+            try entries.append(.{
+                .low_pc = current_base + begin,
+                .high_pc = current_base + end,
+                .name = name,
+            });
+        }
+    }
+}
+
+/// Get the name of the function the subprogram DIE describes.
+/// If the DIE has no name, the name is taken from the DIE referred by DW_AT_abstract_origin or DW_AT_specification.
+fn functionName(cu: *const CompilationUnit, die: DieIndex) ParseError!?[]const u8 {
+    var current = die;
+
+    for (0..max_ref_depth) |_| {
+        var name: ?[]const u8 = null;
+        var origin: ?u64 = null;
+
+        var it = try cu.attributes(current);
+        while (it.index < it.attrs.len) {
+            switch (it.attrs[it.index].name) {
+                .LinkageName => switch ((try it.next()).?.value) {
+                    .str => |s| return s,
+                    else => {},
+                },
+                .Name => switch ((try it.next()).?.value) {
+                    .str => |s| name = s,
+                    else => {},
+                },
+                .AbstractOrigin, .Specification => switch ((try it.next()).?.value) {
+                    .ref => |r| origin = r,
+                    else => {},
+                },
+                else => try it.skip(),
+            }
+        }
+
+        if (name) |n| return n;
+        current = cu.findDieByOffset(origin orelse return null) orelse return null;
+    }
+
+    return null;
+}
+
+fn lessThan(_: void, a: Entry, b: Entry) bool {
+    return a.low_pc < b.low_pc;
+}
+
+const testing = std.testing;
+
+test "Look up functions by address" {
+    const bin align(0x100) = @embedFile("dwarf-elf").*;
+    const elf = try Elf.new(&bin);
+    const abbr_tbls = try AbbrevTable.parse(elf, std.heap.page_allocator);
+    const cus = try CompilationUnit.parse(elf, abbr_tbls, testing.allocator);
+    defer {
+        for (cus) |*cu| cu.deinit();
+        testing.allocator.free(cus);
+    }
+
+    const index = try build(cus, testing.allocator);
+    defer index.deinit();
+
+    // Entries are sorted by the start address.
+    try testing.expect(index.entries.len != 0);
+    for (index.entries[0 .. index.entries.len - 1], index.entries[1..]) |prev, cur| {
+        try testing.expect(prev.low_pc <= cur.low_pc);
+    }
+
+    // Any address inside the function resolves to it.
+    const fibo = for (index.entries) |ent| {
+        if (std.mem.endsWith(u8, ent.name, "fibo")) break ent;
+    } else return error.TestUnexpectedResult;
+    try testing.expectEqualStrings(fibo.name, index.lookup(fibo.low_pc).?.name);
+    try testing.expectEqualStrings(fibo.name, index.lookup(fibo.high_pc - 1).?.name);
+    try testing.expectEqual(null, index.lookup(0));
+}
@@ -50,6 +50,7 @@ const ArrayList = std.ArrayList;
 
 const Elf = @import("elf.zig").Elf;
 const encoding = @import("encoding.zig");
+const TagEncoding = encoding.TagEncoding;
 const AttributeName = encoding.AttributeName;
 const AttributeForm = encoding.AttributeForm;
 const AbbrevTable = @import("AbbreviationTable.zig");
@@ -60,28 +61,49 @@ const CompilationUnit = Self;
 
 /// Header of this compilation unit
 header: CompilationUnitHeader,
-/// All DIEs this compilation unit contains.
-/// The tree relationship is determined by `children` field.
+/// Offset of the compilation unit header from the start of .debug_info section.
+offset: usize,
+/// All DIEs this compilation unit contains, in the order of appearance in .debug_info.
+/// The tree relationship is determined by `first_child` and `next_sibling` fields.
 dies: ArrayList(Die),
-/// Children DIE.
-/// The entries are index of DIEs(`dies`).
-children: ArrayList(DieIndex),
 /// Abbreviation Table this compilation unit uses.
 tbl: AbbrevTable,
+/// ELF binary.
+/// Attribute values are decoded lazily from its .debug_info section.
+elf: Elf,
 /// Memory allocator.
 allocator: Allocator,
 
+pub const ParseError = error{
+    /// Reached the end of the section unexpectedly.
+    EndOfStream,
+    /// LEB128 value does not fit in 64 bits.
+    Overflow,
+    /// The attribute form is not supported.
+    UnsupportedForm,
+    /// The abbreviation declaration is not found.
+    DeclNotFound,
+    /// The string is not terminated.
+    InvalidString,
+};
+
+const Stream = std.io.FixedBufferStream([]const u8);
+
 /// Parse ELF's .debug_info section and constructs DIE trees.
+/// Only the structure of DIEs is recorded here. Attribute values are not copied.
 pub fn parse(elf: Elf, abbr_tables: []AbbrevTable, allocator: Allocator) ![]Self {
     var cus = ArrayList(Self).init(allocator);
-    errdefer cus.deinit();
+    errdefer {
+        for (cus.items) |*cu| cu.deinit();
+        cus.deinit();
+    }
 
     const info = elf.debug_info;
     var stream = std.io.fixedBufferStream(info);
-    var crdr = std.io.countingReader(stream.reader());
-    const rdr = crdr.reader();
+    const rdr = stream.reader();
 
-    while (crdr.bytes_read != info.len) {
+    while (stream.pos != info.len) {
+        const unit_offset = stream.pos;
         const length_short = try rdr.readInt(u32, .little);
         const version = try rdr.readInt(u16, .little);
         const abbrev_offset = try rdr.readInt(u32, .little);
@@ -106,21 +128,17 @@ pub fn parse(elf: Elf, abbr_tables: []AbbrevTable, allocator: Allocator) ![]Self
         const tbl = AbbrevTable.findTbl(abbr_tables, abbrev_offset) orelse @panic("Abbrev table not found.");
         var cu = Self{
             .header = unit,
+            .offset = unit_offset,
             .dies = ArrayList(Die).init(allocator),
-            .children = ArrayList(DieIndex).init(allocator),
             .tbl = tbl,
+            .elf = elf,
             .allocator = allocator,
         };
+        errdefer cu.deinit();
 
-        // Parse all compilation units.
+        // Parse all DIEs in this compilation unit.
         const len = length_short + @sizeOf(@TypeOf(length_short)); // NOTE: DWARF bit specific
-        try cu.parseDie(
-            null,
-            elf,
-            (crdr.bytes_read - 11) + len,
-            crdr,
-            rdr,
-        );
+        try cu.parseDies(&stream, unit_offset + len);
 
         try cus.append(cu);
     }
@@ -128,202 +146,326 @@ pub fn parse(elf: Elf, abbr_tables: []AbbrevTable, allocator: Allocator) ![]Self
     return cus.toOwnedSlice();
 }
 
-/// Parse a DIE and all its children recursively for the current compilation unit.
-fn parseDie(
+/// Free the DIE store.
+pub fn deinit(self: *Self) void {
+    self.dies.deinit();
+}
+
+/// Parse all DIEs of the current compilation unit and link them as a tree.
+fn parseDies(
     self: *Self,
-    /// Index of the parent DIE in the compilation unit.
-    parent: ?DieIndex,
-    /// ELF binary
-    elf: Elf,
+    /// Stream of .debug_info positioned at the first DIE.
+    stream: *Stream,
     /// The offset of the end of this compilation unit starting from the start of .debug_info.
     until: usize,
-    /// Counting reader
-    crdr: anytype,
-    /// Reader
-    rdr: anytype,
 ) !void {
-    const header = self.header;
-    const tbl = self.tbl;
-    const allocator = self.allocator;
-
-    while (crdr.bytes_read != until) {
-        const ix = self.dies.items.len;
-        const abbrev_code = try leb.readULEB128(u64, rdr);
+    // The last DIE at each depth, used to link siblings.
+    var last = ArrayList(?DieIndex).init(self.allocator);
+    defer last.deinit();
+    try last.append(null);
+
+    while (stream.pos < until) {
+        const die_offset = stream.pos;
+        const abbrev_code = try leb.readULEB128(u64, stream.reader());
         if (abbrev_code == 0) {
-            // If this DIE is a children, go back to the parent layer.
+            // If this is the end of children, go back to the parent layer.
             // If this DIE does not have a parent, continue parsing siblings.
-            if (parent) |_| return else continue;
+            if (last.items.len > 1) _ = last.pop();
+            continue;
         }
-        const decl = tbl.findDecl(abbrev_code) orelse @panic("Abbr decl not found.");
+        const decl = self.tbl.findDecl(abbrev_code) orelse @panic("Abbr decl not found.");
 
-        // Parse all attributes in this DIE.
-        var attributes = ArrayList([]const u8).init(allocator);
-        errdefer attributes.deinit();
+        const ix: DieIndex = @intCast(self.dies.items.len);
+        try self.dies.append(.{
+            .code = abbrev_code,
+            .offset = @intCast(die_offset),
+            .first_child = null,
+            .next_sibling = null,
+        });
+
+        // Link this DIE to its previous sibling, or to its parent if this is the first child.
+        const depth = last.items.len - 1;
+        if (last.items[depth]) |prev| {
+            self.dies.items[prev].next_sibling = ix;
+        } else if (depth > 0) {
+            self.dies.items[last.items[depth - 1].?].first_child = ix;
+        }
+        last.items[depth] = ix;
+
+        // Skip all attributes. They are decoded on access.
         for (decl.attributes) |attr| {
-            try attributes.append(try readAttribute(
-                header,
-                attr,
-                rdr,
-                elf,
-                self.allocator,
-            ));
+            try skipAttribute(attr.form, stream);
         }
 
-        const die = Die{
-            .code = abbrev_code,
-            .values = try attributes.toOwnedSlice(),
-            .children = ArrayList(DieIndex).init(allocator),
-        };
-        try self.dies.append(die);
+        if (decl.has_children == .HasChildren) {
+            try last.append(null);
+        }
+    }
+}
 
-        if (parent) |p| {
-            try self.dies.items[p].children.append(ix);
-        } else {
-            try self.children.append(ix);
+/// Get the tag of the DIE.
+pub fn tag(self: *const Self, die: DieIndex) ParseError!TagEncoding {
+    const decl = self.tbl.findDecl(self.dies.items[die].code) orelse return ParseError.DeclNotFound;
+    return decl.tag;
+}
+
+/// Get the value of the attribute of the DIE.
+/// The value is decoded from .debug_info section on each call.
+/// Returns null if the DIE does not have the attribute.
+pub fn attribute(self: *const Self, die: DieIndex, name: AttributeName) ParseError!?AttributeValue {
+    var it = try self.attributes(die);
+    while (it.index < it.attrs.len) {
+        const attr = it.attrs[it.index];
+        if (attr.name == name) {
+            return (try it.next()).?.value;
         }
+        try it.skip();
+    }
 
-        if (decl.has_children == .HasChildren) {
-            try self.parseDie(
-                ix,
-                elf,
-                until,
-                crdr,
-                rdr,
-            );
+    return null;
+}
+
+/// Get the iterator over the attributes of the DIE.
+pub fn attributes(self: *const Self, die: DieIndex) ParseError!AttributeIterator {
+    const d = self.dies.items[die];
+    const decl = self.tbl.findDecl(d.code) orelse return ParseError.DeclNotFound;
+
+    var stream = std.io.fixedBufferStream(self.elf.debug_info);
+    stream.pos = d.offset;
+    _ = try leb.readULEB128(u64, stream.reader());
+
+    return .{
+        .cu = self,
+        .attrs = decl.attributes,
+        .stream = stream,
+    };
+}
+
+/// Get the iterator over the children of the DIE.
+/// If `die` is null, top-level DIEs of this compilation unit are iterated.
+pub fn children(self: *const Self, die: ?DieIndex) ChildIterator {
+    const first = if (die) |d|
+        self.dies.items[d].first_child
+    else if (self.dies.items.len != 0)
+        @as(?DieIndex, 0)
+    else
+        null;
+
+    return .{ .cu = self, .current = first };
+}
+
+/// Find the DIE at the given offset from the start of this compilation unit.
+/// This is used to resolve reference attributes.
+pub fn findDieByOffset(self: *const Self, unit_relative: u64) ?DieIndex {
+    const target: u64 = self.offset + unit_relative;
+    const ix = std.sort.binarySearch(Die, target, self.dies.items, {}, compareDieOffset) orelse return null;
+
+    return @intCast(ix);
+}
+
+fn compareDieOffset(_: void, offset: u64, die: Die) std.math.Order {
+    return std.math.order(offset, @as(u64, die.offset));
+}
+
+pub fn print(self: Self, writer: Writer, allocator: Allocator) !void {
+    for (0..self.dies.items.len) |i| {
+        const die: DieIndex = @intCast(i);
+        writer("Abbrev Number: {d}", .{self.dies.items[die].code}); // TODO
+        var it = try self.attributes(die);
+        while (try it.next()) |ent| {
+            writer("\t{s}: {s}", .{ @tagName(ent.attr.name), try printFormat(ent.value, allocator) });
         }
     }
 }
 
-/// Read a single attribute data and advance the reader.
-fn readAttribute(
-    unit: CompilationUnitHeader,
-    /// Abbreviation declaration.
-    attr: Attribute,
-    /// Reader
-    rdr: anytype,
-    /// ELF binary
-    elf: Elf,
-    /// Memory allocator
-    allocator: Allocator,
-) ![]const u8 {
-    _ = unit;
-    const asBytes = std.mem.asBytes;
-
-    switch (attr.form) {
-        .Addr => {
-            const addr = try rdr.readInt(u64, .little);
-            const p = try allocator.create(u64);
-            p.* = addr;
-            return asBytes(p);
-        },
-        .Strp => {
+fn printFormat(value: AttributeValue, allocator: Allocator) ![]const u8 {
+    return switch (value) {
+        .addr => |v| std.fmt.allocPrint(allocator, "0x{X}", .{v}),
+        .str => |v| v,
+        .udata => |v| std.fmt.allocPrint(allocator, "<0x{X}>", .{v}),
+        .sdata => |v| std.fmt.allocPrint(allocator, "<{d}>", .{v}),
+        .ref => |v| std.fmt.allocPrint(allocator, "{d}", .{v}),
+        else => "???",
+    };
+}
+
+/// Read a single attribute value from the stream without copying it.
+/// Strings and blocks are returned as slices of the ELF sections.
+fn readAttribute(self: *const Self, form: AttributeForm, stream: *Stream) ParseError!AttributeValue {
+    const rdr = stream.reader();
+
+    return switch (form) {
+        .Addr => .{ .addr = try rdr.readInt(u64, .little) },
+        .Data1 => .{ .udata = try rdr.readInt(u8, .little) },
+        .Data2 => .{ .udata = try rdr.readInt(u16, .little) },
+        .Data4 => .{ .udata = try rdr.readInt(u32, .little) },
+        .Data8 => .{ .udata = try rdr.readInt(u64, .little) },
+        .SData => .{ .sdata = try leb.readILEB128(i64, rdr) },
+        .UData => .{ .udata = try leb.readULEB128(u64, rdr) },
+        .Strp => blk: {
             const offset = try rdr.readInt(u32, .little); // NOTE: DWARF bit specific
-            const str = elf.debugStr(offset).?;
-            return str;
-        },
-        .Data1 => return copyBytesForInt(u8, rdr, allocator),
-        .Data2 => return copyBytesForInt(u16, rdr, allocator),
-        .Data4 => return copyBytesForInt(u32, rdr, allocator),
-        .Data8 => return copyBytesForInt(u64, rdr, allocator),
-        .SData => return copyBytesForLEB(i64, rdr, allocator),
-        .UData => return copyBytesForLEB(u64, rdr, allocator),
-        .SecOffset => {
-            _ = try rdr.readInt(u32, .little); // NOTE: DWARF bit specific
-            return &.{};
-        },
-        .FlagPresent => return &.{},
-        .Flag => {
-            const data = try rdr.readByte() != 0;
-            return asBytes(&data);
-        },
-        .Ref1 => return copyBytesForInt(u8, rdr, allocator),
-        .Ref2 => return copyBytesForInt(u16, rdr, allocator),
-        .Ref4 => return copyBytesForInt(u32, rdr, allocator),
-        .Ref8 => return copyBytesForInt(u64, rdr, allocator),
-        .Exprloc => {
-            const length = try leb.readULEB128(u64, rdr);
-            try rdr.skipBytes(length, .{});
-            return &.{};
+            break :blk .{ .str = self.elf.debugStr(offset) orelse return ParseError.InvalidString };
         },
-        .Block1 => {
-            const length = try rdr.readInt(u8, .little);
-            try rdr.skipBytes(length, .{});
-            return &.{};
+        .String => blk: {
+            const start = stream.pos;
+            const rest = stream.buffer[start..];
+            const len = std.mem.indexOfScalar(u8, rest, 0) orelse return ParseError.InvalidString;
+            stream.pos += len + 1;
+            break :blk .{ .str = rest[0..len] };
         },
-        .Block2 => {
-            const length = try rdr.readInt(u16, .little);
-            try rdr.skipBytes(length, .{});
-            return &.{};
-        },
-        .Block4 => {
-            const length = try rdr.readInt(u32, .little);
-            try rdr.skipBytes(length, .{});
-            return &.{};
-        },
-        .Block => {
-            const length = try leb.readULEB128(u64, rdr);
-            try rdr.skipBytes(length, .{});
-            return &.{};
+        .Flag => .{ .flag = try rdr.readByte() != 0 },
+        .FlagPresent => .{ .flag = true },
+        .Ref1 => .{ .ref = try rdr.readInt(u8, .little) },
+        .Ref2 => .{ .ref = try rdr.readInt(u16, .little) },
+        .Ref4 => .{ .ref = try rdr.readInt(u32, .little) },
+        .Ref8 => .{ .ref = try rdr.readInt(u64, .little) },
+        .RefUData => .{ .ref = try leb.readULEB128(u64, rdr) },
+        .RefAddr => .{ .ref_addr = try rdr.readInt(u32, .little) }, // NOTE: DWARF bit specific
+        .RefSig8 => .{ .ref_sig = try rdr.readInt(u64, .little) },
+        .SecOffset => .{ .sec_offset = try rdr.readInt(u32, .little) }, // NOTE: DWARF bit specific
+        .Exprloc, .Block => .{ .block = try readBlock(stream, try leb.readULEB128(u64, rdr)) },
+        .Block1 => .{ .block = try readBlock(stream, try rdr.readInt(u8, .little)) },
+        .Block2 => .{ .block = try readBlock(stream, try rdr.readInt(u16, .little)) },
+        .Block4 => .{ .block = try readBlock(stream, try rdr.readInt(u32, .little)) },
+        .Indirect => self.readAttribute(try readIndirectForm(stream), stream),
+        .Reserved, .Strx, .Addrx, .RefSup4, .StrpSup, .Data16, .LineStrp => ParseError.UnsupportedForm,
+    };
+}
+
+/// Advance the stream over a single attribute value without decoding it.
+fn skipAttribute(form: AttributeForm, stream: *Stream) ParseError!void {
+    switch (form) {
+        .FlagPresent => {},
+        .Data1, .Ref1, .Flag => try advance(stream, 1),
+        .Data2, .Ref2 => try advance(stream, 2),
+        .Data4, .Ref4, .Strp, .RefAddr, .SecOffset => try advance(stream, 4), // NOTE: DWARF bit specific
+        .Addr, .Data8, .Ref8, .RefSig8 => try advance(stream, 8),
+        .SData, .UData, .RefUData => try skipLeb128(stream),
+        .String => {
+            const len = std.mem.indexOfScalar(u8, stream.buffer[stream.pos..], 0) orelse return ParseError.InvalidString;
+            try advance(stream, len + 1);
         },
-        .String,
-        .RefAddr,
-        .RefUData,
-        .Indirect,
-        .RefSig8,
-        => @panic("Unimplemented type of DIE attribute format"),
-        .Reserved => @panic("The DIE's attribute has RESERVED type format."),
+        .Exprloc, .Block => try advance(stream, try leb.readULEB128(u64, stream.reader())),
+        .Block1 => try advance(stream, try stream.reader().readInt(u8, .little)),
+        .Block2 => try advance(stream, try stream.reader().readInt(u16, .little)),
+        .Block4 => try advance(stream, try stream.reader().readInt(u32, .little)),
+        .Indirect => try skipAttribute(try readIndirectForm(stream), stream),
+        .Reserved, .Strx, .Addrx, .RefSup4, .StrpSup, .Data16, .LineStrp => return ParseError.UnsupportedForm,
     }
 }
 
-pub fn print(self: Self, writer: Writer, allocator: Allocator) !void {
-    for (self.dies.items) |*die| {
-        try die.print(&self.tbl, writer, allocator);
+fn readIndirectForm(stream: *Stream) ParseError!AttributeForm {
+    const form = try leb.readULEB128(u64, stream.reader());
+    return std.meta.intToEnum(AttributeForm, form) catch ParseError.UnsupportedForm;
+}
+
+fn readBlock(stream: *Stream, len: u64) ParseError![]const u8 {
+    const start = stream.pos;
+    try advance(stream, len);
+    return stream.buffer[start..stream.pos];
+}
+
+fn advance(stream: *Stream, len: u64) ParseError!void {
+    if (len > stream.buffer.len - stream.pos) return ParseError.EndOfStream;
+    stream.pos += @intCast(len);
+}
+
+fn skipLeb128(stream: *Stream) ParseError!void {
+    const rest = stream.buffer[stream.pos..];
+    for (rest, 0..) |byte, i| {
+        if (byte & 0x80 == 0) {
+            stream.pos += i + 1;
+            return;
+        }
     }
+    return ParseError.EndOfStream;
 }
 
 const Code = u64;
-const DieIndex = usize;
+pub const DieIndex = u32;
 const Writer = @TypeOf(std.log.debug);
 
-/// Debug Information Entry
+/// Debug Information Entry.
+/// Attribute values are not stored. They are decoded from .debug_info section on access.
 const Die = struct {
     /// Code of the abbreviation declaration used by this DIE.
     code: Code,
-    /// Raw data of the attributes.
-    /// The attribute name and its format can be looked up using the code.
-    values: [][]const u8,
-    /// Children of this DIE.
-    /// This slice contains children DIE's index inside the compilation unit.
-    children: ArrayList(DieIndex),
-
-    pub fn print(self: *Die, tbl: *const AbbrevTable, writer: Writer, allocator: Allocator) !void {
-        const decl = tbl.findDecl(self.code) orelse return error.DeclNotFound;
-        writer("Abbrev Number: {d}", .{self.code}); // TODO
-        for (decl.attributes, self.values) |attr, value| {
-            writer("\t{s}: {s}", .{ @tagName(attr.name), try printFormat(attr, value, allocator) });
-        }
+    /// Offset of this DIE from the start of .debug_info section.
+    offset: u32,
+    /// Index of the first child DIE.
+    first_child: ?DieIndex,
+    /// Index of the next sibling DIE.
+    next_sibling: ?DieIndex,
+};
+
+/// Decoded value of an attribute.
+pub const AttributeValue = union(enum) {
+    /// Address on the target.
+    addr: u64,
+    /// Unsigned constant.
+    udata: u64,
+    /// Signed constant.
+    sdata: i64,
+    /// Flag.
+    flag: bool,
+    /// String. This is a slice of .debug_str or .debug_info section.
+    str: []const u8,
+    /// Offset of the referenced DIE from the start of the compilation unit.
+    ref: u64,
+    /// Offset of the referenced DIE from the start of .debug_info section.
+    ref_addr: u64,
+    /// Type signature of the referenced type unit.
+    ref_sig: u64,
+    /// Offset into another debug section.
+    sec_offset: u64,
+    /// Block or DWARF expression. This is a slice of .debug_info section.
+    block: []const u8,
+
+    /// Get the value as an unsigned integer if it is a constant or an address.
+    pub fn asUnsigned(self: AttributeValue) ?u64 {
+        return switch (self) {
+            .addr, .udata, .sec_offset => |v| v,
+            .sdata => |v| if (v >= 0) @intCast(v) else null,
+            else => null,
+        };
     }
+};
 
-    fn printFormat(attr: Attribute, value: []const u8, allocator: Allocator) ![]const u8 {
-        switch (attr.form) {
-            .Addr => {
-                const v = std.mem.bytesAsValue(u64, value.ptr).*;
-                return std.fmt.allocPrint(allocator, "0x{X}", .{v});
-            },
-            .Strp => return value,
-            .Data1,
-            .Data2,
-            .Data4,
-            .Data8,
-            .SData,
-            .UData,
-            => return std.fmt.allocPrint(allocator, "<0x{any}>", .{value}),
-            .Ref1 => return std.fmt.allocPrint(allocator, "{d}", .{std.mem.bytesAsValue(u8, value.ptr).*}),
-            .Ref2 => return std.fmt.allocPrint(allocator, "{d}", .{std.mem.bytesAsValue(u16, value.ptr).*}),
-            .Ref4 => return std.fmt.allocPrint(allocator, "{d}", .{std.mem.bytesAsValue(u32, value.ptr).*}),
-            .Ref8 => return std.fmt.allocPrint(allocator, "{d}", .{std.mem.bytesAsValue(u64, value.ptr).*}),
-            else => return "???",
-        }
+/// Iterator over the attributes of a DIE.
+pub const AttributeIterator = struct {
+    cu: *const CompilationUnit,
+    /// Attribute specifications of the DIE.
+    attrs: []const Attribute,
+    /// Stream positioned at the next attribute value.
+    stream: Stream,
+    /// Index of the next attribute.
+    index: usize = 0,
+
+    /// Decode the next attribute.
+    pub fn next(self: *AttributeIterator) ParseError!?struct { attr: Attribute, value: AttributeValue } {
+        if (self.index >= self.attrs.len) return null;
+        const attr = self.attrs[self.index];
+        self.index += 1;
+        return .{ .attr = attr, .value = try self.cu.readAttribute(attr.form, &self.stream) };
+    }
+
+    /// Skip the next attribute without decoding it.
+    pub fn skip(self: *AttributeIterator) ParseError!void {
+        if (self.index >= self.attrs.len) return;
+        try skipAttribute(self.attrs[self.index].form, &self.stream);
+        self.index += 1;
+    }
+};
+
+/// Iterator over sibling DIEs.
+pub const ChildIterator = struct {
+    cu: *const CompilationUnit,
+    current: ?DieIndex,
+
+    pub fn next(self: *ChildIterator) ?DieIndex {
+        const ix = self.current orelse return null;
+        self.current = self.cu.dies.items[ix].next_sibling;
+        return ix;
     }
 };
 
@@ -346,24 +488,6 @@ const CompilationUnitHeader = packed struct {
     address_size: u8,
 };
 
-fn copyBytesForInt(T: type, rdr: anytype, allocator: Allocator) ![]const u8 {
-    const data = try rdr.readInt(T, .little);
-    const p = try allocator.create(T);
-    p.* = data;
-    return std.mem.asBytes(p);
-}
-
-fn copyBytesForLEB(T: type, rdr: anytype, allocator: Allocator) ![]const u8 {
-    const data = switch (T) {
-        i64 => try leb.readILEB128(T, rdr),
-        u64 => try leb.readULEB128(T, rdr),
-        else => @panic("Unsupported type for copyByteForLEB()"),
-    };
-    const p = try allocator.create(T);
-    p.* = data;
-    return std.mem.asBytes(p);
-}
-
 const testing = std.testing;
 
 test "Parse compilation units and its DIE children" {
@@ -378,3 +502,38 @@ test "Parse compilation units and its DIE children" {
     try testing.expect(cus[0].dies.items.len > 10000);
     try testing.expect(cus[1].dies.items.len > 10000);
 }
+
+test "DIE tree and lazy attributes" {
+    const bin align(0x100) = @embedFile("dwarf-elf").*;
+    const elf = try Elf.new(&bin);
+    const abbr_tbls = try AbbrevTable.parse(elf, std.heap.page_allocator);
+    const cus = try parse(elf, abbr_tbls, testing.allocator);
+    defer {
+        for (cus) |*cu| cu.deinit();
+        testing.allocator.free(cus);
+    }
+
+    for (cus) |*cu| {
+        // The first DIE is the compile unit and has a name.
+        try testing.expectEqual(.CompileUnit, try cu.tag(0));
+        const name = try cu.attribute(0, .Name);
+        try testing.expect(name != null and name.?.str.len != 0);
+
+        // Every DIE is reachable from the top-level DIEs exactly once.
+        try testing.expectEqual(cu.dies.items.len, countDies(cu, null));
+
+        // References resolve to the DIE at the offset.
+        const first_child = cu.dies.items[0].first_child.?;
+        const rel = cu.dies.items[first_child].offset - cu.offset;
+        try testing.expectEqual(first_child, cu.findDieByOffset(rel).?);
+    }
+}
+
+fn countDies(cu: *const CompilationUnit, die: ?DieIndex) usize {
+    var count: usize = 0;
+    var it = cu.children(die);
+    while (it.next()) |child| {
+        count += 1 + countDies(cu, child);
+    }
+    return count;
+}
@@ -0,0 +1,563 @@
+//! This file defines a line number table decoded from .debug_line section.
+//!
+//! The line number program of each compilation unit (DWARF v2 to v5, 32-bit format) is interpreted once,
+//! and the resulting rows of all units are sorted by address and stored in a compact form:
+//! rows are grouped into blocks of `block_size` rows,
+//! the first row of each block is a checkpoint that has the absolute address,
+//! and the other rows store only the differences from the previous row as LEB128.
+//! A lookup is a binary search over the checkpoints followed by decoding of a single block.
+//!
+//! For the format of the line number program,
+//! refer to Chapter 6.2 (Page.148) of DWARF 5 standard.
+
+const std = @import("std");
+const leb = std.leb;
+const Allocator = std.mem.Allocator;
+const ArrayList = std.ArrayList;
+
+const Elf = @import("elf.zig").Elf;
+const encoding = @import("encoding.zig");
+const AttributeForm = encoding.AttributeForm;
+
+const Self = @This();
+const LineTable = Self;
+
+/// Files referred by rows.
+/// File and directory names are slices of the ELF sections.
+files: []const File,
+/// The first row of each block.
+checkpoints: []Checkpoint,
+/// Delta-encoded rows.
+data: []u8,
+/// Number of rows.
+len: usize,
+/// Memory allocator.
+allocator: Allocator,
+
+/// Number of rows in a block.
+const block_size = 32;
+
+pub const LineError = error{
+    /// Reached the end of the section unexpectedly.
+    EndOfStream,
+    /// LEB128 value does not fit in the integer.
+    Overflow,
+    /// The version of the line number program is not supported.
+    UnsupportedVersion,
+    /// The format of the line number program is not supported.
+    UnsupportedFormat,
+    /// The form of the entry is not supported.
+    UnsupportedForm,
+    /// The string is not terminated.
+    InvalidString,
+    /// The file index is out of range.
+    InvalidFile,
+};
+
+/// Source file.
+pub const File = struct {
+    /// Directory name. Empty if it is the compilation directory.
+    dir: []const u8,
+    /// File name.
+    name: []const u8,
+};
+
+/// Source location.
+pub const Location = struct {
+    /// Source file.
+    file: File,
+    /// Line number starting from 1.
+    line: u32,
+};
+
+/// Checkpoint for the first row of a block.
+/// This is also the on-disk format of the embedded symbol table.
+pub const Checkpoint = extern struct {
+    /// Address of the row.
+    address: u64,
+    /// Offset of the encoded row in `data`.
+    offset: u32,
+    /// Reserved.
+    _reserved: u32 = 0,
+};
+
+/// Row of the line number table.
+pub const Row = struct {
+    /// Address of the first instruction for the row.
+    address: u64,
+    /// Line number.
+    /// 0 means the address is not covered by any line, such as the end of a sequence.
+    line: u32,
+    /// Index of the file in `files`.
+    file: u32,
+};
+
+/// Stream of the section.
+const Stream = std.io.FixedBufferStream([]const u8);
+
+/// Format of an entry of the directory or file name table in DWARF v5.
+const EntryFormat = struct {
+    /// Content type code (DW_LNCT_*).
+    content: u64,
+    /// Form of the value.
+    form: AttributeForm,
+};
+
+/// Maximum number of entry formats supported.
+const max_entry_formats = 16;
+
+/// DW_LNCT_path
+const lnct_path = 0x1;
+/// DW_LNCT_directory_index
+const lnct_directory_index = 0x2;
+
+/// Interpret all line number programs in .debug_line section and build the table.
+/// The ELF binary MUST outlive the table since file names refer to its sections.
+pub fn build(elf: Elf, allocator: Allocator) !Self {
+    var files = ArrayList(File).init(allocator);
+    errdefer files.deinit();
+    var rows = ArrayList(Row).init(allocator);
+    defer rows.deinit();
+
+    var stream = std.io.fixedBufferStream(elf.debug_line);
+    while (stream.pos < elf.debug_line.len) {
+        try parseUnit(elf, &stream, &files, &rows, allocator);
+    }
+
+    // Sort rows by address, keeping the order of rows at the same address.
+    // An end of sequence comes before a row starting the next sequence at the same address.
+    std.mem.sort(Row, rows.items, {}, lessThan);
+
+    var self = try encode(rows.items, allocator);
+    errdefer self.deinit();
+    self.files = try files.toOwnedSlice();
+    return self;
+}
+
+/// Free the table.
+pub fn deinit(self: Self) void {
+    self.allocator.free(self.files);
+    self.allocator.free(self.checkpoints);
+    self.allocator.free(self.data);
+}
+
+/// Find the source location of the instruction at the address.
+/// Returns null if the address is not covered by the table.
+pub fn lookup(self: Self, addr: u64) ?Location {
+    const row = findRow(self.checkpoints, self.data, self.len, addr) orelse return null;
+    return .{ .file = self.files[row.file], .line = row.line };
+}
+
+/// Find the row covering the address from the encoded rows.
+/// Returns null if the address is not covered by any line.
+pub fn findRow(checkpoints: []const Checkpoint, data: []const u8, len: usize, addr: u64) ?Row {
+    // Find the last block whose first address is less than or equal to the address.
+    var left: usize = 0;
+    var right: usize = checkpoints.len;
+    while (left < right) {
+        const mid = left + (right - left) / 2;
+        if (checkpoints[mid].address <= addr) {
+            left = mid + 1;
+        } else {
+            right = mid;
+        }
+    }
+    if (left == 0) return null;
+    const block = left - 1;
+    const checkpoint = checkpoints[block];
+
+    // Decode rows in the block until the next row starts after the address.
+    var stream = std.io.fixedBufferStream(data);
+    stream.pos = checkpoint.offset;
+    const rdr = stream.reader();
+
+    var row = Row{
+        .address = checkpoint.address,
+        .line = leb.readULEB128(u32, rdr) catch return null,
+        .file = leb.readULEB128(u32, rdr) catch return null,
+    };
+    const end = @min(len, (block + 1) * block_size);
+    for (block * block_size + 1..end) |_| {
+        const delta = leb.readULEB128(u64, rdr) catch return null;
+        if (row.address + delta > addr) break;
+
+        const line_delta = leb.readILEB128(i64, rdr) catch return null;
+        row.address += delta;
+        row.line = @intCast(@as(i64, row.line) + line_delta);
+        row.file = leb.readULEB128(u32, rdr) catch return null;
+    }
+
+    return if (row.line == 0) null else row;
+}
+
+/// Encode sorted rows into blocks.
+/// `files` of the returned table is left empty.
+fn encode(rows: []const Row, allocator: Allocator) !Self {
+    var checkpoints = ArrayList(Checkpoint).init(allocator);
+    errdefer checkpoints.deinit();
+    var data = ArrayList(u8).init(allocator);
+    errdefer data.deinit();
+    const writer = data.writer();
+
+    for (rows, 0..) |row, i| {
+        if (i % block_size == 0) {
+            try checkpoints.append(.{
+                .address = row.address,
+                .offset = @intCast(data.items.len),
+            });
+            try leb.writeULEB128(writer, row.line);
+        } else {
+            const prev = rows[i - 1];
+            try leb.writeULEB128(writer, row.address - prev.address);
+            try leb.writeILEB128(writer, @as(i64, row.line) - @as(i64, prev.line));
+        }
+        try leb.writeULEB128(writer, row.file);
+    }
+
+    return .{
+        .files = &.{},
+        .checkpoints = try checkpoints.toOwnedSlice(),
+        .data = try data.toOwnedSlice(),
+        .len = rows.len,
+        .allocator = allocator,
+    };
+}
+
+/// Parse a single line number program and append its files and rows.
+fn parseUnit(
+    elf: Elf,
+    /// Stream of .debug_line positioned at the start of the program header.
+    stream: *Stream,
+    files: *ArrayList(File),
+    rows: *ArrayList(Row),
+    allocator: Allocator,
+) !void {
+    const rdr = stream.reader();
+
+    // Header.
+    const unit_length = try rdr.readInt(u32, .little);
+    if (unit_length == 0xFFFF_FFFF) {
+        // NOTE: DWARF bit specific
+        return LineError.UnsupportedFormat;
+    }
+    const unit_end = stream.pos + unit_length;
+    if (unit_end > stream.buffer.len) return LineError.EndOfStream;
+
+    const version = try rdr.readInt(u16, .little);
+    if (version < 2 or version > 5) return LineError.UnsupportedVersion;
+    if (version >= 5) {
+        const address_size = try rdr.readByte();
+        _ = try rdr.readByte(); // segment_selector_size
+        if (address_size != 8) return LineError.UnsupportedFormat;
+    }
+    const header_length = try rdr.readInt(u32, .little);
+    const program_start = stream.pos + header_length;
+    if (program_start > unit_end) return LineError.EndOfStream;
+
+    const min_inst_length = try rdr.readByte();
+    if (version >= 4) {
+        // maximum_operations_per_instruction is only meaningful for VLIW.
+        _ = try rdr.readByte();
+    }
+    _ = try rdr.readByte(); // default_is_stmt
+    const line_base = try rdr.readByteSigned();
+    const line_range = try rdr.readByte();
+    const opcode_base = try rdr.readByte();
+    if (line_range == 0 or opcode_base == 0) return LineError.UnsupportedFormat;
+    var std_lengths: [255]u8 = undefined;
+    try rdr.readNoEof(std_lengths[0 .. opcode_base - 1]);
+
+    // Directory and file name tables.
+    var dirs = ArrayList([]const u8).init(allocator);
+    defer dirs.deinit();
+    const file_base = files.items.len;
+    if (version >= 5) {
+        try parseEntriesV5(elf, stream, &dirs, files);
+    } else {
+        try parseEntriesV4(stream, &dirs, files);
+    }
+    // File indices are 1-based before DWARF v5.
+    const file_index_base: u64 = if (version >= 5) 0 else 1;
+
+    // Line number program.
+    stream.pos = program_start;
+    var address: u64 = 0;
+    var file: u64 = 1;
+    var line: i64 = 1;
+    var seq_start = rows.items.len;
+
+    while (stream.pos < unit_end) {
+        const opcode = try rdr.readByte();
+
+        // Special opcodes.
+        if (opcode >= opcode_base) {
+            const adjusted = opcode - opcode_base;
+            address +%= @as(u64, adjusted / line_range) * min_inst_length;
+            line += line_base + @as(i64, adjusted % line_range);
+            try appendRow(rows, address, line, try globalFile(files, file_base, file_index_base, file));
+            continue;
+        }
+
+        switch (opcode) {
+            // Extended opcodes.
+            0 => {
+                const len = try leb.readULEB128(u64, rdr);
+                if (len == 0) continue;
+                if (len > unit_end - stream.pos) return LineError.EndOfStream;
+                const ext_end = stream.pos + len;
+
+                switch (try rdr.readByte()) {
+                    // DW_LNE_end_sequence
+                    0x01 => {
+                        try appendRow(rows, address, 0, 0);
+                        // Discard sequences of functions removed by the linker.
+                        if (isTombstone(rows.items[seq_start].address)) {
+                            rows.shrinkRetainingCapacity(seq_start);
+                        }
+                        seq_start = rows.items.len;
+                        address = 0;
+                        file = 1;
+                        line = 1;
+                    },
+                    // DW_LNE_set_address
+                    0x02 => address = try rdr.readInt(u64, .little),
+                    // DW_LNE_define_file
+                    0x03 => try files.append(try readFileV4(stream, dirs.items)),
+                    else => {},
+                }
+                stream.pos = @intCast(ext_end);
+            },
+            // DW_LNS_copy
+            0x01 => try appendRow(rows, address, line, try globalFile(files, file_base, file_index_base, file)),
+            // DW_LNS_advance_pc
+            0x02 => address +%= try leb.readULEB128(u64, rdr) * min_inst_length,
+            // DW_LNS_advance_line
+            0x03 => line += try leb.readILEB128(i64, rdr),
+            // DW_LNS_set_file
+            0x04 => file = try leb.readULEB128(u64, rdr),
+            // DW_LNS_const_add_pc
+            0x08 => address +%= @as(u64, (255 - opcode_base) / line_range) * min_inst_length,
+            // DW_LNS_fixed_advance_pc
+            0x09 => address +%= try rdr.readInt(u16, .little),
+            // Other standard opcodes do not affect the table. Skip their operands.
+            else => {
+                for (0..std_lengths[opcode - 1]) |_| {
+                    _ = try leb.readULEB128(u64, rdr);
+                }
+            },
+        }
+    }
+
+    stream.pos = unit_end;
+}
+
+/// Parse the directory and file name tables of DWARF v2 to v4.
+fn parseEntriesV4(stream: *Stream, dirs: *ArrayList([]const u8), files: *ArrayList(File)) !void {
+    // Directory 0 is the compilation directory, which is not in the table.
+    try dirs.append("");
+    while (true) {
+        const dir = try readString(stream);
+        if (dir.len == 0) break;
+        try dirs.append(dir);
+    }
+
+    while (stream.buffer.len > stream.pos and stream.buffer[stream.pos] != 0) {
+        try files.append(try readFileV4(stream, dirs.items));
+    }
+    _ = try stream.reader().readByte();
+}
+
+/// Read a file entry of DWARF v2 to v4.
+fn readFileV4(stream: *Stream, dirs: []const []const u8) !File {
+    const rdr = stream.reader();
+    const name = try readString(stream);
+    const dir = try leb.readULEB128(u64, rdr);
+    _ = try leb.readULEB128(u64, rdr); // modification time
+    _ = try leb.readULEB128(u64, rdr); // file length
+
+    return .{
+        .dir = if (dir < dirs.len) dirs[dir] else "",
+        .name = name,
+    };
+}
+
+/// Parse the directory and file name tables of DWARF v5.
+fn parseEntriesV5(elf: Elf, stream: *Stream, dirs: *ArrayList([]const u8), files: *ArrayList(File)) !void {
+    const rdr = stream.reader();
+    var formats: [max_entry_formats]EntryFormat = undefined;
+
+    var num_formats = try readEntryFormats(stream, &formats);
+    const num_dirs = try leb.readULEB128(u64, rdr);
+    for (0..num_dirs) |_| {
+        const entry = try readEntryV5(elf, stream, formats[0..num_formats]);
+        try dirs.append(entry.path);
+    }
+
+    num_formats = try readEntryFormats(stream, &formats);
+    const num_files = try leb.readULEB128(u64, rdr);
+    for (0..num_files) |_| {
+        const entry = try readEntryV5(elf, stream, formats[0..num_formats]);
+        try files.append(.{
+            .dir = if (entry.dir < dirs.items.len) dirs.items[entry.dir] else "",
+            .name = entry.path,
+        });
+    }
+}
+
+/// Read the entry format description of DWARF v5.
+/// Returns the number of formats.
+fn readEntryFormats(stream: *Stream, formats: *[max_entry_formats]EntryFormat) !usize {
+    const rdr = stream.reader();
+    const count = try rdr.readByte();
+    if (count > max_entry_formats) return LineError.UnsupportedFormat;
+
+    for (formats[0..count]) |*format| {
+        const content = try leb.readULEB128(u64, rdr);
+        const form = try leb.readULEB128(u64, rdr);
+        format.* = .{
+            .content = content,
+            .form = std.meta.intToEnum(AttributeForm, form) catch return LineError.UnsupportedForm,
+        };
+    }
+
+    return count;
+}
+
+/// Read a directory or file name entry of DWARF v5.
+/// Only the path and the directory index are kept.
+fn readEntryV5(elf: Elf, stream: *Stream, formats: []const EntryFormat) !struct { path: []const u8, dir: u64 } {
+    const rdr = stream.reader();
+    var path: []const u8 = "";
+    var dir: u64 = 0;
+
+    for (formats) |format| {
+        switch (format.form) {
+            .String, .LineStrp, .Strp => {
+                const s = switch (format.form) {
+                    .String => try readString(stream),
+                    .LineStrp => elf.debugLineStr(try rdr.readInt(u32, .little)) orelse return LineError.InvalidString,
+                    else => elf.debugStr(try rdr.readInt(u32, .little)) orelse return LineError.InvalidString,
+                };
+                if (format.content == lnct_path) path = s;
+            },
+            .UData, .Data1, .Data2, .Data4, .Data8 => {
+                const v: u64 = switch (format.form) {
+                    .UData => try leb.readULEB128(u64, rdr),
+                    .Data1 => try rdr.readInt(u8, .little),
+                    .Data2 => try rdr.readInt(u16, .little),
+                    .Data4 => try rdr.readInt(u32, .little),
+                    else => try rdr.readInt(u64, .little),
+                };
+                if (format.content == lnct_directory_index) dir = v;
+            },
+            .Data16 => try skip(stream, 16),
+            .Block => try skip(stream, try leb.readULEB128(u64, rdr)),
+            else => return LineError.UnsupportedForm,
+        }
+    }
+
+    return .{ .path = path, .dir = dir };
+}
+
+/// Append a row to the table.
+fn appendRow(rows: *ArrayList(Row), address: u64, line: i64, file: u32) !void {
+    try rows.append(.{
+        .address = address,
+        .line = @intCast(std.math.clamp(line, 0, std.math.maxInt(u32))),
+        .file = file,
+    });
+}
+
+/// Convert the file index in the line number program into the index of `files`.
+fn globalFile(files: *const ArrayList(File), file_base: usize, file_index_base: u64, file: u64) LineError!u32 {
+    if (file < file_index_base) return LineError.InvalidFile;
+    const index = file_base + (file - file_index_base);
+    if (index >= files.items.len) return LineError.InvalidFile;
+    return @intCast(index);
+}
+
+/// Check if the address is a tombstone the linker puts for removed code.
+fn isTombstone(address: u64) bool {
+    return address == 0 or address >= std.math.maxInt(u64) - 1;
+}
+
+/// Read a null-terminated string without copying it.
+fn readString(stream: *Stream) LineError![]const u8 {
+    const rest = stream.buffer[stream.pos..];
+    const len = std.mem.indexOfScalar(u8, rest, 0) orelse return LineError.InvalidString;
+    stream.pos += len + 1;
+    return rest[0..len];
+}
+
+fn skip(stream: *Stream, len: u64) LineError!void {
+    if (len > stream.buffer.len - stream.pos) return LineError.EndOfStream;
+    stream.pos += @intCast(len);
+}
+
+fn lessThan(_: void, a: Row, b: Row) bool {
+    if (a.address != b.address) return a.address < b.address;
+    return a.line == 0 and b.line != 0;
+}
+
+const testing = std.testing;
+
+test "Encode and look up rows" {
+    const rows = [_]Row{
+        .{ .address = 0x1000, .line = 10, .file = 0 },
+        .{ .address = 0x1004, .line = 12, .file = 0 },
+        .{ .address = 0x1010, .line = 5, .file = 1 },
+        .{ .address = 0x1020, .line = 0, .file = 0 },
+        .{ .address = 0x2000, .line = 100, .file = 1 },
+    } ++ [_]Row{.{ .address = 0x2000, .line = 101, .file = 1 }} ** block_size ++ [_]Row{
+        .{ .address = 0x3000, .line = 0, .file = 0 },
+    };
+    var table = try encode(&rows, testing.allocator);
+    var files = [_]File{
+        .{ .dir = "", .name = "a.zig" },
+        .{ .dir = "", .name = "b.zig" },
+    };
+    table.files = &files;
+    defer {
+        table.files = &.{};
+        table.deinit();
+    }
+
+    try testing.expectEqual(2, table.checkpoints.len);
+    try testing.expectEqual(null, table.lookup(0xFFF));
+    try testing.expectEqual(10, table.lookup(0x1000).?.line);
+    try testing.expectEqual(10, table.lookup(0x1003).?.line);
+    try testing.expectEqual(12, table.lookup(0x1004).?.line);
+    try testing.expectEqualStrings("b.zig", table.lookup(0x101F).?.file.name);
+    try testing.expectEqual(null, table.lookup(0x1020));
+    try testing.expectEqual(101, table.lookup(0x2000).?.line);
+    try testing.expectEqual(101, table.lookup(0x2FFF).?.line);
+    try testing.expectEqual(null, table.lookup(0x3000));
+}
+
+test "Look up source locations of functions" {
+    const AbbrevTable = @import("AbbreviationTable.zig");
+    const CompilationUnit = @import("CompilationUnit.zig");
+    const AddressIndex = @import("AddressIndex.zig");
+
+    const bin align(0x100) = @embedFile("dwarf-elf").*;
+    const elf = try Elf.new(&bin);
+    const abbr_tbls = try AbbrevTable.parse(elf, std.heap.page_allocator);
+    const cus = try CompilationUnit.parse(elf, abbr_tbls, testing.allocator);
+    defer {
+        for (cus) |*cu| cu.deinit();
+        testing.allocator.free(cus);
+    }
+    const index = try AddressIndex.build(cus, testing.allocator);
+    defer index.deinit();
+
+    const table = try build(elf, testing.allocator);
+    defer table.deinit();
+
+    // `fibo` is defined in tests/dwarf/main.zig.
+    const fibo = for (index.entries) |ent| {
+        if (std.mem.endsWith(u8, ent.name, "fibo")) break ent;
+    } else return error.TestUnexpectedResult;
+    const loc = table.lookup(fibo.low_pc).?;
+    try testing.expect(std.mem.endsWith(u8, loc.file.name, "main.zig"));
+    try testing.expect(3 <= loc.line and loc.line <= 8);
+}
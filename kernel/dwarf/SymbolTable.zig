@@ -0,0 +1,267 @@
+//! This file defines a compact symbol table embedded into the kernel image at build time.
+//!
+//! The table is generated from DWARF of the linked kernel by `tools/symtab.zig`,
+//! and contains function address ranges of `AddressIndex` and line rows of `LineTable`.
+//! The kernel can look up symbols and source locations without parsing DWARF or allocating memory.
+//!
+//! Layout of the table (little-endian, each array is 8-byte aligned):
+//!
+//!   Header
+//!   [num_functions]Function        sorted by `low_pc`
+//!   [num_checkpoints]Checkpoint    see `LineTable`
+//!   [num_files]FileEntry
+//!   [line_data_size]u8             delta-encoded line rows, see `LineTable`
+//!   [strtab_size]u8                null-terminated strings
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const ArrayList = std.ArrayList;
+
+const AddressIndex = @import("AddressIndex.zig");
+const LineTable = @import("LineTable.zig");
+const Checkpoint = LineTable.Checkpoint;
+
+const Self = @This();
+const SymbolTable = Self;
+
+/// Functions sorted by `low_pc`.
+functions: []const Function,
+/// The first line row of each block.
+checkpoints: []const Checkpoint,
+/// Files referred by line rows.
+files: []const FileEntry,
+/// Delta-encoded line rows.
+line_data: []const u8,
+/// Number of line rows.
+num_rows: usize,
+/// String table.
+strtab: []const u8,
+
+/// Magic of the table.
+const magic = "ZSYM".*;
+/// Version of the table format.
+const version = 1;
+
+/// Header of the table.
+pub const Header = extern struct {
+    /// Magic.
+    magic: [4]u8 = magic,
+    /// Format version.
+    version: u32 = version,
+    /// Number of functions.
+    num_functions: u32,
+    /// Number of line checkpoints.
+    num_checkpoints: u32,
+    /// Number of files.
+    num_files: u32,
+    /// Number of line rows.
+    num_rows: u32,
+    /// Size in bytes of delta-encoded line rows.
+    line_data_size: u32,
+    /// Size in bytes of the string table.
+    strtab_size: u32,
+};
+
+/// Address range of a function.
+pub const Function = extern struct {
+    /// Start address.
+    low_pc: u64,
+    /// Size in bytes.
+    size: u32,
+    /// Offset of the name in the string table.
+    name: u32,
+};
+
+/// Source file.
+pub const FileEntry = extern struct {
+    /// Offset of the directory name in the string table.
+    dir: u32,
+    /// Offset of the file name in the string table.
+    name: u32,
+};
+
+/// Function containing an address.
+pub const Symbol = struct {
+    /// Name of the function.
+    name: []const u8,
+    /// Offset of the address from the start of the function.
+    offset: u64,
+};
+
+/// Interpret the bytes as a symbol table.
+/// Returns null if the bytes are not a valid table.
+pub fn init(bytes: []align(8) const u8) ?Self {
+    if (bytes.len < @sizeOf(Header)) return null;
+    const header: *const Header = @ptrCast(bytes.ptr);
+    if (!std.mem.eql(u8, &header.magic, &magic) or header.version != version) return null;
+
+    var offset: usize = @sizeOf(Header);
+    return .{
+        .functions = section(Function, bytes, &offset, header.num_functions) orelse return null,
+        .checkpoints = section(Checkpoint, bytes, &offset, header.num_checkpoints) orelse return null,
+        .files = section(FileEntry, bytes, &offset, header.num_files) orelse return null,
+        .line_data = section(u8, bytes, &offset, header.line_data_size) orelse return null,
+        .num_rows = header.num_rows,
+        .strtab = section(u8, bytes, &offset, header.strtab_size) orelse return null,
+    };
+}
+
+/// Find the function containing the address.
+pub fn findFunction(self: Self, addr: u64) ?Symbol {
+    // Find the first function whose `low_pc` is greater than the address.
+    var left: usize = 0;
+    var right: usize = self.functions.len;
+    while (left < right) {
+        const mid = left + (right - left) / 2;
+        if (self.functions[mid].low_pc <= addr) {
+            left = mid + 1;
+        } else {
+            right = mid;
+        }
+    }
+
+    if (left == 0) return null;
+    const func = self.functions[left - 1];
+    if (addr - func.low_pc >= func.size) return null;
+
+    return .{
+        .name = self.string(func.name),
+        .offset = addr - func.low_pc,
+    };
+}
+
+/// Find the source location of the instruction at the address.
+pub fn findLine(self: Self, addr: u64) ?LineTable.Location {
+    const row = LineTable.findRow(self.checkpoints, self.line_data, self.num_rows, addr) orelse return null;
+    if (row.file >= self.files.len) return null;
+    const file = self.files[row.file];
+
+    return .{
+        .file = .{ .dir = self.string(file.dir), .name = self.string(file.name) },
+        .line = row.line,
+    };
+}
+
+/// Get the string at the offset of the string table.
+fn string(self: Self, offset: u32) []const u8 {
+    if (offset >= self.strtab.len) return "";
+    return std.mem.sliceTo(self.strtab[offset..], 0);
+}
+
+/// Get the array of `n` elements at the offset and advance the offset.
+fn section(comptime T: type, bytes: []align(8) const u8, offset: *usize, n: usize) ?[]const T {
+    const size = @sizeOf(T) * n;
+    if (bytes.len - offset.* < size) return null;
+
+    const ptr: [*]const T = @alignCast(@ptrCast(bytes.ptr + offset.*));
+    offset.* += size;
+    return ptr[0..n];
+}
+
+/// Serialize functions and line rows into a symbol table.
+/// If `lines` is null, the table has no line information.
+/// Caller owns the returned memory.
+pub fn serialize(functions: []const AddressIndex.Entry, lines: ?LineTable, allocator: Allocator) ![]u8 {
+    var strtab = StringTable.init(allocator);
+    defer strtab.deinit();
+    _ = try strtab.put("");
+
+    var out = ArrayList(u8).init(allocator);
+    errdefer out.deinit();
+    const writer = out.writer();
+
+    const checkpoints: []const Checkpoint = if (lines) |l| l.checkpoints else &.{};
+    const files: []const LineTable.File = if (lines) |l| l.files else &.{};
+    const line_data: []const u8 = if (lines) |l| l.data else &.{};
+
+    // The header is filled after the string table is built.
+    try writer.writeStruct(std.mem.zeroes(Header));
+    for (functions) |func| {
+        try writer.writeStruct(Function{
+            .low_pc = func.low_pc,
+            .size = @intCast(func.high_pc - func.low_pc),
+            .name = try strtab.put(func.name),
+        });
+    }
+    for (checkpoints) |checkpoint| {
+        try writer.writeStruct(checkpoint);
+    }
+    for (files) |file| {
+        try writer.writeStruct(FileEntry{
+            .dir = try strtab.put(file.dir),
+            .name = try strtab.put(file.name),
+        });
+    }
+    try writer.writeAll(line_data);
+    try writer.writeAll(strtab.bytes.items);
+
+    const header: *align(1) Header = @ptrCast(out.items.ptr);
+    header.* = .{
+        .num_functions = @intCast(functions.len),
+        .num_checkpoints = @intCast(checkpoints.len),
+        .num_files = @intCast(files.len),
+        .num_rows = @intCast(if (lines) |l| l.len else 0),
+        .line_data_size = @intCast(line_data.len),
+        .strtab_size = @intCast(strtab.bytes.items.len),
+    };
+
+    return out.toOwnedSlice();
+}
+
+/// String table that deduplicates strings.
+const StringTable = struct {
+    /// Null-terminated strings.
+    bytes: ArrayList(u8),
+    /// Map of a string to its offset.
+    map: std.StringHashMap(u32),
+
+    fn init(allocator: Allocator) StringTable {
+        return .{
+            .bytes = ArrayList(u8).init(allocator),
+            .map = std.StringHashMap(u32).init(allocator),
+        };
+    }
+
+    fn deinit(self: *StringTable) void {
+        self.bytes.deinit();
+        self.map.deinit();
+    }
+
+    /// Add the string and return its offset.
+    /// The string MUST outlive the table.
+    fn put(self: *StringTable, s: []const u8) !u32 {
+        if (self.map.get(s)) |offset| return offset;
+
+        const offset: u32 = @intCast(self.bytes.items.len);
+        try self.bytes.appendSlice(s);
+        try self.bytes.append(0);
+        try self.map.put(s, offset);
+        return offset;
+    }
+};
+
+const testing = std.testing;
+
+test "Serialize and look up symbols" {
+    const functions = [_]AddressIndex.Entry{
+        .{ .low_pc = 0x1000, .high_pc = 0x1010, .name = "foo" },
+        .{ .low_pc = 0x1020, .high_pc = 0x1080, .name = "bar" },
+    };
+    const bytes = try serialize(&functions, null, testing.allocator);
+    defer testing.allocator.free(bytes);
+
+    // Copy to an aligned buffer as the kernel image does.
+    const aligned = try testing.allocator.alignedAlloc(u8, 8, bytes.len);
+    defer testing.allocator.free(aligned);
+    @memcpy(aligned, bytes);
+
+    const table = SymbolTable.init(aligned).?;
+    try testing.expectEqual(null, table.findFunction(0xFFF));
+    try testing.expectEqualStrings("foo", table.findFunction(0x1000).?.name);
+    try testing.expectEqual(0xF, table.findFunction(0x100F).?.offset);
+    try testing.expectEqual(null, table.findFunction(0x1010));
+    try testing.expectEqualStrings("bar", table.findFunction(0x107F).?.name);
+    try testing.expectEqual(null, table.findLine(0x1000));
+
+    try testing.expectEqual(null, SymbolTable.init(aligned[0..8]));
+}
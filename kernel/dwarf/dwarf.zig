@@ -1,14 +1,20 @@
 const std = @import("std");
 
-const Elf = @import("elf.zig");
-const AbbreviationTable = @import("AbbreviationTable.zig");
-const CompilationUnit = @import("CompilationUnit.zig");
+pub const Elf = @import("elf.zig");
+pub const AbbreviationTable = @import("AbbreviationTable.zig");
+pub const CompilationUnit = @import("CompilationUnit.zig");
+pub const AddressIndex = @import("AddressIndex.zig");
+pub const LineTable = @import("LineTable.zig");
+pub const SymbolTable = @import("SymbolTable.zig");
 
 test {
     std.testing.refAllDeclsRecursive(@This());
     std.testing.refAllDeclsRecursive(Elf);
     std.testing.refAllDeclsRecursive(AbbreviationTable);
     std.testing.refAllDeclsRecursive(CompilationUnit);
+    std.testing.refAllDeclsRecursive(AddressIndex);
+    std.testing.refAllDeclsRecursive(LineTable);
+    std.testing.refAllDeclsRecursive(SymbolTable);
 }
 
 test "Can read DWARF example program in a test" {
@@ -15,15 +15,20 @@ pub const Elf = struct {
     /// debug_info section
     debug_info: []const u8,
     /// debug_loc section
+    /// Empty if the binary does not have it.
     debug_loc: []const u8,
     /// debug_abbrev section
     debug_abbrev: []const u8,
-    /// debug_aranges section
+    /// debug_ranges section
+    /// Empty if the binary does not have it.
     debug_ranges: []const u8,
     /// debug_str section
     debug_str: []const u8,
     /// debug_line section
     debug_line: []const u8,
+    /// debug_line_str section (DWARF v5).
+    /// Empty if the binary does not have it.
+    debug_line_str: []const u8,
     // ELF header
     header: ElfHeader,
 
@@ -36,29 +41,35 @@ pub const Elf = struct {
         const header = try ElfHeader.new(bin);
         var self = Self{
             .debug_info = undefined,
-            .debug_loc = undefined,
+            .debug_loc = &.{},
             .debug_abbrev = undefined,
-            .debug_ranges = undefined,
+            .debug_ranges = &.{},
             .debug_str = undefined,
             .debug_line = undefined,
+            .debug_line_str = &.{},
             .header = header,
             .bin = bin,
         };
 
         const err = ElfError.SectionNotFound;
         const debug_info = self.sectionHeader(".debug_info") orelse return err;
-        const debug_loc = self.sectionHeader(".debug_loc") orelse return err;
         const debug_abbrev = self.sectionHeader(".debug_abbrev") orelse return err;
-        const debug_ranges = self.sectionHeader(".debug_ranges") orelse return err;
         const debug_str = self.sectionHeader(".debug_str") orelse return err;
         const debug_line = self.sectionHeader(".debug_line") orelse return err;
 
         self.debug_info = (bin + debug_info.offset)[0..debug_info.size];
-        self.debug_loc = (bin + debug_loc.offset)[0..debug_loc.size];
         self.debug_abbrev = (bin + debug_abbrev.offset)[0..debug_abbrev.size];
-        self.debug_ranges = (bin + debug_ranges.offset)[0..debug_ranges.size];
         self.debug_str = (bin + debug_str.offset)[0..debug_str.size];
         self.debug_line = (bin + debug_line.offset)[0..debug_line.size];
+        if (self.sectionHeader(".debug_loc")) |debug_loc| {
+            self.debug_loc = (bin + debug_loc.offset)[0..debug_loc.size];
+        }
+        if (self.sectionHeader(".debug_ranges")) |debug_ranges| {
+            self.debug_ranges = (bin + debug_ranges.offset)[0..debug_ranges.size];
+        }
+        if (self.sectionHeader(".debug_line_str")) |debug_line_str| {
+            self.debug_line_str = (bin + debug_line_str.offset)[0..debug_line_str.size];
+        }
 
         return self;
     }
@@ -89,6 +100,13 @@ pub const Elf = struct {
 
         return null;
     }
+
+    /// Get the string from .debug_line_str section.
+    pub fn debugLineStr(self: Self, offset: u64) ?[]const u8 {
+        if (offset >= self.debug_line_str.len) return null;
+        const len = std.mem.indexOfScalar(u8, self.debug_line_str[offset..], 0) orelse return null;
+        return self.debug_line_str[offset .. offset + len];
+    }
 };
 
 /// ELF header.
@@ -238,5 +238,11 @@ pub const AttributeForm = enum(u64) {
     SecOffset = 0x17,
     Exprloc = 0x18,
     FlagPresent = 0x19,
+    Strx = 0x1A,
+    Addrx = 0x1B,
+    RefSup4 = 0x1C,
+    StrpSup = 0x1D,
+    Data16 = 0x1E,
+    LineStrp = 0x1F,
     RefSig8 = 0x20,
 };
@@ -7,21 +7,24 @@ const std = @import("std");
 const Allocator = std.mem.Allocator;
 
 const zakuro = @import("zakuro");
-const FixedSizeQueue = zakuro.lib.queue.FixedSizeQueue;
+const Mpsc = zakuro.lib.ring.Mpsc;
 
-const EventQueue = FixedSizeQueue(EventMessage);
+/// Interrupt handlers and the main loop push messages, and only the main loop pops them.
+const EventQueue = Mpsc(EventMessage);
 
 /// Event queue instance.
+/// The queue is lock-free, so interrupts need not be disabled to access it.
 var queue: EventQueue = undefined;
 
 /// Initialize the event queue instance with the given capacity.
+/// The capacity is rounded up to a power of two.
 pub fn init(capacity: usize, allocator: Allocator) !void {
     queue = try EventQueue.init(capacity, allocator);
 }
 
 /// Size of the enqueued event messages.
 pub fn size() usize {
-    return queue.len;
+    return queue.len();
 }
 
 /// Push the event message to the queue.
@@ -30,18 +33,17 @@ pub fn push(event: EventMessage) !void {
 }
 
 /// Pop the event message from the queue.
+/// This function MUST be called only from the main loop.
 pub fn pop() ?EventMessage {
     return queue.pop();
 }
 
 const EventMessageType = enum {
-    mouse,
     timer,
 };
 
 /// Event message.
 /// The message is enqueued in the interrupt handler and processed in the main loop.
 pub const EventMessage = union(EventMessageType) {
-    mouse: void,
     timer: zakuro.timer.TimerMessage,
 };
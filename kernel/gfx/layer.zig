@@ -24,8 +24,10 @@ pub fn getLayers() *Layers {
 }
 
 /// Initialize the global layered writer.
-pub fn initialize(pixel_writer: PixelWriter, fb_config: gfx.FrameBufferConfig, allocator: Allocator) void {
-    layers = Layers.init(pixel_writer, fb_config, allocator);
+/// `buffer_allocator` is used for the back buffer and shadow buffers of windows,
+/// which are large but do not have to be physically contiguous.
+pub fn initialize(pixel_writer: PixelWriter, fb_config: gfx.FrameBufferConfig, allocator: Allocator, buffer_allocator: Allocator) void {
+    layers = Layers.init(pixel_writer, fb_config, allocator, buffer_allocator);
 }
 
 /// Manages a list of windows and their drawing order.
@@ -45,10 +47,12 @@ const Layers = struct {
     back_buffer_size: usize,
 
     allocator: Allocator,
+    /// Allocator for pixel buffers.
+    buffer_allocator: Allocator,
     fb_config: gfx.FrameBufferConfig,
 
-    pub fn init(writer: PixelWriter, fb_config: gfx.FrameBufferConfig, allocator: Allocator) Self {
-        const back_buffer = allocator.alloc(u8, fb_config.horizontal_resolution * fb_config.vertical_resolution * gfx.bytes_per_pixel) catch {
+    pub fn init(writer: PixelWriter, fb_config: gfx.FrameBufferConfig, allocator: Allocator, buffer_allocator: Allocator) Self {
+        const back_buffer = buffer_allocator.alloc(u8, fb_config.horizontal_resolution * fb_config.vertical_resolution * gfx.bytes_per_pixel) catch {
             @panic("Failed to allocate a back buffer for Layers.");
         };
         const back_config = allocator.create(gfx.FrameBufferConfig) catch {
@@ -64,6 +68,7 @@ const Layers = struct {
             .writer = writer,
             .windows_stack = WindowList.init(allocator),
             .allocator = allocator,
+            .buffer_allocator = buffer_allocator,
             .fb_config = fb_config,
             .back_writer = PixelWriter.new(back_config),
             .back_buffer_size = fb_config.horizontal_resolution * fb_config.vertical_resolution * gfx.bytes_per_pixel,
@@ -79,6 +84,7 @@ const Layers = struct {
             draggable,
             self.back_writer.config.*,
             self.allocator,
+            self.buffer_allocator,
         )) catch return Error.NoMemory;
         self.next_id += 1;
 
@@ -92,6 +98,9 @@ const Layers = struct {
 
     /// Renders the specified window layer and all the layers above it.
     pub fn flushLayer(self: *Self, window: *Window) void {
+        const scope = zakuro.arch.pmu.measure("flush_layer");
+        defer scope.end();
+
         var draw = false;
         for (self.windows_stack.items) |*cur_win| {
             if (cur_win.id == window.id) {
@@ -40,6 +40,9 @@ pub const Window = struct {
     data: [][]gfx.PixelColor,
     /// Memory allocator used to allocate an pixel buffer.
     allocator: Allocator,
+    /// Memory allocator used to allocate the shadow buffer.
+    /// The buffer is large, so it does not have to be physically contiguous.
+    buffer_allocator: Allocator,
     /// Writer to the shadow buffer of the frame buffer.
     /// Converting PixelColor to u8 for every pixels in a window every time window is refreshed is too expensive.
     /// Therefore, we use a shadow buffer and copy the content using memory copy when the window was flushed.
@@ -55,13 +58,14 @@ pub const Window = struct {
         draggable: bool,
         fb_config: gfx.FrameBufferConfig,
         allocator: Allocator,
+        buffer_allocator: Allocator,
     ) Error!Self {
         var data = allocator.alloc([]gfx.PixelColor, height) catch return Error.NoMemory;
         for (0..height) |y| {
             data[y] = allocator.alloc(gfx.PixelColor, width) catch return Error.NoMemory;
         }
 
-        const shadow_buffer = allocator.alloc(u8, width * height * 4) catch return Error.NoMemory;
+        const shadow_buffer = buffer_allocator.alloc(u8, width * height * 4) catch return Error.NoMemory;
         const config = allocator.create(gfx.FrameBufferConfig) catch return Error.NoMemory;
         config.frame_buffer = @ptrCast(shadow_buffer.ptr);
         config.pixel_format = fb_config.pixel_format;
@@ -77,13 +81,14 @@ pub const Window = struct {
             .origin = .{ .x = 0, .y = 0 },
             .draggable = draggable,
             .allocator = allocator,
+            .buffer_allocator = buffer_allocator,
             .shadow_writer = gfx.PixelWriter.new(config),
         };
     }
 
     pub fn deinit(self: Self) void {
         self.allocator.free(self.data);
-        self.allocator.free(self.shadow_writer.config.frame_buffer);
+        self.buffer_allocator.free(self.shadow_writer.config.frame_buffer[0 .. self.width * self.height * 4]);
     }
 
     /// Write a pixel color at the specified position.
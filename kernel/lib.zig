@@ -3,6 +3,7 @@
 const std = @import("std");
 
 pub const queue = @import("lib/queue.zig");
+pub const ring = @import("lib/ring.zig");
 
 test {
     std.testing.refAllDecls(@This());
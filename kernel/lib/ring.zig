@@ -0,0 +1,562 @@
+//! Lock-free bounded ring buffers.
+//!
+//! - `Spsc` is a single-producer single-consumer ring. Each side owns its index and caches the other's.
+//! - `Mpsc` is a multi-producer single-consumer ring.
+//! - `Mpmc` is a multi-producer multi-consumer ring.
+//!
+//! `Mpsc` and `Mpmc` tag each slot with a sequence number, so that a slot is published
+//! only after its value is written, even if another producer claims a later slot first.
+//!
+//! Capacities are powers of two, so that positions are mapped to slots by masking.
+//! Positions are free-running counters that wrap around, and the number of elements is `tail -% head`.
+//! The producer and consumer indices are placed on separate cache lines to avoid false sharing.
+//!
+//! A ring can have `Hooks` to block when it is full or empty.
+//! `notify` is called after each push and pop, and `wait` is called by `pushBlocking()` and `popBlocking()`
+//! until the operation succeeds. Without hooks, they spin.
+//!
+//! Rings never take a lock, so they can be shared between interrupt handlers and the interrupted context.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const Atomic = std.atomic.Value;
+
+pub const Error = error{
+    /// Failed to allocate memory.
+    OutOfMemory,
+    /// The ring is full.
+    QueueFull,
+};
+
+/// Size in bytes that indices are aligned to.
+const cache_line = std.atomic.cache_line;
+
+/// Hooks to block on a full or empty ring.
+pub const Hooks = struct {
+    /// Context passed to the hooks.
+    ctx: *anyopaque,
+    /// Called when an operation cannot proceed.
+    /// Returns when the ring may have changed.
+    wait: *const fn (ctx: *anyopaque) void,
+    /// Called after an element is pushed or popped.
+    notify: *const fn (ctx: *anyopaque) void,
+};
+
+/// Whether a side of a ring is used by a single thread or by multiple threads.
+const Sharing = enum {
+    /// Only one context uses the side at a time.
+    Single,
+    /// Multiple contexts use the side concurrently.
+    Multi,
+};
+
+/// Single-producer single-consumer ring.
+pub fn Spsc(comptime T: type) type {
+    return struct {
+        const Self = @This();
+
+        /// Index owned by one side, with a cached copy of the other side's index.
+        const Side = struct {
+            /// Position of the next element to write or read.
+            index: Atomic(usize) = Atomic(usize).init(0),
+            /// Last observed index of the other side.
+            cache: usize = 0,
+        };
+
+        /// Underlying slots.
+        buf: []T,
+        /// `buf.len - 1`.
+        mask: usize,
+        /// Allocator of `buf`. Null if the buffer is given by the caller.
+        allocator: ?Allocator = null,
+        /// Blocking hooks.
+        hooks: ?Hooks = null,
+
+        /// Producer side. `index` is the tail.
+        producer: Side align(cache_line) = .{},
+        /// Consumer side. `index` is the head.
+        consumer: Side align(cache_line) = .{},
+
+        /// Initialize the ring with at least `n` slots.
+        /// Caller MUST call `deinit()`.
+        pub fn init(n: usize, allocator: Allocator) Allocator.Error!Self {
+            const buf = try allocator.alloc(T, std.math.ceilPowerOfTwoAssert(usize, @max(n, 1)));
+            var self = initBuffer(buf);
+            self.allocator = allocator;
+            return self;
+        }
+
+        /// Initialize the ring on the given buffer.
+        /// The length of the buffer MUST be a power of two.
+        pub fn initBuffer(buf: []T) Self {
+            std.debug.assert(std.math.isPowerOfTwo(buf.len));
+            return Self{ .buf = buf, .mask = buf.len - 1 };
+        }
+
+        /// Free the buffer if it is allocated by `init()`.
+        pub fn deinit(self: *Self) void {
+            if (self.allocator) |allocator| allocator.free(self.buf);
+        }
+
+        /// Number of slots.
+        pub fn capacity(self: *const Self) usize {
+            return self.buf.len;
+        }
+
+        /// Number of elements in the ring.
+        /// The value can be stale if the other side is running concurrently.
+        pub fn len(self: *const Self) usize {
+            return self.producer.index.load(.acquire) -% self.consumer.index.load(.acquire);
+        }
+
+        /// Push an element to the back of the ring.
+        /// This function MUST be called only from the producer.
+        pub fn push(self: *Self, elem: T) Error!void {
+            if (self.pushBatch(&.{elem}) == 0) return Error.QueueFull;
+        }
+
+        /// Push as many elements as possible and publish them at once.
+        /// Returns the number of pushed elements.
+        /// This function MUST be called only from the producer.
+        pub fn pushBatch(self: *Self, elems: []const T) usize {
+            const tail = self.producer.index.load(.monotonic);
+            var free = self.buf.len - (tail -% self.producer.cache);
+            if (free < elems.len) {
+                self.producer.cache = self.consumer.index.load(.acquire);
+                free = self.buf.len - (tail -% self.producer.cache);
+            }
+
+            const n = @min(free, elems.len);
+            if (n == 0) return 0;
+            for (elems[0..n], 0..) |elem, i| {
+                self.buf[(tail +% i) & self.mask] = elem;
+            }
+            self.producer.index.store(tail +% n, .release);
+            if (self.hooks) |h| h.notify(h.ctx);
+            return n;
+        }
+
+        /// Get the front element of the ring and remove it.
+        /// This function MUST be called only from the consumer.
+        pub fn pop(self: *Self) ?T {
+            var elem: [1]T = undefined;
+            return if (self.popBatch(&elem) == 0) null else elem[0];
+        }
+
+        /// Pop as many elements as fit in `out` and release their slots at once.
+        /// Returns the number of popped elements.
+        /// This function MUST be called only from the consumer.
+        pub fn popBatch(self: *Self, out: []T) usize {
+            const head = self.consumer.index.load(.monotonic);
+            var avail = self.consumer.cache -% head;
+            if (avail < out.len) {
+                self.consumer.cache = self.producer.index.load(.acquire);
+                avail = self.consumer.cache -% head;
+            }
+
+            const n = @min(avail, out.len);
+            if (n == 0) return 0;
+            for (out[0..n], 0..) |*elem, i| {
+                elem.* = self.buf[(head +% i) & self.mask];
+            }
+            self.consumer.index.store(head +% n, .release);
+            if (self.hooks) |h| h.notify(h.ctx);
+            return n;
+        }
+
+        /// Push an element, waiting while the ring is full.
+        pub fn pushBlocking(self: *Self, elem: T) void {
+            while (true) {
+                self.push(elem) catch {
+                    waitFor(self.hooks);
+                    continue;
+                };
+                return;
+            }
+        }
+
+        /// Pop an element, waiting while the ring is empty.
+        pub fn popBlocking(self: *Self) T {
+            while (true) {
+                return self.pop() orelse {
+                    waitFor(self.hooks);
+                    continue;
+                };
+            }
+        }
+    };
+}
+
+/// Multi-producer single-consumer ring.
+pub fn Mpsc(comptime T: type) type {
+    return Sequenced(T, .Multi, .Single);
+}
+
+/// Multi-producer multi-consumer ring.
+pub fn Mpmc(comptime T: type) type {
+    return Sequenced(T, .Multi, .Multi);
+}
+
+/// Ring whose slots are tagged with sequence numbers.
+/// A slot for position `p` is free when its sequence is `p`,
+/// and holds an element when its sequence is `p + 1`.
+/// Popping the element sets the sequence to `p + capacity`, the position of the next lap.
+fn Sequenced(comptime T: type, comptime producers: Sharing, comptime consumers: Sharing) type {
+    return struct {
+        const Self = @This();
+
+        /// Slot of the ring.
+        const Slot = struct {
+            /// Sequence number.
+            seq: Atomic(usize),
+            /// Element.
+            value: T,
+        };
+
+        /// Underlying slots.
+        slots: []Slot,
+        /// `slots.len - 1`.
+        mask: usize,
+        /// Allocator of `slots`.
+        allocator: Allocator,
+        /// Blocking hooks.
+        hooks: ?Hooks = null,
+
+        /// Position of the next element to write.
+        tail: Atomic(usize) align(cache_line) = Atomic(usize).init(0),
+        /// Position of the next element to read.
+        head: Atomic(usize) align(cache_line) = Atomic(usize).init(0),
+
+        /// Initialize the ring with at least `n` slots.
+        /// Caller MUST call `deinit()`.
+        pub fn init(n: usize, allocator: Allocator) Allocator.Error!Self {
+            const slots = try allocator.alloc(Slot, std.math.ceilPowerOfTwoAssert(usize, @max(n, 1)));
+            for (slots, 0..) |*slot, i| {
+                slot.seq = Atomic(usize).init(i);
+            }
+            return Self{
+                .slots = slots,
+                .mask = slots.len - 1,
+                .allocator = allocator,
+            };
+        }
+
+        /// Free the underlying slots.
+        pub fn deinit(self: *Self) void {
+            self.allocator.free(self.slots);
+        }
+
+        /// Number of slots.
+        pub fn capacity(self: *const Self) usize {
+            return self.slots.len;
+        }
+
+        /// Number of elements in the ring, including the ones being written or read.
+        /// The value can be stale if other contexts are running concurrently.
+        pub fn len(self: *const Self) usize {
+            const head = self.head.load(.acquire);
+            const tail = self.tail.load(.acquire);
+            // A consumer can pass the tail observed before it.
+            return if (tail -% head > self.slots.len) 0 else tail -% head;
+        }
+
+        /// Push an element to the back of the ring.
+        pub fn push(self: *Self, elem: T) Error!void {
+            const pos = self.claim(&self.tail, 0) orelse return Error.QueueFull;
+            const slot = &self.slots[pos & self.mask];
+            slot.value = elem;
+            slot.seq.store(pos +% 1, .release);
+            if (self.hooks) |h| h.notify(h.ctx);
+        }
+
+        /// Get the front element of the ring and remove it.
+        pub fn pop(self: *Self) ?T {
+            const pos = self.claim(&self.head, 1) orelse return null;
+            const slot = &self.slots[pos & self.mask];
+            const elem = slot.value;
+            slot.seq.store(pos +% self.slots.len, .release);
+            if (self.hooks) |h| h.notify(h.ctx);
+            return elem;
+        }
+
+        /// Push as many elements as possible.
+        /// Returns the number of pushed elements.
+        /// Each element is claimed separately, so elements of other producers can be interleaved.
+        pub fn pushBatch(self: *Self, elems: []const T) usize {
+            for (elems, 0..) |elem, i| {
+                self.push(elem) catch return i;
+            }
+            return elems.len;
+        }
+
+        /// Pop as many elements as fit in `out`.
+        /// Returns the number of popped elements.
+        pub fn popBatch(self: *Self, out: []T) usize {
+            for (out, 0..) |*elem, i| {
+                elem.* = self.pop() orelse return i;
+            }
+            return out.len;
+        }
+
+        /// Push an element, waiting while the ring is full.
+        pub fn pushBlocking(self: *Self, elem: T) void {
+            while (true) {
+                self.push(elem) catch {
+                    waitFor(self.hooks);
+                    continue;
+                };
+                return;
+            }
+        }
+
+        /// Pop an element, waiting while the ring is empty.
+        pub fn popBlocking(self: *Self) T {
+            while (true) {
+                return self.pop() orelse {
+                    waitFor(self.hooks);
+                    continue;
+                };
+            }
+        }
+
+        /// Claim the position of `index` whose slot has the sequence `pos + lag`.
+        /// `lag` is 0 for producers and 1 for consumers.
+        /// Returns null if the ring is full or empty respectively.
+        fn claim(self: *Self, index: *Atomic(usize), comptime lag: usize) ?usize {
+            const sharing = if (lag == 0) producers else consumers;
+            var pos = index.load(.monotonic);
+            while (true) {
+                const seq = self.slots[pos & self.mask].seq.load(.acquire);
+                const diff: isize = @bitCast(seq -% (pos +% lag));
+                if (diff < 0) {
+                    // The slot is not released by the previous lap yet.
+                    return null;
+                } else if (diff > 0) {
+                    // Another context claimed the position.
+                    pos = index.load(.monotonic);
+                    continue;
+                }
+
+                switch (sharing) {
+                    .Single => {
+                        index.store(pos +% 1, .monotonic);
+                        return pos;
+                    },
+                    .Multi => pos = index.cmpxchgWeak(pos, pos +% 1, .monotonic, .monotonic) orelse return pos,
+                }
+            }
+        }
+    };
+}
+
+/// Wait for the ring to change.
+fn waitFor(hooks: ?Hooks) void {
+    if (hooks) |h| {
+        h.wait(h.ctx);
+    } else {
+        std.atomic.spinLoopHint();
+    }
+}
+
+const testing = std.testing;
+
+test "SPSC push and pop" {
+    var q = try Spsc(u32).init(3, testing.allocator);
+    defer q.deinit();
+    try testing.expectEqual(4, q.capacity());
+    try testing.expectEqual(null, q.pop());
+
+    for (0..4) |i| try q.push(@intCast(i));
+    try testing.expectError(Error.QueueFull, q.push(4));
+    try testing.expectEqual(4, q.len());
+
+    try testing.expectEqual(0, q.pop());
+    try testing.expectEqual(1, q.pop());
+    try q.push(4);
+    try testing.expectEqual(3, q.len());
+}
+
+test "SPSC batch" {
+    var buf: [8]u32 = undefined;
+    var q = Spsc(u32).initBuffer(&buf);
+    defer q.deinit();
+
+    try testing.expectEqual(8, q.pushBatch(&.{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }));
+    var out: [5]u32 = undefined;
+    try testing.expectEqual(5, q.popBatch(&out));
+    try testing.expectEqualSlices(u32, &.{ 0, 1, 2, 3, 4 }, &out);
+
+    // Wraps around the end of the buffer.
+    try testing.expectEqual(3, q.pushBatch(&.{ 8, 9, 10, 11 }));
+    try testing.expectEqual(5, q.popBatch(&out));
+    try testing.expectEqualSlices(u32, &.{ 5, 6, 7, 8, 9 }, &out);
+    try testing.expectEqual(1, q.popBatch(&out));
+    try testing.expectEqual(10, out[0]);
+}
+
+test "Positions wrap around" {
+    var buf: [4]u32 = undefined;
+    var q = Spsc(u32).initBuffer(&buf);
+    q.producer.index.store(std.math.maxInt(usize) - 1, .monotonic);
+    q.consumer.index.store(std.math.maxInt(usize) - 1, .monotonic);
+    q.producer.cache = std.math.maxInt(usize) - 1;
+    q.consumer.cache = std.math.maxInt(usize) - 1;
+
+    for (0..4) |i| try q.push(@intCast(i));
+    try testing.expectError(Error.QueueFull, q.push(4));
+    for (0..4) |i| try testing.expectEqual(i, q.pop());
+    try testing.expectEqual(null, q.pop());
+}
+
+test "MPMC push and pop" {
+    var q = try Mpmc(u64).init(4, testing.allocator);
+    defer q.deinit();
+
+    for (0..4) |i| try q.push(i);
+    try testing.expectError(Error.QueueFull, q.push(4));
+    try testing.expectEqual(4, q.len());
+    for (0..2) |i| try testing.expectEqual(i, q.pop());
+
+    try testing.expectEqual(2, q.pushBatch(&.{ 4, 5, 6 }));
+    var out: [8]u64 = undefined;
+    try testing.expectEqual(4, q.popBatch(&out));
+    try testing.expectEqualSlices(u64, &.{ 2, 3, 4, 5 }, out[0..4]);
+    try testing.expectEqual(null, q.pop());
+}
+
+test "Blocking hooks" {
+    const Counter = struct {
+        waits: usize = 0,
+        notifies: usize = 0,
+
+        fn wait(ctx: *anyopaque) void {
+            const self: *@This() = @alignCast(@ptrCast(ctx));
+            self.waits += 1;
+        }
+
+        fn notify(ctx: *anyopaque) void {
+            const self: *@This() = @alignCast(@ptrCast(ctx));
+            self.notifies += 1;
+        }
+    };
+
+    var counter = Counter{};
+    var q = try Mpsc(u8).init(2, testing.allocator);
+    defer q.deinit();
+    q.hooks = .{ .ctx = &counter, .wait = Counter.wait, .notify = Counter.notify };
+
+    q.pushBlocking(1);
+    try testing.expectEqual(1, q.popBlocking());
+    try testing.expectEqual(0, counter.waits);
+    try testing.expectEqual(2, counter.notifies);
+}
+
+/// Number of elements each producer pushes in stress tests.
+const stress_count = 100_000;
+
+/// Run `num_producers` producers and `num_consumers` consumers on the ring,
+/// and check that each element is received exactly once.
+/// Each consumer MUST see the elements of a producer in the pushed order.
+fn stress(comptime Q: type, num_producers: usize, num_consumers: usize) !void {
+    const max_threads = 4;
+    const Ctx = struct {
+        q: Q,
+        received: [max_threads]Atomic(usize) = [_]Atomic(usize){Atomic(usize).init(0)} ** max_threads,
+        sum: Atomic(u64) = Atomic(u64).init(0),
+        total: Atomic(usize) = Atomic(usize).init(0),
+        out_of_order: Atomic(bool) = Atomic(bool).init(false),
+        expected: usize,
+
+        fn produce(self: *@This(), id: usize) void {
+            var batch: [8]u64 = undefined;
+            var i: usize = 0;
+            while (i < stress_count) {
+                const n = @min(batch.len, stress_count - i);
+                for (batch[0..n], 0..) |*e, j| e.* = (@as(u64, id) << 32) | (i + j);
+                var pushed: usize = 0;
+                while (pushed < n) {
+                    pushed += self.q.pushBatch(batch[pushed..n]);
+                }
+                i += n;
+            }
+        }
+
+        fn consume(self: *@This()) void {
+            var last = [_]?u64{null} ** max_threads;
+            var out: [8]u64 = undefined;
+            while (self.total.load(.monotonic) < self.expected) {
+                const n = self.q.popBatch(&out);
+                for (out[0..n]) |e| {
+                    const id: usize = @intCast(e >> 32);
+                    const seq = e & 0xFFFF_FFFF;
+                    if (last[id]) |l| {
+                        if (seq <= l) self.out_of_order.store(true, .monotonic);
+                    }
+                    last[id] = seq;
+                    _ = self.received[id].fetchAdd(1, .monotonic);
+                    _ = self.sum.fetchAdd(seq, .monotonic);
+                }
+                _ = self.total.fetchAdd(n, .monotonic);
+            }
+        }
+    };
+
+    const ctx = try testing.allocator.create(Ctx);
+    defer testing.allocator.destroy(ctx);
+    ctx.* = .{
+        .q = try Q.init(64, testing.allocator),
+        .expected = num_producers * stress_count,
+    };
+    defer ctx.q.deinit();
+
+    var threads: [2 * max_threads]std.Thread = undefined;
+    var num_threads: usize = 0;
+    for (0..num_consumers) |_| {
+        threads[num_threads] = try std.Thread.spawn(.{}, Ctx.consume, .{ctx});
+        num_threads += 1;
+    }
+    for (0..num_producers) |id| {
+        threads[num_threads] = try std.Thread.spawn(.{}, Ctx.produce, .{ ctx, id });
+        num_threads += 1;
+    }
+    for (threads[0..num_threads]) |t| t.join();
+
+    try testing.expect(!ctx.out_of_order.load(.monotonic));
+    for (ctx.received[0..num_producers]) |r| {
+        try testing.expectEqual(stress_count, r.load(.monotonic));
+    }
+    try testing.expectEqual(num_producers * (stress_count * (stress_count - 1) / 2), ctx.sum.load(.monotonic));
+    try testing.expectEqual(null, ctx.q.pop());
+}
+
+test "SPSC stress" {
+    try stress(Spsc(u64), 1, 1);
+}
+
+test "MPSC stress" {
+    try stress(Mpsc(u64), 4, 1);
+}
+
+test "MPMC stress" {
+    try stress(Mpmc(u64), 4, 4);
+}
+
+test "Throughput" {
+    // Reports the throughput of a single thread pushing and popping in batches.
+    // Not a pass/fail criterion, since the result depends on the host.
+    const rounds = 1_000_000;
+    inline for (.{ Spsc(u64), Mpsc(u64), Mpmc(u64) }) |Q| {
+        var q = try Q.init(256, testing.allocator);
+        defer q.deinit();
+
+        var batch = [_]u64{0} ** 16;
+        var timer = try std.time.Timer.start();
+        var i: usize = 0;
+        while (i < rounds) : (i += batch.len) {
+            try testing.expectEqual(batch.len, q.pushBatch(&batch));
+            try testing.expectEqual(batch.len, q.popBatch(&batch));
+        }
+        const ns = @max(timer.read(), 1);
+        std.debug.print("{s}: {d} Mops/s\n", .{ @typeName(Q), rounds * 1000 / ns });
+    }
+}
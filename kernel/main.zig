@@ -1,6 +1,7 @@
 //! Kernel entry point.
 
 const std = @import("std");
+const builtin = @import("builtin");
 const log = std.log.scoped(.main);
 const Allocator = std.mem.Allocator;
 
@@ -16,14 +17,16 @@ const mouse = zakuro.mouse;
 const kbd = zakuro.keyboard;
 const arch = zakuro.arch;
 const intr = zakuro.arch.intr;
-const FixedSizeQueue = zakuro.lib.queue.FixedSizeQueue;
 const mm = zakuro.mm;
 const Rsdp = arch.Rsdp;
 const timer = zakuro.timer;
 const event = zakuro.event;
+const profile = zakuro.profile;
+const boot_trace = zakuro.boot_trace;
 const MemoryMap = mm.uefi.MemoryMap;
 const BitmapPageAllocator = mm.BitmapPageAllocator;
 const SlubAllocator = mm.SlubAllocator;
+const VmallocAllocator = mm.VmallocAllocator;
 
 /// Override panic impl
 pub const panic = @import("panic.zig").panic_fn;
@@ -31,28 +34,80 @@ pub const panic = @import("panic.zig").panic_fn;
 pub const std_options = klog.default_log_options;
 
 const kstack_size = arch.page_size * 0x50;
-/// Kernel stack
-var kstack: [kstack_size]u8 align(16) = [_]u8{0} ** kstack_size;
+/// Kernel stack with a guard page below it.
+var kstack: arch.page.GuardedStack(kstack_size) = std.mem.zeroes(arch.page.GuardedStack(kstack_size));
+
+/// ID of the timer that redraws the counter window.
+const counter_timer_id: u64 = 1;
+/// Interval in ticks between redraws of the counter window.
+const counter_interval: u64 = 10;
 
 /// Buffer for BitmapPageAllocator.
 /// TODO: allocate memory dynamically
 var bpa_buf: [@sizeOf(BitmapPageAllocator)]u8 align(4096) = [_]u8{0} ** @sizeOf(BitmapPageAllocator);
 
+/// Symbol table of the kernel generated at build time.
+/// This is placed in a dedicated writable section that the linker puts after the code,
+/// so that the size of the table does not move any function.
+/// The kernel accesses the table via `zakuro.symbols`.
+export var zakuro_symtab: [symtab_bin.len]u8 align(8) linksection("zakuro_symtab") = symtab_bin.*;
+const symtab_bin = @embedFile("symtab");
+
+// Override the memory routines of compiler-rt with the optimized ones.
+export fn memcpy(noalias dest: ?[*]u8, noalias src: ?[*]const u8, len: usize) callconv(.C) ?[*]u8 {
+    if (len != 0) arch.mem.copy(dest.?, src.?, len);
+    return dest;
+}
+
+export fn memmove(dest: ?[*]u8, src: ?[*]const u8, len: usize) callconv(.C) ?[*]u8 {
+    if (len != 0) arch.mem.move(dest.?, src.?, len);
+    return dest;
+}
+
+export fn memset(dest: ?[*]u8, c: u8, len: usize) callconv(.C) ?[*]u8 {
+    if (len != 0) arch.mem.set(dest.?, c, len);
+    return dest;
+}
+
 /// xHC controller.
 /// TODO: Move this to a proper place.
 var xhc: drivers.usb.xhc.Controller = undefined;
+/// Wait queue of the xHC event task, woken by the xHC interrupt handler.
+var xhc_waiters = zakuro.task.WaitQueue{};
 
 /// Instance of a console.
 var con: console.Console = undefined;
 
+/// Whether the kernel is compiled to use AVX.
+const use_avx = std.Target.x86.featureSetHas(builtin.cpu.features, .avx);
+
 /// Kernel entry point called from the bootloader.
 /// This function switches to the kernel stack and calls `kernel_main`.
 export fn kernel_entry() callconv(.Naked) noreturn {
+    // If the kernel is compiled for a CPU with AVX, the compiler can emit AVX instructions anywhere.
+    // Enable XSAVE and AVX state in XCR0 before running any Zig code,
+    // preserving RCX and RDX that hold arguments of `kernel_main`.
+    // The rest of the FPU configuration is done by `arch.fpu.init()`.
+    if (use_avx) {
+        asm volatile (
+            \\movq %%rcx, %%r10
+            \\movq %%rdx, %%r11
+            \\movq %%cr4, %%rax
+            \\orq $0x40000, %%rax
+            \\movq %%rax, %%cr4
+            \\xorl %%ecx, %%ecx
+            \\xgetbv
+            \\orl $0x7, %%eax
+            \\xsetbv
+            \\movq %%r10, %%rcx
+            \\movq %%r11, %%rdx
+        );
+    }
     asm volatile (
         \\movq %[new_stack], %%rsp
         \\call kernel_main
         :
-        : [new_stack] "r" (@intFromPtr(&kstack) + kstack_size),
+        : [new_stack] "r" (@intFromPtr(&kstack.stack) + kstack_size),
     );
 }
 
@@ -65,12 +120,19 @@ export fn kernel_main(
     fb_config: *gfx.FrameBufferConfig,
     memory_map: *MemoryMap,
     rdsp: *Rsdp,
+    loader_trace: *boot_trace.LoaderTrace,
 ) callconv(.Win64) noreturn {
+    boot_trace.init(loader_trace);
+    boot_trace.mark("kernel-entry");
+
     // This function runs on the new kernel stack,
     // but the arguments are still placed in the old stack.
     // Therefore, we copy the arguments in the new stack and pass their pointers to `main`.
+    // The arguments are identity mapped by the bootloader, which is unmapped by `arch.page.init()`.
+    // The memory map buffer is referred via the direct map so that it is available after that.
     var new_fb_config = fb_config.*;
     var new_memory_map = memory_map.*;
+    new_memory_map.descriptors = @ptrFromInt(arch.page.phys2virt(@intFromPtr(memory_map.descriptors)));
     var new_rdsp = rdsp.*;
 
     main(&new_fb_config, &new_memory_map, &new_rdsp) catch |err| switch (err) {
@@ -91,6 +153,12 @@ fn main(
 ) !void {
     const serial = ser.init();
     klog.init(serial);
+    kstack.guard();
+    zakuro.unwind.registerStack(kstack.base(), kstack_size);
+    _ = arch.fpu.init();
+    const mem_features = arch.mem.init();
+    log.info("Memory routines: ERMS={} FSRM={} AVX2={}", .{ mem_features.erms, mem_features.fsrm, mem_features.avx2 });
+    boot_trace.mark("serial");
 
     log.info("Booting Zakuro OS...", .{});
     log.info("BSP LAPIC ID: {d}", .{arch.getLapicId()});
@@ -101,24 +169,43 @@ fn main(
 
     // Initialize GDT
     arch.gdt.init();
+    zakuro.unwind.registerStack(arch.gdt.double_fault_stack.base(), arch.gdt.double_fault_stack.stack.len);
     log.info("Initialized GDT.", .{});
+    boot_trace.mark("idt-gdt");
 
     // Initialize page allocator
+    const phys_end = memory_map.physicalEnd();
     var bpa = BitmapPageAllocator.init(memory_map, &bpa_buf);
     const page_allocator = bpa.allocator();
-    var slub_allocator = try SlubAllocator.init(bpa);
-    const gpa = slub_allocator.allocator();
+    boot_trace.mark("page-allocator");
 
     // Initialize paging.
-    try arch.page.initIdentityMapping(page_allocator);
+    // Switch to the kernel page table before any allocator hands out memory,
+    // so that allocated objects never refer to the identity map of the bootloader.
+    try arch.page.init(phys_end, page_allocator);
+    _ = arch.pcid.init();
+    fb_config.frame_buffer = @ptrFromInt(try arch.page.ioremap(
+        @intFromPtr(fb_config.frame_buffer),
+        @as(usize, fb_config.pixels_per_scan_line) * fb_config.vertical_resolution * gfx.bytes_per_pixel,
+        .WriteCombining,
+    ));
+    boot_trace.mark("paging");
+
+    var slub_allocator = try SlubAllocator.init(bpa);
+    const gpa = slub_allocator.allocator();
+    // Install the per-CPU area of the BSP. This MUST be after the GDT is initialized.
+    try arch.percpu.init(0, arch.getLapicId(), gpa);
+    var vmalloc_allocator = try VmallocAllocator.init(bpa, gpa);
+    const vmalloc = vmalloc_allocator.allocator();
+    boot_trace.mark("slub-allocator");
 
     // Initialize interrupt queue
     try event.init(16, gpa);
-    intr.registerHandler(intr.mouse_interrupt, &mouseHandler);
+    intr.registerHandler(intr.mouse_interrupt, &xhcHandler);
 
     // Initialize a pixel writer
     const pixel_writer = gfx.PixelWriter.new(fb_config);
-    gfx.layer.initialize(pixel_writer, fb_config.*, gpa);
+    gfx.layer.initialize(pixel_writer, fb_config.*, gpa, vmalloc);
 
     // Initialize graphic layers
     var layers = gfx.layer.getLayers();
@@ -148,10 +235,20 @@ fn main(
     var example_counter: u64 = 0;
     try example_gfx_win.writeFormat(.{ .x = 0, .y = 0 }, gpa, "{}\n", .{example_counter});
     layers.flush();
+    boot_trace.mark("desktop");
 
     // Initialize local APIC timer.
     intr.registerHandler(intr.timer_interrupt, &timerHandler);
     timer.init(intr.timer_interrupt, gpa, rsdp);
+    boot_trace.mark("timer-calibration");
+    profile.init();
+
+    // Initialize performance counters.
+    _ = arch.pmu.init();
+    _ = arch.idle.init();
+
+    // Initialize tasks, which USB devices are enumerated in.
+    zakuro.task.init(vmalloc);
 
     // Initialize PCI devices.
     try initPci(gpa);
@@ -162,33 +259,51 @@ fn main(
 
     // Initialize keyboard
     try initKeyboard(gpa);
+    boot_trace.mark("first-frame");
+    boot_trace.print();
+
+    // Run benchmarks instead of the desktop if enabled.
+    if (zakuro.bench.enabled) {
+        zakuro.bench.runAll(.{
+            .gpa = gpa,
+            .bpa = bpa,
+            .window = bgwindow,
+            .xhc = &xhc,
+        });
+    }
+
+    // Redraw the counter periodically rather than on every wakeup.
+    try timer.newTimer(timer.getTicks() + counter_interval, counter_timer_id);
 
     // Loop to process interrupt messages
     while (true) {
-        arch.disableIntr();
-        example_counter = timer.getTicks();
-        arch.enableIntr();
+        // Emit samples of the profiler if any.
+        profile.flush();
 
-        try example_gfx_win.writeFormat(.{ .x = 0, .y = 0 }, gpa, "{}\n", .{example_counter});
-        layers.flushLayer(example_window);
-
-        // Check if there is any queued events.
-        arch.disableIntr();
-        {
-            if (event.size() == 0) {
-                arch.enableIntr();
-                arch.halt();
-                continue;
+        // Process the messages queued by interrupt handlers.
+        while (event.pop()) |msg| {
+            switch (msg) {
+                .timer => |t| if (t.id == counter_timer_id) {
+                    example_counter = timer.getTicks();
+                    try example_gfx_win.writeFormat(.{ .x = 0, .y = 0 }, gpa, "{}\n", .{example_counter});
+                    layers.flushLayer(example_window);
+                    try timer.newTimer(example_counter + counter_interval, counter_timer_id);
+                } else {
+                    log.info("Timer Event: ID={d}", .{t.id});
+                },
             }
         }
-        arch.enableIntr();
 
-        // Process the message
-        if (event.pop()) |msg| {
-            switch (msg) {
-                .mouse => handleMouseMessage(),
-                .timer => |t| log.info("Timer Event: ID={d}", .{t.id}),
-            }
+        // Resume tasks woken by the messages or interrupt handlers, including the xHC event task.
+        _ = zakuro.task.runReady();
+
+        // Sleep until the next interrupt if there is no work.
+        // Interrupts are disabled during the check so that work queued after it wakes the CPU.
+        arch.disableIntr();
+        if (event.size() == 0 and !zakuro.task.hasReady()) {
+            arch.idle.wait();
+        } else {
+            arch.enableIntr();
         }
     }
 
@@ -202,14 +317,17 @@ fn main(
 /// Register PCI devices and initialize xHC controller.
 fn initPci(allocator: Allocator) !void {
     // Register PCI devices.
+    pci.init();
     try pci.registerAllDevices();
+    boot_trace.mark("pci-enumeration");
     for (0..pci.num_devices) |i| {
         if (pci.devices[i]) |info| {
-            log.info("Found PCI device: {X:0>2}:{X:0>2}:{X:0>1} vendor={X:0>2} class={X:0>2}:{X:0>2}:{X:0>2}", .{
+            log.info("Found PCI device: {X:0>2}:{X:0>2}:{X:0>1} id={X:0>4}:{X:0>4} class={X:0>2}:{X:0>2}:{X:0>2}", .{
                 info.device.bus,
                 info.device.device,
                 info.function,
                 info.vendor_id,
+                info.device_id,
                 info.base_class,
                 info.subclass,
                 info.prog_if,
@@ -220,38 +338,25 @@ fn initPci(allocator: Allocator) !void {
     }
 
     // Find a xHC controller.
-    var xhc_maybe: ?pci.DeviceInfo = null;
-    for (0..pci.num_devices) |i| {
-        if (pci.devices[i]) |info| {
-            if (info.base_class == @intFromEnum(pci.ClassCodes.SerialBusController) and info.subclass == 0x03 and info.prog_if == 0x30) {
-                xhc_maybe = info;
-                // We assume that Intel's xHC controller is the main one.
-                if (info.vendor_id == @intFromEnum(pci.KnownVendors.Intel)) {
-                    break;
-                }
-            }
-        }
-    }
-    const xhc_dev = xhc_maybe orelse @panic("xHC controller not found.");
+    const xhc_dev = pci.findDevice(drivers.usb.xhc.pci_driver) orelse @panic("xHC controller not found.");
     try xhc_dev.configureMsi(
-        .{ .dest_id = arch.getLapicId() },
+        .{ .dest_id = @intCast(arch.percpu.lapicId()) },
         .{ .vector = intr.mouse_interrupt, .assert = true },
         0,
     );
 
-    const bar0 = xhc_dev.device.readBar(xhc_dev.function, 0);
-    const bar1 = xhc_dev.device.readBar(xhc_dev.function, 1);
-    const xhc_mmio_base = (@as(u64, bar1) << 32) | @as(u64, bar0 & ~@as(u32, 0b1111));
+    const xhc_mmio_base = try xhc_dev.mapBar(0);
     log.info("xHC MMIO base: 0x{X}", .{xhc_mmio_base});
 
-    // TODO: identity map for MMIO base in case it exceeds 16GiB.
-    try arch.page.mapIdentity(xhc_mmio_base, allocator);
-
     // Initialize xHC controller.
     xhc = drivers.usb.xhc.Controller.new(xhc_mmio_base, allocator);
     try xhc.init();
     xhc.run();
     log.info("Started xHC controller.", .{});
+    boot_trace.mark("xhc-init");
+
+    // Process xHC events in a task woken by the interrupt handler.
+    try zakuro.task.spawn(xhcEventTask, &xhc);
 
     // Find available devices
     const max_ports = xhc.capability_regs.hcs_params1.read().maxports;
@@ -265,6 +370,7 @@ fn initPci(allocator: Allocator) !void {
             log.info("Reset of port {d} completed.", .{i});
         }
     }
+    boot_trace.mark("usb-port-reset");
 }
 
 /// Initialize mouse cursor and registers mouse movement observer.
@@ -299,23 +405,28 @@ fn initKeyboard(allocator: Allocator) !void {
 }
 
 // TODO: Move this to a proper place.
-fn mouseHandler(_: *intr.Context) void {
-    event.push(.mouse) catch |err| {
-        log.err("Failed to push mouse event to the queue: {?}", .{err});
-    };
+fn xhcHandler(_: *intr.Context) void {
+    // Events are processed by the xHC event task in the main loop.
+    xhc_waiters.wakeAll();
     arch.notifyEoi();
 }
 
-fn timerHandler(_: *intr.Context) void {
+fn timerHandler(ctx: *intr.Context) void {
+    profile.sample(ctx);
     timer.tick();
     arch.notifyEoi();
 }
 
 // TODO: Move this to a proper place.
-fn handleMouseMessage() void {
-    while (xhc.hasEvent()) {
-        xhc.processEvent() catch |err| {
-            log.err("Failed to process xHC event: {?}", .{err});
-        };
+/// Wait until the event ring of the xHC has events and process all of them.
+fn xhcEventTask(ctx: *anyopaque) void {
+    const controller: *drivers.usb.xhc.Controller = @alignCast(@ptrCast(ctx));
+    while (true) {
+        xhc_waiters.waitUntil(controller, drivers.usb.xhc.Controller.hasEvent);
+        while (controller.hasEvent()) {
+            controller.processEvent() catch |err| {
+                log.err("Failed to process xHC event: {?}", .{err});
+            };
+        }
     }
 }
@@ -1,8 +1,10 @@
 const std = @import("std");
 
 pub const uefi = @import("mm/uefi.zig");
+pub const page = @import("mm/page.zig");
 pub const BitmapPageAllocator = @import("mm/BitmapPageAllocator.zig");
 pub const SlubAllocator = @import("mm/SlubAllocator.zig");
+pub const VmallocAllocator = @import("mm/VmallocAllocator.zig");
 
 test {
     std.testing.refAllDecls(@This());
@@ -119,7 +119,7 @@ fn alloc(ctx: *anyopaque, n: usize, _: u8, _: usize) ?[*]u8 {
         self.set(pfn + i, .Unusable);
     }
 
-    return @ptrFromInt(page.pfn2phys(pfn));
+    return @ptrFromInt(page.pfn2virt(pfn));
 }
 
 /// Not implemented.
@@ -147,7 +147,7 @@ fn free(
     }
 
     const num_pages = buf.len / page_size;
-    const pfn = page.phys2pfn(@intFromPtr(buf.ptr));
+    const pfn = page.virt2pfn(@intFromPtr(buf.ptr));
     for (0..num_pages) |i| {
         self.set(pfn + i, .Usable);
     }
@@ -186,6 +186,8 @@ pub fn getAdjacentPages(self: *Self, n: usize) ?Pfn {
     while (pos_pfn < self.end_pfn) : (pos_pfn += 1) {
         if (self.get(pos_pfn) == .Usable) {
             cont_count += 1;
+        } else {
+            cont_count = 0;
         }
         if (cont_count == n) {
             const ret_pfn = pos_pfn - n + 1;
@@ -242,3 +244,16 @@ test "bitmap operation" {
     try testing.expectEqual(.Unusable, bpa.get(9));
     try testing.expectEqual(.Usable, bpa.get(10));
 }
+
+test "adjacent pages are contiguous" {
+    var bpa = BitmapPageAllocator{ .start_pfn = 0, .end_pfn = 16 };
+    bpa.set(0, .Usable);
+    bpa.set(1, .Usable);
+    bpa.set(3, .Usable);
+    bpa.set(4, .Usable);
+    bpa.set(5, .Usable);
+
+    try testing.expectEqual(3, bpa.getAdjacentPages(3).?);
+    try testing.expectEqual(0, bpa.getAdjacentPages(2).?);
+    try testing.expectEqual(null, bpa.getAdjacentPages(1));
+}
@@ -67,7 +67,7 @@ fn alloc(ctx: *anyopaque, len: usize, log2_align: u8, _: usize) ?[*]u8 {
     } else {
         const num_page = (aligned_len + page_size - 1) / page_size;
         const pages = self.bpa.getAdjacentPages(num_page) orelse return null;
-        return @ptrFromInt(page.pfn2phys(pages));
+        return @ptrFromInt(page.pfn2virt(pages));
     }
 }
 
@@ -100,7 +100,7 @@ fn free(
         return slub.free(buf.ptr) catch {};
     } else {
         const num_page = (aligned_len + page_size - 1) / page_size;
-        self.bpa.returnAdjacentPages(page.phys2pfn(@intFromPtr(buf.ptr)), num_page);
+        self.bpa.returnAdjacentPages(page.virt2pfn(@intFromPtr(buf.ptr)), num_page);
     }
 }
 
@@ -199,7 +199,7 @@ const PageStructCache = struct {
             .freelist = null,
         };
 
-        ret.initPage(page.pfn2phys(cache_pfn));
+        ret.initPage(page.pfn2virt(cache_pfn));
 
         return ret;
     }
@@ -230,7 +230,7 @@ const PageStructCache = struct {
     fn mayAllocNewPage(self: *PageStructCache) Error!void {
         if (self.num_pages * node_per_page == self.num_objects) {
             const new_page = self.pa.getAdjacentPages(1) orelse return Error.MetadataNoMemory;
-            self.initPage(page.pfn2phys(new_page));
+            self.initPage(page.pfn2virt(new_page));
         }
     }
 
@@ -284,7 +284,7 @@ const Slub = struct {
             .list_fullpage = .{},
             .num_pages = 1,
         };
-        slub.active_page = try slub.initSlubPage(page.pfn2phys(first_page_pfn), page_cache);
+        slub.active_page = try slub.initSlubPage(page.pfn2virt(first_page_pfn), page_cache);
 
         return slub;
     }
@@ -365,7 +365,7 @@ const Slub = struct {
         // If there is no free pages, allocate a new page.
         if (self.list_freepage.first == null) {
             const new_page_pfn = bpa.getAdjacentPages(1) orelse return Error.NoMemory;
-            const new_page_struct = try self.initSlubPage(page.pfn2phys(new_page_pfn), page_cache);
+            const new_page_struct = try self.initSlubPage(page.pfn2virt(new_page_pfn), page_cache);
             self.list_freepage.append(new_page_struct);
 
             self.num_pages += 1;
@@ -445,11 +445,11 @@ const MockedPageAllocator = struct {
             -1,
             0,
         );
-        return page.phys2pfn(@intFromPtr(ret));
+        return page.virt2pfn(@intFromPtr(ret));
     }
 
     pub fn returnAdjacentPages(_: *MockedPageAllocator, pfn: page.Pfn, n: usize) void {
-        const ret = std.c.munmap(@ptrFromInt(page.pfn2phys(pfn)), page_size * n);
+        const ret = std.c.munmap(@ptrFromInt(page.pfn2virt(pfn)), page_size * n);
         if (ret != 0) unreachable;
     }
 };
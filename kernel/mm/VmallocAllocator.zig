@@ -0,0 +1,247 @@
+//! Allocator that maps physically non-contiguous pages to contiguous virtual addresses in the vmalloc area.
+//! This is intended for large buffers such as window buffers and the back buffer.
+//! The page allocator requires physically contiguous pages for them, which can fail on fragmented memory.
+//! Each allocation is followed by an unmapped guard page to catch overruns.
+//! Buffers allocated by this allocator MUST NOT be used for DMA, since they are not physically contiguous.
+
+const std = @import("std");
+const log = std.log.scoped(.vmalloc);
+const Allocator = std.mem.Allocator;
+
+const zakuro = @import("zakuro");
+const arch = zakuro.arch;
+const page = @import("page.zig");
+const BitmapPageAllocator = @import("BitmapPageAllocator.zig");
+
+const Self = @This();
+const VmallocAllocator = @This();
+
+const page_size = arch.page_size;
+
+/// Number of pages unmapped at once when freeing a buffer.
+const free_batch = 32;
+
+/// Page allocator to allocate backing pages.
+bpa: *BitmapPageAllocator,
+/// Free virtual address ranges in the vmalloc area.
+areas: AreaList,
+
+/// Instantiate the allocator that manages the whole vmalloc area.
+/// `meta_allocator` is used to allocate the metadata of free ranges.
+pub fn init(bpa: *BitmapPageAllocator, meta_allocator: Allocator) Allocator.Error!Self {
+    var areas = AreaList{ .allocator = meta_allocator };
+    try areas.give(arch.page.vmalloc_base, arch.page.vmalloc_size);
+    return Self{
+        .bpa = bpa,
+        .areas = areas,
+    };
+}
+
+/// Get the allocator.
+pub fn allocator(self: *Self) Allocator {
+    return Allocator{
+        .ptr = self,
+        .vtable = &.{
+            .alloc = alloc,
+            .resize = resize,
+            .free = free,
+        },
+    };
+}
+
+fn alloc(ctx: *anyopaque, n: usize, log2_align: u8, _: usize) ?[*]u8 {
+    const self: *Self = @alignCast(@ptrCast(ctx));
+    const alignment = @max(page_size, @as(usize, 1) << @as(Allocator.Log2Align, @intCast(log2_align)));
+    const num_pages = std.math.divCeil(usize, n, page_size) catch unreachable;
+
+    // Reserve one more page as a guard page.
+    const vaddr = self.areas.take((num_pages + 1) * page_size, alignment) orelse return null;
+    for (0..num_pages) |i| {
+        const pfn = self.bpa.getAdjacentPages(1) orelse {
+            self.release(vaddr, i, num_pages + 1);
+            return null;
+        };
+        arch.page.map(vaddr + i * page_size, page.pfn2phys(pfn), page_size, .{}) catch |err| {
+            log.err("Failed to map a page: {?}", .{err});
+            self.bpa.returnAdjacentPages(pfn, 1);
+            self.release(vaddr, i, num_pages + 1);
+            return null;
+        };
+    }
+
+    return @ptrFromInt(vaddr);
+}
+
+fn resize(ctx: *anyopaque, buf: []u8, _: u8, new_len: usize, _: usize) bool {
+    const self: *Self = @alignCast(@ptrCast(ctx));
+    const old_pages = std.math.divCeil(usize, buf.len, page_size) catch unreachable;
+    const new_pages = std.math.divCeil(usize, new_len, page_size) catch unreachable;
+
+    // Growing beyond the last page is not supported, since the next page is the guard page.
+    if (new_pages > old_pages) return false;
+
+    if (new_pages < old_pages) {
+        // The first dropped page becomes the new guard page.
+        // The other dropped pages and the old guard page are returned to the free list.
+        const vaddr = @intFromPtr(buf.ptr);
+        self.unmapPages(vaddr + new_pages * page_size, old_pages - new_pages);
+        self.giveRange(vaddr + (new_pages + 1) * page_size, old_pages - new_pages);
+    }
+    return true;
+}
+
+fn free(ctx: *anyopaque, buf: []u8, _: u8, _: usize) void {
+    const self: *Self = @alignCast(@ptrCast(ctx));
+    const vaddr = @intFromPtr(buf.ptr);
+    const num_pages = std.math.divCeil(usize, buf.len, page_size) catch unreachable;
+    self.release(vaddr, num_pages, num_pages + 1);
+}
+
+/// Unmap the first `num_mapped` pages from `vaddr` and return them to the page allocator,
+/// then return `num_reserved` pages of the virtual range to the free list.
+fn release(self: *Self, vaddr: u64, num_mapped: usize, num_reserved: usize) void {
+    self.unmapPages(vaddr, num_mapped);
+    self.giveRange(vaddr, num_reserved);
+}
+
+/// Unmap `num_mapped` pages from `vaddr` and return them to the page allocator.
+fn unmapPages(self: *Self, vaddr: u64, num_mapped: usize) void {
+    var pfns: [free_batch]page.Pfn = undefined;
+    var i: usize = 0;
+    while (i < num_mapped) {
+        const n = @min(free_batch, num_mapped - i);
+        const start = vaddr + i * page_size;
+        for (0..n) |j| {
+            const phys = arch.page.translate(start + j * page_size) orelse @panic("vmalloc: page is not mapped.");
+            pfns[j] = page.phys2pfn(phys);
+        }
+
+        // Return the pages only after they are unmapped and the TLB is flushed.
+        arch.page.unmap(start, n * page_size) catch @panic("vmalloc: failed to unmap pages.");
+        for (pfns[0..n]) |pfn| {
+            self.bpa.returnAdjacentPages(pfn, 1);
+        }
+        i += n;
+    }
+}
+
+/// Return `num_reserved` pages of the virtual range from `vaddr` to the free list.
+fn giveRange(self: *Self, vaddr: u64, num_reserved: usize) void {
+    self.areas.give(vaddr, num_reserved * page_size) catch {
+        // The range is leaked, but it does not affect the correctness.
+        log.warn("Failed to return a virtual range: 0x{X} ({d} pages)", .{ vaddr, num_reserved });
+    };
+}
+
+/// Sorted list of free address ranges.
+const AreaList = struct {
+    /// Free range.
+    const Area = struct {
+        /// Start address.
+        start: u64,
+        /// Size in bytes.
+        size: u64,
+        /// Next range with higher addresses.
+        next: ?*Area,
+
+        fn end(self: *const Area) u64 {
+            return self.start + self.size;
+        }
+    };
+
+    /// Head of the list.
+    head: ?*Area = null,
+    /// Allocator for `Area`.
+    allocator: Allocator,
+
+    /// Take the range of the given size and alignment from the first range that fits.
+    /// Returns the start address of the range.
+    fn take(self: *AreaList, size: u64, alignment: u64) ?u64 {
+        var prev: ?*Area = null;
+        var cur = self.head;
+        while (cur) |area| : ({
+            prev = area;
+            cur = area.next;
+        }) {
+            const start = std.mem.alignForward(u64, area.start, alignment);
+            if (start + size > area.end()) continue;
+
+            const tail_start = start + size;
+            const tail_size = area.end() - tail_start;
+            if (start == area.start) {
+                // Shrink or remove the area from the front.
+                if (tail_size == 0) {
+                    if (prev) |p| p.next = area.next else self.head = area.next;
+                    self.allocator.destroy(area);
+                } else {
+                    area.start = tail_start;
+                    area.size = tail_size;
+                }
+            } else {
+                // Keep the head gap, and insert the tail if any.
+                if (tail_size != 0) {
+                    const tail = self.allocator.create(Area) catch return null;
+                    tail.* = .{ .start = tail_start, .size = tail_size, .next = area.next };
+                    area.next = tail;
+                }
+                area.size = start - area.start;
+            }
+            return start;
+        }
+        return null;
+    }
+
+    /// Give the range back to the list, merging it with adjacent ranges.
+    fn give(self: *AreaList, start: u64, size: u64) Allocator.Error!void {
+        var prev: ?*Area = null;
+        var next = self.head;
+        while (next) |area| : (next = area.next) {
+            if (area.start >= start) break;
+            prev = area;
+        }
+
+        const merge_prev = if (prev) |p| p.end() == start else false;
+        const merge_next = if (next) |n| start + size == n.start else false;
+        if (merge_prev and merge_next) {
+            prev.?.size += size + next.?.size;
+            prev.?.next = next.?.next;
+            self.allocator.destroy(next.?);
+        } else if (merge_prev) {
+            prev.?.size += size;
+        } else if (merge_next) {
+            next.?.start = start;
+            next.?.size += size;
+        } else {
+            const area = try self.allocator.create(Area);
+            area.* = .{ .start = start, .size = size, .next = next };
+            if (prev) |p| p.next = area else self.head = area;
+        }
+    }
+};
+
+const testing = std.testing;
+
+test "Take and give ranges" {
+    var areas = AreaList{ .allocator = testing.allocator };
+    try areas.give(0x10000, 0x10000);
+
+    const a = areas.take(0x1000, 0x1000).?;
+    const b = areas.take(0x2000, 0x1000).?;
+    try testing.expectEqual(0x10000, a);
+    try testing.expectEqual(0x11000, b);
+
+    // The head gap is kept as a separate range.
+    const c = areas.take(0x1000, 0x8000).?;
+    try testing.expectEqual(0x18000, c);
+    try testing.expectEqual(null, areas.take(0x10000, 0x1000));
+
+    // Ranges are merged with both neighbors.
+    try areas.give(a, 0x1000);
+    try areas.give(c, 0x1000);
+    try areas.give(b, 0x2000);
+    try testing.expectEqual(0x10000, areas.head.?.start);
+    try testing.expectEqual(0x10000, areas.head.?.size);
+    try testing.expectEqual(null, areas.head.?.next);
+
+    testing.allocator.destroy(areas.head.?);
+}
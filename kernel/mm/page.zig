@@ -1,8 +1,13 @@
 //! Defines page frame related types.
 //! For now, we support flat memory model,
 //! wehere the PFN of the page can be calculated just by dividing the physical address of the page by the page size.
+//!
+//! The kernel accesses physical memory via the direct map.
+//! In tests, physical addresses are regarded as identical to virtual addresses
+//! since pages are provided by the host.
 
 const std = @import("std");
+const is_test = @import("builtin").is_test;
 
 const zakuro = @import("zakuro");
 const arch = zakuro.arch;
@@ -23,3 +28,24 @@ pub inline fn phys2pfn(phys: u64) Pfn {
 pub inline fn pfn2phys(pfn: Pfn) u64 {
     return pfn * page_size;
 }
+
+/// Converts the physical address to the virtual address in the direct map.
+pub inline fn phys2virt(phys: u64) u64 {
+    return if (is_test) phys else arch.page.phys2virt(phys);
+}
+
+/// Converts the virtual address of the kernel to the physical address.
+/// This is used to tell devices the address of DMA buffers.
+pub inline fn virt2phys(virt: u64) u64 {
+    return if (is_test) virt else arch.page.virt2phys(virt);
+}
+
+/// Converts the page frame number to the virtual address in the direct map.
+pub inline fn pfn2virt(pfn: Pfn) u64 {
+    return phys2virt(pfn2phys(pfn));
+}
+
+/// Converts the virtual address in the direct map to the page frame number.
+pub inline fn virt2pfn(virt: u64) Pfn {
+    return phys2pfn(virt2phys(virt));
+}
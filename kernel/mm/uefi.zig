@@ -2,6 +2,10 @@
 
 const std = @import("std");
 
+/// Size of a page in the UEFI memory map.
+/// This is always 4KiB regardless of the page size used by the OS.
+const page_size: u64 = 0x1000;
+
 /// Thin wrapper struct for memory map passed to by the bootloader.
 /// The memory map is an array of memory descriptors.
 /// The size of each descriptor is given by `descriptor_size`.
@@ -33,6 +37,17 @@ pub const MemoryMap = extern struct {
             return @alignCast(@ptrCast(self.descriptors));
         }
     }
+
+    /// End of the physical address space described by this memory map.
+    /// All memory types are taken into account, including MMIO regions.
+    pub fn physicalEnd(self: *MemoryMap) u64 {
+        var end: u64 = 0;
+        var current_desc = self.next(null);
+        while (current_desc) |desc| : (current_desc = self.next(desc)) {
+            end = @max(end, desc.physical_start + desc.num_pages * page_size);
+        }
+        return end;
+    }
 };
 
 /// EFI_MEMORY_DESCRIPTOR.
@@ -117,3 +132,21 @@ test "descriptor next" {
     current_desc = map_ptr.next(current_desc);
     try testing.expectEqual(null, map_ptr.next(current_desc));
 }
+
+test "physical end" {
+    var descs = [_]MemoryDescriptor{
+        .{ .typ = .ConventionalMemory, .physical_start = 0x10_0000, .virtual_start = 0, .num_pages = 0x10, .attr = 0 },
+        .{ .typ = .MemoryMappedIO, .physical_start = 0xFEE0_0000, .virtual_start = 0, .num_pages = 1, .attr = 0 },
+        .{ .typ = .LoaderData, .physical_start = 0x20_0000, .virtual_start = 0, .num_pages = 0x100, .attr = 0 },
+    };
+    var map = MemoryMap{
+        .buffer_size = @sizeOf(@TypeOf(descs)),
+        .descriptors = @ptrCast(&descs),
+        .map_size = @sizeOf(@TypeOf(descs)),
+        .map_key = 0,
+        .descriptor_size = @sizeOf(MemoryDescriptor),
+        .descriptor_version = 1,
+    };
+
+    try testing.expectEqual(0xFEE0_1000, map.physicalEnd());
+}
@@ -8,35 +8,11 @@ const zakuro = @import("zakuro");
 const builtin = std.builtin;
 const debug = std.debug;
 const log = std.log.scoped(.panic);
-const ser = zakuro.serial;
-const format = std.fmt.format;
+const unwind = zakuro.unwind;
 
 /// Implementation of the panic function.
 pub const panic_fn = panic;
 
-var serial: ser.Serial = undefined;
-const PanicError = error{};
-const Writer = std.io.Writer(
-    void,
-    PanicError,
-    writerFunction,
-);
-
-fn write(comptime fmt: []const u8, args: anytype) void {
-    format(
-        Writer{ .context = {} },
-        fmt,
-        args,
-    ) catch unreachable;
-}
-
-fn writerFunction(context: void, bytes: []const u8) PanicError!usize {
-    _ = context;
-    serial.write_string(bytes);
-
-    return bytes.len;
-}
-
 fn panic(
     msg: []const u8,
     error_return_trace: ?*builtin.StackTrace,
@@ -45,22 +21,19 @@ fn panic(
     @setCold(true);
     _ = ret_addr;
 
-    serial = ser.get();
     _ = zakuro.log.unsetConsole();
     log.err("{s}", .{msg});
 
     if (error_return_trace) |ert| {
-        printStackTrace(ert) catch |err| {
-            log.err("Failed to write stack trace: {s}\n", .{err});
-        };
-    } else {
-        var it = std.debug.StackIterator.init(@returnAddress(), null);
-        var ix: usize = 0;
-        log.err("=== Stack Trace ==============", .{});
-        while (it.next()) |frame| {
-            log.err("#{d:0>2}: 0x{X}: (No symbol available)", .{ ix, frame });
-            ix += 1;
-        }
+        log.err("=== Error Return Trace =======", .{});
+        printStackTrace(ert);
+    }
+
+    log.err("=== Stack Trace ==============", .{});
+    var it = unwind.FrameIterator.init(@frameAddress());
+    var ix: usize = 0;
+    while (it.next()) |frame| : (ix += 1) {
+        printFrame(ix, frame);
     }
 
     halt();
@@ -73,7 +46,7 @@ fn halt() noreturn {
     }
 }
 
-fn printStackTrace(stack_trace: *builtin.StackTrace) !void {
+fn printStackTrace(stack_trace: *builtin.StackTrace) void {
     var frames_left: usize = @min(stack_trace.index, stack_trace.instruction_addresses.len);
     var frames_index: usize = 0;
 
@@ -82,10 +55,10 @@ fn printStackTrace(stack_trace: *builtin.StackTrace) !void {
         frames_index = (frames_index + 1) % stack_trace.instruction_addresses.len;
     }) {
         const return_address = stack_trace.instruction_addresses[frames_index];
-        printFrame(return_address) catch |err| write("Failed to print this frame: {s}\n", .{err});
+        printFrame(frames_index, return_address);
     }
 }
 
-fn printFrame(address: usize) !void {
-    write("{x}: {s}\n", .{ address, "TODO: print frame" });
+fn printFrame(ix: usize, address: usize) void {
+    log.err("#{d:0>2}: {}", .{ ix, unwind.Frame.fromReturnAddress(address) });
 }
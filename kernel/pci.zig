@@ -24,6 +24,10 @@ pub const PciError = error{
     MsiUncapable,
     /// Exceed the number of supported vectors.
     ExceedSupportedVectors,
+    /// BAR does not exist or cannot be used for the requested operation.
+    InvalidBar,
+    /// Failed to map the BAR.
+    MapFailed,
 };
 
 /// Configration address register.
@@ -160,6 +164,18 @@ pub const PciDevice = struct {
         cap: u16,
     };
 
+    /// Offset of the first extended capability in the configuration space.
+    const ext_cap_start: u12 = 0x100;
+
+    const ExtCapabilityHeader = packed struct(u32) {
+        /// PCI Express Extended Capability ID.
+        id: u16,
+        /// Capability version.
+        version: u4,
+        /// Offset of the next extended capability.
+        next_ptr: u12,
+    };
+
     /// Get the configuration address of the device.
     pub fn address(self: Self, function: u3, reg: RegisterOffsets) ConfigAddress {
         return ConfigAddress{
@@ -176,33 +192,21 @@ pub const PciDevice = struct {
         function: u3,
         comptime reg: RegisterOffsets,
     ) reg.Width() {
-        const addr = self.address(function, reg);
-        arch.pci.setConfigAddress(addr);
-        const val = arch.pci.getConfigData();
+        const val = self.readDataArb(function, @intFromEnum(reg));
 
         return @truncate(val >> (@intFromEnum(reg) % 4 * 8));
     }
 
-    fn readDataArb(self: Self, function: u3, offset: u8) u32 {
-        const addr = ConfigAddress{
-            .offset = offset,
-            .function = function,
-            .device = self.device,
-            .bus = self.bus,
-        };
-        arch.pci.setConfigAddress(addr);
-        return arch.pci.getConfigData();
+    /// Read 32-bit data at the given offset of the configuration space.
+    /// `offset` is rounded down to 4-byte boundary.
+    fn readDataArb(self: Self, function: u3, offset: u12) u32 {
+        return arch.pci.readConfig(self.bus, self.device, function, offset);
     }
 
-    fn writeDataArb(self: Self, function: u3, offset: u8, data: u32) void {
-        const addr = ConfigAddress{
-            .offset = offset,
-            .function = function,
-            .device = self.device,
-            .bus = self.bus,
-        };
-        arch.pci.setConfigAddress(addr);
-        arch.pci.setConfigData(data);
+    /// Write 32-bit data at the given offset of the configuration space.
+    /// `offset` is rounded down to 4-byte boundary.
+    fn writeDataArb(self: Self, function: u3, offset: u12, data: u32) void {
+        arch.pci.writeConfig(self.bus, self.device, function, offset, data);
     }
 
     /// Check if the device is a single-function device.
@@ -234,56 +238,55 @@ pub const PciDevice = struct {
     /// Read a 32-bit BAR (Base Address Register) of the device from the configuration space.
     pub fn readBar(self: Self, function: u3, comptime index: u3) u32 {
         const offset: u8 = @intFromEnum(RegisterOffsets.BAR0) + @as(u8, index) * 4;
-        const addr = ConfigAddress{
-            .offset = offset,
-            .function = function,
-            .device = self.device,
-            .bus = self.bus,
-        };
-        arch.pci.setConfigAddress(addr);
-        return arch.pci.getConfigData();
+        return self.readDataArb(function, offset);
+    }
+
+    /// Find the extended capability with the given ID.
+    /// Returns the offset of the capability header in the configuration space,
+    /// or null if the capability is not found or the extended configuration space is not accessible.
+    pub fn findExtCapability(self: Self, function: u3, id: u16) ?u12 {
+        if (!arch.pci.hasExtendedConfig(self.bus)) return null;
+
+        // Extended capabilities start at 0x100 and are linked by 12-bit next pointers.
+        var offset: u12 = ext_cap_start;
+        // Bound the walk so that a broken list does not loop forever.
+        for (0..(0x1000 - ext_cap_start) / @sizeOf(ExtCapabilityHeader)) |_| {
+            const header: ExtCapabilityHeader = @bitCast(self.readDataArb(function, offset));
+            if (header.id == 0 or header.id == 0xFFFF) return null;
+            if (header.id == id) return offset;
+            if (header.next_ptr < ext_cap_start) return null;
+            offset = header.next_ptr & ~@as(u12, 0b11);
+        }
+        return null;
     }
 
     /// Read a various information of the device from the configuration space.
     pub fn readDeviceInfo(self: Self, function: u3) ?DeviceInfo {
-        const vendor_id = self.readVendorId(function);
+        // Read whole DWORDs to reduce the number of configuration space accesses.
+        const id = self.readDataArb(function, @intFromEnum(RegisterOffsets.VendorID));
+        const vendor_id: u16 = @truncate(id);
         if (vendor_id == 0xFFFF) {
             return null;
         }
-        const revision_id = self.readData(function, RegisterOffsets.RevisionID);
-        const base_class = self.readData(function, RegisterOffsets.BaseClass);
-        const subclass = self.readData(function, RegisterOffsets.Subclass);
-        const prog_if = self.readData(function, RegisterOffsets.ProgIF);
-        const header_type = self.readHeaderType(function);
+        const class = self.readDataArb(function, @intFromEnum(RegisterOffsets.RevisionID));
+        const misc = self.readDataArb(function, @intFromEnum(RegisterOffsets.CacheLineSize));
 
         return .{
             .device = self,
             .function = function,
             .vendor_id = vendor_id,
-            .revision_id = revision_id,
-            .base_class = base_class,
-            .subclass = subclass,
-            .prog_if = prog_if,
-            .header_type = header_type,
+            .device_id = @truncate(id >> 16),
+            .revision_id = @truncate(class),
+            .prog_if = @truncate(class >> 8),
+            .subclass = @truncate(class >> 16),
+            .base_class = @truncate(class >> 24),
+            .header_type = @truncate(misc >> 16),
         };
     }
 
-    /// Read a 8-bit Header Type of the device from the configuration space.
-    fn readHeaderType(self: Self, function: u3) u8 {
-        return self.readData(function, RegisterOffsets.HeaderType);
-    }
-
     /// Read bus numbers from the configuration space of bridge devices (Header Type = 1 or 2).
     fn readBusNumber(self: Self, function: u3) u32 {
-        const addr = ConfigAddress{
-            .offset = 0x18,
-            .function = function,
-            .device = self.device,
-            .bus = self.bus,
-        };
-
-        arch.pci.setConfigAddress(addr);
-        return arch.pci.getConfigData();
+        return self.readDataArb(function, 0x18);
     }
 };
 
@@ -296,6 +299,8 @@ pub const DeviceInfo = struct {
     function: u3,
     /// Vendor ID
     vendor_id: u16,
+    /// Device ID
+    device_id: u16,
     /// Revision ID
     revision_id: u8,
     /// Base class code
@@ -309,6 +314,92 @@ pub const DeviceInfo = struct {
 
     const Self = @This();
 
+    /// Get the class triple of the device.
+    pub fn class(self: Self) ClassTriple {
+        return .{
+            .base_class = self.base_class,
+            .subclass = self.subclass,
+            .prog_if = self.prog_if,
+        };
+    }
+
+    /// Check if the device is a PCI-to-PCI bridge (Header Type = 1).
+    pub fn isBridge(self: Self) bool {
+        return self.header_type & 0x7F == 0x01;
+    }
+
+    /// Check if the device is a multi-function device.
+    pub fn isMultiFunction(self: Self) bool {
+        return self.header_type & 0x80 != 0;
+    }
+
+    /// Number of BARs of the device.
+    pub fn numBars(self: Self) u3 {
+        return switch (self.header_type & 0x7F) {
+            0x00 => 6,
+            0x01 => 2,
+            else => 0,
+        };
+    }
+
+    /// Read and decode the BAR at the given index.
+    /// The size of the region is probed by writing all-ones to the BAR.
+    /// Returns null if the BAR is not implemented.
+    /// For 64-bit BARs, `index` MUST point to the lower half.
+    pub fn readBarInfo(self: *const Self, index: u3) PciError!?Bar {
+        const num_bars = self.numBars();
+        if (index >= num_bars) return PciError.InvalidBar;
+
+        const dev = self.device;
+        const func = self.function;
+        const offset: u12 = @intFromEnum(RegisterOffsets.BAR0) + @as(u12, index) * 4;
+
+        const lower = dev.readDataArb(func, offset);
+        const is64 = Bar.isLower64(lower);
+        if (is64 and index + 1 >= num_bars) return PciError.InvalidBar;
+        const upper = if (is64) dev.readDataArb(func, offset + 4) else 0;
+
+        // Disable decoding while probing so that the device does not respond to all-ones address.
+        // Status register is written with zeros, which does not clear any RW1C bits.
+        const command_offset = @intFromEnum(RegisterOffsets.Command);
+        const command = dev.readData(func, RegisterOffsets.Command);
+        dev.writeDataArb(func, command_offset, command & ~@as(u16, 0b11));
+
+        dev.writeDataArb(func, offset, 0xFFFF_FFFF);
+        const lower_mask = dev.readDataArb(func, offset);
+        dev.writeDataArb(func, offset, lower);
+        const upper_mask = if (is64) blk: {
+            dev.writeDataArb(func, offset + 4, 0xFFFF_FFFF);
+            const mask = dev.readDataArb(func, offset + 4);
+            dev.writeDataArb(func, offset + 4, upper);
+            break :blk mask;
+        } else 0;
+
+        dev.writeDataArb(func, command_offset, command);
+
+        return Bar.decode(lower, upper, lower_mask, upper_mask);
+    }
+
+    /// Map the memory BAR at the given index and get its virtual address.
+    /// Prefetchable BARs are mapped as write-combining, and others are mapped as uncacheable.
+    pub fn mapBar(self: *const Self, index: u3) PciError!u64 {
+        const bar = try self.readBarInfo(index) orelse return PciError.InvalidBar;
+        if (bar.space != .Memory) return PciError.InvalidBar;
+
+        const mtype: arch.page.MemoryType = if (bar.prefetchable) .WriteCombining else .Uncacheable;
+        log.debug("Mapping BAR{d} of {X:0>2}:{X:0>2}:{X:0>1}: base=0x{X} size=0x{X} type={s}", .{
+            index,
+            self.device.bus,
+            self.device.device,
+            self.function,
+            bar.base,
+            bar.size,
+            @tagName(mtype),
+        });
+
+        return arch.page.ioremap(bar.base, bar.size, mtype) catch return PciError.MapFailed;
+    }
+
     /// Enable MSI for the device.
     /// `num_vectors_exp` is the number of MSI vectors to be enabled.
     /// When `num_vectors_exp` is N, 2^N MSI vectors are enabled.
@@ -380,27 +471,25 @@ pub const DeviceInfo = struct {
     }
 };
 
-/// Add a PCI device to the known device list.
-fn addDevice(device: PciDevice, function: u3) PciError!void {
+/// Add a PCI device to the known device list and the indices.
+fn addDevice(info: DeviceInfo) PciError!void {
     if (num_devices >= max_device_num) {
         return PciError.ListFull;
     }
 
-    const info = device.readDeviceInfo(function);
-    devices[num_devices] = info;
+    const index: u16 = @truncate(num_devices);
+    devices[index] = info;
+    class_index.insert(info.class().key(), index);
+    id_index.insert(idKey(info.vendor_id, info.device_id), index);
     num_devices += 1;
 }
 
-fn registerFunction(bus: u8, device: u5, function: u3) PciError!void {
-    const dev = PciDevice{ .bus = bus, .device = device };
-    const base_class = dev.readData(function, RegisterOffsets.BaseClass);
-    const subclass = dev.readData(function, RegisterOffsets.Subclass);
+fn registerFunction(info: DeviceInfo) PciError!void {
+    try addDevice(info);
 
-    try addDevice(dev, function);
-
-    if (base_class == @intFromEnum(ClassCodes.Bridge) and subclass == 0x04) {
-        // this is a PCI-to-PCI bridge
-        const bus_number = dev.readBusNumber(function);
+    if (info.isBridge()) {
+        // This is a PCI-to-PCI bridge. Follow its secondary bus.
+        const bus_number = info.device.readBusNumber(info.function);
         const secondary_bus: u8 = @truncate(bus_number >> 8);
         try registerBus(secondary_bus);
     }
@@ -408,24 +497,36 @@ fn registerFunction(bus: u8, device: u5, function: u3) PciError!void {
 
 fn registerDevice(bus: u8, device: u5) PciError!void {
     const dev = PciDevice{ .bus = bus, .device = device };
-    if (dev.readVendorId(0) == 0xFFFF) return;
+    const info = dev.readDeviceInfo(0) orelse return;
 
-    try registerFunction(bus, device, 0);
+    try registerFunction(info);
 
-    if (dev.isSingleFunction()) return;
+    // Functions other than 0 are probed only when the multi-function bit is set.
+    if (!info.isMultiFunction()) return;
     for (1..8) |function| {
-        if (dev.readVendorId(@truncate(function)) != 0xFFFF) {
-            try registerFunction(bus, device, @truncate(function));
+        if (dev.readDeviceInfo(@truncate(function))) |finfo| {
+            try registerFunction(finfo);
         }
     }
 }
 
 fn registerBus(bus: u8) PciError!void {
+    // Misconfigured bridges can point to an already scanned bus.
+    if (scanned_buses.isSet(bus)) return;
+    scanned_buses.set(bus);
+
     for (0..32) |device| {
         try registerDevice(bus, @truncate(device));
     }
 }
 
+/// Initialize the access method to the PCI configuration space.
+/// ECAM is used if available, otherwise legacy I/O ports are used.
+/// ACPI MUST be initialized before calling this function to use ECAM.
+pub fn init() void {
+    arch.pci.init();
+}
+
 /// Scan all PCI devices and register them.
 /// Note that it clears the device list before scanning.
 /// Note: There are three ways to scan PCI devices.
@@ -433,10 +534,14 @@ fn registerBus(bus: u8) PciError!void {
 /// The second is a recursive scan that finds available buses while scanning.
 /// The last one is similar to the second, but configures registers while scanning.
 /// This function uses the second method.
+/// Found devices are indexed by class triple and by Vendor ID / Device ID.
 pub fn registerAllDevices() PciError!void {
-    // Clear the device list.
+    // Clear the device list and the indices.
     num_devices = 0;
     @memset(&devices, null);
+    class_index.clear();
+    id_index.clear();
+    scanned_buses = std.StaticBitSet(256).initEmpty();
 
     // Recursively scan all devices under valid buses.
     const bridge = PciDevice{ .bus = 0, .device = 0 };
@@ -458,10 +563,291 @@ pub const KnownVendors = enum(u16) {
     Qemu = 0x1234,
 };
 
+/// Address space of a BAR.
+pub const BarSpace = enum {
+    /// Memory space.
+    Memory,
+    /// I/O space.
+    Io,
+};
+
+/// Decoded Base Address Register.
+pub const Bar = struct {
+    /// Address space that the BAR maps.
+    space: BarSpace,
+    /// Base address of the region.
+    base: u64,
+    /// Size in bytes of the region.
+    size: u64,
+    /// The BAR is 64-bit and consumes two BAR slots.
+    is64: bool,
+    /// The memory region is prefetchable.
+    prefetchable: bool,
+
+    /// Check if the raw BAR value is the lower half of a 64-bit memory BAR.
+    fn isLower64(lower: u32) bool {
+        return lower & 0b1 == 0 and (lower >> 1) & 0b11 == 0b10;
+    }
+
+    /// Decode raw BAR values and masks read back after writing all-ones.
+    /// `upper` and `upper_mask` are ignored for 32-bit BARs.
+    /// Returns null if the BAR is not implemented.
+    fn decode(lower: u32, upper: u32, lower_mask: u32, upper_mask: u32) ?Bar {
+        const is_io = lower & 0b1 != 0;
+        const is64 = isLower64(lower);
+        const flags: u32 = if (is_io) 0b11 else 0b1111;
+
+        const low = lower_mask & ~flags;
+        const high: u32 = if (is64) upper_mask else 0xFFFF_FFFF;
+        if (low == 0 and (!is64 or high == 0)) return null;
+
+        var mask = (@as(u64, high) << 32) | low;
+        if (is_io) {
+            // Upper 16 bits of I/O BARs can be hardwired to zero.
+            mask |= 0xFFFF_0000;
+        }
+
+        return .{
+            .space = if (is_io) .Io else .Memory,
+            .base = (@as(u64, if (is64) upper else 0) << 32) | (lower & ~flags),
+            .size = ~mask +% 1,
+            .is64 = is64,
+            .prefetchable = !is_io and lower & 0b1000 != 0,
+        };
+    }
+};
+
+/// Triple of class codes that identifies the function of a device.
+pub const ClassTriple = struct {
+    /// Base class code
+    base_class: u8,
+    /// Subclass code
+    subclass: u8,
+    /// Program interface
+    prog_if: u8,
+
+    /// Get the key used in the class index.
+    fn key(self: ClassTriple) u32 {
+        return (@as(u32, self.base_class) << 16) | (@as(u32, self.subclass) << 8) | self.prog_if;
+    }
+};
+
+/// Get the key used in the ID index.
+fn idKey(vendor_id: u16, device_id: u16) u32 {
+    return (@as(u32, vendor_id) << 16) | device_id;
+}
+
+/// Index of registered devices by class triple.
+var class_index: DeviceIndex = .{};
+/// Index of registered devices by Vendor ID and Device ID.
+var id_index: DeviceIndex = .{};
+/// Buses that are already scanned in the current enumeration.
+var scanned_buses = std.StaticBitSet(256).initEmpty();
+
+/// Hash table that maps a key to the list of indices of `devices`.
+/// It uses open addressing with linear probing.
+/// Devices with the same key are chained in the order of registration.
+const DeviceIndex = struct {
+    /// Number of slots.
+    /// This is twice the maximum number of devices so that the table never gets full.
+    const num_slots: usize = max_device_num * 2;
+
+    const Slot = struct {
+        /// Key of the devices.
+        key: u32,
+        /// Index of the first device with the key.
+        head: u16,
+        /// Index of the last device with the key.
+        tail: u16,
+    };
+
+    /// Slots of the hash table.
+    slots: [num_slots]?Slot = [_]?Slot{null} ** num_slots,
+    /// Index of the next device with the same key.
+    next: [max_device_num]?u16 = [_]?u16{null} ** max_device_num,
+
+    /// Remove all entries.
+    fn clear(self: *DeviceIndex) void {
+        self.* = .{};
+    }
+
+    /// Append the device index to the chain of the key.
+    fn insert(self: *DeviceIndex, k: u32, index: u16) void {
+        self.next[index] = null;
+
+        var pos = hash(k);
+        while (true) : (pos = (pos + 1) % num_slots) {
+            if (self.slots[pos]) |*slot| {
+                if (slot.key != k) continue;
+                self.next[slot.tail] = index;
+                slot.tail = index;
+            } else {
+                self.slots[pos] = .{ .key = k, .head = index, .tail = index };
+            }
+            return;
+        }
+    }
+
+    /// Get the index of the first device with the key.
+    fn lookup(self: *const DeviceIndex, k: u32) ?u16 {
+        var pos = hash(k);
+        while (self.slots[pos]) |slot| : (pos = (pos + 1) % num_slots) {
+            if (slot.key == k) return slot.head;
+        }
+        return null;
+    }
+
+    fn hash(k: u32) usize {
+        // Fibonacci hashing.
+        const shift = 32 - std.math.log2_int(usize, num_slots);
+        return @as(u32, k *% 0x9E37_79B9) >> @intCast(shift);
+    }
+};
+
+/// Iterator over registered devices that share the same key.
+pub const DeviceIterator = struct {
+    index: *const DeviceIndex,
+    current: ?u16,
+
+    /// Get the next device.
+    pub fn next(self: *DeviceIterator) ?*const DeviceInfo {
+        const i = self.current orelse return null;
+        self.current = self.index.next[i];
+        return &devices[i].?;
+    }
+};
+
+/// Iterate over registered devices with the given class triple.
+pub fn findByClass(class: ClassTriple) DeviceIterator {
+    return .{ .index = &class_index, .current = class_index.lookup(class.key()) };
+}
+
+/// Iterate over registered devices with the given Vendor ID and Device ID.
+pub fn findById(vendor_id: u16, device_id: u16) DeviceIterator {
+    return .{ .index = &id_index, .current = id_index.lookup(idKey(vendor_id, device_id)) };
+}
+
+/// Condition for a driver to handle a device.
+/// Either `class` or both of `vendor_id` and `device_id` MUST be specified.
+/// Unspecified fields match any value.
+pub const DeviceMatch = struct {
+    /// Class triple of the device.
+    class: ?ClassTriple = null,
+    /// Vendor ID of the device.
+    vendor_id: ?u16 = null,
+    /// Device ID of the device.
+    device_id: ?u16 = null,
+
+    /// Check if the device satisfies all the specified conditions.
+    fn matches(comptime self: DeviceMatch, info: *const DeviceInfo) bool {
+        if (self.class) |c| if (c.key() != info.class().key()) return false;
+        if (self.vendor_id) |v| if (v != info.vendor_id) return false;
+        if (self.device_id) |d| if (d != info.device_id) return false;
+        return true;
+    }
+};
+
+/// PCI driver declaration.
+pub const Driver = struct {
+    /// Name of the driver.
+    name: []const u8,
+    /// Match table of the driver in order of preference.
+    matches: []const DeviceMatch,
+};
+
+/// Find the most preferred device that the driver can handle.
+/// Entries of the match table are tried in order,
+/// and each entry is resolved by the class index or the ID index.
+pub fn findDevice(comptime driver: Driver) ?*const DeviceInfo {
+    inline for (driver.matches) |m| {
+        var it = if (m.vendor_id != null and m.device_id != null)
+            findById(m.vendor_id.?, m.device_id.?)
+        else if (m.class) |c|
+            findByClass(c)
+        else
+            @compileError("Match entry of " ++ driver.name ++ " must specify a class or IDs.");
+
+        while (it.next()) |info| {
+            if (m.matches(info)) return info;
+        }
+    }
+
+    return null;
+}
+
 /////////////////////////////////////
 
 const expectEqual = std.testing.expectEqual;
 
+test "Bar decode" {
+    // Unimplemented BAR.
+    try expectEqual(null, Bar.decode(0, 0, 0, 0));
+
+    // 32-bit non-prefetchable memory BAR of 16KiB.
+    try expectEqual(Bar{
+        .space = .Memory,
+        .base = 0xFEBF_0000,
+        .size = 0x4000,
+        .is64 = false,
+        .prefetchable = false,
+    }, Bar.decode(0xFEBF_0000, 0, 0xFFFF_C000, 0));
+
+    // 64-bit prefetchable memory BAR of 16MiB.
+    try expectEqual(Bar{
+        .space = .Memory,
+        .base = 0x80_0000_0000,
+        .size = 0x100_0000,
+        .is64 = true,
+        .prefetchable = true,
+    }, Bar.decode(0x0000_000C, 0x80, 0xFF00_000C, 0xFFFF_FFFF));
+
+    // 64-bit memory BAR of 8GiB.
+    try expectEqual(Bar{
+        .space = .Memory,
+        .base = 0x4_0000_0000,
+        .size = 0x2_0000_0000,
+        .is64 = true,
+        .prefetchable = false,
+    }, Bar.decode(0x0000_0004, 0x4, 0x0000_0004, 0xFFFF_FFFE));
+
+    // I/O BAR of 32 bytes with upper bits hardwired to zero.
+    try expectEqual(Bar{
+        .space = .Io,
+        .base = 0xC040,
+        .size = 0x20,
+        .is64 = false,
+        .prefetchable = false,
+    }, Bar.decode(0xC041, 0, 0x0000_FFE1, 0));
+}
+
+test "DeviceIndex" {
+    var index = DeviceIndex{};
+    try expectEqual(null, index.lookup(0x0C0330));
+
+    // Devices with the same key are chained in the order of registration.
+    index.insert(0x0C0330, 3);
+    index.insert(0x060400, 1);
+    index.insert(0x0C0330, 5);
+    index.insert(0x0C0330, 0);
+    try expectEqual(3, index.lookup(0x0C0330));
+    try expectEqual(5, index.next[3]);
+    try expectEqual(0, index.next[5]);
+    try expectEqual(null, index.next[0]);
+    try expectEqual(1, index.lookup(0x060400));
+    try expectEqual(null, index.next[1]);
+
+    // Many distinct keys do not break lookups.
+    for (10..200) |i| {
+        index.insert(@truncate(i * 0x1_0000), @truncate(i));
+    }
+    for (10..200) |i| {
+        try expectEqual(@as(u16, @truncate(i)), index.lookup(@truncate(i * 0x1_0000)));
+    }
+
+    index.clear();
+    try expectEqual(null, index.lookup(0x0C0330));
+}
+
 test "ConfigAddress cast" {
     const addr = ConfigAddress{
         .offset = 0b0010_0000,
@@ -0,0 +1,166 @@
+//! This module provides a sampling profiler driven by the timer interrupt.
+//!
+//! On every `interval` timer ticks, the instruction pointer and a shallow frame-pointer stack
+//! of the interrupted context are recorded into a lock-free single-producer single-consumer ring.
+//! The interrupt handler is the only producer and `flush()` called from the main loop is the only consumer.
+//!
+//! `flush()` emits each sample to the serial console as a symbolized folded stack:
+//!
+//!   @prof outermost;...;caller;leaf 1
+//!
+//! Lines starting with `@prof ` can be summed up by a host tool such as flamegraph.pl
+//! after stripping the prefix. `printFlat()` prints a flat profile of the leaf functions.
+
+const std = @import("std");
+const log = std.log.scoped(.profile);
+const option = @import("option");
+
+const zakuro = @import("zakuro");
+const arch = zakuro.arch;
+const ser = zakuro.serial;
+const symbols = zakuro.symbols;
+const unwind = zakuro.unwind;
+const Spsc = zakuro.lib.ring.Spsc;
+
+/// Maximum number of frames recorded per sample including the leaf.
+const max_depth = 8;
+/// Number of samples the ring can hold. MUST be a power of two.
+const ring_size = 256;
+/// Maximum number of distinct functions in the flat profile.
+const flat_size = 128;
+
+/// Sample of the interrupted context.
+const Sample = struct {
+    /// Number of valid addresses in `frames`.
+    depth: u8,
+    /// Instruction pointer followed by return addresses, innermost first.
+    frames: [max_depth]u64,
+};
+
+/// Entry of the flat profile.
+const FlatEntry = struct {
+    /// Name of the function. Empty if the slot is unused.
+    name: []const u8 = "",
+    /// Number of samples whose leaf is in the function.
+    count: u64 = 0,
+};
+
+/// Storage of the ring.
+var ring_buf: [ring_size]Sample = undefined;
+/// Ring buffer of samples.
+var ring = Spsc(Sample).initBuffer(&ring_buf);
+
+/// Sampling interval in timer ticks. 0 if the profiler is stopped.
+var interval: u64 = 0;
+/// Ticks since the last sample.
+var ticks: u64 = 0;
+/// Number of samples dropped because the ring is full.
+var dropped: u64 = 0;
+/// Number of samples taken.
+var total: u64 = 0;
+/// Number of samples per leaf function.
+var flat: [flat_size]FlatEntry = [_]FlatEntry{.{}} ** flat_size;
+
+/// Start the profiler if it is enabled by the build option.
+pub fn init() void {
+    if (option.profile_interval != 0) {
+        start(option.profile_interval);
+    }
+}
+
+/// Start sampling once per `interval_ticks` timer ticks.
+pub fn start(interval_ticks: u64) void {
+    ticks = 0;
+    dropped = 0;
+    total = 0;
+    flat = [_]FlatEntry{.{}} ** flat_size;
+    interval = @max(interval_ticks, 1);
+    log.info("Profiler started: interval={d} ticks", .{interval});
+}
+
+/// Stop sampling.
+/// Samples in the ring are kept until `flush()` is called.
+pub fn stop() void {
+    interval = 0;
+}
+
+/// Record a sample of the interrupted context if the interval elapsed.
+/// This function MUST be called from the timer interrupt handler.
+pub fn sample(ctx: *const arch.intr.Context) void {
+    if (interval == 0) return;
+    ticks += 1;
+    if (ticks < interval) return;
+    ticks = 0;
+
+    var s: Sample = undefined;
+    s.frames[0] = ctx.rip;
+    s.depth = @intCast(1 + unwind.capture(ctx.registers.rbp, s.frames[1..]));
+    ring.push(s) catch {
+        dropped += 1;
+    };
+}
+
+/// Emit all samples in the ring to the serial console.
+/// This function MUST be called from a single context at a time, such as the main loop.
+pub fn flush() void {
+    const writer = ser.get().writer();
+
+    while (ring.pop()) |s| {
+        writer.writeAll("@prof ") catch {};
+        var i: usize = s.depth;
+        while (i > 0) {
+            i -= 1;
+            // Return addresses are resolved by the call instruction.
+            const addr = if (i == 0) s.frames[i] else s.frames[i] -| 1;
+            printSymbol(writer, addr);
+            if (i != 0) writer.writeAll(";") catch {};
+        }
+        writer.writeAll(" 1\n") catch {};
+
+        countFlat(s.frames[0]);
+        total += 1;
+    }
+}
+
+/// Print the flat profile of the samples flushed so far.
+pub fn printFlat() void {
+    var sorted = flat;
+    std.sort.pdq(FlatEntry, &sorted, {}, moreSamples);
+
+    log.info("=== Flat Profile: {d} samples, {d} dropped ===", .{ total, dropped });
+    for (sorted) |ent| {
+        if (ent.count == 0) break;
+        log.info("{d: >6} {d: >3}% {s}", .{ ent.count, ent.count * 100 / @max(total, 1), ent.name });
+    }
+}
+
+fn printSymbol(writer: ser.Serial.Writer, addr: u64) void {
+    if (symbols.findFunction(addr)) |sym| {
+        writer.writeAll(sym.name) catch {};
+    } else {
+        writer.print("0x{X}", .{addr}) catch {};
+    }
+}
+
+/// Count the sample into the flat profile.
+/// Samples of unknown functions are counted as "[unknown]".
+/// Samples of new functions are ignored if the table is full.
+fn countFlat(addr: u64) void {
+    const name = if (symbols.findFunction(addr)) |sym| sym.name else "[unknown]";
+
+    // Names are slices of the embedded symbol table, so the pointer identifies the function.
+    var i = std.hash.uint32(@truncate(@intFromPtr(name.ptr))) % flat_size;
+    for (0..flat_size) |_| {
+        const ent = &flat[i];
+        if (ent.count == 0) ent.name = name;
+        if (ent.name.ptr == name.ptr) {
+            ent.count += 1;
+            return;
+        }
+        i = (i + 1) % flat_size;
+    }
+}
+
+fn moreSamples(_: void, a: FlatEntry, b: FlatEntry) bool {
+    return a.count > b.count;
+}
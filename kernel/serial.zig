@@ -1,5 +1,6 @@
 //! This module provides a serial interface.
 
+const std = @import("std");
 const zakuro = @import("zakuro");
 const arch = zakuro.arch;
 
@@ -24,6 +25,19 @@ pub const Serial = struct {
             self.write(c);
         }
     }
+
+    /// Get a writer to the serial console.
+    pub fn writer(self: Self) Writer {
+        return .{ .context = self };
+    }
+
+    fn writeBytes(self: Self, bytes: []const u8) error{}!usize {
+        self.write_string(bytes);
+        return bytes.len;
+    }
+
+    /// Writer to the serial console.
+    pub const Writer = std.io.GenericWriter(Self, error{}, writeBytes);
 };
 
 /// Initialize the serial console.
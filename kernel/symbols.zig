@@ -0,0 +1,48 @@
+//! This module provides the symbol table of the kernel embedded at build time.
+//! The table is in `zakuro_symtab` section, whose bounds are provided by the linker.
+//! If the kernel is linked without the table, no symbol is available.
+
+const zakuro = @import("zakuro");
+const SymbolTable = zakuro.dwarf.SymbolTable;
+
+pub const Symbol = SymbolTable.Symbol;
+pub const Location = zakuro.dwarf.LineTable.Location;
+
+/// Start of the symbol table.
+const symtab_start = @extern(?[*]align(8) const u8, .{
+    .name = "__start_zakuro_symtab",
+    .linkage = .weak,
+});
+/// End of the symbol table.
+const symtab_stop = @extern(?[*]const u8, .{
+    .name = "__stop_zakuro_symtab",
+    .linkage = .weak,
+});
+
+/// Symbol table. null if not available.
+var table: ?SymbolTable = null;
+/// The table is already looked up.
+var initialized = false;
+
+/// Get the symbol table of the kernel.
+/// Returns null if the kernel does not have a valid table.
+pub fn get() ?SymbolTable {
+    if (!initialized) {
+        initialized = true;
+        const start = symtab_start orelse return null;
+        const stop = symtab_stop orelse return null;
+        table = SymbolTable.init(start[0 .. @intFromPtr(stop) - @intFromPtr(start)]);
+    }
+
+    return table;
+}
+
+/// Find the function containing the address.
+pub fn findFunction(addr: u64) ?Symbol {
+    return (get() orelse return null).findFunction(addr);
+}
+
+/// Find the source location of the instruction at the address.
+pub fn findLine(addr: u64) ?Location {
+    return (get() orelse return null).findLine(addr);
+}
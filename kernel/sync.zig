@@ -0,0 +1,283 @@
+//! Synchronization primitives.
+//!
+//! - `SpinLock` is a test-and-test-and-set lock. It is cheap but unfair under contention.
+//! - `TicketLock` serves waiters in the order of arrival.
+//!
+//! Locks shared with interrupt handlers MUST be taken by `lockIrqSave()` and released by `unlockIrqRestore()`.
+//! They keep interrupts disabled while the lock is held, and restore RFLAGS.IF to the state before locking,
+//! so that they can be nested and used in interrupt handlers.
+//! Otherwise, a handler that takes the lock held by the interrupted context deadlocks.
+//!
+//! When the kernel is built with `-Dlock_stats`, each lock records the number of acquisitions,
+//! contended acquisitions, spin iterations, and a histogram of hold times in TSC cycles.
+//! Statistics are updated while the lock is held, so they need no atomic operations.
+//! They are printed by `dumpStats()`. The benchmark runner prints those of the kernel's locks when it finishes.
+
+const std = @import("std");
+const log = std.log.scoped(.sync);
+const option = @import("option");
+const is_test = @import("builtin").is_test;
+const Atomic = std.atomic.Value;
+
+const zakuro = @import("zakuro");
+const arch = zakuro.arch;
+
+/// Whether locks collect statistics.
+const stats_enabled = if (is_test) true else option.lock_stats;
+
+/// Interrupt state saved by `lockIrqSave()`.
+pub const IrqState = bool;
+
+/// Test-and-test-and-set spin lock.
+pub const SpinLock = Lock(TtasImpl);
+/// FIFO ticket lock.
+pub const TicketLock = Lock(TicketImpl);
+
+/// Statistics of a lock.
+pub const Stats = struct {
+    /// Number of buckets of the hold-time histogram.
+    pub const num_buckets = 16;
+    /// Hold times shorter than 2^min_shift cycles fall into the first bucket.
+    const min_shift = 6;
+
+    /// Number of acquisitions.
+    acquisitions: u64 = 0,
+    /// Number of acquisitions that had to wait for another holder.
+    contentions: u64 = 0,
+    /// Total number of spin iterations while waiting.
+    spins: u64 = 0,
+    /// Maximum hold time in cycles.
+    max_hold: u64 = 0,
+    /// Histogram of hold times.
+    /// Bucket `i` (0 < i < num_buckets - 1) counts hold times in [2^(i+min_shift-1), 2^(i+min_shift)) cycles.
+    /// The last bucket also counts all longer hold times.
+    hold_hist: [num_buckets]u64 = [_]u64{0} ** num_buckets,
+    /// TSC when the lock is acquired.
+    acquired_at: u64 = 0,
+
+    fn recordAcquire(self: *Stats, spins: u64) void {
+        self.acquisitions += 1;
+        if (spins != 0) {
+            self.contentions += 1;
+            self.spins += spins;
+        }
+        self.acquired_at = arch.readTsc();
+    }
+
+    fn recordRelease(self: *Stats) void {
+        const cycles = arch.readTsc() -% self.acquired_at;
+        self.max_hold = @max(self.max_hold, cycles);
+        self.hold_hist[bucket(cycles)] += 1;
+    }
+
+    /// Get the histogram bucket of the hold time.
+    fn bucket(cycles: u64) usize {
+        if (cycles < (1 << min_shift)) return 0;
+        const order: usize = std.math.log2_int(u64, cycles) - min_shift + 1;
+        return @min(order, num_buckets - 1);
+    }
+
+    /// Print the statistics.
+    pub fn dump(self: *const Stats, name: []const u8) void {
+        log.info("{s}: acquisitions={d} contentions={d} spins={d} max_hold={d}", .{
+            name,
+            self.acquisitions,
+            self.contentions,
+            self.spins,
+            self.max_hold,
+        });
+        for (self.hold_hist, 0..) |count, i| {
+            if (count == 0) continue;
+            if (i == num_buckets - 1) {
+                log.info("{s}:  >= 2^{d: >2} cycles: {d}", .{ name, i + min_shift - 1, count });
+            } else {
+                log.info("{s}:   < 2^{d: >2} cycles: {d}", .{ name, i + min_shift, count });
+            }
+        }
+    }
+};
+
+/// Lock built on the given implementation of the acquire/release protocol.
+fn Lock(comptime Impl: type) type {
+    return struct {
+        const Self = @This();
+
+        /// Lock state.
+        impl: Impl = .{},
+        /// Statistics. Empty unless enabled.
+        stats: if (stats_enabled) Stats else struct {} = .{},
+
+        /// Acquire the lock, spinning until it is available.
+        pub fn lock(self: *Self) void {
+            const spins = self.impl.acquire();
+            if (stats_enabled) self.stats.recordAcquire(spins);
+        }
+
+        /// Try to acquire the lock without spinning.
+        /// Returns true if the lock is acquired.
+        pub fn tryLock(self: *Self) bool {
+            if (!self.impl.tryAcquire()) return false;
+            if (stats_enabled) self.stats.recordAcquire(0);
+            return true;
+        }
+
+        /// Release the lock.
+        pub fn unlock(self: *Self) void {
+            if (stats_enabled) self.stats.recordRelease();
+            self.impl.release();
+        }
+
+        /// Disable interrupts and acquire the lock.
+        /// Returns the interrupt state to pass to `unlockIrqRestore()`.
+        /// In tests, running on the host in user mode, interrupts are left untouched.
+        pub fn lockIrqSave(self: *Self) IrqState {
+            const state = if (is_test) false else arch.saveAndDisableIntr();
+            self.lock();
+            return state;
+        }
+
+        /// Release the lock and restore the interrupt state saved by `lockIrqSave()`.
+        pub fn unlockIrqRestore(self: *Self, state: IrqState) void {
+            self.unlock();
+            arch.restoreIntr(state);
+        }
+
+        /// Print the statistics of the lock under the given name.
+        /// Does nothing unless statistics are enabled.
+        pub fn dumpStats(self: *const Self, name: []const u8) void {
+            if (stats_enabled) self.stats.dump(name);
+        }
+
+        /// Check if the lock is held by someone.
+        pub fn isLocked(self: *const Self) bool {
+            return self.impl.isLocked();
+        }
+    };
+}
+
+/// Test-and-test-and-set protocol.
+/// Waiters spin on a plain load, so that the cache line is not bounced between CPUs until the lock is released.
+const TtasImpl = struct {
+    locked: Atomic(bool) = Atomic(bool).init(false),
+
+    fn acquire(self: *TtasImpl) u64 {
+        var spins: u64 = 0;
+        while (self.locked.swap(true, .acquire)) {
+            while (self.locked.load(.monotonic)) {
+                arch.relax();
+                spins += 1;
+            }
+        }
+        return spins;
+    }
+
+    fn tryAcquire(self: *TtasImpl) bool {
+        return !self.locked.load(.monotonic) and !self.locked.swap(true, .acquire);
+    }
+
+    fn release(self: *TtasImpl) void {
+        self.locked.store(false, .release);
+    }
+
+    fn isLocked(self: *const TtasImpl) bool {
+        return self.locked.load(.monotonic);
+    }
+};
+
+/// Ticket protocol.
+/// Each waiter takes a ticket and waits until the ticket is served.
+const TicketImpl = struct {
+    /// Next ticket to hand out.
+    next: Atomic(u32) = Atomic(u32).init(0),
+    /// Ticket being served.
+    serving: Atomic(u32) = Atomic(u32).init(0),
+
+    fn acquire(self: *TicketImpl) u64 {
+        const ticket = self.next.fetchAdd(1, .monotonic);
+        var spins: u64 = 0;
+        while (self.serving.load(.acquire) != ticket) {
+            arch.relax();
+            spins += 1;
+        }
+        return spins;
+    }
+
+    fn tryAcquire(self: *TicketImpl) bool {
+        const serving = self.serving.load(.monotonic);
+        return self.next.cmpxchgStrong(serving, serving +% 1, .acquire, .monotonic) == null;
+    }
+
+    fn release(self: *TicketImpl) void {
+        // Only the holder updates `serving`.
+        self.serving.store(self.serving.load(.monotonic) +% 1, .release);
+    }
+
+    fn isLocked(self: *const TicketImpl) bool {
+        return self.next.load(.monotonic) != self.serving.load(.monotonic);
+    }
+};
+
+const testing = std.testing;
+
+test "SpinLock" {
+    var lock = SpinLock{};
+    try testing.expect(!lock.isLocked());
+    lock.lock();
+    try testing.expect(lock.isLocked());
+    try testing.expect(!lock.tryLock());
+    lock.unlock();
+    try testing.expect(lock.tryLock());
+    lock.unlock();
+
+    try testing.expectEqual(2, lock.stats.acquisitions);
+    try testing.expectEqual(0, lock.stats.contentions);
+}
+
+test "TicketLock" {
+    var lock = TicketLock{};
+    lock.lock();
+    try testing.expect(!lock.tryLock());
+    lock.unlock();
+    try testing.expect(!lock.isLocked());
+
+    // Tickets wrap around.
+    lock.impl.next.store(std.math.maxInt(u32), .monotonic);
+    lock.impl.serving.store(std.math.maxInt(u32), .monotonic);
+    lock.lock();
+    lock.unlock();
+    try testing.expectEqual(0, lock.impl.serving.load(.monotonic));
+    try testing.expect(lock.tryLock());
+    lock.unlock();
+}
+
+test "Locks exclude each other across threads" {
+    inline for (.{ SpinLock, TicketLock }) |L| {
+        const Counter = struct {
+            lock: L = .{},
+            value: usize = 0,
+
+            fn run(self: *@This()) void {
+                for (0..10000) |_| {
+                    self.lock.lock();
+                    self.value += 1;
+                    self.lock.unlock();
+                }
+            }
+        };
+
+        var counter = Counter{};
+        var threads: [4]std.Thread = undefined;
+        for (&threads) |*t| t.* = try std.Thread.spawn(.{}, Counter.run, .{&counter});
+        for (threads) |t| t.join();
+        try testing.expectEqual(40000, counter.value);
+        try testing.expectEqual(40000, counter.lock.stats.acquisitions);
+    }
+}
+
+test "Hold time buckets" {
+    try testing.expectEqual(0, Stats.bucket(0));
+    try testing.expectEqual(0, Stats.bucket(63));
+    try testing.expectEqual(1, Stats.bucket(64));
+    try testing.expectEqual(2, Stats.bucket(128));
+    try testing.expectEqual(Stats.num_buckets - 1, Stats.bucket(std.math.maxInt(u64)));
+}
@@ -0,0 +1,412 @@
+//! Cooperative kernel tasks and futures.
+//!
+//! A task runs a function on its own stack. When the task waits on a `Future` that is not completed yet,
+//! or on a `WaitQueue` until a condition holds, it is suspended and the control returns to the main loop.
+//! Completing the future or waking the queue puts the task in the run queue,
+//! and the main loop resumes it by `runReady()`.
+//! This lets a sequence of asynchronous requests be written as straight-line code:
+//!
+//!   const len = try device.controlIn(ep_id, sud, buf); // Suspended until the transfer completes.
+//!
+//! Tasks are never preempted. A task runs until it waits or finishes,
+//! so state shared only with other tasks and the main loop needs no locks.
+//! Tasks MUST NOT be started or resumed from interrupt handlers.
+//! `WaitQueue.wakeAll()` only moves tasks to the run queue, so it can be called from interrupt handlers.
+//!
+//! Stacks are allocated on demand from the allocator given to `init()`
+//! and kept in a pool for reuse when tasks finish.
+
+const std = @import("std");
+const log = std.log.scoped(.task);
+const Allocator = std.mem.Allocator;
+
+const zakuro = @import("zakuro");
+const arch = zakuro.arch;
+const unwind = zakuro.unwind;
+const percpu = arch.percpu;
+const PerCpu = percpu.PerCpu;
+const SpinLock = zakuro.sync.SpinLock;
+
+pub const Error = error{
+    /// Failed to allocate a stack.
+    OutOfMemory,
+    /// All task slots are in use.
+    TooManyTasks,
+};
+
+/// Maximum number of tasks that exist at the same time.
+const max_tasks = 8;
+/// Size in bytes of the stack of each task.
+const stack_size = 16 * 1024;
+
+/// Function run by a task.
+pub const Func = *const fn (ctx: *anyopaque) void;
+
+/// State of a task.
+const State = enum {
+    /// The slot is not used.
+    Free,
+    /// The task is running, or waking another task.
+    Running,
+    /// The task waits on a future or a wait queue, or is in the run queue.
+    Waiting,
+    /// The function returned. The slot is released by the context that switched from the task.
+    Done,
+};
+
+/// Task.
+pub const Task = struct {
+    /// Stack pointer of the task while it is suspended.
+    rsp: u64 = 0,
+    /// Stack pointer of the context that switched to the task.
+    waker_rsp: u64 = 0,
+    /// Stack of the task. Kept even when the slot is free.
+    stack: ?[]align(16) u8 = null,
+    /// State of the task.
+    state: State = .Free,
+    /// Function to run.
+    func: Func = undefined,
+    /// Argument of the function.
+    ctx: *anyopaque = undefined,
+    /// Next task in a wait queue or the run queue.
+    next: ?*Task = null,
+};
+
+/// Intrusive FIFO list of tasks.
+const TaskList = struct {
+    /// First task.
+    head: ?*Task = null,
+    /// Last task.
+    tail: ?*Task = null,
+
+    fn append(self: *TaskList, task: *Task) void {
+        task.next = null;
+        if (self.tail) |tail| tail.next = task else self.head = task;
+        self.tail = task;
+    }
+
+    fn popFirst(self: *TaskList) ?*Task {
+        const task = self.head orelse return null;
+        self.head = task.next;
+        if (self.head == null) self.tail = null;
+        task.next = null;
+        return task;
+    }
+
+    /// Move all tasks of `other` to the end of this list.
+    fn appendList(self: *TaskList, other: *TaskList) void {
+        const head = other.head orelse return;
+        if (self.tail) |tail| tail.next = head else self.head = head;
+        self.tail = other.tail;
+        other.* = .{};
+    }
+};
+
+/// Task slots.
+var tasks: [max_tasks]Task = [_]Task{.{}} ** max_tasks;
+/// Task currently running on this CPU. Null if the main context is running.
+/// Per-CPU areas MUST be installed before any task is started.
+var current: PerCpu(?*Task) linksection(percpu.section) = PerCpu(?*Task).init(null);
+/// Allocator of stacks.
+var stack_allocator: ?Allocator = null;
+/// Tasks woken and waiting to be resumed by `runReady()`.
+var run_queue = TaskList{};
+/// Lock of `run_queue`, which is shared with interrupt handlers.
+var run_queue_lock = SpinLock{};
+
+/// Set the allocator used to allocate stacks.
+pub fn init(allocator: Allocator) void {
+    stack_allocator = allocator;
+}
+
+/// Start a task that calls `func(ctx)`.
+/// The task runs immediately until it waits for the first time or finishes.
+pub fn spawn(func: Func, ctx: *anyopaque) Error!void {
+    const task = for (&tasks) |*t| {
+        if (t.state == .Free) break t;
+    } else return Error.TooManyTasks;
+
+    if (task.stack == null) {
+        const allocator = stack_allocator orelse return Error.OutOfMemory;
+        const stack = try allocator.alignedAlloc(u8, 16, stack_size);
+        unwind.registerStack(@intFromPtr(stack.ptr), stack.len);
+        task.stack = stack;
+    }
+
+    const stack = task.stack.?;
+    task.func = func;
+    task.ctx = ctx;
+    task.rsp = arch.context.initStack(@intFromPtr(stack.ptr) + stack.len, entry, task);
+    wake(task);
+}
+
+/// Get the task currently running, or null if called outside of tasks.
+pub fn currentTask() ?*Task {
+    return current.get();
+}
+
+/// Resume the tasks in the run queue until each of them waits again or finishes.
+/// Tasks woken while this function runs are also resumed.
+/// Returns true if any task is resumed.
+/// This function MUST be called from the main loop.
+pub fn runReady() bool {
+    var resumed = false;
+    while (true) {
+        const state = run_queue_lock.lockIrqSave();
+        const task = run_queue.popFirst();
+        run_queue_lock.unlockIrqRestore(state);
+
+        wake(task orelse return resumed);
+        resumed = true;
+    }
+}
+
+/// Check if any task is waiting to be resumed.
+/// Call this with interrupts disabled before idling, so that a wakeup after the check is not missed.
+pub fn hasReady() bool {
+    const state = run_queue_lock.lockIrqSave();
+    defer run_queue_lock.unlockIrqRestore(state);
+    return run_queue.head != null;
+}
+
+/// Print the statistics of the run queue lock.
+pub fn dumpLockStats() void {
+    run_queue_lock.dumpStats("run_queue_lock");
+}
+
+/// Put the suspended task in the run queue.
+fn makeReady(task: *Task) void {
+    const state = run_queue_lock.lockIrqSave();
+    defer run_queue_lock.unlockIrqRestore(state);
+    run_queue.append(task);
+}
+
+/// Switch to the task and return when it waits or finishes.
+fn wake(task: *Task) void {
+    std.debug.assert(task.state != .Running);
+    const prev = current.get();
+    current.set(task);
+    task.state = .Running;
+    arch.context.switchStack(&task.waker_rsp, task.rsp);
+    current.set(prev);
+
+    if (task.state == .Done) {
+        task.state = .Free;
+    }
+}
+
+/// Suspend the current task and switch back to its waker.
+fn suspendCurrent() void {
+    const task = current.get() orelse @panic("Only tasks can be suspended.");
+    task.state = .Waiting;
+    arch.context.switchStack(&task.rsp, task.waker_rsp);
+}
+
+/// Entry point of tasks.
+fn entry(arg: *anyopaque) callconv(.C) noreturn {
+    const task: *Task = @alignCast(@ptrCast(arg));
+    task.func(task.ctx);
+
+    // The stack is reused only after the waker switches back from it.
+    task.state = .Done;
+    arch.context.switchStack(&task.rsp, task.waker_rsp);
+    unreachable;
+}
+
+/// Queue of tasks waiting until a condition holds.
+pub const WaitQueue = struct {
+    /// Waiting tasks.
+    waiters: TaskList = .{},
+    /// Lock of `waiters`, which is shared with interrupt handlers.
+    lock: SpinLock = .{},
+
+    /// Suspend the current task until `condition(ctx)` returns true.
+    /// The condition is checked with the queue locked and interrupts disabled,
+    /// so a wakeup between the check and the suspension is not lost.
+    /// This function MUST be called in a task.
+    pub fn waitUntil(self: *WaitQueue, ctx: anytype, comptime condition: fn (@TypeOf(ctx)) bool) void {
+        while (true) {
+            const state = self.lock.lockIrqSave();
+            if (condition(ctx)) {
+                self.lock.unlockIrqRestore(state);
+                return;
+            }
+            self.waiters.append(current.get() orelse @panic("Only tasks can wait on a wait queue."));
+            self.lock.unlockIrqRestore(state);
+
+            // Wakers only move the task to the run queue,
+            // which is not processed until the task is suspended.
+            suspendCurrent();
+        }
+    }
+
+    /// Move all waiting tasks to the run queue.
+    /// Call this after making the condition true. This function can be called from interrupt handlers.
+    pub fn wakeAll(self: *WaitQueue) void {
+        const state = self.lock.lockIrqSave();
+        defer self.lock.unlockIrqRestore(state);
+        if (self.waiters.head == null) return;
+
+        const rq_state = run_queue_lock.lockIrqSave();
+        defer run_queue_lock.unlockIrqRestore(rq_state);
+        run_queue.appendList(&self.waiters);
+    }
+
+    /// Check if no task is waiting.
+    pub fn isEmpty(self: *WaitQueue) bool {
+        const state = self.lock.lockIrqSave();
+        defer self.lock.unlockIrqRestore(state);
+        return self.waiters.head == null;
+    }
+};
+
+/// Value that becomes available later.
+/// Only one task can wait on a future at a time.
+/// Futures MUST be completed from the main loop or tasks, not from interrupt handlers.
+pub fn Future(comptime T: type) type {
+    return struct {
+        const Self = @This();
+
+        /// Completed value.
+        value: ?T = null,
+        /// Task waiting for the value.
+        waiter: ?*Task = null,
+
+        /// Wait until the future is completed and get the value.
+        /// If the value is not available yet, the current task is suspended.
+        /// This function MUST be called in a task.
+        pub fn wait(self: *Self) T {
+            while (self.value == null) {
+                std.debug.assert(self.waiter == null);
+                self.waiter = current.get() orelse @panic("Futures can be waited only in tasks.");
+                suspendCurrent();
+            }
+            return self.value.?;
+        }
+
+        /// Complete the future with the value and put the waiting task in the run queue if any.
+        pub fn complete(self: *Self, value: T) void {
+            self.value = value;
+            if (self.waiter) |task| {
+                self.waiter = null;
+                makeReady(task);
+            }
+        }
+
+        /// Check if the future is completed.
+        pub fn isCompleted(self: *const Self) bool {
+            return self.value != null;
+        }
+    };
+}
+
+const testing = std.testing;
+
+test "Tasks wait on futures" {
+    init(std.heap.page_allocator);
+
+    const Ctx = struct {
+        first: Future(u32) = .{},
+        second: Future(u32) = .{},
+        steps: [4]u32 = undefined,
+        num_steps: usize = 0,
+
+        fn run(arg: *anyopaque) void {
+            const self: *@This() = @alignCast(@ptrCast(arg));
+            self.record(1);
+            self.record(self.first.wait());
+            self.record(self.second.wait());
+            self.record(4);
+        }
+
+        fn record(self: *@This(), step: u32) void {
+            self.steps[self.num_steps] = step;
+            self.num_steps += 1;
+        }
+    };
+
+    var ctx = Ctx{};
+    try spawn(Ctx.run, &ctx);
+    try testing.expectEqual(1, ctx.num_steps);
+    try testing.expectEqual(null, currentTask());
+
+    // A future completed before it is waited does not suspend the task.
+    ctx.second.complete(3);
+    try testing.expect(!runReady());
+    try testing.expectEqual(1, ctx.num_steps);
+    ctx.first.complete(2);
+    try testing.expectEqual(1, ctx.num_steps);
+    try testing.expect(runReady());
+    try testing.expectEqualSlices(u32, &.{ 1, 2, 3, 4 }, &ctx.steps);
+
+    // The slot is released.
+    for (tasks) |t| try testing.expectEqual(State.Free, t.state);
+}
+
+test "Tasks run concurrently" {
+    init(std.heap.page_allocator);
+
+    const Ctx = struct {
+        future: Future(void) = .{},
+        done: bool = false,
+
+        fn run(arg: *anyopaque) void {
+            const self: *@This() = @alignCast(@ptrCast(arg));
+            self.future.wait();
+            self.done = true;
+        }
+    };
+
+    var ctxs = [_]Ctx{.{}} ** max_tasks;
+    for (&ctxs) |*ctx| try spawn(Ctx.run, ctx);
+    try testing.expectError(Error.TooManyTasks, spawn(Ctx.run, &ctxs[0]));
+
+    // Wake tasks in the reverse order.
+    var i: usize = max_tasks;
+    while (i > 0) {
+        i -= 1;
+        ctxs[i].future.complete({});
+        _ = runReady();
+        try testing.expect(ctxs[i].done);
+        if (i > 0) try testing.expect(!ctxs[i - 1].done);
+    }
+}
+
+test "Tasks wait on wait queues" {
+    init(std.heap.page_allocator);
+
+    const Ctx = struct {
+        queue: WaitQueue = .{},
+        count: u32 = 0,
+        seen: u32 = 0,
+
+        fn run(arg: *anyopaque) void {
+            const self: *@This() = @alignCast(@ptrCast(arg));
+            self.queue.waitUntil(self, reached);
+            self.seen = self.count;
+        }
+
+        fn reached(self: *@This()) bool {
+            return self.count >= 2;
+        }
+    };
+
+    var ctx = Ctx{};
+    try spawn(Ctx.run, &ctx);
+    try testing.expect(!ctx.queue.isEmpty());
+
+    // The task checks the condition again and keeps waiting.
+    ctx.count = 1;
+    ctx.queue.wakeAll();
+    try testing.expect(hasReady());
+    try testing.expect(runReady());
+    try testing.expectEqual(0, ctx.seen);
+    try testing.expect(!ctx.queue.isEmpty());
+
+    ctx.count = 2;
+    ctx.queue.wakeAll();
+    try testing.expect(runReady());
+    try testing.expectEqual(2, ctx.seen);
+    try testing.expect(ctx.queue.isEmpty());
+    try testing.expect(!hasReady());
+}
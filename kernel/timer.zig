@@ -5,10 +5,14 @@ const ArrayList = std.ArrayList;
 const zakuro = @import("zakuro");
 const arch = zakuro.arch;
 const event = zakuro.event;
+const SpinLock = zakuro.sync.SpinLock;
 
 /// Total tick count.
+/// This is written only by the timer interrupt handler and read atomically.
 var total_tick: u64 = 0;
 var timers: ArrayList(Timer) = undefined;
+/// Lock of `timers`, which is shared with the timer interrupt handler.
+var timers_lock = SpinLock{};
 
 /// Initialize a Local APIC timer.
 pub fn init(vector: u8, allocator: Allocator, rsdp: *arch.Rsdp) void {
@@ -19,6 +23,8 @@ pub fn init(vector: u8, allocator: Allocator, rsdp: *arch.Rsdp) void {
 
 /// Initiate an new timer with the given timeout.
 pub fn newTimer(timeout: u64, id: u64) !void {
+    const state = timers_lock.lockIrqSave();
+    defer timers_lock.unlockIrqRestore(state);
     try timers.append(Timer.new(timeout, id));
 }
 
@@ -26,8 +32,10 @@ pub fn newTimer(timeout: u64, id: u64) !void {
 /// If there is a timer that has reached the timeout,
 /// interrupt message is pushed to the message queue.
 pub fn tick() void {
-    total_tick += 1;
+    @atomicStore(u64, &total_tick, total_tick + 1, .monotonic);
 
+    const state = timers_lock.lockIrqSave();
+    defer timers_lock.unlockIrqRestore(state);
     var i: usize = 0;
     while (i < timers.items.len) {
         const timer = timers.items[i];
@@ -41,7 +49,12 @@ pub fn tick() void {
 
 /// Get the total tick count.
 pub fn getTicks() u64 {
-    return total_tick;
+    return @atomicLoad(u64, &total_tick, .monotonic);
+}
+
+/// Print the statistics of the timer lock.
+pub fn dumpLockStats() void {
+    timers_lock.dumpStats("timers_lock");
 }
 
 pub const Timer = struct {
@@ -0,0 +1,161 @@
+//! This module provides stack unwinding using frame pointers.
+//!
+//! The kernel is compiled with frame pointers, so each frame starts with
+//! the caller's frame pointer followed by the return address:
+//!
+//!   [fp + 8] return address
+//!   [fp + 0] caller's frame pointer
+//!
+//! Frame pointers are bounds-checked against registered stacks before dereferenced,
+//! so a corrupted stack ends the walk instead of faulting.
+//! The unwinder does not allocate memory and can be used in interrupt context.
+
+const std = @import("std");
+const zakuro = @import("zakuro");
+const symbols = zakuro.symbols;
+
+/// Maximum number of stacks that can be registered.
+const max_stacks = 16;
+
+/// Range of a stack.
+const StackRange = struct {
+    /// Lowest address of the stack.
+    start: u64,
+    /// Address right after the highest address of the stack.
+    end: u64,
+
+    fn contains(self: StackRange, addr: u64, size: u64) bool {
+        return self.start <= addr and addr <= self.end and size <= self.end - addr;
+    }
+};
+
+/// Registered stacks.
+var stacks: [max_stacks]StackRange = undefined;
+/// Number of registered stacks.
+var num_stacks: usize = 0;
+
+/// Register a stack that frame pointers can point to.
+/// Stacks that exceed `max_stacks` are ignored.
+pub fn registerStack(start: u64, size: u64) void {
+    if (num_stacks >= max_stacks) return;
+    stacks[num_stacks] = .{ .start = start, .end = start + size };
+    num_stacks += 1;
+}
+
+/// Check if the frame at the frame pointer is readable.
+fn validFrame(fp: u64) bool {
+    if (fp == 0 or fp % @alignOf(u64) != 0) return false;
+    for (stacks[0..num_stacks]) |stack| {
+        if (stack.contains(fp, 2 * @sizeOf(u64))) return true;
+    }
+    return false;
+}
+
+/// Iterator over return addresses of the call stack.
+pub const FrameIterator = struct {
+    /// Frame pointer of the current frame.
+    fp: u64,
+
+    /// Start unwinding from the frame pointer.
+    pub fn init(fp: u64) FrameIterator {
+        return .{ .fp = fp };
+    }
+
+    /// Get the return address of the current frame and move to the caller's frame.
+    /// Returns null if the frame is the last one or the frame pointer is invalid.
+    pub fn next(self: *FrameIterator) ?u64 {
+        if (!validFrame(self.fp)) return null;
+
+        const frame: *const [2]u64 = @ptrFromInt(self.fp);
+        const caller_fp = frame[0];
+        const ret_addr = frame[1];
+        if (ret_addr == 0) return null;
+
+        // The stack grows down, so the caller's frame MUST be above this frame.
+        // Otherwise, the walk would loop forever.
+        self.fp = if (caller_fp > self.fp) caller_fp else 0;
+        return ret_addr;
+    }
+};
+
+/// Capture return addresses of the call stack starting from the frame pointer.
+/// Returns the number of addresses written to `buf`.
+pub fn capture(fp: u64, buf: []u64) usize {
+    var it = FrameIterator.init(fp);
+    var n: usize = 0;
+    while (n < buf.len) : (n += 1) {
+        buf[n] = it.next() orelse break;
+    }
+    return n;
+}
+
+/// Symbolized frame.
+pub const Frame = struct {
+    /// Address of the frame.
+    address: u64,
+    /// Function containing the address.
+    symbol: ?symbols.Symbol,
+    /// Source location of the address.
+    location: ?symbols.Location,
+
+    /// Symbolize the return address.
+    /// The address of the call instruction is used to look up,
+    /// since the return address can be the first instruction of the next line or function.
+    pub fn fromReturnAddress(ret_addr: u64) Frame {
+        const call_addr = ret_addr -| 1;
+        var symbol = symbols.findFunction(call_addr);
+        if (symbol) |*sym| sym.offset += ret_addr - call_addr;
+
+        return .{
+            .address = ret_addr,
+            .symbol = symbol,
+            .location = symbols.findLine(call_addr),
+        };
+    }
+
+    pub fn format(
+        self: Frame,
+        comptime _: []const u8,
+        _: std.fmt.FormatOptions,
+        writer: anytype,
+    ) !void {
+        try writer.print("0x{X:0>16}: ", .{self.address});
+        if (self.symbol) |sym| {
+            try writer.print("{s}+0x{X}", .{ sym.name, sym.offset });
+        } else {
+            try writer.writeAll("(No symbol available)");
+        }
+        if (self.location) |loc| {
+            if (loc.file.dir.len != 0) {
+                try writer.print(" at {s}/{s}:{d}", .{ loc.file.dir, loc.file.name, loc.line });
+            } else {
+                try writer.print(" at {s}:{d}", .{ loc.file.name, loc.line });
+            }
+        }
+    }
+};
+
+test "Frame pointer walk" {
+    // Fake stack with three frames and a corrupted frame pointer at the end.
+    var stack: [8]u64 align(16) = undefined;
+    const base = @intFromPtr(&stack);
+    stack[0] = base + 2 * 8; // frame 0 -> frame 1
+    stack[1] = 0x1000;
+    stack[2] = base + 4 * 8; // frame 1 -> frame 2
+    stack[3] = 0x2000;
+    stack[4] = 0xDEAD_BEEF; // frame 2 -> out of the stack
+    stack[5] = 0x3000;
+
+    const saved = num_stacks;
+    defer num_stacks = saved;
+    num_stacks = 0;
+    registerStack(base, @sizeOf(@TypeOf(stack)));
+
+    var buf: [8]u64 = undefined;
+    const n = capture(base, &buf);
+    try std.testing.expectEqualSlices(u64, &.{ 0x1000, 0x2000, 0x3000 }, buf[0..n]);
+
+    // Unregistered stacks are not walked.
+    num_stacks = 0;
+    try std.testing.expectEqual(0, capture(base, &buf));
+}
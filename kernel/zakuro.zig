@@ -4,7 +4,7 @@ pub const pci = @import("pci.zig");
 pub const log = @import("log.zig");
 pub const serial = @import("serial.zig");
 pub const console = @import("console.zig");
-pub const gfx = @import("gfx.zig");
+pub const gfx = @import("gfx");
 pub const color = @import("color.zig");
 pub const arch = @import("arch.zig").impl;
 pub const font = @import("font.zig");
@@ -12,13 +12,20 @@ pub const drivers = @import("drivers.zig");
 pub const mmio = @import("mmio.zig");
 pub const mouse = @import("mouse.zig");
 pub const keyboard = @import("keyboard.zig");
-pub const mm = @import("mm.zig");
+pub const mm = @import("mm");
 pub const timer = @import("timer.zig");
 pub const event = @import("event.zig");
+pub const sync = @import("sync.zig");
+pub const task = @import("task.zig");
 
 pub const lib = @import("lib.zig");
 
 pub const dwarf = @import("dwarf/dwarf.zig");
+pub const symbols = @import("symbols.zig");
+pub const unwind = @import("unwind.zig");
+pub const profile = @import("profile.zig");
+pub const bench = @import("bench.zig");
+pub const boot_trace = @import("boot_trace.zig");
 
 /// 2D vector.
 pub fn Vector(comptime T: type) type {
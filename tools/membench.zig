@@ -0,0 +1,86 @@
+//! This tool benchmarks the kernel's memory copy and fill routines on the host.
+//!
+//! Each strategy of `kernel/arch/x86/mem.zig` is compared with `@memcpy` / `@memset` of the host
+//! over sizes from 16 B to 8 MiB. The in-kernel counterparts are run by `zig build bench`.
+
+const std = @import("std");
+const log = std.log;
+const plog = @import("plog");
+const mem = @import("mem");
+
+pub const std_options = std.Options{
+    .log_level = .info, // Edit here to change log level
+    .logFn = plog.logFunc,
+};
+
+/// Sizes of operations in bytes.
+const sizes = [_]usize{ 16, 64, 256, 1024, 4096, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 8 * 1024 * 1024 };
+/// Approximate number of bytes processed per measurement.
+const bytes_per_size = 512 * 1024 * 1024;
+
+/// Implementation to measure.
+const Impl = struct {
+    name: []const u8,
+    /// Features forced to `mem`. Null to use the host's `@memcpy` and `@memset`.
+    features: ?mem.Features,
+};
+
+pub fn main() !void {
+    const allocator = std.heap.page_allocator;
+    const max_size = sizes[sizes.len - 1];
+    const src = try allocator.alloc(u8, max_size);
+    defer allocator.free(src);
+    const dest = try allocator.alloc(u8, max_size);
+    defer allocator.free(dest);
+    @memset(src, 0x5A);
+    @memset(dest, 0);
+
+    const detected = mem.init();
+    log.info("Detected: ERMS={} FSRM={} AVX2={}", .{ detected.erms, detected.fsrm, detected.avx2 });
+
+    const impls = [_]Impl{
+        .{ .name = "host", .features = null },
+        .{ .name = "qwords", .features = .{} },
+        .{ .name = "erms", .features = .{ .erms = true } },
+        .{ .name = "fsrm", .features = .{ .erms = true, .fsrm = true } },
+        .{ .name = "avx2", .features = .{ .avx2 = detected.avx2 } },
+        .{ .name = "auto", .features = detected },
+    };
+
+    const stdout = std.io.getStdOut().writer();
+    try stdout.print("{s: <8} {s: >10}", .{ "op", "size" });
+    for (impls) |impl| try stdout.print(" {s: >9}", .{impl.name});
+    try stdout.writeAll("   (GiB/s)\n");
+
+    for ([_][]const u8{ "memcpy", "memset" }) |op| {
+        for (sizes) |size| {
+            try stdout.print("{s: <8} {d: >10}", .{ op, size });
+            for (impls) |impl| {
+                const gibps = try measure(op, impl, dest[0..size], src[0..size]);
+                try stdout.print(" {d: >9.2}", .{gibps});
+            }
+            try stdout.writeAll("\n");
+        }
+    }
+}
+
+/// Measure the throughput of the operation in GiB/s.
+fn measure(op: []const u8, impl: Impl, dest: []u8, src: []const u8) !f64 {
+    if (impl.features) |f| mem.force(f);
+    const iterations = @max(bytes_per_size / dest.len, 1);
+    const is_copy = std.mem.eql(u8, op, "memcpy");
+
+    var timer = try std.time.Timer.start();
+    for (0..iterations) |_| {
+        if (impl.features == null) {
+            if (is_copy) @memcpy(dest, src) else @memset(dest, 0xA5);
+        } else {
+            if (is_copy) mem.copy(dest.ptr, src.ptr, dest.len) else mem.set(dest.ptr, 0xA5, dest.len);
+        }
+        std.mem.doNotOptimizeAway(dest.ptr);
+    }
+    const ns = timer.read();
+
+    const bytes: f64 = @floatFromInt(iterations * dest.len);
+    return bytes / (@as(f64, @floatFromInt(@max(ns, 1))) / std.time.ns_per_s) / (1024 * 1024 * 1024);
+}
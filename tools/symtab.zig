@@ -0,0 +1,114 @@
+//! This tool generates a symbol table of the kernel from its DWARF debug information.
+//! The table is embedded into the kernel image so that the kernel can symbolize addresses
+//! without parsing DWARF at runtime. See `kernel/dwarf/SymbolTable.zig` for the format.
+//!
+//! The kernel is linked twice:
+//! first with an empty table (`--empty`) to generate the table from it,
+//! and then with the generated table.
+//! Since the table is placed after the code, the second link does not move any function.
+//! `--check` verifies it by regenerating the table from the final kernel and comparing it.
+
+const std = @import("std");
+const fs = std.fs;
+const clap = @import("clap");
+const plog = @import("plog");
+const dwarf = @import("dwarf");
+const log = std.log;
+
+const Elf = dwarf.Elf.Elf;
+const AbbreviationTable = dwarf.AbbreviationTable;
+const CompilationUnit = dwarf.CompilationUnit;
+const AddressIndex = dwarf.AddressIndex;
+const LineTable = dwarf.LineTable;
+const SymbolTable = dwarf.SymbolTable;
+
+pub const std_options = std.Options{
+    .log_level = .info, // Edit here to change log level
+    .logFn = plog.logFunc,
+};
+
+/// Maximum size of the kernel ELF file.
+const max_elf_size = 256 * 1024 * 1024;
+
+/// Generate a symbol table from the ELF file.
+fn generate(allocator: std.mem.Allocator, in_path: []const u8) ![]u8 {
+    const bin = try fs.cwd().readFileAllocOptions(allocator, in_path, max_elf_size, null, 8, null);
+    const elf = try Elf.new(bin.ptr);
+
+    const abbr_tbls = try AbbreviationTable.parse(elf, allocator);
+    const cus = try CompilationUnit.parse(elf, abbr_tbls, allocator);
+    const index = try AddressIndex.build(cus, allocator);
+    const lines = try LineTable.build(elf, allocator);
+    log.info("{d} functions, {d} line rows ({d} bytes)", .{
+        index.entries.len,
+        lines.len,
+        lines.data.len,
+    });
+
+    return SymbolTable.serialize(index.entries, lines, allocator);
+}
+
+/// Output a binary data to a file.
+fn output2file(path: []const u8, data: []const u8) !void {
+    const file = try fs.cwd().createFile(path, .{});
+    defer file.close();
+    try file.writer().writeAll(data);
+}
+
+pub fn main() !void {
+    // All memory is freed at exit.
+    var arena = std.heap.ArenaAllocator.init(std.heap.page_allocator);
+    defer arena.deinit();
+    const allocator = arena.allocator();
+
+    const params = comptime clap.parseParamsComptime(
+        \\-h, --help             Display this help and exit.
+        \\-i, --input  <str>     Input kernel ELF file path.
+        \\-o, --output <str>     Output symbol table path.
+        \\-c, --check  <str>     Check if the table generated from the input equals to this table.
+        \\-e, --empty            Generate an empty table without input.
+        \\
+    );
+    var diag = clap.Diagnostic{};
+    var res = clap.parse(clap.Help, &params, clap.parsers.default, .{
+        .diagnostic = &diag,
+        .allocator = allocator,
+    }) catch |err| {
+        diag.report(std.io.getStdErr().writer(), err) catch {};
+        return err;
+    };
+    defer res.deinit();
+
+    if (res.args.help != 0) {
+        return clap.help(std.io.getStdErr().writer(), clap.Help, &params, .{});
+    }
+
+    if (res.args.empty != 0) {
+        const out_path = res.args.output orelse {
+            log.err("Output file path is not specified.", .{});
+            std.process.exit(1);
+        };
+        log.info("Generating an empty symbol table to {s}", .{out_path});
+        return output2file(out_path, try SymbolTable.serialize(&.{}, null, allocator));
+    }
+
+    const in_path = res.args.input orelse {
+        log.err("Input ELF file path is not specified.", .{});
+        std.process.exit(1);
+    };
+    log.info("Generating symbol table from {s}", .{in_path});
+    const table = try generate(allocator, in_path);
+
+    if (res.args.check) |check_path| {
+        const expected = try fs.cwd().readFileAlloc(allocator, check_path, max_elf_size);
+        if (!std.mem.eql(u8, expected, table)) {
+            log.err("Symbol table embedded in {s} is stale. Functions moved in the second link.", .{in_path});
+            std.process.exit(1);
+        }
+        log.info("Symbol table embedded in {s} is up-to-date.", .{in_path});
+    }
+    if (res.args.output) |out_path| {
+        log.info("Outputting symbol table to {s}", .{out_path});
+        try output2file(out_path, table);
+    }
+}